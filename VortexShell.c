@@ -1,3 +1,4 @@
+#define _GNU_SOURCE               // Expose Linux-specific calls (splice, copy_file_range)
 #include <stdio.h>         
 #include <stdlib.h>        
 #include <string.h>      
@@ -7,603 +8,7455 @@
 #include <sys/stat.h>      
 #include <fcntl.h>         
 #include <signal.h>        
-// Configuration constants to enforce shell limits
-#define MAX_CMD_LEN 256        // Maximum characters allowed in a single command input
-#define MAX_ARGS 6             // Restricts commands to 5 arguments plus the command name
-#define MAX_PIPES 5            // Caps the number of commands that can be piped together
-#define MAX_SEQUENTIAL 4       // Limits sequential commands separated by semicolons
+#include <errno.h>           
+#include <sys/sendfile.h>    
+#include <sys/mman.h>        
+#include <stdint.h>          
+#include <pthread.h>         
+#include <setjmp.h>          // # recovers from SIGBUS when a mapped file shrinks
+#include <time.h>            
+#include <dirent.h>          
+#include <limits.h>          
+#include <sys/ioctl.h>       
+#include <linux/fs.h>        // FICLONERANGE for reflink copies
+#include <spawn.h>           
+#include <sched.h>           
+#include <sys/epoll.h>       // Event loop that reaps jobs
+#include <sys/signalfd.h>    // SIGCHLD delivered as a readable descriptor
+#include <sys/syscall.h>     // pidfd_open and waitid on pidfds
+#include <termios.h>         // Terminal modes saved for stopped jobs
+#include <sys/resource.h>    // Per-stage rusage for time and VORTEX_TRACE
+#include <sys/socket.h>      // Zygote socketpair and SCM_RIGHTS
+#include <poll.h>            // Fan-out pump waits on full consumer pipes
+#include <sys/uio.h>         // writev for batches of small files
+#include <sys/file.h>        // flock serializes history index updates
+#include <linux/io_uring.h>  // Ring layout and opcodes; the system calls are made directly
+#include <ctype.h>           // Name characters in $VAR references
+#include <sys/timerfd.h>     // limit --timeout deadlines in the job event loop
+#include <sys/un.h>          // --serve listens on an AF_UNIX socket
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>       // SSE2/AVX2 intrinsics for the word-count kernels
+#define WC_HAVE_X86 1        // Enables runtime-selected vector kernels
+#endif
+#if __has_include(<zlib.h>)
+#include <zlib.h>            // gzip inputs of + and #
+#define DECODE_HAVE_GZIP 1   // The Makefile links -lz when the header is there
+#endif
+#if __has_include(<zstd.h>)
+#include <zstd.h>            // zstd inputs of + and #
+#define DECODE_HAVE_ZSTD 1   // The Makefile links -lzstd when the header is there
+#endif
+// Configuration constants
 #define MAX_LINE 256           // General-purpose buffer size for strings and lines
+#define ARENA_BLOCK_SIZE (64 * 1024) // First block of the per-line parse arena
+#define ARENA_ALIGN 16         // Alignment of every arena allocation
 #define CMDLINE_PATH "/proc/self/cmdline" // System path to fetch this process's command line
+#define COPY_CHUNK (1 << 30)   // Largest transfer requested from the kernel per zero-copy call
+#define COPY_BUF_SIZE (128 * 1024) // Fixed buffer for the read/write fallback path
+#define WC_BUF_SIZE (1 << 20)  // Read size when a # input cannot be mapped
+#define WC_MIN_PER_THREAD (64 << 20) // Smallest slice worth handing to a worker thread
+#define WC_MAX_THREADS 64      // Upper bound on word-count worker threads
+#define SPAWN_STACK_SIZE (64 * 1024) // Stack for the clone(CLONE_VM|CLONE_VFORK) child
+#define SPAWN_SH "/bin/sh"     // Runs executables that have no #! line, as execvp does
+#define PATH_CACHE_INITIAL 64  // Starting slot count of the command hash table (power of two)
+#define PATH_CACHE_RECHECK_NS 1000000000LL // Minimum gap between PATH directory mtime checks
+#define DEFAULT_PATH "/bin:/usr/bin" // Search path when PATH is unset, as execvp uses
+#define SWAP_JOURNAL_PREFIX "swap-append." // Journal files are swap-append.<pid>.journal
+#define WC_CACHE_FILE "wc-checkpoints" // Checkpoint store name under the state directory
+#define WC_CACHE_ENTRIES 256   // Files remembered before the least recently used is dropped
+#define WC_CACHE_MIN (64 * 1024) // Files smaller than this are cheaper to rescan than to track
+#define WC_FINGERPRINT_LEN 4096 // Head and tail bytes of the prefix hashed to detect rewrites
+#define JOB_EVENTS 64          // epoll events handled per wakeup of the job loop
+#define PARALLEL_MAX_FAILURES 10 // Failed inputs listed by name in parallel's summary
+#define AUTOPAR_STDOUT "<stdout>" // Resource name for the shell's stdout under autopar
+#define READER_BUF_SIZE (64 * 1024) // First read buffer of the command reader; grows for longer lines
+#define JOB_P_PIDFD 3          // waitid idtype for pidfds (P_PIDFD), missing from older headers
+#define TRACE_ENV "VORTEX_TRACE" // Path that receives one JSON line per stage and input line
+#define PROC_DENTS_SIZE (64 * 1024) // getdents64 buffer for scanning /proc
+#define PROC_COMM_LEN 16       // TASK_COMM_LEN: /proc/PID/comm keeps 15 characters plus NUL
+#define PIPESZ_ENV "VORTEX_PIPESZ" // Capacity requested for pipeline pipes (F_SETPIPE_SZ), e.g. 1m
+#define PIPE_MAX_SIZE_PATH "/proc/sys/fs/pipe-max-size" // Largest capacity an unprivileged process may set
+#define MEMO_DIR "memo"        // memo's index and output files, under the state directory
+#define MEMO_INDEX "index"     // Entry table inside MEMO_DIR
+#define MEMO_MAGIC 0x31786469656d6f6dULL // "memoidx1": identifies a memo index file
+#define MEMO_MAX_ENTRIES 1024  // Cached results kept before the least recently used is dropped
+#define MEMO_BUDGET_ENV "VORTEX_MEMO_MAX" // Size budget for cached output, e.g. 512m
+#define MEMO_DEFAULT_BUDGET (256LL << 20) // Budget when VORTEX_MEMO_MAX is unset
+#define MEMO_VARS_ENV "VORTEX_MEMO_ENV" // Colon-separated variables that are part of every key
+#define MEMO_DEFAULT_VARS "PATH:LANG:LC_ALL:LC_CTYPE:TZ" // Key variables when VORTEX_MEMO_ENV is unset
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434     // Same number on every architecture
+#endif
+#define ZYGOTE_ENV_SAME 0xffffffffu // ZygoteRequest.env_len: environment unchanged since the last request
+#define ZYGOTE_NUM_FDS 4       // Descriptors passed per request: stdin, stdout, stderr, cwd
+#ifndef SYS_clone3
+#define SYS_clone3 435         // Same number on every architecture
+#endif
+#define HISTORY_FILE "history" // Shared command log under the state directory
+#define HISTORY_INDEX_SUFFIX ".idx" // Trigram index next to the log
+#define HISTORY_ENV "VORTEX_HISTFILE" // Overrides the log's path
+#define HISTORY_SEG_MAGIC 0x3267657374736968ULL // "histseg2": starts every index segment
+#define HISTORY_SEGMENT_MIN (256 * 1024) // Unindexed log bytes a search scans before indexing them
+#define HISTORY_SEGMENT_MAX (4 << 20) // Log bytes covered by one index segment
+#define EXPAND_ESC '\001'      // In a word still to be expanded: the next byte is literal
+#define EXPAND_QUOTED '\002'   // Leads a word still to be expanded that had quotes: it may expand to ""
+#define PROMPT "w25shell$ "    // Interactive prompt, hardcoded
+#define COMPLETE_DIR_CACHE 16  // Directories whose listings filename completion keeps
+#define COMPLETE_LIST_ASK 100  // More candidates than this are listed only after asking
+#define COMPLETE_RACY_NS 100000000LL // A directory changed this close to being read may have changed unseen
+#define COMPLETE_ESCAPE " \t\n|&;<>'\"\\$*?[" // Characters completion escapes with a backslash
+#define LIMIT_GRACE_NS 2000000000LL // After --timeout sends SIGTERM, time left before SIGKILL
+#define LIMIT_CPU_PERIOD 100000 // cpu.max period in microseconds; --cpu N grants N periods per period
+#define LIMIT_STATUS_TIMEOUT 124 // Status of a job ended by --timeout, as timeout(1) reports it
+#define LIMIT_STATUS_MEMORY 137 // Status of a job killed for going over --mem (128 + SIGKILL)
+#define LIMIT_CGROUP_PREFIX "vortex-" // Transient cgroups are vortex-<shell pid>-<job serial>
+#define SERVE_WORKERS_ENV "VORTEX_SERVE_WORKERS" // Requests --serve runs at once; default: online CPUs
+#define SERVE_MAX_REQUEST (1 << 20) // Largest request frame a client may send
+#define SERVE_READ_SIZE (64 * 1024) // Output read from a request's pipe per frame
+#define SERVE_OUT_LIMIT (1 << 20) // Output queued for a slow client before its request's pipes are paused
+#define SERVE_EVENTS 64        // epoll events handled per wakeup of the server loop
+#define DECODE_ENV "VORTEX_DECOMPRESS" // Set to 0 to treat compressed inputs of + and # as plain bytes
+#define DECODE_IN_SIZE (128 * 1024) // Compressed bytes read per refill
+#define DECODE_OUT_SIZE (1 << 20) // Each of the two decoded buffers the reader thread fills in turn
+#define URING_ENV "VORTEX_URING" // Set to 0 to keep + on the synchronous path
+#define URING_DEPTH 64         // Files opened and read concurrently by +
+#define URING_BUF_SIZE (64 * 1024) // Registered buffer per file; larger files stream the rest
+#define URING_MIN_FILES 4      // Fewer files than this are not worth a batch
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup 425 // Same number on every architecture
+#define SYS_io_uring_enter 426
+#define SYS_io_uring_register 427
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424 // Same number on every architecture
+#endif
 
-// Command structure to organize execution parameters
+// Command structure to organize execution parameters; all memory belongs to the line arena
 typedef struct {
-    char *args[MAX_ARGS];      // Array to hold command and its arguments for execvp
+    char **args;               // NULL-terminated argument vector for exec
     int argc;                  // Counter for the number of arguments parsed
     char *input_file;          // Pointer to filename for input redirection (<)
     char *output_file;         // Pointer to filename for output redirection (>)
     int append_output;         // Boolean flag: 1 for append (>>), 0 for overwrite (>)
+    char file_op;              // '#', '+' or '~' for the file operators (args are file names), else 0
+    int memo;                  // Prefixed by memo: output replayed from the cache when inputs are unchanged
+    int expand;                // Some word holds $ or glob characters, expanded just before running
 } Command;
 
+// Entry in the builtin dispatch table; builtins run inside the shell without a fork
+typedef struct {
+    const char *name;          // Command word that selects the builtin
+    int (*run)(Command *cmd);  // Implementation; returns the exit status
+} Builtin;
+
+// What a limit prefix asks for; lives in the line arena with the syntax tree
+typedef struct {
+    long long mem;             // --mem in bytes, or 0
+    double cpu;                // --cpu in CPUs (may be fractional), or 0
+    uint64_t timeout_ns;       // --timeout, or 0
+} Limits;
+
+// Syntax tree node kinds produced by the parser
+typedef enum {
+    NODE_COMMAND,              // One command
+    NODE_PIPELINE,             // Commands joined by | (or by = when reverse is set)
+    NODE_FANOUT,               // left |& { branches... }: left's output copied to every branch
+    NODE_AND,                  // left && right
+    NODE_OR,                   // left || right
+    NODE_SEQUENCE,             // left ; right
+    NODE_BACKGROUND            // left &
+} NodeType;
+
+// Syntax tree node; every node of a line lives in that line's arena
+typedef struct Node {
+    NodeType type;             // Which of the fields below are meaningful
+    Command *commands;         // NODE_COMMAND: the command; NODE_PIPELINE: every stage
+    int num_commands;          // Stage count (1 for NODE_COMMAND)
+    int reverse;               // NODE_PIPELINE: stages joined by = instead of |
+    struct Node *left;         // NODE_AND/OR/SEQUENCE: first operand; NODE_FANOUT: the producer
+    struct Node *right;        // NODE_AND/OR/SEQUENCE: second operand
+    const char *text;          // Source text of a pipeline or background list, for job listings
+    int text_len;              // Length of text (it points into the input line)
+    int timed;                 // NODE_COMMAND/PIPELINE/FANOUT: prefixed by time
+    struct Node **branches;    // NODE_FANOUT: consumer commands or pipelines
+    int num_branches;          // NODE_FANOUT: entries in branches
+    Limits *limits;            // NODE_COMMAND/PIPELINE/FANOUT: prefixed by limit, else NULL
+} Node;
+
+// Bump allocator block; blocks chain when a line outgrows the first one
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;   // Previously filled block
+    size_t size;               // Usable bytes in data
+    size_t used;               // Bytes handed out so far
+    char data[];               // Allocation space
+} ArenaBlock;
+
+// Per-line arena: tokens and nodes are bump-allocated and released together
+typedef struct {
+    ArenaBlock *head;          // Block currently being filled
+    size_t total;              // Sum of block sizes, used to size the block kept on reset
+    unsigned long resets;      // Lines released so far; per-line caches compare against it
+} Arena;
+
+// Lexical token kinds
+typedef enum {
+    TOK_WORD, TOK_PIPE, TOK_OR, TOK_AND, TOK_AMP, TOK_SEMI, TOK_LESS, TOK_GREAT,
+    TOK_DGREAT, TOK_REVPIPE, TOK_PLUS, TOK_TILDE, TOK_FANOUT, TOK_COMMA, TOK_RBRACE,
+    TOK_END, TOK_ERROR
+} TokenType;
+
+// Lexer/parser state for one input line; one token of lookahead
+typedef struct {
+    const char *src;           // Line being parsed
+    size_t pos;                // Scan position in src
+    Arena *arena;              // Destination for words and nodes
+    TokenType type;            // Current token
+    char *text;                // Current word (quotes removed), or operator spelling
+    int quoted;                // Current word contained quoting
+    int expand;                // Current word has unquoted $ or glob characters (escaped form, see EXPAND_ESC)
+    size_t start;              // Offset of the current token in src
+    int braces;                // Open |& { ... } groups: , and } are operators inside one
+} Parser;
+
+// Everything needed to launch one child: argv plus its stdin/stdout wiring
+typedef struct {
+    char **argv;               // NULL-terminated argument vector
+    int in_fd;                 // Descriptor installed as stdin, or -1 to inherit
+    int out_fd;                // Descriptor installed as stdout, or -1 to inherit
+    int err_fd;                // Descriptor installed as stderr, or -1 to inherit
+    char *input_file;          // File opened as stdin (<), applied after in_fd
+    char *output_file;         // File opened as stdout (> or >>), applied after out_fd
+    int append_output;         // Boolean flag: 1 for append (>>), 0 for overwrite (>)
+    pid_t pgid;                // Process group to join; 0 leads a new group, -1 inherits
+    int fail_stage;            // Set by the vfork child: which step failed
+    int fail_errno;            // Set by the vfork child: errno of the failed step
+    int report_in_child;       // Forked child prints its own error (no shared memory)
+    int fail_pipe;             // Zygote's child: pipe that carries a failure back (0: none)
+    const char *exec_path;     // Resolved executable; filled in by spawn_process
+} SpawnRequest;
+
+// Fixed part of one spawn request sent to the zygote; the strings follow in the stream:
+// exec path, argv, input file, output file, then the environment if it changed
+typedef struct {
+    uint32_t payload_len;      // Bytes of strings after the header
+    uint32_t argc;             // Arguments in the payload
+    uint32_t env_len;          // Bytes of environment in the payload, or ZYGOTE_ENV_SAME
+    int32_t pgid;              // SpawnRequest.pgid
+    uint8_t has_input;         // input_file follows argv
+    uint8_t has_output;        // output_file follows
+    uint8_t append_output;     // >> rather than >
+} ZygoteRequest;
+
+// Zygote's answer: the child's PID, or where it failed
+typedef struct {
+    int32_t pid;               // Child (a child of the shell, not of the zygote), or -1
+    int32_t fail_stage;        // SPAWN_OK or the step that failed
+    int32_t fail_errno;        // errno of that step
+} ZygoteReply;
+
+// Shell's side of the zygote: a helper forked while the shell was small that forks commands
+typedef struct {
+    int fd;                    // Shell's end of the socketpair, or -1 when no zygote runs
+    pid_t pid;                 // Zygote process
+    char *env;                 // Environment block last sent, to skip resending it
+    size_t env_len;            // Bytes in env
+    char *buf;                 // Request payload being built
+    size_t cap;                // Allocated bytes in buf
+} Zygote;
+
+// Header of one history index segment. Segments are appended in log order, each
+// followed by its sorted trigrams, their posting ranges and the postings (line offsets)
+typedef struct {
+    uint64_t magic;            // HISTORY_SEG_MAGIC
+    uint64_t log_start;        // First log byte covered; the previous segment's log_end
+    uint64_t log_end;          // End of the covered bytes, just past a newline
+    uint64_t size;             // Bytes in this segment, header included
+    uint64_t log_id;           // history_log_id of the log indexed; any other log makes the segment stale
+    uint32_t num_trigrams;     // Distinct trigrams in the covered lines
+    uint32_t num_postings;     // (trigram, line) pairs, lines relative to log_start
+} HistorySegment;
+
+// This shell's side of the history log; searches map the files afresh each time
+typedef struct {
+    int log_fd;                // O_APPEND descriptor, opened by the first recorded line
+    char *last;                // Last line recorded, to skip immediate repeats
+} History;
+
+// Shell's io_uring instance, mapped on first use by +
+typedef struct {
+    int fd;                    // Ring descriptor, or -1 when not set up
+    int failed;                // Setup failed: io_uring is unavailable, stop trying
+    unsigned *sq_head;         // Submission ring: consumer index (kernel)
+    unsigned *sq_tail;         // Submission ring: producer index (shell)
+    unsigned sq_mask;          // Index mask of the submission ring
+    unsigned *sq_array;        // Submission ring slots, pointing into sqes
+    unsigned sq_entries;       // Submission ring size
+    unsigned sq_local;         // Entries prepared, published to sq_tail on enter
+    struct io_uring_sqe *sqes; // Submission entries
+    unsigned *cq_head;         // Completion ring: consumer index (shell)
+    unsigned *cq_tail;         // Completion ring: producer index (kernel)
+    unsigned cq_mask;          // Index mask of the completion ring
+    struct io_uring_cqe *cqes; // Completion entries
+    char *buffers;             // URING_DEPTH buffers of URING_BUF_SIZE bytes
+    int fixed;                 // buffers are registered: reads use READ_FIXED
+    unsigned inflight;         // Submitted operations not yet completed
+} Uring;
+
+// Where each file of a batched + stands; also the step tag of its ring operations
+enum { URING_FREE, URING_OPENING, URING_READING, URING_READY, URING_CLOSING };
+
+// One slot of the command location cache (open addressing, linear probing)
+typedef struct {
+    char *name;                // Command name as typed; NULL marks an empty slot
+    char *path;                // Absolute path, or NULL for a cached "not found"
+    unsigned hits;             // Lookups answered by this entry
+} PathEntry;
+
+// Command name -> executable path, valid for one PATH value and its directories' mtimes
+typedef struct {
+    PathEntry *slots;          // Hash table storage
+    size_t capacity;           // Slot count, always a power of two
+    size_t used;               // Occupied slots
+    char *path_value;          // PATH the entries were resolved against
+    char **dirs;               // PATH split into directories
+    struct timespec *mtimes;   // Directory mtimes when the entries were resolved
+    int num_dirs;              // Entries in dirs and mtimes
+    long long checked_ns;      // When the mtimes were last compared
+} PathCache;
+
+// Sorted names read from one directory, valid while the directory's mtime is unchanged
+typedef struct {
+    char *path;                // Directory as read (heap), or NULL for an unused slot
+    struct timespec mtime;     // Directory mtime when it was read; zero if it was missing
+    long long read_ns;         // Realtime clock when it was read
+    long long used_ns;         // Last use, for replacing the least recently used cached directory
+    char *pool;                // The names, NUL-terminated, back to back
+    char **names;              // Sorted pointers into pool; directories carry a trailing '/'
+    int count;                 // Entries in names
+} DirListing;
+
+// Directory listings read while expanding globs, shared by every word of one input line
+typedef struct {
+    unsigned long generation;  // line_arena.resets when filled; a new line starts empty
+    long long command;         // Commands expanded this line; a listing from an earlier one is revalidated
+    char *cwd;                 // Working directory the relative listings belong to
+    DirListing *slots;         // Open-addressed by path; used_ns holds the command that last checked it
+    size_t capacity;           // Slot count, always a power of two
+    size_t used;               // Occupied slots
+} GlobCache;
+
+// Completion candidates: PATH executables and builtins, and recently listed directories
+typedef struct {
+    pthread_t builder;         // Thread that reads PATH after startup
+    int building;              // builder has not been joined yet
+    char *path_value;          // PATH the command table was built for
+    DirListing *path_dirs;     // One listing per PATH directory, executables only
+    int num_path_dirs;         // Entries in path_dirs
+    char **commands;           // Sorted, deduplicated command names, pointing into the listings
+    int num_commands;          // Entries in commands
+    DirListing files[COMPLETE_DIR_CACHE]; // Directories read for filename completion
+    char **matches;            // Candidates found by the last complete_word, in order
+    int num_matches;           // Entries in matches
+    int matches_size;          // Allocated entries in matches
+} Completer;
+
+// Terminal line editor state; buf is kept between lines
+typedef struct {
+    char *buf;                 // Line being edited, always NUL-terminated
+    size_t len;                // Bytes in buf
+    size_t pos;                // Cursor offset in buf
+    size_t size;               // Allocated bytes in buf
+    const char *prompt;        // Shown before the line
+    char *log;                 // History log, mapped by the first Up press, or NULL
+    size_t map_len;            // Bytes mapped at log
+    size_t log_len;            // Mapped bytes up to the end of the last complete line
+    size_t hist_at;            // Start of the history line shown; log_len while editing the draft
+    char *draft;               // What was typed before browsing history
+    int tabs;                  // Consecutive Tab presses; the second lists the candidates
+} Editor;
+
+// Ctrl-R state: the most recent distinct matching lines, oldest first
+typedef struct {
+    char **lines;              // Copies of the lines (heap)
+    int count;                 // Lines held
+    int want;                  // Lines to keep: one more than the matches skipped
+} EditorSearch;
+
+// One process of a job; its epoll registration points here so an exit is handled in O(1)
+typedef struct {
+    struct Job *job;           // Owning job
+    pid_t pid;                 // Process ID, or -1 if the stage failed to start
+    int pidfd;                 // pidfd watched by the event loop, or -1
+    int status;                // Exit status once reaped (128 + signal if killed)
+    int done;                  // Reaped, or never started
+    int stopped;               // Currently stopped by a job-control signal
+    char *name;                // Traced jobs: command name (heap)
+    uint64_t spawn_ns;         // Traced jobs: time spent launching the process
+    uint64_t start_ns;         // Traced jobs: when the launch returned
+    uint64_t end_ns;           // Traced jobs: when the exit was collected
+    struct rusage usage;       // Traced jobs: CPU time and peak RSS from the kernel
+    long long read_bytes;      // Traced jobs: bytes read (rchar), or -1 if unknown
+    long long write_bytes;     // Traced jobs: bytes written (wchar), or -1 if unknown
+} JobProc;
+
+// Why the shell ended a limited job
+enum { LIMIT_NONE, LIMIT_TIMEOUT, LIMIT_MEMORY };
+
+// Limits in force for a running job. Owned by the job, which may outlive the line.
+typedef struct {
+    struct Job *job;           // Job being limited
+    Limits want;               // What the prefix asked for
+    char *cgroup;              // Transient cgroup directory, or NULL when rlimits stand in
+    int procs_fd;              // The cgroup's cgroup.procs: each child writes "0" to move in; -1 without one
+    int timer_fd;              // timerfd for --timeout, watched by the event loop; -1 if none
+    int reason;                // LIMIT_* that ended the job
+    int signals;               // Kill signals sent so far: SIGTERM first, SIGKILL after the grace period
+    cpu_set_t cpus;            // Without a cgroup: CPUs each child is pinned to for --cpu (empty: any)
+} JobLimit;
+
+// Job states as shown by jobs
+enum { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+// A pipeline (or backgrounded && / || list) running in its own process group
+typedef struct Job {
+    int id;                    // Job number, as in %1
+    pid_t pgid;                // Process group shared by every stage
+    int state;                 // JOB_RUNNING, JOB_STOPPED or JOB_DONE
+    int live;                  // Processes not yet reaped
+    int stopped;               // Live processes currently stopped
+    int stop_signal;           // Signal that stopped the job, for the status
+    int status_index;          // Stage whose status is the job's status
+    char *text;                // Command text for listings; outlives the line arena
+    struct termios tmodes;     // Terminal modes saved when the job stopped
+    int has_tmodes;            // tmodes is valid
+    int waited;                // A caller collects its status; never announced at the prompt
+    int traced;                // Stages are timed, for time or VORTEX_TRACE
+    int timed;                 // Print a per-stage breakdown when it finishes (time prefix)
+    JobLimit *limit;           // limit prefix in force, or NULL
+    struct Job *next_done;     // Link in the list of finished jobs not yet reported
+    int num_procs;             // Entries in procs
+    JobProc procs[];           // One per stage
+} Job;
+
+// Every job of the shell plus the event loop that reaps them
+typedef struct {
+    Job **slots;               // Indexed by job id - 1; NULL for free ids
+    int capacity;              // Slots allocated
+    int max_id;                // Highest id in use; new jobs get max_id + 1 like bash
+    int epoll_fd;              // Watches every child's pidfd and the SIGCHLD signalfd
+    int signal_fd;             // SIGCHLD as a descriptor: stops, continues, pidfd-less reaping
+    int use_pidfd;             // Exits arrive through pidfds (0: fall back to waitpid(-1))
+    int unwatched;             // Live processes without a pidfd, reaped by waitpid(-1)
+    int enabled;               // 0 before init and in subshells, which wait directly
+    int interactive;           // Terminal is handed to foreground jobs
+    struct termios shell_tmodes; // Shell's own terminal modes, restored after each job
+    Job *done;                 // Finished background jobs not yet reported
+    Job *foreground;           // Job the shell is waiting on, if any
+} JobTable;
+
+// One input line run by parallel; output is held in memfds until it may be printed
+typedef struct {
+    char *line;                // Input line the command was built from
+    pid_t pid;                 // Child, or -1 if it never started
+    int pidfd;                 // Watched by parallel's epoll set, or -1
+    int out_fd;                // memfd capturing stdout
+    int err_fd;                // memfd capturing stderr
+    int status;                // Exit status once finished
+    int done;                  // Finished, or failed to start
+    int emitted;               // Output already printed
+} ParallelTask;
+
+// Work queue of parallel: a window of tasks in input order, oldest unprinted first
+typedef struct {
+    ParallelTask *tasks;       // tasks[i] holds input line number first_seq + i
+    size_t len;                // Tasks in the window
+    size_t cap;                // Allocated entries
+    size_t first_seq;          // Input line number of tasks[0]
+    size_t start;              // tasks[0..start) are printed and await compaction
+    int epoll_fd;              // Watches running children's pidfds
+    int unwatched;             // Running children without a pidfd, collected by waitpid(-1)
+    long running;              // Children currently running
+    int keep_order;            // -k: print in input order rather than completion order
+    int interrupted;           // A child died of SIGINT; start nothing new
+    size_t total;              // Lines run
+    size_t failed;             // Runs with a nonzero status
+    char *failures[PARALLEL_MAX_FAILURES]; // First failed lines, for the summary
+} Parallel;
+
+// A file (or the shell's stdout) that a ; segment may touch, for autopar's conflict check
+typedef struct {
+    char *key;                 // Canonical path, or AUTOPAR_STDOUT
+    int write;                 // Segment may modify it
+} Resource;
+
+// Progress of a segment under autopar
+enum { AUTOPAR_PENDING, AUTOPAR_RUNNING, AUTOPAR_DONE, AUTOPAR_RELEASED };
+
+// One ; segment under set -o autopar: what it touches and its place in the dependency graph
+typedef struct {
+    Node *node;                // and_or list, or an & node
+    Resource *res;             // Files read or written
+    int num_res;               // Entries in res
+    int cap_res;               // Allocated entries
+    int barrier;               // Changes shell state (cd, export, ...): ordered against everything
+    int *succ;                 // Later segments that wait for this one
+    int num_succ;              // Entries in succ
+    int waiting;               // Earlier conflicting segments not yet finished
+    int state;                 // AUTOPAR_* progress
+    int status;                // Exit status once finished
+    Job *job;                  // Running job, if any
+} Segment;
+
+// Entry in the set -o option table
+typedef struct {
+    const char *name;          // Option name as given to set -o
+    char letter;               // Short form (set -e), or 0
+    int *flag;                 // Variable holding its value
+} ShellOption;
+
+// Buffered source of command lines: a terminal, a script, a pipe or a -c string
+typedef struct {
+    int fd;                    // Descriptor read from, or -1 when buf holds all input
+    char *buf;                 // Unconsumed input; grows to fit the longest line
+    size_t size;               // Allocated bytes in buf
+    size_t start;              // First byte not yet returned
+    size_t end;                // End of the bytes read so far
+    int eof;                   // read() reported end of input
+    int edit;                  // A terminal: lines come from the line editor, buf queues keys
+} LineReader;
+
+// Ways to start a child; posix_spawn is the default, the others exist for fallback and benchmarks
+enum { SPAWN_POSIX, SPAWN_VFORK, SPAWN_FORK, SPAWN_ZYGOTE };
+// Steps that can fail while preparing a child
+enum { SPAWN_OK, SPAWN_FAIL_INPUT, SPAWN_FAIL_OUTPUT, SPAWN_FAIL_EXEC, SPAWN_FAIL_SETUP };
+
+// Running totals for the word counter; in_word carries state across buffers
+typedef struct {
+    unsigned long long lines;  // Newline bytes seen
+    unsigned long long words;  // Words started so far
+    unsigned long long bytes;  // Bytes consumed
+    int in_word;               // 1 if the last non-transparent byte was printable
+} WordCount;
+
+// Persistent checkpoint letting # resume counting an append-only file where it stopped
+typedef struct {
+    uint64_t dev;              // Device of the counted file
+    uint64_t ino;              // Inode of the counted file
+    uint64_t offset;           // Bytes already counted (file size at checkpoint)
+    uint64_t lines;            // Lines within [0, offset)
+    uint64_t words;            // Words within [0, offset)
+    uint64_t fingerprint;      // Hash of the first and last bytes before offset
+    int64_t mtime_ns;          // st_mtim of the file when it was counted
+    int64_t last_used;         // Time of last use, for LRU eviction
+    uint32_t in_word;          // Word state at offset
+    uint32_t reserved;         // Keeps the record 8-byte aligned
+} WcCheckpoint;
+
+// One memoized result: what identified the command, where its output is and how it ended
+typedef struct {
+    uint64_t key[2];           // Hash of argv, cwd, key variables and every input file's identity
+    uint64_t blob[2];          // Hash of the output, which names its file
+    uint64_t size;             // Output bytes
+    uint64_t run_ns;           // Wall time of the run that produced the output
+    int64_t last_used;         // Realtime clock in ns at last use, for LRU eviction
+    int32_t status;            // Exit status replayed on a hit
+    uint32_t reserved;         // Keeps the record 8-byte aligned
+} MemoEntry;
+
+// The memo index file: counters, then count entries
+typedef struct {
+    uint64_t magic;            // MEMO_MAGIC; anything else is treated as an empty cache
+    uint64_t hits;             // Lookups answered from the cache
+    uint64_t misses;           // Lookups that ran the command
+    uint64_t bytes_saved;      // Output bytes replayed instead of produced
+    uint64_t ns_saved;         // Run time of the replayed results
+    uint32_t count;            // Entries in use
+    uint32_t reserved;         // Keeps the entries 8-byte aligned
+    MemoEntry entries[MEMO_MAX_ENTRIES];
+} MemoIndex;
+
+// Running 128-bit hash for memo keys and output addresses (not cryptographic)
+typedef struct {
+    uint64_t h[2];             // Two lanes, mixed together when finished
+    uint64_t len;              // Bytes hashed
+} MemoHash;
+
+// Transient cgroups for limit: where they go, probed on first use
+typedef struct {
+    int probed;                // The cgroup v2 hierarchy has been looked at
+    char *base;                // Directory job cgroups are created in, or NULL to use rlimits
+    char controllers[256];     // Controllers enabled for base's children, e.g. "cpu memory"
+    unsigned serial;           // Names the next job cgroup
+    JobLimit *starting;        // Limits the children being started now must enter
+    char **stale;              // Job cgroups whose removal must be retried (heap)
+    int num_stale;             // Entries in stale
+} Limiter;
+
+// Header of every frame on a --serve connection; length bytes of payload follow.
+// A request's payload is NUL-terminated strings: the command line, the working
+// directory ("" keeps the server's), then NAME=value to set or NAME to unset.
+typedef struct {
+    uint32_t type;             // SERVE_* frame type
+    uint32_t length;           // Payload bytes after the header
+} ServeFrame;
+
+// Frame types: clients send requests; the server answers with output chunks, then the status
+enum { SERVE_REQUEST = 1, SERVE_STDOUT, SERVE_STDERR, SERVE_STATUS };
+// Descriptors of a connection in the server's epoll set
+enum { SERVE_WATCH_SOCKET, SERVE_WATCH_STDOUT, SERVE_WATCH_STDERR, SERVE_WATCH_PIDFD };
+
+typedef struct ServeConn ServeConn;
+
+// epoll tag of one descriptor: the connection it belongs to and which one it is
+typedef struct {
+    ServeConn *conn;           // Owning connection
+    int kind;                  // SERVE_WATCH_*
+} ServeWatch;
+
+// One --serve client and the request it is running, if any. Requests on one
+// connection run one after another; different connections run side by side.
+struct ServeConn {
+    int fd;                    // Client socket
+    char *in;                  // Bytes received and not yet consumed (heap)
+    size_t in_len;             // Bytes in in
+    size_t in_size;            // Allocated bytes in in
+    char *out;                 // Frames the socket has not accepted yet (heap)
+    size_t out_start;          // First unsent byte of out
+    size_t out_len;            // End of the queued bytes
+    size_t out_size;           // Allocated bytes in out
+    pid_t pid;                 // Running request, leader of its own process group; 0 when idle
+    int pidfd;                 // Readable once pid exits, or -1
+    int pipes[2];              // Read ends of its stdout and stderr, -1 once at end of file
+    int exited;                // pid has been reaped and status is final
+    int status;                // Exit status of the request
+    int queued;                // Holds a complete request waiting for a worker
+    int hungup;                // Client went away; freed once its request is reaped
+    int paused;                // Pipes left out of epoll until the client catches up
+    int eof;                   // Client stopped sending; the connection ends once it is answered
+    int dead;                  // Retired; freed at the end of the current batch of events
+    ServeConn *next;           // Next connection waiting for a worker, or retired
+    ServeConn *all_prev;       // Neighbours in Server.conns
+    ServeConn *all_next;
+    ServeWatch watch[4];       // Tags for the socket, both pipes and the pidfd
+};
+
+// The --serve daemon: one event loop and a bounded number of running requests
+typedef struct {
+    int epoll_fd;              // Listening socket, signals, and every connection's descriptors
+    int listen_fd;             // Bound AF_UNIX socket
+    int signal_fd;             // SIGINT and SIGTERM, which shut the server down
+    int workers;               // Requests allowed to run at once
+    int running;               // Requests running now
+    ServeConn *head;           // Requests waiting for a worker, oldest first
+    ServeConn *tail;           // Where the next waiting request is appended
+    ServeConn *conns;          // Every open connection
+    ServeConn *dead;           // Connections retired during the current batch
+} Server;
+
+// Compressed formats + and # decode, told apart by their first bytes
+enum { DECODE_NONE, DECODE_GZIP, DECODE_ZSTD };
+
+// One compressed input being decoded: a reader thread reads and decompresses into
+// the two output buffers in turn while the caller consumes the other one
+typedef struct {
+    int fd;                    // Compressed file, read sequentially from the start
+    int format;                // DECODE_GZIP or DECODE_ZSTD
+    unsigned char *in;         // Compressed bytes (DECODE_IN_SIZE)
+    int in_eof;                // read() reported end of file
+    int clean;                 // Input so far ends exactly on a gzip member or zstd frame
+    unsigned char *out[2];     // Decoded buffers (DECODE_OUT_SIZE each)
+    size_t len[2];             // Bytes in each, valid while it is full
+    int full[2];               // Filled by the reader and not yet given back by the caller
+    int done;                  // The reader has stopped; no more buffers will fill
+    int error;                 // It stopped on a read error or corrupt data
+    int stop;                  // The caller gave up; the reader should stop
+    pthread_mutex_t lock;      // Guards full, len, done, error and stop
+    pthread_cond_t cond;       // Signaled whenever one of them changes
+#ifdef DECODE_HAVE_GZIP
+    z_stream z;                // Inflate state of the current gzip member
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    ZSTD_DCtx *zstd;           // zstd decompression context
+    ZSTD_inBuffer zin;         // Unconsumed part of in
+#endif
+} Decoder;
+
 // Function prototypes for modular design and forward declaration
-void parse_command(char *input, Command *cmd);              // Breaks down input into a Command struct
-void execute_single_command(Command *cmd);                 // Runs a single command with I/O redirection
-void handle_pipes(Command *commands, int num_commands);     // Orchestrates standard pipe execution
-void handle_reverse_pipes(Command *commands, int num_commands); // Manages reverse pipe execution
-void handle_file_append(char *file1, char *file2);         // Swaps and appends content between two files
-void count_words(char *filename);                          // Calculates word count in a file
-void concatenate_files(char **files, int num_files);       // Merges file contents to stdout
-void execute_sequential_commands(char *commands[], int num_commands); // Executes commands in order
-void execute_conditional(Command *commands, int num_commands, char *operators); // Handles &&/|| logic
-void free_command(Command *cmd);                           // Releases dynamically allocated memory
+char *reader_line(LineReader *in);                          // Returns the next input line, or NULL at end of input
+int shell_loop(LineReader *in, int interactive);            // Runs every line of the input; returns the last status
+Node *parse_line(const char *line, Arena *arena);           // Builds the syntax tree for one input line
+void *arena_alloc(Arena *arena, size_t size);               // Bump-allocates from the line arena
+void arena_reset(Arena *arena);                             // Releases everything allocated for a line
+char *arena_strdup(Arena *arena, const char *s);            // Copies a string into the arena
+int execute_node(Node *node);                               // Runs a syntax tree and returns its status
+int execute_single_command(Node *node);                    // Runs a single command with I/O redirection
+int run_file_operator(Command *cmd);                       // Runs #, + or ~ inside the shell
+const Builtin *find_builtin(Command *cmd);                  // Looks up a command in the builtin table
+int run_in_shell(Command *cmd, const Builtin *builtin);    // Runs a builtin with saved/restored redirections
+pid_t spawn_command(Command *cmd, int in_fd, int out_fd, pid_t pgid); // Launches a parsed command with the given stdio
+pid_t spawn_process(SpawnRequest *req);                    // Launches a child through the active backend
+int spawn_select_backend(void);                            // Reads VORTEX_SPAWN once; returns the backend
+int zygote_start(int interactive);                         // Forks the zygote helper; 0 on success
+int wait_for_child(pid_t pid);                             // Waits for a child and returns its exit status
+void trace_init(void);                                     // Opens $VORTEX_TRACE for appending, if set
+uint64_t trace_now_ns(void);                               // Monotonic clock for stage and line timings
+void trace_line(const char *line, uint64_t parse_ns, uint64_t exec_ns, int status); // Records one input line
+int run_timed(Node *node);                                 // Runs a pipeline under time and prints its cost
+int limit_option(Limits *limits, const char *name, const char *value); // Applies one limit option; 0 if valid
+JobLimit *limit_create(Job *job, const Limits *want);      // Prepares a job's cgroup or rlimits
+int limit_enter(const JobLimit *limit);                    // Moves a starting child under its job's limits
+void limit_arm(JobLimit *limit);                           // Starts a limited job's --timeout clock
+void limit_timer_fired(JobLimit *limit);                   // Signals a job whose --timeout ran out
+void limit_job_done(Job *job);                             // Settles a finished limited job's status
+void limit_free(JobLimit *limit);                          // Removes a job's cgroup and timer
+void limit_wait_direct(Job *job);                          // Waits for a limited job without the event loop
+void jobs_init(int interactive);                           // Sets up the job table's event loop and signals
+int run_job(Node *node, int background);                   // Launches a pipeline as a job in its own process group
+Job *job_start(Node *node, pid_t pgid);                    // Starts a pipeline's stages without waiting
+int pipe_open(int fds[2]);                                 // Creates a pipeline pipe, sized by $VORTEX_PIPESZ
+Job *job_create(Node *node, int num_procs);                // Adds a job for a pipeline or background list
+void job_add_proc(Job *job, int index, pid_t pid);         // Records a started stage and watches its pidfd
+int job_launched(Job *job, pid_t pid);                     // Announces a background job; returns 0
+void job_reaped(pid_t pid, int status);                    // Takes an exit collected by another waitpid(-1)
+void job_child_reset(void);                                // Drops job control in a forked subshell
+int is_job_signal(int sig);                                // Signals an interactive shell ignores for job control
+int run_background(Node *node);                            // Runs an & list without waiting for it
+void jobs_poll(Job *until);                                // Reaps finished children; blocks until a job stops or ends
+int jobs_dispatch(int timeout);                            // Handles one batch of child events
+int job_wait_foreground(Job *job);                         // Gives a job the terminal and waits for it
+void jobs_report(void);                                    // Prints and forgets background jobs that finished
+const char *resolve_command(const char *name, int *cached); // Finds a command's executable via the hash cache
+void path_cache_flush(void);                               // Forgets every cached command location
+int builtin_hash(Command *cmd);                            // Implements hash / hash -r / hash name...
+int handle_pipes(Node *node);                              // Orchestrates standard pipe execution
+int handle_reverse_pipes(Node *node);                      // Manages reverse pipe execution
+int handle_file_append(char *file1, char *file2);          // Swaps and appends content between two files
+int copy_range(int in_fd, off_t in_off, int out_fd, off_t out_off, off_t len); // Copies a byte range between files
+int run_swap_append(int fd1, int fd2, off_t len1, off_t len2, int same, int phase, const char *journal); // Performs the two appends
+void recover_file_append(void);                            // Completes ~ operations interrupted by a crash
+int count_words(char *filename);                           // Calculates word count in a file
+int count_fd(int fd, struct stat *st, off_t start, WordCount *wc); // Counts an open file from start
+int state_path(const char *name, char *path, size_t size); // Locates a file in the shell's state directory
+uint64_t wc_fingerprint(int fd, uint64_t offset);          // Hashes the ends of a counted prefix
+off_t wc_cache_lookup(struct stat *st, int fd, WordCount *wc); // Restores a checkpoint; returns resume offset
+void wc_cache_store(struct stat *st, int fd, WordCount *wc); // Records a checkpoint after counting
+int memo_run(Node *node);                                  // Replays a memo command's output, or runs and records it
+int builtin_cache(Command *cmd);                           // Implements cache stats / cache clear
+void history_add(const char *line);                        // Appends an interactive line to the shared log
+int history_search(const char *pattern, void (*emit)(const char *line, size_t len, void *ctx), void *ctx); // Lines containing pattern
+int builtin_history(Command *cmd);                         // Implements history / history N / history /pattern
+char *editor_line(LineReader *in, const char *prompt);     // Reads a line at the terminal with editing, completion and history
+void completer_start(void);                                // Lists PATH executables on a background thread
+int complete_word(const char *word, int command);          // Collects completions for a typed word; returns how many
+int expand_command(Command *cmd);                          // Expands variables and globs in a command's words
+void wc_feed(WordCount *wc, const unsigned char *buf, size_t len); // Advances counts over a buffer
+int decode_detect(int fd, struct stat *st);                // Returns a regular file's DECODE_* format from its magic bytes
+int decode_stream(int fd, int format, int (*sink)(const unsigned char *buf, size_t len, void *ctx), void *ctx); // Feeds decoded bytes to sink
+int concatenate_files(char **files, int num_files);        // Merges file contents to stdout
+int stream_file(int in_fd, int out_fd, struct stat *out_st); // Copies one open file to out_fd
+int execute_sequential_commands(Node *node);               // Executes ; sequences in order
+int autopar_run(Node *node);                               // Runs a ; chain concurrently where files allow
+int execute_conditional(Node *node);                       // Handles &&/|| logic
+int serve(const char *path);                               // Runs requests from clients of an AF_UNIX socket
 void get_process_name(char *name, size_t size);            // Extracts this process's name
 void kill_all_shells(char *self_name);                     // Terminates all shell instances
 
-// Global variable to unify process group management
-pid_t shell_pgid;              // Process group ID to keep child processes organized
+// Global variable to unify process group management
+pid_t shell_pgid;              // Process group ID to keep child processes organized
+int spawn_backend = -1;        // Selected SPAWN_* backend; -1 until first use
+PathCache path_cache;          // Remembered command locations, like bash's hash table
+Arena line_arena;              // Holds the tokens and syntax tree of the line being run
+int last_status;               // Exit status of the most recent command, for exit's default and $?
+char self_name[MAX_LINE];      // This process's name, used by killallterms
+JobTable jobs;                 // Background and stopped jobs, reaped by one event loop
+int opt_autopar;               // set -o autopar: independent ; segments run concurrently
+int opt_errexit;               // set -e: leave the shell when a command fails
+int errexit_suppressed;        // Depth of && / || left operands, whose failure set -e ignores
+int trace_fd = -1;             // $VORTEX_TRACE, opened for appending; -1 when tracing is off
+Zygote zygote = { .fd = -1 };  // VORTEX_SPAWN=zygote helper, if running
+Uring uring = { .fd = -1 };    // io_uring used by + over many files
+History history = { .log_fd = -1 }; // Interactive command log
+Completer completer;           // Tab completion tables
+Editor editor;                 // Terminal line editor
+GlobCache glob_cache;          // Directories listed by globs on the current line
+Limiter limiter;               // Transient cgroups of limited jobs
+Server server = { .epoll_fd = -1, .listen_fd = -1, .signal_fd = -1 }; // --serve state
+
+#ifndef VORTEX_NO_MAIN         // Benchmarks include this file and provide their own main
+// vortexshell [-c commands | script | --serve socket]: with none, commands come from
+// stdin, and the shell is interactive (prompt, job control) only when stdin is a terminal
+int main(int argc, char **argv) {
+    LineReader in = { .fd = STDIN_FILENO }; // Where commands come from
+    int interactive = 0;           // Prompt and hand the terminal to jobs
+    const char *serve_path = NULL; // --serve: commands come from clients of this socket
+    
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if (argc < 3) {
+            printf("Error: --serve requires a socket path\n");
+            return 2;
+        }
+        serve_path = argv[2];
+    } else if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            printf("Error: -c requires a command string\n");
+            return 2;
+        }
+        in.fd = -1;                // The whole input is already in memory
+        in.buf = strdup(argv[2]);
+        in.size = in.end = strlen(argv[2]) + 1;
+        in.end--;                  // buf's last byte is the NUL
+        in.eof = 1;
+    } else if (argc > 1) {
+        in.fd = open(argv[1], O_RDONLY | O_CLOEXEC); // Children must not inherit the script
+        if (in.fd < 0) {
+            printf("Error: Cannot open %s: %s\n", argv[1], strerror(errno));
+            return 127;
+        }
+    } else {
+        interactive = isatty(STDIN_FILENO);
+    }
+    
+    shell_pgid = getpid();         // Set this process's PID as the group leader
+    if (interactive) setpgid(0, 0); // Own process group for job control; scripts stay in the caller's
+    shell_pgid = getpgrp();
+    if (!serve_path && spawn_select_backend() == SPAWN_ZYGOTE && zygote_start(interactive) < 0) {
+        spawn_backend = SPAWN_POSIX;   // Forked now, while the shell is at its smallest
+    }
+    
+    // Fetch the executable name to use in kill_all_shells
+    get_process_name(self_name, sizeof(self_name)); // Populates self_name with process basename
+    recover_file_append();         // Finish any ~ left half-done by a crashed shell
+    trace_init();                  // Per-stage JSON records when VORTEX_TRACE is set
+    if (serve_path) return serve(serve_path); // Each request sets up its own job table
+    jobs_init(interactive);        // Job table, SIGCHLD handling and terminal ownership
+    const char *term = getenv("TERM");
+    if (interactive && !(term && strcmp(term, "dumb") == 0)) {
+        in.edit = 1;               // Keys are read one at a time, in raw mode
+        completer_start();         // After jobs_init: the thread inherits the blocked SIGCHLD
+    }
+    
+    int status = shell_loop(&in, interactive);
+    if (interactive) printf("exit\n"); // End of input (Ctrl-D) at the prompt, as bash says
+    fflush(stdout);
+    return status;
+}
+#endif
+
+// Returns the next line of input with its newline removed, reading in large blocks so a
+// script or a fast pipe costs one read() per many lines. The line stays valid until the
+// next call. Returns NULL once the input is exhausted.
+char *reader_line(LineReader *in) {
+    size_t scan = in->start;               // Bytes before scan hold no newline
+    while (1) {
+        char *nl = memchr(in->buf + scan, '\n', in->end - scan);
+        if (nl || (in->eof && in->start < in->end)) {
+            char *line = in->buf + in->start;
+            if (!nl) nl = in->buf + in->end; // Last line without a newline; buf keeps a spare byte
+            *nl = 0;
+            in->start = nl - in->buf + 1;
+            if (in->start > in->end) in->start = in->end;
+            return line;
+        }
+        if (in->eof) return NULL;          // Everything returned
+        if (in->start > 0) {               // Slide the partial line to the front
+            memmove(in->buf, in->buf + in->start, in->end - in->start);
+            in->end -= in->start;
+            in->start = 0;
+        }
+        scan = in->end;
+        if (in->end + 1 >= in->size) {     // Full with one line: grow, keeping a byte for the NUL
+            size_t size = in->size ? in->size * 2 : READER_BUF_SIZE;
+            char *grown = realloc(in->buf, size);
+            if (!grown) {
+                printf("Error: Memory allocation failed\n");
+                exit(1);
+            }
+            in->buf = grown;
+            in->size = size;
+        }
+        ssize_t n = read(in->fd, in->buf + in->end, in->size - in->end - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) in->eof = 1;           // End of input, or an error that ends it
+        else in->end += n;
+    }
+}
+
+// Reads, parses and runs lines until the input ends; returns the last command's status.
+// Interactive shells print the prompt and report finished background jobs before it.
+int shell_loop(LineReader *in, int interactive) {
+    char *line;                            // Current input line
+    int first = 1;                         // Next line is the first, which may be a #! line
+    while (1) {
+        if (jobs.max_id > 0) {             // Nothing to reap or report without jobs
+            jobs_poll(NULL);               // Reap background jobs that ended while the last line ran
+            jobs_report();                 // ...and announce them before the prompt, as bash does
+        }
+        if (in->edit) {
+            line = editor_line(in, PROMPT); // Prints the prompt and redraws it while editing
+        } else {
+            if (interactive) {
+                printf(PROMPT);            // Display a unique, hardcoded shell prompt
+                fflush(stdout);            // Force the prompt to appear immediately on the terminal
+            }
+            line = reader_line(in);
+        }
+        if (line == NULL) break;           // End of input
+        if (first && line[0] == '#' && line[1] == '!') { // Interpreter line of an executable script
+            first = 0;
+            continue;
+        }
+        first = 0;
+        if (interactive) history_add(line);
+        
+        // Parse the whole line into a syntax tree, run it, then drop the line's memory at once
+        uint64_t t0 = trace_fd >= 0 ? trace_now_ns() : 0; // Clock reads only when tracing
+        Node *tree = parse_line(line, &line_arena);
+        uint64_t t1 = trace_fd >= 0 ? trace_now_ns() : 0;
+        if (tree) {
+            last_status = execute_node(tree); // Pipelines, conditionals and sequences in one walk
+        } else if (line[strspn(line, " \t")] != 0) {
+            last_status = 2;               // Syntax error, as bash reports it
+            if (opt_errexit) exit(last_status);
+        }
+        if (trace_fd >= 0 && tree) trace_line(line, t1 - t0, trace_now_ns() - t1, last_status);
+        arena_reset(&line_arena);          // O(1): every token and node goes together
+    }
+    return last_status;
+}
+
+// Adds, changes or removes (op) the epoll registration of one of conn's descriptors
+static void serve_watch(ServeConn *conn, int kind, int fd, int op, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = &conn->watch[kind];      // Leads back to the connection and the descriptor's role
+    epoll_ctl(server.epoll_fd, op, fd, &ev);
+}
+
+// Closes a watched descriptor. It leaves the epoll set first: a worker forked a moment
+// ago may still hold a copy, which would keep the registration (and its events) alive.
+static void serve_unwatch(int *fd) {
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+    close(*fd);
+    *fd = -1;
+}
+
+// Makes room for len more bytes at the end of conn's output queue
+static void serve_reserve(ServeConn *conn, size_t len) {
+    if (conn->out_start > 0) {             // Slide the unsent bytes to the front
+        memmove(conn->out, conn->out + conn->out_start, conn->out_len - conn->out_start);
+        conn->out_len -= conn->out_start;
+        conn->out_start = 0;
+    }
+    if (conn->out_size - conn->out_len >= len) return;
+    size_t size = conn->out_size ? conn->out_size : SERVE_READ_SIZE;
+    while (size - conn->out_len < len) size *= 2;
+    char *grown = realloc(conn->out, size);
+    if (!grown) {
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+    conn->out = grown;
+    conn->out_size = size;
+}
+
+// Sets which of conn's descriptors the loop waits on: new requests are read only while
+// it is idle, the socket's writability matters only while frames are queued, and the
+// request's pipes are left unread while the client is SERVE_OUT_LIMIT bytes behind
+static void serve_update(ServeConn *conn) {
+    int pause = conn->out_len - conn->out_start > SERVE_OUT_LIMIT;
+    if (pause != conn->paused) {
+        for (int i = 0; i < 2; i++) {
+            if (conn->pipes[i] >= 0) serve_watch(conn, SERVE_WATCH_STDOUT + i, conn->pipes[i], EPOLL_CTL_MOD, pause ? 0 : EPOLLIN);
+        }
+        conn->paused = pause;
+    }
+    if (conn->fd < 0) return;              // Hung up
+    uint32_t events = 0;                   // EPOLLHUP and EPOLLERR are always reported
+    if (!conn->pid && !conn->queued && !conn->eof) events |= EPOLLIN;
+    if (conn->out_start < conn->out_len) events |= EPOLLOUT;
+    serve_watch(conn, SERVE_WATCH_SOCKET, conn->fd, EPOLL_CTL_MOD, events);
+}
+
+// Ends a connection. A running request's process group gets SIGHUP, as when a terminal
+// closes; the connection itself is freed once nothing refers to it any more.
+static void serve_close(ServeConn *conn) {
+    if (conn->fd >= 0) serve_unwatch(&conn->fd);
+    conn->out_start = conn->out_len = 0;
+    if (conn->pid) kill(-conn->pid, SIGHUP);
+    if (conn->queued) {                    // Waiting for a worker: it never will now
+        ServeConn **link = &server.head, *prev = NULL;
+        while (*link != conn) {
+            prev = *link;
+            link = &(*link)->next;
+        }
+        *link = conn->next;
+        if (server.tail == conn) server.tail = prev;
+        conn->queued = 0;
+    }
+}
+
+// Writes as much of conn's output queue as the socket takes without blocking
+static void serve_flush(ServeConn *conn) {
+    while (conn->out_start < conn->out_len && conn->fd >= 0) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_start, conn->out_len - conn->out_start, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break; // Full: EPOLLOUT resumes it
+        if (n < 0) {                       // Client gone: its request ends too
+            conn->eof = 1;
+            serve_close(conn);
+            break;
+        }
+        conn->out_start += n;
+    }
+    if (conn->fd < 0 || conn->out_start == conn->out_len) conn->out_start = conn->out_len = 0;
+}
+
+// Queues one frame for the client and starts sending it
+static void serve_send(ServeConn *conn, uint32_t type, const void *data, uint32_t len) {
+    ServeFrame frame = { type, len };
+    serve_reserve(conn, sizeof(frame) + len);
+    memcpy(conn->out + conn->out_len, &frame, sizeof(frame));
+    memcpy(conn->out + conn->out_len + sizeof(frame), data, len);
+    conn->out_len += sizeof(frame) + len;
+    serve_flush(conn);
+}
+
+// Answers a request that could not be run with a message and a status, as a run would
+static void serve_fail(ServeConn *conn, const char *message, int32_t status) {
+    serve_send(conn, SERVE_STDOUT, message, strlen(message));
+    serve_send(conn, SERVE_STATUS, &status, sizeof(status));
+}
+
+// Drops the frame at the front of conn's input
+static void serve_consume(ServeConn *conn, size_t len) {
+    memmove(conn->in, conn->in + len, conn->in_len - len);
+    conn->in_len -= len;
+}
+
+// Looks at what an idle connection has received: a complete request is queued for a
+// worker, and a malformed one is answered at once
+static void serve_next(ServeConn *conn) {
+    while (!conn->pid && !conn->queued && conn->fd >= 0 && conn->in_len >= sizeof(ServeFrame)) {
+        ServeFrame frame;
+        memcpy(&frame, conn->in, sizeof(frame));
+        if (frame.type != SERVE_REQUEST || frame.length > SERVE_MAX_REQUEST) {
+            conn->eof = 1;                 // Not this protocol: nothing after it can be framed
+            conn->in_len = 0;
+            return;
+        }
+        if (conn->in_len < sizeof(frame) + frame.length) return; // The rest is still coming
+        const char *text = conn->in + sizeof(frame);
+        const char *cmd_end = memchr(text, 0, frame.length);
+        if (!cmd_end || cmd_end == text + frame.length - 1 || text[frame.length - 1]) {
+            serve_fail(conn, "Error: Malformed request\n", 2); // No directory, or an unterminated string
+            serve_consume(conn, sizeof(frame) + frame.length);
+            continue;
+        }
+        conn->queued = 1;
+        conn->next = NULL;
+        if (server.tail) server.tail->next = conn;
+        else server.head = conn;
+        server.tail = conn;
+    }
+}
+
+// Runs one request in a forked worker: its own process group, directory and environment,
+// with stdout and stderr going back through pipes. The command text goes through
+// shell_loop as -c would run it, so a request can be anything a line of the shell can.
+static void serve_child(ServeConn *conn, int out_fd, int err_fd) {
+    ServeFrame frame;
+    memcpy(&frame, conn->in, sizeof(frame));
+    char *text = conn->in + sizeof(frame); // Command, directory, then variables, each NUL-terminated
+    char *end = text + frame.length;
+    char *cwd = text + strlen(text) + 1;
+    setpgid(0, 0);                         // Signals for this request reach no other
+    shell_pgid = getpgrp();
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null_fd >= 0) dup2(null_fd, STDIN_FILENO); // Requests have no input
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+    job_child_reset();                     // Closes the server's sockets, epoll set and other requests' pipes
+    for (char *var = cwd + strlen(cwd) + 1; var < end; var += strlen(var) + 1) {
+        char *eq = strchr(var, '=');
+        if (eq) {
+            *eq = 0;
+            setenv(var, eq + 1, 1);
+        } else {
+            unsetenv(var);
+        }
+    }
+    if (*cwd) {
+        if (chdir(cwd) < 0) {
+            printf("Error: Cannot change directory to %s: %s\n", cwd, strerror(errno));
+            exit(1);
+        }
+        char now[PATH_MAX];                // As cd leaves it
+        if (getcwd(now, sizeof(now))) setenv("PWD", now, 1);
+    }
+    jobs_init(0);                          // Pipelines and & get the event loop, as in a script
+    LineReader in = { .fd = -1, .buf = text, .size = strlen(text) + 1, .eof = 1 };
+    in.end = in.size - 1;                  // buf's last byte is the NUL
+    exit(shell_loop(&in, 0));
+}
+
+// Starts the request at the front of conn's input in a worker process
+static void serve_start(ServeConn *conn) {
+    int out[2], err[2];                    // Request's stdout and stderr
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        serve_fail(conn, "Error: Cannot create pipe\n", 1);
+        return;
+    }
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        close(out[0]);
+        close(out[1]);
+        serve_fail(conn, "Error: Cannot create pipe\n", 1);
+        return;
+    }
+    fflush(stdout);                        // Nothing of the server's may be written twice
+    pid_t pid = fork();                    // The server stays small, so this is cheap
+    if (pid == 0) serve_child(conn, out[1], err[1]);
+    close(out[1]);
+    close(err[1]);
+    if (pid < 0) {
+        close(out[0]);
+        close(err[0]);
+        serve_fail(conn, "Error: Cannot fork a worker\n", 1);
+        return;
+    }
+    setpgid(pid, pid);                     // Also done by the child; whichever runs first wins
+    ServeFrame frame;
+    memcpy(&frame, conn->in, sizeof(frame));
+    serve_consume(conn, sizeof(frame) + frame.length);
+    conn->pid = pid;
+    conn->exited = 0;
+    conn->pipes[0] = out[0];
+    conn->pipes[1] = err[0];
+    conn->paused = 0;
+    for (int i = 0; i < 2; i++) {
+        fcntl(conn->pipes[i], F_SETFL, O_NONBLOCK);
+        serve_watch(conn, SERVE_WATCH_STDOUT + i, conn->pipes[i], EPOLL_CTL_ADD, EPOLLIN);
+    }
+    conn->pidfd = syscall(SYS_pidfd_open, pid, 0); // Checked to work when the server started
+    serve_watch(conn, SERVE_WATCH_PIDFD, conn->pidfd, EPOLL_CTL_ADD, EPOLLIN);
+    server.running++;
+}
+
+// After an event: retires a connection nothing refers to any more, or one whose client
+// has stopped sending and has everything it asked for; otherwise updates its interest.
+// Retired connections are freed after the current batch, which may still name them.
+static void serve_settle(ServeConn *conn) {
+    if (conn->eof && !conn->pid && !conn->queued && conn->out_start == conn->out_len) serve_close(conn);
+    if (conn->fd >= 0 || conn->pid || conn->queued) {
+        serve_update(conn);
+        return;
+    }
+    if (conn->all_prev) conn->all_prev->all_next = conn->all_next;
+    else server.conns = conn->all_next;
+    if (conn->all_next) conn->all_next->all_prev = conn->all_prev;
+    conn->dead = 1;
+    conn->next = server.dead;
+    server.dead = conn;
+}
+
+// Starts waiting requests while workers are free
+static void serve_dispatch(void) {
+    while (server.running < server.workers && server.head) {
+        ServeConn *conn = server.head;
+        server.head = conn->next;
+        if (!server.head) server.tail = NULL;
+        conn->queued = 0;
+        serve_start(conn);
+        if (!conn->pid) serve_next(conn);  // Failed to start and was answered: look at the next one
+        serve_settle(conn);
+    }
+}
+
+// Sends a request's status once it has exited and both of its pipes are drained, then
+// moves on to the connection's next request
+static void serve_finish(ServeConn *conn) {
+    if (!conn->pid || !conn->exited || conn->pipes[0] >= 0 || conn->pipes[1] >= 0) return;
+    conn->pid = 0;
+    server.running--;
+    int32_t status = conn->status;
+    serve_send(conn, SERVE_STATUS, &status, sizeof(status));
+    serve_next(conn);
+    serve_dispatch();
+}
+
+// Handles an event on one of conn's pipes: output becomes a frame, end of file closes it
+static void serve_output(ServeConn *conn, int kind) {
+    int *fd = &conn->pipes[kind - SERVE_WATCH_STDOUT];
+    serve_reserve(conn, sizeof(ServeFrame) + SERVE_READ_SIZE); // Read straight into the queue
+    ssize_t n = read(*fd, conn->out + conn->out_len + sizeof(ServeFrame), SERVE_READ_SIZE);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        serve_unwatch(fd);
+        serve_finish(conn);
+        return;
+    }
+    if (conn->fd < 0) return;              // Nobody to send it to; read only to let the request go on
+    ServeFrame frame = { kind == SERVE_WATCH_STDOUT ? SERVE_STDOUT : SERVE_STDERR, (uint32_t)n };
+    memcpy(conn->out + conn->out_len, &frame, sizeof(frame));
+    conn->out_len += sizeof(frame) + n;
+    serve_flush(conn);
+}
+
+// Collects an exited request. Anything it left running in its process group gets
+// SIGHUP, since nothing else would end it and it may hold the output pipes open.
+static void serve_reaped(ServeConn *conn) {
+    conn->status = wait_for_child(conn->pid); // Ready: the pidfd said so
+    conn->exited = 1;
+    serve_unwatch(&conn->pidfd);
+    kill(-conn->pid, SIGHUP);
+    serve_finish(conn);
+}
+
+// Handles an event on a client socket: request bytes, room for queued output, or a hangup
+static void serve_socket(ServeConn *conn, uint32_t events) {
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        conn->eof = 1;
+        serve_close(conn);
+        return;
+    }
+    if (events & EPOLLOUT) serve_flush(conn);
+    if (!(events & EPOLLIN) || conn->eof) return;
+    if (conn->in_size - conn->in_len < SERVE_READ_SIZE) {
+        size_t size = conn->in_size ? conn->in_size * 2 : 2 * SERVE_READ_SIZE;
+        char *grown = realloc(conn->in, size);
+        if (!grown) {
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+        conn->in = grown;
+        conn->in_size = size;
+    }
+    ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_size - conn->in_len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {                          // Done sending; pending requests are still answered
+        conn->eof = 1;
+        return;
+    }
+    conn->in_len += n;
+    serve_next(conn);
+    serve_dispatch();
+}
+
+// Accepts every pending client of the listening socket
+static void serve_accept(void) {
+    int fd;
+    while ((fd = accept4(server.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        ServeConn *conn = calloc(1, sizeof(ServeConn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->pidfd = conn->pipes[0] = conn->pipes[1] = -1;
+        for (int k = 0; k < 4; k++) conn->watch[k] = (ServeWatch){ conn, k };
+        conn->all_next = server.conns;
+        if (server.conns) server.conns->all_prev = conn;
+        server.conns = conn;
+        serve_watch(conn, SERVE_WATCH_SOCKET, fd, EPOLL_CTL_ADD, EPOLLIN);
+    }
+}
+
+// vortexshell --serve path: listens on an AF_UNIX socket and runs the requests of any
+// number of clients, at most $VORTEX_SERVE_WORKERS at a time (default: online CPUs).
+// Each request is forked from this small process into its own process group, so the
+// exec-and-initialize cost of a fresh shell is paid once, not per command. Runs until
+// SIGINT or SIGTERM; returns the exit status for main.
+int serve(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path too long: %s\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+    int probe = syscall(SYS_pidfd_open, getpid(), 0); // Request exits are watched through pidfds
+    if (probe < 0) {
+        printf("Error: --serve needs pidfds (Linux 5.3 or later)\n");
+        return 1;
+    }
+    close(probe);
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) { // Left behind, or another server's
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (fd >= 0) close(fd);
+        if (live) {
+            printf("Error: A server is already listening on %s\n", path);
+            return 1;
+        }
+        unlink(path);                      // Nobody answers: a crashed server's socket
+    }
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server.listen_fd, SOMAXCONN) < 0) {
+        printf("Error: Cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const char *env = getenv(SERVE_WORKERS_ENV);
+    server.workers = env && atoi(env) > 0 ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (server.workers < 1) server.workers = 1;
+    
+    sigset_t stop;                         // Shutdown requests, read from signal_fd
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop, NULL);   // Workers unblock them in job_child_reset
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.signal_fd = signalfd(-1, &stop, SFD_CLOEXEC);
+    struct epoll_event ev = {0};           // data.ptr NULL marks the listening socket, &server the signals
+    ev.events = EPOLLIN;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev);
+    ev.data.ptr = &server;
+    if (server.signal_fd >= 0) epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.signal_fd, &ev);
+    
+    struct epoll_event events[SERVE_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(server.epoll_fd, events, SERVE_EVENTS, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                serve_accept();
+                continue;
+            }
+            if (events[i].data.ptr == &server) {
+                running = 0;
+                continue;
+            }
+            ServeWatch *watch = events[i].data.ptr;
+            ServeConn *conn = watch->conn;
+            if (conn->dead) continue;      // Retired earlier in this batch
+            switch (watch->kind) {
+            case SERVE_WATCH_SOCKET: serve_socket(conn, events[i].events); break;
+            case SERVE_WATCH_PIDFD: serve_reaped(conn); break;
+            default: serve_output(conn, watch->kind); break;
+            }
+            serve_settle(conn);
+        }
+        while (server.dead) {
+            ServeConn *conn = server.dead;
+            server.dead = conn->next;
+            free(conn->in);
+            free(conn->out);
+            free(conn);
+        }
+    }
+    for (ServeConn *conn = server.conns; conn; conn = conn->all_next) {
+        if (conn->pid) kill(-conn->pid, SIGHUP); // Requests end with the server
+    }
+    unlink(path);
+    close(server.listen_fd);
+    return 0;
+}
+
+// Bump-allocates size bytes from the arena, chaining a larger block when full
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1); // Keep every allocation aligned
+    ArenaBlock *block = arena->head;       // Block being filled
+    if (!block || block->size - block->used < size) {
+        size_t want = block ? block->size * 2 : ARENA_BLOCK_SIZE; // Geometric growth
+        while (want < size) want *= 2;     // Oversized requests get their own block
+        ArenaBlock *fresh = malloc(sizeof(ArenaBlock) + want);
+        if (!fresh) {                      // Out of memory: nothing sensible to continue with
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+        fresh->next = block;               // Keep the old block until the line is done
+        fresh->size = want;
+        fresh->used = 0;
+        arena->head = block = fresh;
+        arena->total += want;
+    }
+    void *ptr = block->data + block->used; // Hand out the next free bytes
+    block->used += size;
+    return ptr;
+}
+
+// Copies a NUL-terminated string into the arena
+char *arena_strdup(Arena *arena, const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(arena_alloc(arena, len), s, len);
+}
+
+// Releases a line's allocations. With one block this is a single store; after a line
+// that needed several, they are merged into one block big enough for next time.
+void arena_reset(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    arena->resets++;
+    if (!block) return;                    // Nothing allocated yet
+    if (!block->next) {                    // Common case: rewind the only block
+        block->used = 0;
+        return;
+    }
+    size_t total = arena->total;           // Capacity the last line needed
+    while (block) {                        // Drop the chain
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->total = 0;
+    arena_alloc(arena, total);             // One block sized for lines like the last one
+    arena->head->used = 0;
+}
+
+// Characters that end an unquoted word
+static int is_word_break(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '\n' ||
+           c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+// Whether c is $, a glob character or a marker byte: the characters expansion treats
+// specially. A table lookup keeps the lexer's scan of every word free of branches.
+static inline int is_expand_char(char c) {
+    static const unsigned char special[256] = {
+        ['$'] = 1, ['*'] = 1, ['?'] = 1, ['['] = 1, [(unsigned char)EXPAND_ESC] = 1, [(unsigned char)EXPAND_QUOTED] = 1,
+    };
+    return special[(unsigned char)c];
+}
+
+// Appends one character of a word being unquoted. In a word to be expanded, quoted special
+// characters (and the marker bytes themselves) are escaped with EXPAND_ESC. expand is
+// passed by value: stores through out could alias a parser field and force reloads.
+static inline size_t lex_put(int expand, char *out, size_t len, char c, int quoted) {
+    if (expand && (c == EXPAND_ESC || c == EXPAND_QUOTED || (quoted && is_expand_char(c)))) {
+        out[len++] = EXPAND_ESC;
+    }
+    out[len++] = c;
+    return len;
+}
+
+// Reads the next token into the parser; words are copied into the arena without quotes
+static void next_token(Parser *p) {
+    const char *s = p->src;                // Shorthand for the line
+    while (s[p->pos] == ' ' || s[p->pos] == '\t' || s[p->pos] == '\n') p->pos++; // Skip blanks
+    p->quoted = 0;
+    p->start = p->pos;                     // Token start, used to slice command text for jobs
+    char c = s[p->pos];                    // First character of the token
+    
+    if (c == '\0') { p->type = TOK_END; p->text = "end of line"; return; }
+    if (c == '|' && s[p->pos + 1] == '|') { p->type = TOK_OR; p->text = "||"; p->pos += 2; return; }
+    if (c == '|' && s[p->pos + 1] == '&') { p->type = TOK_FANOUT; p->text = "|&"; p->pos += 2; return; }
+    if (c == '&' && s[p->pos + 1] == '&') { p->type = TOK_AND; p->text = "&&"; p->pos += 2; return; }
+    if (c == '>' && s[p->pos + 1] == '>') { p->type = TOK_DGREAT; p->text = ">>"; p->pos += 2; return; }
+    if (c == '|') { p->type = TOK_PIPE; p->text = "|"; p->pos++; return; }
+    if (c == '&') { p->type = TOK_AMP; p->text = "&"; p->pos++; return; }
+    if (c == ';') { p->type = TOK_SEMI; p->text = ";"; p->pos++; return; }
+    if (c == '<') { p->type = TOK_LESS; p->text = "<"; p->pos++; return; }
+    if (c == '>') { p->type = TOK_GREAT; p->text = ">"; p->pos++; return; }
+    
+    // Word: find its extent first so the copy is sized exactly once. A word holding $, a
+    // glob character or a marker byte anywhere, even quoted, is kept in escaped form:
+    // quoted special characters sit behind EXPAND_ESC, so they stay literal when the
+    // command's words are expanded just before it runs.
+    size_t start = p->pos, end = start;    // Raw extent of the word
+    int has_quotes = 0;                    // Quotes or backslashes appear in the word
+    int expand = 0;                        // Word is kept in escaped form
+    while (!is_word_break(s[end])) {
+        if (s[end] == '\'' || s[end] == '"' || s[end] == '\\') has_quotes = 1;
+        if (s[end] == '\'') {              // Single quotes: everything literal up to the next '
+            const char *close = strchr(s + end + 1, '\'');
+            if (!close) { p->type = TOK_ERROR; p->text = "unterminated quote"; return; }
+            for (end++; s + end < close; end++) expand |= is_expand_char(s[end]);
+            end++;
+        } else if (s[end] == '"') {        // Double quotes: backslash may escape the quote
+            end++;
+            while (s[end] && s[end] != '"') {
+                if (s[end] == '\\' && s[end + 1]) end++;
+                expand |= is_expand_char(s[end++]);
+            }
+            if (!s[end]) { p->type = TOK_ERROR; p->text = "unterminated quote"; return; }
+            end++;
+        } else if (s[end] == '\\' && s[end + 1]) { // Backslash escapes one character
+            expand |= is_expand_char(s[end + 1]);
+            end += 2;
+        } else {
+            expand |= is_expand_char(s[end++]);
+        }
+    }
+    
+    p->expand = expand;
+    char *out = arena_alloc(p->arena, (end - start) * (expand ? 2 : 1) + 2); // Escapes at most double the text
+    size_t len = 0;                        // Bytes written to out
+    if (expand && has_quotes) out[len++] = EXPAND_QUOTED; // Survives expanding to nothing
+    for (size_t i = start; i < end; ) {
+        if (s[i] == '\'') {                // Copy single-quoted run verbatim
+            p->quoted = 1;
+            for (i++; s[i] != '\''; i++) len = lex_put(expand, out, len, s[i], 1);
+            i++;
+        } else if (s[i] == '"') {          // Copy double-quoted run, resolving escapes; $ stays live
+            p->quoted = 1;
+            for (i++; s[i] != '"'; i++) {
+                if (s[i] == '\\' && (s[i + 1] == '"' || s[i + 1] == '\\' || s[i + 1] == '$' || s[i + 1] == '`')) {
+                    len = lex_put(expand, out, len, s[++i], 1);
+                } else {
+                    len = lex_put(expand, out, len, s[i], s[i] != '$' || s[i + 1] == '"'); // "a$" keeps its $
+                }
+            }
+            i++;
+        } else if (s[i] == '\\' && s[i + 1]) { // Escaped character
+            p->quoted = 1;
+            len = lex_put(expand, out, len, s[i + 1], 1);
+            i += 2;
+        } else {
+            len = lex_put(expand, out, len, s[i], 0);
+            i++;
+        }
+    }
+    out[len] = '\0';
+    p->pos = end;
+    p->text = out;
+    p->type = TOK_WORD;
+    
+    // The file operators and reverse pipe are only operators as standalone, unquoted words
+    if (!p->quoted && !p->expand && len == 1 && (out[0] == '=' || out[0] == '+' || out[0] == '~')) {
+        p->type = out[0] == '=' ? TOK_REVPIPE : out[0] == '+' ? TOK_PLUS : TOK_TILDE;
+    }
+    if (!p->quoted && len == 1 && p->braces > 0 && (out[0] == ',' || out[0] == '}')) { // Fan-out separators
+        p->type = out[0] == ',' ? TOK_COMMA : TOK_RBRACE;
+    }
+}
+
+// Reports a syntax error at the current token; always returns NULL for the caller to propagate
+static Node *parse_error(Parser *p) {
+    if (p->type == TOK_ERROR) printf("Error: Syntax error: %s\n", p->text);
+    else printf("Error: Syntax error near '%s'\n", p->text);
+    p->type = TOK_ERROR;                   // Unwind every enclosing rule
+    return NULL;
+}
+
+// Appends a word to an arena-backed argument vector, doubling it when full
+static void push_arg(Parser *p, Command *cmd, int *cap, char *word) {
+    if (cmd->argc + 1 >= *cap) {           // Keep room for the NULL terminator
+        int grown = *cap ? *cap * 2 : 8;
+        char **args = arena_alloc(p->arena, grown * sizeof(char *));
+        if (cmd->argc) memcpy(args, cmd->args, cmd->argc * sizeof(char *)); // Old array stays in the arena
+        cmd->args = args;
+        *cap = grown;
+    }
+    cmd->args[cmd->argc++] = word;
+    cmd->args[cmd->argc] = NULL;
+    if (p->expand) cmd->expand = 1;
+}
+
+// Consumes redirections and words into cmd until an operator is reached
+static int parse_words(Parser *p, Command *cmd, int *cap) {
+    while (1) {
+        if (p->type == TOK_WORD) {         // Plain argument
+            push_arg(p, cmd, cap, p->text);
+            next_token(p);
+        } else if (p->type == TOK_LESS || p->type == TOK_GREAT || p->type == TOK_DGREAT) {
+            TokenType op = p->type;        // Which redirection
+            next_token(p);
+            if (p->type != TOK_WORD) return -1; // Redirection needs a file name
+            if (p->expand) cmd->expand = 1;
+            if (op == TOK_LESS) cmd->input_file = p->text;
+            else {                         // Last output redirection wins
+                cmd->output_file = p->text;
+                cmd->append_output = op == TOK_DGREAT;
+            }
+            next_token(p);
+        } else {
+            return 0;                      // Operator or end of line
+        }
+    }
+}
+
+// command := '#' file | word ('+' word)+ | word '~' word | (word | redirection)+
+static Node *parse_command(Parser *p) {
+    Node *node = arena_alloc(p->arena, sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->type = NODE_COMMAND;
+    node->num_commands = 1;
+    Command *cmd = node->commands = arena_alloc(p->arena, sizeof(Command));
+    memset(cmd, 0, sizeof(Command));
+    int cap = 0;                           // Capacity of cmd->args
+    if (p->type == TOK_WORD && !p->quoted && strcmp(p->text, "memo") == 0) { // Cache this command's output
+        cmd->memo = 1;
+        next_token(p);
+    }
+    
+    // Word count operator: #file or # file
+    if (p->type == TOK_WORD && !p->quoted && p->text[0] == '#') {
+        cmd->file_op = '#';
+        if (p->text[1]) push_arg(p, cmd, &cap, p->text + 1); // File glued to the #
+        next_token(p);
+        if (parse_words(p, cmd, &cap) < 0) return parse_error(p);
+        if (cmd->argc != 1) {              // Exactly one file to count
+            printf("Error: # requires exactly one file name\n");
+            p->type = TOK_ERROR;
+            return NULL;
+        }
+        return node;
+    }
+    
+    if (parse_words(p, cmd, &cap) < 0) return parse_error(p);
+    if (p->type == TOK_PLUS || p->type == TOK_TILDE) { // File operators take plain names
+        char op = p->type == TOK_PLUS ? '+' : '~';
+        if (cmd->argc != 1 || cmd->input_file) return parse_error(p);
+        cmd->file_op = op;
+        while (p->type == (op == '+' ? TOK_PLUS : TOK_TILDE)) {
+            next_token(p);
+            if (p->type != TOK_WORD) return parse_error(p);
+            push_arg(p, cmd, &cap, p->text);
+            next_token(p);
+        }
+        if (parse_words(p, cmd, &cap) < 0) return parse_error(p); // Trailing > or >>
+        if (op == '~' && cmd->argc != 2) { // Exactly two files to swap
+            printf("Error: Two text files required for ~ operation\n");
+            p->type = TOK_ERROR;
+            return NULL;
+        }
+        return node;
+    }
+    if (cmd->argc == 0) return parse_error(p); // Operator where a command was expected
+    return node;
+}
+
+// Points node->text at the source from begin up to the current token, minus trailing blanks
+static void set_node_text(Parser *p, Node *node, size_t begin) {
+    size_t end = p->start;                 // Current token is not part of the node
+    while (end > begin && (p->src[end - 1] == ' ' || p->src[end - 1] == '\t')) end--;
+    node->text = p->src + begin;
+    node->text_len = (int)(end - begin);
+}
+
+// Allocates a binary node joining two subtrees
+static Node *make_binary(Parser *p, NodeType type, Node *left, Node *right) {
+    Node *node = arena_alloc(p->arena, sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+// chain := command ('|' command)* | command ('=' command)*
+static Node *parse_chain(Parser *p) {
+    size_t begin = p->start;               // Where this chain's text starts
+    Node *first = parse_command(p);
+    if (!first) return NULL;
+    if (p->type != TOK_PIPE && p->type != TOK_REVPIPE) { // Single command
+        set_node_text(p, first, begin);
+        return first;
+    }
+    
+    TokenType joiner = p->type;            // | and = cannot be mixed in one pipeline
+    int cap = 4, count = 1;                // Stage array grows by doubling
+    Command *stages = arena_alloc(p->arena, cap * sizeof(Command));
+    stages[0] = first->commands[0];
+    while (p->type == TOK_PIPE || p->type == TOK_REVPIPE) {
+        if (p->type != joiner) {
+            printf("Error: Cannot mix | and = in one pipeline\n");
+            p->type = TOK_ERROR;
+            return NULL;
+        }
+        next_token(p);
+        Node *stage = parse_command(p);
+        if (!stage) return NULL;
+        if (count == cap) {                // Grow into fresh arena space
+            Command *grown = arena_alloc(p->arena, cap * 2 * sizeof(Command));
+            memcpy(grown, stages, count * sizeof(Command));
+            stages = grown;
+            cap *= 2;
+        }
+        stages[count++] = stage->commands[0];
+    }
+    for (int i = 0; i < count; i++) {
+        if (!stages[i].memo) continue;
+        printf("Error: memo applies to a single command, not a pipeline stage\n");
+        p->type = TOK_ERROR;
+        return NULL;
+    }
+    first->type = NODE_PIPELINE;           // Reuse the first node for the whole pipeline
+    first->commands = stages;
+    first->num_commands = count;
+    first->reverse = joiner == TOK_REVPIPE;
+    set_node_text(p, first, begin);
+    return first;
+}
+
+// Parses the options after a limit keyword: --mem SIZE, --cpu N and --timeout DURATION,
+// at least one of them. Returns NULL after reporting a malformed option.
+static Limits *parse_limits(Parser *p) {
+    Limits *limits = arena_alloc(p->arena, sizeof(Limits));
+    memset(limits, 0, sizeof(Limits));
+    next_token(p);
+    int given = 0;                         // Options seen
+    while (p->type == TOK_WORD && !p->quoted && strncmp(p->text, "--", 2) == 0) {
+        const char *name = p->text;
+        next_token(p);
+        if (p->type != TOK_WORD || limit_option(limits, name, p->text) < 0) {
+            printf("Error: limit: bad option %s %s (want --mem SIZE, --cpu N or --timeout DURATION)\n", name,
+                   p->type == TOK_WORD ? p->text : "");
+            p->type = TOK_ERROR;
+            return NULL;
+        }
+        given++;
+        next_token(p);
+    }
+    if (!given) {
+        printf("Error: limit needs --mem, --cpu or --timeout\n");
+        p->type = TOK_ERROR;
+        return NULL;
+    }
+    return limits;
+}
+
+// pipeline := ['time'] ['limit' option...] chain ['|&' '{' chain (',' chain)* '}']
+static Node *parse_pipeline(Parser *p) {
+    int timed = 0;                         // Leading time keyword, as in bash
+    if (p->type == TOK_WORD && !p->quoted && strcmp(p->text, "time") == 0) {
+        timed = 1;
+        next_token(p);
+    }
+    Limits *limits = NULL;                 // limit prefix: the whole pipeline runs under it
+    if (p->type == TOK_WORD && !p->quoted && strcmp(p->text, "limit") == 0) {
+        limits = parse_limits(p);
+        if (!limits) return NULL;
+    }
+    size_t begin = p->start;               // Where this pipeline's text starts
+    Node *node = parse_chain(p);
+    if (!node) return NULL;
+    if (p->type == TOK_FANOUT) {           // Producer feeds a braced list of consumers
+        next_token(p);
+        if (p->type != TOK_WORD || p->quoted || strcmp(p->text, "{") != 0) return parse_error(p);
+        Node *fan = make_binary(p, NODE_FANOUT, node, NULL);
+        int cap = 4;                       // Branch array grows by doubling
+        fan->branches = arena_alloc(p->arena, cap * sizeof(Node *));
+        p->braces++;
+        next_token(p);
+        while (1) {
+            Node *branch = parse_chain(p);
+            if (!branch) return NULL;
+            if (fan->num_branches == cap) {
+                Node **grown = arena_alloc(p->arena, cap * 2 * sizeof(Node *));
+                memcpy(grown, fan->branches, cap * sizeof(Node *));
+                fan->branches = grown;
+                cap *= 2;
+            }
+            fan->branches[fan->num_branches++] = branch;
+            if (p->type != TOK_COMMA) break;
+            next_token(p);
+        }
+        if (p->type != TOK_RBRACE) return parse_error(p);
+        p->braces--;                       // Before reading on: , and } are words again
+        next_token(p);
+        set_node_text(p, fan, begin);
+        node = fan;
+    }
+    node->timed = timed;
+    node->limits = limits;
+    if (limits && node->type == NODE_COMMAND && node->commands[0].memo) {
+        printf("Error: memo cannot be combined with limit\n");
+        p->type = TOK_ERROR;
+        return NULL;
+    }
+    return node;
+}
+
+// and_or := pipeline (('&&' | '||') pipeline)*, left-associative like sh
+static Node *parse_and_or(Parser *p) {
+    Node *left = parse_pipeline(p);
+    while (left && (p->type == TOK_AND || p->type == TOK_OR)) {
+        NodeType type = p->type == TOK_AND ? NODE_AND : NODE_OR;
+        next_token(p);
+        Node *right = parse_pipeline(p);
+        if (!right) return NULL;
+        left = make_binary(p, type, left, right);
+    }
+    return left;
+}
+
+// sequence := and_or ((';' | '&') and_or)* [';' | '&'], where & backgrounds the list before it
+static Node *parse_sequence(Parser *p) {
+    Node *left = NULL;                     // Sequence built so far
+    while (1) {
+        size_t begin = p->start;           // Text of a backgrounded list starts here
+        Node *item = parse_and_or(p);
+        if (!item) return NULL;
+        if (p->type == TOK_AMP) {          // Run this list as a background job
+            item = make_binary(p, NODE_BACKGROUND, item, NULL);
+            set_node_text(p, item, begin);
+        }
+        left = left ? make_binary(p, NODE_SEQUENCE, left, item) : item;
+        if (p->type != TOK_SEMI && p->type != TOK_AMP) return left;
+        next_token(p);
+        if (p->type == TOK_END) return left; // Trailing ; or & is allowed
+    }
+}
+
+// Parses one input line into a syntax tree in the arena; NULL for blank lines or errors
+Node *parse_line(const char *line, Arena *arena) {
+    Parser p = {0};                        // Fresh state for this line
+    p.src = line;
+    p.arena = arena;
+    next_token(&p);
+    if (p.type == TOK_END) return NULL;    // Blank line
+    if (p.type == TOK_ERROR) return parse_error(&p);
+    Node *tree = parse_sequence(&p);
+    if (!tree) return NULL;                // Error already reported
+    if (p.type != TOK_END) return parse_error(&p); // Leftover tokens
+    return tree;
+}
+
+// Runs a command or pipeline node
+static int run_pipeline(Node *node) {
+    if (node->type == NODE_COMMAND) return execute_single_command(node);
+    if (node->type == NODE_FANOUT) return run_job(node, 0);
+    return node->reverse ? handle_reverse_pipes(node) : handle_pipes(node);
+}
+
+// Walks a syntax tree and returns the exit status of what ran last
+int execute_node(Node *node) {
+    int status;                            // Status of a command or pipeline
+    switch (node->type) {
+    case NODE_COMMAND:
+    case NODE_PIPELINE:
+    case NODE_FANOUT:   status = node->timed ? run_timed(node) : run_pipeline(node); break;
+    case NODE_AND:
+    case NODE_OR:       return execute_conditional(node);
+    case NODE_SEQUENCE: return execute_sequential_commands(node);
+    case NODE_BACKGROUND: return run_background(node);
+    default:            return 1;          // Unknown node type
+    }
+    if (status != 0 && opt_errexit && !errexit_suppressed) { // set -e: a failure ends the shell
+        fflush(stdout);
+        exit(status);
+    }
+    return status;
+}
+
+// Executes a single command with possible I/O redirection; returns its exit status
+int execute_single_command(Node *node) {
+    Command *cmd = &node->commands[0];     // The only stage
+    if (cmd->expand && expand_command(cmd) < 0) return 1;
+    if (cmd->argc == 0) return 1;          // Exit if no valid command to execute
+    if (node->limits) return run_job(node, 0); // Even a builtin runs in a child the limits can hold
+    const Builtin *builtin = find_builtin(cmd); // Builtins and file operators never fork
+    if (cmd->memo && !builtin && cmd->file_op != '~') return memo_run(node); // ~ edits its files: never cached
+    if (builtin || cmd->file_op) return run_in_shell(cmd, builtin);
+    
+    return run_job(node, 0);               // One-stage job, so Ctrl-Z and fg work on it too
+}
+
+// Runs #, + or ~ in the current process; returns 0 on success
+int run_file_operator(Command *cmd) {
+    if (cmd->file_op == '#') return count_words(cmd->args[0]);
+    if (cmd->file_op == '+') return concatenate_files(cmd->args, cmd->argc);
+    return handle_file_append(cmd->args[0], cmd->args[1]);
+}
+
+// Points stdin/stdout at the command's redirection targets. When saved is non-NULL the
+// original descriptors are parked there (close-on-exec, above the low fds) for restoring.
+static int apply_redirections(Command *cmd, int saved[2]) {
+    if (cmd->input_file) {                 // Handle input redirection if specified
+        int fd = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            printf("Error: Cannot open input file %s\n", cmd->input_file);
+            return -1;
+        }
+        if (saved) saved[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (cmd->output_file) {                // Handle output redirection if specified
+        int fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append_output ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0) {
+            printf("Error: Cannot open output file %s\n", cmd->output_file);
+            return -1;
+        }
+        fflush(stdout);                    // Pending output belongs to the old stdout
+        if (saved) saved[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    return 0;
+}
+
+// Puts back descriptors parked by apply_redirections
+static void restore_redirections(int saved[2]) {
+    fflush(stdout);                        // Flush into the redirected file first
+    for (int i = 0; i < 2; i++) {
+        if (saved[i] < 0) continue;        // This stream was not redirected
+        dup2(saved[i], i);                 // fd 0 or 1 gets its original target back
+        close(saved[i]);
+    }
+}
+
+// Runs a builtin (or file operator when builtin is NULL) inside the shell process,
+// with redirections applied around it and undone afterwards
+int run_in_shell(Command *cmd, const Builtin *builtin) {
+    int saved[2] = {-1, -1};               // Original stdin/stdout while redirected
+    int status = 1;                        // Redirection failures report status 1
+    if (apply_redirections(cmd, saved) == 0) {
+        status = builtin ? builtin->run(cmd) : run_file_operator(cmd);
+    }
+    restore_redirections(saved);
+    return status;
+}
+
+// Runs a builtin or file operator in a forked child so it can sit in a pipeline
+static pid_t spawn_in_subshell(Command *cmd, const Builtin *builtin, int in_fd, int out_fd, pid_t pgid) {
+    fflush(stdout);                        // Child must not replay buffered output
+    pid_t pid = fork();                    // Needs the shell's code, so no exec-based spawn
+    if (pid != 0) return pid;              // Parent (or fork failure)
+    
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    if (limiter.starting && limit_enter(limiter.starting) < 0) _exit(1); // Needs cgroup.procs, still open
+    job_child_reset();                     // Also drops the other stages' pipe ends
+    if (pgid >= 0) setpgid(0, pgid);       // Same process group as the rest of the job
+    if (apply_redirections(cmd, NULL) < 0) {
+        fflush(stdout);
+        _exit(1);
+    }
+    int status = builtin ? builtin->run(cmd) : run_file_operator(cmd);
+    fflush(stdout);                        // Flush before _exit skips stdio teardown
+    _exit(status);                         // exit in a pipeline ends only this stage
+}
+
+// Fills a SpawnRequest from a parsed command and launches it
+// pgid follows SpawnRequest: 0 starts a new group, -1 stays in the caller's.
+pid_t spawn_command(Command *cmd, int in_fd, int out_fd, pid_t pgid) {
+    const Builtin *builtin = find_builtin(cmd); // Shell-internal stages need the shell's code
+    if (builtin || cmd->file_op) return spawn_in_subshell(cmd, builtin, in_fd, out_fd, pgid);
+    SpawnRequest req = {0};                // Wiring for this child
+    req.argv = cmd->args;                  // Argument vector for exec
+    req.in_fd = in_fd;                     // Pipe end for stdin, if any
+    req.out_fd = out_fd;                   // Pipe end for stdout, if any
+    req.err_fd = -1;                       // stderr is always inherited
+    req.input_file = cmd->input_file;      // < redirection overrides the pipe
+    req.output_file = cmd->output_file;    // > or >> redirection overrides the pipe
+    req.append_output = cmd->append_output;
+    req.pgid = pgid;                       // Every stage of a job shares one process group
+    return spawn_process(&req);
+}
+
+// Prints the error for a failed spawn step, matching the shell's usual messages
+static void spawn_report_failure(SpawnRequest *req, int stage) {
+    if (stage == SPAWN_FAIL_INPUT) printf("Error: Cannot open input file %s\n", req->input_file);
+    else if (stage == SPAWN_FAIL_OUTPUT) printf("Error: Cannot open output file %s\n", req->output_file);
+    else if (stage == SPAWN_FAIL_EXEC && req->fail_errno == ENOENT) printf("Error: Command '%s' not found\n", req->argv[0]);
+    else if (stage == SPAWN_FAIL_EXEC) printf("Error: Cannot execute '%s': %s\n", req->argv[0], strerror(req->fail_errno));
+    else printf("Error: Cannot start '%s'\n", req->argv[0]);
+    fflush(stdout);                        // A forked child exits without flushing stdio
+}
+
+// Argument vector that runs path as a script with /bin/sh, for an executable without a
+// #! line: sh, path, then argv's arguments. NULL if out of memory; free() when done.
+static char **spawn_sh_argv(const char *path, char **argv) {
+    int argc = 0;                          // Entries in argv, including argv[0]
+    while (argv[argc]) argc++;
+    char **sh_argv = malloc((argc + 2) * sizeof(char *));
+    if (!sh_argv) return NULL;
+    sh_argv[0] = "sh";
+    sh_argv[1] = (char *)path;
+    memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *)); // Arguments and the NULL
+    return sh_argv;
+}
+
+// Runs in the child: installs descriptors, joins the process group and execs.
+// Shares memory with the parent under CLONE_VM, so it only makes raw system calls
+// and reports failures through req instead of touching stdio.
+static int spawn_child_setup(void *arg) {
+    SpawnRequest *req = arg;               // Request lives in the parent's frame
+    int stage = SPAWN_FAIL_SETUP;          // Step in progress, for error reporting
+    struct sigaction dfl = {0};            // Default disposition
+    dfl.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; sig++) { // Parent handlers must not run in this child
+        struct sigaction old;              // Job-control signals the interactive shell ignores reset too
+        if (sigaction(sig, NULL, &old) == 0 && old.sa_handler != SIG_DFL &&
+            (old.sa_handler != SIG_IGN || (jobs.interactive && is_job_signal(sig))))
+            sigaction(sig, &dfl, NULL);
+    }
+    sigset_t none;                         // Parent blocked everything around clone
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    
+    if (req->pgid >= 0 && setpgid(0, req->pgid) < 0) goto fail;
+    if (limiter.starting && limit_enter(limiter.starting) < 0) goto fail; // Before exec: nothing runs unlimited
+    if (req->in_fd >= 0 && dup2(req->in_fd, STDIN_FILENO) < 0) goto fail;
+    if (req->out_fd >= 0 && dup2(req->out_fd, STDOUT_FILENO) < 0) goto fail;
+    if (req->err_fd >= 0 && dup2(req->err_fd, STDERR_FILENO) < 0) goto fail;
+    if (req->input_file) {                 // Handle input redirection if specified
+        stage = SPAWN_FAIL_INPUT;
+        int fd = open(req->input_file, O_RDONLY);
+        if (fd < 0 || dup2(fd, STDIN_FILENO) < 0) goto fail;
+        close(fd);
+    }
+    if (req->output_file) {                // Handle output redirection if specified
+        stage = SPAWN_FAIL_OUTPUT;
+        int fd = open(req->output_file, O_WRONLY | O_CREAT | (req->append_output ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) goto fail;
+        close(fd);
+    }
+    stage = SPAWN_FAIL_EXEC;
+    execv(req->exec_path, req->argv);      // Path already resolved: no PATH walk here
+    if (errno == ENOEXEC && req->report_in_child) { // Forked, so it may allocate: fall back as execvp does
+        char **sh_argv = spawn_sh_argv(req->exec_path, req->argv);
+        if (sh_argv) execv(SPAWN_SH, sh_argv);
+    }
+fail:
+    req->fail_errno = errno;               // Visible to the parent through shared memory
+    req->fail_stage = stage;
+    if (req->fail_pipe > 0) {              // Zygote's child: the zygote reads this before replying
+        int report[2] = {stage, req->fail_errno};
+        if (write(req->fail_pipe, report, sizeof(report)) < 0) {}
+    }
+    if (req->report_in_child) spawn_report_failure(req, stage); // Forked: parent cannot see req
+    _exit(req->report_in_child ? 1 : 127);
+}
+
+// posix_spawn backend: file actions carry the same wiring as spawn_child_setup
+static pid_t spawn_posix(SpawnRequest *req) {
+    posix_spawn_file_actions_t actions;    // dup2/open steps run in the child
+    posix_spawnattr_t attr;                // Process group and signal state
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    
+    if (req->in_fd >= 0) posix_spawn_file_actions_adddup2(&actions, req->in_fd, STDIN_FILENO);
+    if (req->out_fd >= 0) posix_spawn_file_actions_adddup2(&actions, req->out_fd, STDOUT_FILENO);
+    if (req->err_fd >= 0) posix_spawn_file_actions_adddup2(&actions, req->err_fd, STDERR_FILENO);
+    if (req->input_file) posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, req->input_file, O_RDONLY, 0);
+    if (req->output_file) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, req->output_file,
+                                         O_WRONLY | O_CREAT | (req->append_output ? O_APPEND : O_TRUNC), 0666);
+    }
+    
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF; // Clean signal state for the child
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);                 // Every signal back to its default action
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (req->pgid >= 0) {                  // Join (or lead) the requested process group
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    
+    pid_t pid;                             // Child PID on success
+    int err = posix_spawn(&pid, req->exec_path, &actions, &attr, req->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err == 0) return pid;
+    
+    // posix_spawn reports one errno for all steps; probe the redirections to name the culprit
+    int stage = SPAWN_FAIL_EXEC;
+    if (req->input_file && access(req->input_file, R_OK) < 0) stage = SPAWN_FAIL_INPUT;
+    else if (req->output_file) {
+        int fd = open(req->output_file, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0) stage = SPAWN_FAIL_OUTPUT;
+        else close(fd);
+    }
+    req->fail_stage = stage;
+    req->fail_errno = err;
+    return -1;
+}
+
+// clone(CLONE_VM|CLONE_VFORK) backend: no page-table copy, parent resumes after exec
+static pid_t spawn_vfork(SpawnRequest *req) {
+    static char *stack;                    // Child stack, reused: the parent is suspended meanwhile
+    if (!stack) {
+        stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) { stack = NULL; return -1; }
+    }
+    sigset_t all, old;                     // No parent handler may run on the shared stack
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old);
+    req->fail_stage = SPAWN_OK;
+    pid_t pid = clone(spawn_child_setup, stack + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, req);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0) {
+        req->fail_stage = SPAWN_FAIL_SETUP;
+        req->fail_errno = errno;
+        return -1;
+    }
+    if (req->fail_stage != SPAWN_OK) {     // Child died before exec: reap it and report
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+// Resolves VORTEX_SPAWN=posix|vfork|fork|zygote on first use
+int spawn_select_backend(void) {
+    if (spawn_backend < 0) {
+        const char *name = getenv("VORTEX_SPAWN");
+        spawn_backend = SPAWN_POSIX;
+        if (name && strcmp(name, "vfork") == 0) spawn_backend = SPAWN_VFORK;
+        else if (name && strcmp(name, "fork") == 0) spawn_backend = SPAWN_FORK;
+        else if (name && strcmp(name, "zygote") == 0) spawn_backend = SPAWN_ZYGOTE;
+    }
+    return spawn_backend;
+}
+
+// Sends all len bytes over a socket, or fails; a closed peer is an error, not SIGPIPE
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Receives exactly len bytes, or fails (including at end of stream)
+static int read_all(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// clone3 arguments (struct clone_args), spelled out for headers that lack it
+struct zygote_clone_args {
+    uint64_t flags, pidfd, child_tid, parent_tid, exit_signal, stack, stack_size, tls;
+};
+
+// Starts one command for the shell. CLONE_PARENT makes it the shell's child, so the
+// shell reaps it, opens its pidfd and puts it in a process group like any other. The
+// zygote waits on a close-on-exec pipe until the exec succeeds or the child reports why not.
+static void zygote_launch(int sock, SpawnRequest *req, char **envp, int cwd_fd) {
+    ZygoteReply reply = { -1, SPAWN_FAIL_SETUP, 0 };
+    int report[2];                         // Child -> zygote failure pipe
+    if (pipe2(report, O_CLOEXEC) < 0) {
+        reply.fail_errno = errno;
+        send_all(sock, &reply, sizeof(reply));
+        return;
+    }
+    struct zygote_clone_args args = {0};
+    args.flags = CLONE_PARENT;             // exit_signal stays 0: the zygote's own (SIGCHLD) applies
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid < 0 && errno == ENOSYS) pid = syscall(SYS_clone, CLONE_PARENT, 0, 0, 0, 0); // Before 5.3
+    if (pid == 0) {
+        close(report[0]);
+        if (fchdir(cwd_fd) < 0) {}         // Relative paths resolve where the shell is
+        environ = envp;
+        req->fail_pipe = report[1];
+        spawn_child_setup(req);            // Never returns
+    }
+    close(report[1]);
+    if (pid < 0) {
+        reply.fail_errno = errno;
+    } else {
+        int failure[2];                    // stage, errno; EOF means exec succeeded
+        reply.pid = pid;
+        reply.fail_stage = SPAWN_OK;
+        if (read_all(report[0], failure, sizeof(failure)) == 0) {
+            reply.fail_stage = failure[0];
+            reply.fail_errno = failure[1];
+        }
+    }
+    close(report[0]);
+    send_all(sock, &reply, sizeof(reply));
+}
+
+// Zygote main loop: one request at a time until the shell closes its end
+static void zygote_serve(int sock) {
+    char *payload = NULL;                  // Strings of the current request
+    size_t cap = 0;
+    char *env = NULL;                      // Environment block last received
+    char **envp = environ;                 // Until the shell sends one, the inherited environment
+    char **argv = NULL;                    // Rebuilt per request
+    size_t argv_cap = 0;
+    while (1) {
+        ZygoteRequest hdr;
+        int fds[ZYGOTE_NUM_FDS];           // stdin, stdout, stderr, cwd
+        char control[CMSG_SPACE(sizeof(fds))];
+        struct iovec iov = { &hdr, sizeof(hdr) };
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+        if (n == 0 || (n < 0 && errno != EINTR)) _exit(0); // Shell gone
+        if (n != sizeof(hdr)) continue;
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if (!cm || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(fds))) _exit(1);
+        memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+        if (hdr.payload_len + 1 > cap) {
+            cap = hdr.payload_len + 1;
+            payload = realloc(payload, cap);
+        }
+        if (argv_cap < hdr.argc + 1) {
+            argv_cap = hdr.argc + 1;
+            argv = realloc(argv, argv_cap * sizeof(char *));
+        }
+        if (!payload || !argv || read_all(sock, payload, hdr.payload_len) < 0) _exit(1);
+        
+        SpawnRequest req = {0};            // Rebuilt from the message
+        char *p = payload;
+        req.exec_path = p;
+        p += strlen(p) + 1;
+        for (uint32_t i = 0; i < hdr.argc; i++, p += strlen(p) + 1) argv[i] = p;
+        argv[hdr.argc] = NULL;
+        req.argv = argv;
+        if (hdr.has_input) { req.input_file = p; p += strlen(p) + 1; }
+        if (hdr.has_output) { req.output_file = p; p += strlen(p) + 1; }
+        if (hdr.env_len != ZYGOTE_ENV_SAME) { // New environment: keep a copy and index it
+            free(env);
+            env = malloc(hdr.env_len + 1);
+            memcpy(env, p, hdr.env_len);
+            size_t count = 0;
+            for (size_t i = 0; i < hdr.env_len; i++) count += env[i] == '\0';
+            if (envp != environ) free(envp);
+            envp = malloc((count + 1) * sizeof(char *));
+            char *e = env;
+            for (size_t i = 0; i < count; i++, e += strlen(e) + 1) envp[i] = e;
+            envp[count] = NULL;
+        }
+        req.in_fd = fds[0];
+        req.out_fd = fds[1];
+        req.err_fd = fds[2];
+        req.append_output = hdr.append_output;
+        req.pgid = hdr.pgid;
+        zygote_launch(sock, &req, envp, fds[3]);
+        for (int i = 0; i < ZYGOTE_NUM_FDS; i++) close(fds[i]);
+    }
+}
+
+// Forks the zygote. Called early in main, so it is a copy of a shell that has not yet
+// grown, and every later fork it makes stays cheap however large the shell becomes.
+int zygote_start(int interactive) {
+    int sv[2];                             // [0] shell, [1] zygote
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        jobs.interactive = interactive;    // Children reset the same signals as the shell's would
+        if (interactive) {                 // Ctrl-C at the prompt is for the shell, not for us
+            for (int sig = 1; sig < NSIG; sig++) {
+                if (is_job_signal(sig)) signal(sig, SIG_IGN);
+            }
+        }
+        zygote_serve(sv[1]);               // Never returns
+    }
+    close(sv[1]);
+    zygote.fd = sv[0];
+    zygote.pid = pid;
+    return 0;
+}
+
+// Stops using the zygote after it died or the stream broke
+static void zygote_stop(void) {
+    close(zygote.fd);
+    zygote.fd = -1;
+    spawn_backend = SPAWN_POSIX;
+}
+
+// Appends len bytes to the request payload
+static void zygote_put(size_t *len, const void *data, size_t size) {
+    if (*len + size > zygote.cap) {
+        size_t cap = zygote.cap ? zygote.cap : 4096;
+        while (cap < *len + size) cap *= 2;
+        char *grown = realloc(zygote.buf, cap);
+        if (!grown) {
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+        zygote.buf = grown;
+        zygote.cap = cap;
+    }
+    memcpy(zygote.buf + *len, data, size);
+    *len += size;
+}
+
+// Zygote backend: sends the request with its descriptors and waits for the PID. The
+// environment travels only when it differs from the last one sent. Falls back to
+// posix_spawn if the zygote is gone.
+static pid_t spawn_zygote(SpawnRequest *req) {
+    ZygoteRequest hdr = {0};
+    size_t len = 0;                        // Payload bytes
+    zygote_put(&len, req->exec_path, strlen(req->exec_path) + 1);
+    for (char **a = req->argv; *a; a++, hdr.argc++) zygote_put(&len, *a, strlen(*a) + 1);
+    if ((hdr.has_input = req->input_file != NULL)) zygote_put(&len, req->input_file, strlen(req->input_file) + 1);
+    if ((hdr.has_output = req->output_file != NULL)) zygote_put(&len, req->output_file, strlen(req->output_file) + 1);
+    size_t env_start = len;                // Serialize the environment, then see if it changed
+    for (char **e = environ; e && *e; e++) zygote_put(&len, *e, strlen(*e) + 1);
+    size_t env_len = len - env_start;
+    if (zygote.env && env_len == zygote.env_len && memcmp(zygote.env, zygote.buf + env_start, env_len) == 0) {
+        hdr.env_len = ZYGOTE_ENV_SAME;
+        len = env_start;                   // Unchanged: drop it from the message
+    } else {
+        free(zygote.env);
+        zygote.env = malloc(env_len ? env_len : 1);
+        memcpy(zygote.env, zygote.buf + env_start, env_len);
+        zygote.env_len = env_len;
+        hdr.env_len = env_len;
+    }
+    hdr.payload_len = len;
+    hdr.pgid = req->pgid;
+    hdr.append_output = req->append_output;
+    
+    int fds[ZYGOTE_NUM_FDS] = {
+        req->in_fd >= 0 ? req->in_fd : STDIN_FILENO,
+        req->out_fd >= 0 ? req->out_fd : STDOUT_FILENO,
+        req->err_fd >= 0 ? req->err_fd : STDERR_FILENO,
+        open(".", O_PATH | O_DIRECTORY | O_CLOEXEC), // The shell's cwd, wherever cd left it
+    };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &hdr, sizeof(hdr) };
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    
+    ZygoteReply reply;
+    ssize_t sent;
+    do {
+        sent = fds[3] < 0 ? -1 : sendmsg(zygote.fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    int ok = sent == (ssize_t)sizeof(hdr) && send_all(zygote.fd, zygote.buf, len) == 0 &&
+             read_all(zygote.fd, &reply, sizeof(reply)) == 0;
+    if (fds[3] >= 0) close(fds[3]);
+    if (!ok) {                             // Zygote died or the stream is out of step
+        free(zygote.env);
+        zygote.env = NULL;
+        zygote_stop();
+        return spawn_posix(req);
+    }
+    if (reply.fail_stage != SPAWN_OK) {
+        if (reply.pid > 0) waitpid(reply.pid, NULL, 0); // Our child, dead before exec
+        req->fail_stage = reply.fail_stage;
+        req->fail_errno = reply.fail_errno;
+        return -1;
+    }
+    return reply.pid;
+}
+
+// Launches a child through the configured backend (VORTEX_SPAWN=posix|vfork|fork|zygote).
+// Returns the PID, or -1 after printing why the child could not be started.
+// Starts req->exec_path through the selected backend; on failure req says which step failed
+static pid_t spawn_launch(SpawnRequest *req) {
+    pid_t pid = -1;                        // Child PID
+    req->fail_stage = SPAWN_OK;
+    if (spawn_backend == SPAWN_FORK) {     // Legacy path: copies the whole address space
+        req->report_in_child = 1;          // Our copy of req is invisible to the parent
+        pid = fork();
+        if (pid == 0) {
+            spawn_child_setup(req);        // Never returns
+        }
+        if (pid < 0) req->fail_stage = SPAWN_FAIL_SETUP;
+    } else if (spawn_backend == SPAWN_VFORK || limiter.starting) { // Limits are entered by spawn_child_setup
+        pid = spawn_vfork(req);
+    } else if (spawn_backend == SPAWN_ZYGOTE && zygote.fd >= 0) {
+        pid = spawn_zygote(req);
+    } else {
+        pid = spawn_posix(req);
+        if (pid < 0 && req->fail_errno == ENOSYS) pid = spawn_vfork(req); // No usable posix_spawn
+    }
+    return pid;
+}
+
+pid_t spawn_process(SpawnRequest *req) {
+    spawn_select_backend();
+    fflush(stdout);                        // Children must not inherit unflushed output
+    
+    pid_t pid = -1;                        // Child PID
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int cached = 0;                    // Whether the location came from the hash cache
+        req->exec_path = resolve_command(req->argv[0], &cached);
+        req->fail_stage = SPAWN_OK;
+        if (!req->exec_path) {             // Known miss: no process is created at all
+            req->fail_stage = SPAWN_FAIL_EXEC;
+            req->fail_errno = ENOENT;
+            break;
+        }
+        pid = spawn_launch(req);
+        // A cached binary that vanished means PATH contents changed faster than the mtime check
+        if (pid >= 0 || !cached || req->fail_stage != SPAWN_FAIL_EXEC || req->fail_errno != ENOENT) break;
+        path_cache_flush();                // Retry once against a fresh PATH walk
+    }
+    if (pid < 0 && req->fail_stage == SPAWN_FAIL_EXEC && req->fail_errno == ENOEXEC) {
+        // Executable without a #! line: run it as a shell script, as execvp does
+        char **argv = req->argv;           // Restored for the caller and error messages
+        const char *path = req->exec_path;
+        char **sh_argv = spawn_sh_argv(path, argv);
+        if (sh_argv) {
+            req->argv = sh_argv;
+            req->exec_path = SPAWN_SH;
+            pid = spawn_launch(req);
+            req->argv = argv;
+            req->exec_path = path;
+            free(sh_argv);
+        }
+    }
+    if (pid < 0) spawn_report_failure(req, req->fail_stage);
+    return pid;
+}
+
+// Waits for one child; exit code, or 128 + signal number if it was killed
+int wait_for_child(pid_t pid) {
+    int status;                            // Raw wait status
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;      // Lost child: treat as failure
+    }
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+}
+
+// Signals an interactive shell ignores so that only the foreground job receives them
+int is_job_signal(int sig) {
+    return sig == SIGINT || sig == SIGQUIT || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU;
+}
+
+// Sets up the event loop: SIGCHLD is blocked and read from a signalfd, and every child's
+// pidfd is added to the same epoll set as it starts. Without these the shell falls back
+// to blocking waits, as subshells do.
+void jobs_init(int interactive) {
+    sigset_t chld;                         // SIGCHLD only
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);   // Delivered through signal_fd instead
+    jobs.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    jobs.signal_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event ev = {0};           // data.ptr NULL marks the signalfd; odd pointers are limit timers
+    ev.events = EPOLLIN;
+    if (jobs.epoll_fd < 0 || jobs.signal_fd < 0 || epoll_ctl(jobs.epoll_fd, EPOLL_CTL_ADD, jobs.signal_fd, &ev) < 0) {
+        if (jobs.epoll_fd >= 0) close(jobs.epoll_fd);
+        if (jobs.signal_fd >= 0) close(jobs.signal_fd);
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        return;                            // jobs.enabled stays 0
+    }
+    int probe = syscall(SYS_pidfd_open, getpid(), 0); // Kernels before 5.3 lack pidfds
+    jobs.use_pidfd = probe >= 0;
+    if (probe >= 0) close(probe);
+    jobs.enabled = 1;
+    
+    if (interactive) {                     // The shell owns the terminal between jobs
+        jobs.interactive = 1;
+        for (int sig = 1; sig < NSIG; sig++) {
+            if (is_job_signal(sig)) signal(sig, SIG_IGN);
+        }
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        tcgetattr(STDIN_FILENO, &jobs.shell_tmodes);
+    }
+}
+
+// Closes every descriptor marked close-on-exec, as an exec would. A forked subshell
+// keeps running shell code, so without this it would hold pipe ends (and the event
+// loop's descriptors) that belong to other stages and keep readers from seeing EOF.
+// The trace file stays open so the subshell's own stages are recorded too.
+static void close_cloexec_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");   // Open descriptors, without probing every number
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int fd = atoi(entry->d_name);
+        if (fd > STDERR_FILENO && fd != dirfd(dir) && fd != trace_fd && (fcntl(fd, F_GETFD) & FD_CLOEXEC)) close(fd);
+    }
+    closedir(dir);
+}
+
+// Called in a forked subshell: it keeps the job table for printing but waits directly
+void job_child_reset(void) {
+    close_cloexec_fds();                   // Includes the epoll set, signalfd, pidfds and zygote socket
+    zygote.fd = -1;                        // The zygote serves the shell only; subshells spawn directly
+    uring.fd = -1;                         // The ring was closed above; a subshell's + makes its own
+    history.log_fd = -1;                   // Closed above too; subshells record nothing
+    limiter.starting = NULL;               // Its cgroup.procs was closed too; the child is already inside
+    jobs.enabled = 0;
+    if (jobs.interactive) {                // Ctrl-C and Ctrl-Z apply to this process again
+        for (int sig = 1; sig < NSIG; sig++) {
+            if (is_job_signal(sig)) signal(sig, SIG_DFL);
+        }
+    }
+    jobs.interactive = 0;
+    sigset_t none;                         // The shell blocks SIGCHLD; children must not
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+// Opens the trace file named by $VORTEX_TRACE. Records are appended with one write()
+// each, so several shells can share a file without interleaving lines.
+void trace_init(void) {
+    const char *path = getenv(TRACE_ENV);
+    if (!path || !*path) return;           // Tracing off: only a few trace_fd tests remain
+    trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (trace_fd < 0) printf("Error: Cannot open %s=%s: %s\n", TRACE_ENV, path, strerror(errno));
+}
+
+// Monotonic clock in nanoseconds
+uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Writes s as a JSON string literal
+static void trace_json_string(FILE *out, const char *s, size_t len) {
+    fputc('"', out);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Starts a record with the fields every record shares: type, wall-clock time and shell PID
+static FILE *trace_begin(const char *type, char **buf, size_t *len) {
+    FILE *out = open_memstream(buf, len);
+    if (!out) return NULL;
+    struct timespec now;                   // Wall clock, for lining records up with other logs
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(out, "{\"type\":\"%s\",\"ts_us\":%lld,\"shell\":%d", type,
+            (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000, (int)getpid());
+    return out;
+}
+
+// Finishes a record and appends it to the trace file in one write()
+static void trace_end(FILE *out, char **buf, size_t *len) {
+    fputs("}\n", out);
+    fclose(out);
+    if (write(trace_fd, *buf, *len) < 0) {} // A full disk must not disturb the command
+    free(*buf);
+}
+
+// Records one input line: time to parse it and time to run it
+void trace_line(const char *line, uint64_t parse_ns, uint64_t exec_ns, int status) {
+    char *buf;
+    size_t len;
+    FILE *out = trace_begin("line", &buf, &len);
+    if (!out) return;
+    fputs(",\"text\":", out);
+    trace_json_string(out, line, strlen(line));
+    fprintf(out, ",\"parse_ns\":%llu,\"dispatch_ns\":%llu,\"status\":%d",
+            (unsigned long long)parse_ns, (unsigned long long)exec_ns, status);
+    trace_end(out, &buf, &len);
+}
+
+// Notes a stage's launch: its name and how long spawning it took
+static void job_trace_start(JobProc *proc, const char *name, uint64_t t0) {
+    proc->start_ns = trace_now_ns();
+    proc->spawn_ns = proc->start_ns - t0;
+    proc->name = strdup(name ? name : "");
+}
+
+// Reads the bytes a not yet reaped child has read and written (pipes and files alike)
+static void job_trace_io(JobProc *proc) {
+    char path[64], buf[512];               // /proc/<pid>/io and its contents
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)proc->pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = 0;
+    char *field;
+    if ((field = strstr(buf, "rchar: "))) proc->read_bytes = atoll(field + 7);
+    if ((field = strstr(buf, "wchar: "))) proc->write_bytes = atoll(field + 7);
+}
+
+// CPU time from an rusage field, in nanoseconds
+static uint64_t tv_ns(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000;
+}
+
+// Completes a traced stage's figures at its exit and emits its record when VORTEX_TRACE is on
+static void job_trace_exit(JobProc *proc, const struct rusage *usage) {
+    Job *job = proc->job;
+    proc->end_ns = trace_now_ns();
+    if (usage) proc->usage = *usage;
+    if (trace_fd < 0 || proc->pid <= 0) return;
+    char *buf;
+    size_t len;
+    FILE *out = trace_begin("stage", &buf, &len);
+    if (!out) return;
+    fprintf(out, ",\"job\":%d,\"stage\":%d,\"pid\":%d,\"cmd\":", job->id, (int)(proc - job->procs), (int)proc->pid);
+    trace_json_string(out, proc->name ? proc->name : "", proc->name ? strlen(proc->name) : 0);
+    fputs(",\"pipeline\":", out);
+    trace_json_string(out, job->text, strlen(job->text));
+    fprintf(out, ",\"spawn_ns\":%llu,\"wall_ns\":%llu,\"user_ns\":%llu,\"sys_ns\":%llu,\"maxrss_kb\":%ld",
+            (unsigned long long)proc->spawn_ns, (unsigned long long)(proc->end_ns - proc->start_ns),
+            (unsigned long long)tv_ns(proc->usage.ru_utime), (unsigned long long)tv_ns(proc->usage.ru_stime),
+            proc->usage.ru_maxrss);
+    if (proc->read_bytes >= 0) fprintf(out, ",\"read_bytes\":%lld,\"write_bytes\":%lld", proc->read_bytes, proc->write_bytes);
+    fprintf(out, ",\"status\":%d", proc->status);
+    trace_end(out, &buf, &len);
+}
+
+// Prints time's per-stage breakdown of a finished job to stderr
+static void job_print_times(Job *job) {
+    if (job->num_procs < 2) return;        // The totals already say it all
+    for (int i = 0; i < job->num_procs; i++) {
+        JobProc *proc = &job->procs[i];
+        if (proc->pid <= 0) continue;      // Never started
+        fprintf(stderr, "%-12s spawn %7.1fus  wall %8.3fs  user %7.3fs  sys %7.3fs  rss %6ldK",
+                proc->name, proc->spawn_ns / 1e3, (proc->end_ns - proc->start_ns) / 1e9,
+                tv_ns(proc->usage.ru_utime) / 1e9, tv_ns(proc->usage.ru_stime) / 1e9, proc->usage.ru_maxrss);
+        if (proc->read_bytes >= 0) fprintf(stderr, "  in %lld  out %lld", proc->read_bytes, proc->write_bytes);
+        fprintf(stderr, "  status %d\n", proc->status);
+    }
+}
+
+// time pipeline: runs it and prints wall, user and system time to stderr like bash.
+// User and system time cover the shell (builtins, file operators) and every reaped child.
+int run_timed(Node *node) {
+    struct rusage self0, kids0, self1, kids1; // Accounting before and after
+    getrusage(RUSAGE_SELF, &self0);
+    getrusage(RUSAGE_CHILDREN, &kids0);
+    uint64_t t0 = trace_now_ns();
+    int status = run_pipeline(node);
+    uint64_t real = trace_now_ns() - t0;
+    getrusage(RUSAGE_SELF, &self1);
+    getrusage(RUSAGE_CHILDREN, &kids1);
+    uint64_t user = tv_ns(self1.ru_utime) - tv_ns(self0.ru_utime) + tv_ns(kids1.ru_utime) - tv_ns(kids0.ru_utime);
+    uint64_t sys = tv_ns(self1.ru_stime) - tv_ns(self0.ru_stime) + tv_ns(kids1.ru_stime) - tv_ns(kids0.ru_stime);
+    fflush(stdout);                        // Keep the report after the command's output
+    fprintf(stderr, "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n",
+            (int)(real / 60000000000ULL), (real % 60000000000ULL) / 1e9,
+            (int)(user / 60000000000ULL), (user % 60000000000ULL) / 1e9,
+            (int)(sys / 60000000000ULL), (sys % 60000000000ULL) / 1e9);
+    return status;
+}
+
+// Allocates a job with room for num_procs stages and gives it the next job number
+Job *job_create(Node *node, int num_procs) {
+    Job *job = calloc(1, sizeof(Job) + num_procs * sizeof(JobProc));
+    if (!job) {                            // Out of memory: nothing sensible to continue with
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+    job->num_procs = num_procs;
+    job->text = strndup(node->text ? node->text : "", node->text ? node->text_len : 0);
+    job->timed = node->timed;
+    job->traced = node->timed || trace_fd >= 0;
+    if (node->limits) job->limit = limiter.starting = limit_create(job, node->limits); // Entered by each child
+    for (int i = 0; i < num_procs; i++) {
+        job->procs[i].job = job;
+        job->procs[i].pid = -1;
+        job->procs[i].pidfd = -1;
+        job->procs[i].read_bytes = job->procs[i].write_bytes = -1;
+    }
+    if (!jobs.enabled) return job;         // Subshell: untracked, freed after waiting
+    if (jobs.max_id == jobs.capacity) {    // Grow the id-indexed table
+        int grown = jobs.capacity ? jobs.capacity * 2 : 16;
+        Job **slots = realloc(jobs.slots, grown * sizeof(Job *));
+        if (!slots) {
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+        memset(slots + jobs.capacity, 0, (grown - jobs.capacity) * sizeof(Job *));
+        jobs.slots = slots;
+        jobs.capacity = grown;
+    }
+    job->id = ++jobs.max_id;
+    jobs.slots[job->id - 1] = job;
+    return job;
+}
+
+// Stops watching a process's pidfd
+static void job_unwatch(JobProc *proc) {
+    if (proc->pidfd < 0) return;
+    epoll_ctl(jobs.epoll_fd, EPOLL_CTL_DEL, proc->pidfd, NULL); // Forked subshells may still hold a copy
+    close(proc->pidfd);
+    proc->pidfd = -1;
+}
+
+// Removes a job from the table and the unreported list, and frees it
+static void job_free(Job *job) {
+    if (job->id) {
+        jobs.slots[job->id - 1] = NULL;
+        while (jobs.max_id > 0 && !jobs.slots[jobs.max_id - 1]) jobs.max_id--; // Ids are reused from the top
+    }
+    for (Job **link = &jobs.done; *link; link = &(*link)->next_done) {
+        if (*link == job) { *link = job->next_done; break; }
+    }
+    if (job->limit) limit_free(job->limit);
+    for (int i = 0; i < job->num_procs; i++) {
+        job_unwatch(&job->procs[i]);
+        free(job->procs[i].name);
+    }
+    free(job->text);
+    free(job);
+}
+
+// Records stage index as pid (or as failed to start when pid <= 0) and watches its exit
+void job_add_proc(Job *job, int index, pid_t pid) {
+    JobProc *proc = &job->procs[index];
+    proc->pid = pid;
+    if (pid <= 0) {                        // Error already printed; the stage counts as failed
+        proc->done = 1;
+        proc->status = 1;
+        if (job->live == 0 && index == job->num_procs - 1) job->state = JOB_DONE;
+        return;
+    }
+    job->live++;
+    job->state = JOB_RUNNING;
+    if (!jobs.enabled) return;             // Waited for directly
+    if (jobs.use_pidfd) proc->pidfd = syscall(SYS_pidfd_open, pid, 0); // Works on a child that already exited
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;                   // Readable once the process exits
+    ev.data.ptr = proc;                    // Event leads straight to the process and its job
+    if (proc->pidfd >= 0 && epoll_ctl(jobs.epoll_fd, EPOLL_CTL_ADD, proc->pidfd, &ev) < 0) {
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+    if (proc->pidfd < 0) jobs.unwatched++; // Reaped by the waitpid(-1) fallback instead
+}
+
+// Announces a background job the way bash does and leaves it running
+int job_launched(Job *job, pid_t pid) {
+    if (!jobs.enabled) {                   // Nobody will report it; its children are left to init
+        job_free(job);
+        return 0;
+    }
+    if (job->live == 0) {                  // Nothing started; the error is already printed
+        job_free(job);
+        return 0;
+    }
+    if (jobs.interactive) printf("[%d] %d\n", job->id, (int)pid); // Scripts run jobs silently, as bash does
+    return 0;
+}
+
+// Marks a process as exited; the job is done once its last process is reaped.
+// usage is the kernel's accounting for it, or NULL when the reaper did not collect it.
+static void job_proc_exited(JobProc *proc, int status, const struct rusage *usage) {
+    Job *job = proc->job;
+    if (proc->done) return;                // Already accounted for
+    if (proc->pidfd < 0 && jobs.enabled) jobs.unwatched--;
+    job_unwatch(proc);
+    proc->done = 1;
+    proc->status = status;
+    if (job->traced) job_trace_exit(proc, usage);
+    if (proc->stopped) {                   // Killed while stopped
+        proc->stopped = 0;
+        job->stopped--;
+    }
+    job->live--;
+    if (job->live == 0) {
+        job->state = JOB_DONE;
+        if (job->limit) limit_job_done(job); // A timeout or OOM kill decides the status
+        if (job != jobs.foreground && !job->waited) { // Background: report at the next prompt
+            job->next_done = jobs.done;
+            jobs.done = job;
+        }
+    } else if (job->stopped == job->live) {
+        job->state = JOB_STOPPED;          // The remaining stages are all stopped
+    }
+}
+
+// Marks a process as stopped; the job stops once every live process has
+static void job_proc_stopped(JobProc *proc, int sig) {
+    Job *job = proc->job;
+    if (proc->done || proc->stopped) return;
+    proc->stopped = 1;
+    job->stopped++;
+    job->stop_signal = sig;
+    if (job->stopped == job->live) job->state = JOB_STOPPED;
+}
+
+// Marks a process as resumed
+static void job_proc_continued(JobProc *proc) {
+    Job *job = proc->job;
+    if (!proc->stopped) return;
+    proc->stopped = 0;
+    job->stopped--;
+    job->state = JOB_RUNNING;
+}
+
+// Finds a process by PID; only stops and the pidfd-less fallback need this scan
+static JobProc *job_find_pid(pid_t pid) {
+    for (int id = 0; id < jobs.max_id; id++) {
+        Job *job = jobs.slots[id];
+        if (!job) continue;
+        for (int i = 0; i < job->num_procs; i++) {
+            if (job->procs[i].pid == pid) return &job->procs[i];
+        }
+    }
+    return NULL;
+}
+
+// Records an exit that another waitpid(-1) caller collected on the job table's behalf
+void job_reaped(pid_t pid, int status) {
+    JobProc *proc = jobs.enabled ? job_find_pid(pid) : NULL;
+    if (proc) job_proc_exited(proc, status, NULL);
+}
+
+// Translates a waitid result into a shell status
+static int job_status(const siginfo_t *info) {
+    if (info->si_code == CLD_EXITED) return info->si_status;
+    return 128 + info->si_status;          // Killed or dumped core
+}
+
+// Reaps the process whose pidfd became readable. The raw waitid system call also
+// returns the child's rusage, which the libc wrapper drops.
+static void job_reap_pidfd(JobProc *proc) {
+    siginfo_t info;                        // Exit details
+    struct rusage usage;                   // CPU time and peak RSS of the child
+    memset(&info, 0, sizeof(info));
+    if (proc->job->traced) job_trace_io(proc); // Still a zombie: its I/O counters are readable
+    if (syscall(SYS_waitid, JOB_P_PIDFD, proc->pidfd, &info, WEXITED | WNOHANG, &usage) == 0 && info.si_pid) {
+        job_proc_exited(proc, job_status(&info), &usage);
+        return;
+    }
+    int status;                            // Kernel without waitid on pidfds
+    if (wait4(proc->pid, &status, WNOHANG, &usage) == proc->pid) {
+        job_proc_exited(proc, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), &usage);
+    } else if (errno == ECHILD) {
+        job_proc_exited(proc, 1, NULL);    // Reaped elsewhere; stop watching it
+    }
+}
+
+// Handles SIGCHLD. With pidfds, exits are reaped elsewhere and this only collects stops
+// and continues (scanning children, so only when one may have happened); otherwise it
+// reaps everything with waitpid(-1).
+static void job_handle_sigchld(void) {
+    struct signalfd_siginfo si;            // Coalesced SIGCHLD notifications
+    int scan = jobs.foreground != NULL;    // A stop of the foreground job must not be missed
+    while (read(jobs.signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_code == CLD_STOPPED || si.ssi_code == CLD_CONTINUED) scan = 1;
+    }
+    if (jobs.unwatched > 0) {              // No pidfds, or pidfd_open failed for some child
+        int status;
+        struct rusage usage;               // Accounting of the reaped child
+        pid_t pid;
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            JobProc *proc = job_find_pid(pid);
+            if (!proc) continue;           // Not a job's process
+            if (WIFSTOPPED(status)) job_proc_stopped(proc, WSTOPSIG(status));
+            else if (WIFCONTINUED(status)) job_proc_continued(proc);
+            else job_proc_exited(proc, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), &usage);
+        }
+        return;
+    }
+    while (scan) {
+        siginfo_t info;                    // One stop or continue per call
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 || info.si_pid == 0) break;
+        JobProc *proc = job_find_pid(info.si_pid);
+        if (!proc) continue;
+        if (info.si_code == CLD_CONTINUED) job_proc_continued(proc);
+        else job_proc_stopped(proc, info.si_status);
+    }
+}
+
+// Runs the event loop. With until set, blocks until that job stops or finishes;
+// otherwise handles whatever is pending and returns.
+void jobs_poll(Job *until) {
+    if (!jobs.enabled) return;
+    while (!until || until->state == JOB_RUNNING) {
+        int n = jobs_dispatch(until ? -1 : 0);
+        if (n < 0 || (n == 0 && !until)) break; // Loop is broken, or nothing pending
+    }
+}
+
+// Waits up to timeout ms (-1: forever) for child events and handles one batch of them.
+// Returns the number handled, or -1 if the event loop failed.
+int jobs_dispatch(int timeout) {
+    struct epoll_event events[JOB_EVENTS]; // Ready pidfds and the signalfd
+    int n;
+    do {
+        n = epoll_wait(jobs.epoll_fd, events, JOB_EVENTS, timeout);
+    } while (n < 0 && errno == EINTR);
+    for (int i = 0; i < n; i++) {
+        JobProc *proc = events[i].data.ptr;
+        if ((uintptr_t)proc & 1) limit_timer_fired((JobLimit *)((uintptr_t)proc - 1)); // Tagged: a --timeout timer
+        else if (proc) job_reap_pidfd(proc); // O(1): the event names the process
+        else job_handle_sigchld();
+    }
+    return n;
+}
+
+// Hands the terminal to a job, waits until it finishes or stops, and takes it back.
+// Returns the job's status, or 128 + signal if it stopped (it then stays in the table).
+int job_wait_foreground(Job *job) {
+    if (!jobs.enabled) {                   // Subshell: plain blocking waits
+        if (job->limit && job->limit->timer_fd >= 0) limit_wait_direct(job);
+        for (int i = 0; i < job->num_procs; i++) {
+            JobProc *proc = &job->procs[i];
+            if (proc->done) continue;
+            int status;                    // Raw wait status
+            struct rusage usage;           // Accounting for time and VORTEX_TRACE
+            while (wait4(proc->pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+            job_proc_exited(proc, WIFEXITED(status) ? WEXITSTATUS(status) : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1, &usage);
+        }
+        int status = job->procs[job->status_index].status;
+        if (job->timed) job_print_times(job);
+        job_free(job);
+        return status;
+    }
+    jobs.foreground = job;
+    if (jobs.interactive && job->state == JOB_RUNNING && job->pgid > 0) {
+        if (job->has_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes); // Resume e.g. an editor
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    jobs_poll(job);
+    jobs.foreground = NULL;
+    if (jobs.interactive) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        if (job->state == JOB_STOPPED) job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &jobs.shell_tmodes);
+    }
+    if (job->state == JOB_STOPPED) {
+        printf("\n[%d]+  Stopped                 %s\n", job->id, job->text);
+        return 128 + job->stop_signal;
+    }
+    int status = job->procs[job->status_index].status;
+    if (jobs.interactive && status == 128 + SIGINT) putchar('\n'); // Ctrl-C left the cursor mid-line
+    if (job->timed) job_print_times(job);
+    job_free(job);
+    return status;
+}
+
+// Runs an & list without waiting. A pipeline becomes a job directly; && and || lists
+// run in a forked subshell that leads the job's process group.
+int run_background(Node *node) {
+    Node *list = node->left;               // What & applies to
+    if (list->type == NODE_COMMAND || list->type == NODE_PIPELINE || list->type == NODE_FANOUT) return run_job(list, 1);
+    
+    Job *job = job_create(node, 1);
+    fflush(stdout);                        // Child must not replay buffered output
+    uint64_t t0 = job->traced ? trace_now_ns() : 0;
+    pid_t pid = fork();                    // Needs the shell's code to walk the list
+    if (pid == 0) {
+        int interactive = jobs.interactive;
+        job_child_reset();
+        if (interactive) setpgid(0, 0);    // Leads its own job's process group
+        int status = execute_node(list);
+        fflush(stdout);                    // Flush before _exit skips stdio teardown
+        _exit(status);
+    }
+    if (pid < 0) printf("Error: Cannot start background job\n");
+    else if (jobs.interactive) setpgid(pid, pid);
+    if (job->traced) job_trace_start(&job->procs[0], "(subshell)", t0);
+    job->pgid = pid > 0 && jobs.interactive ? pid : 0;
+    job_add_proc(job, 0, pid);
+    return job_launched(job, pid);
+}
+
+
+// FNV-1a hash of a command name
+static size_t path_hash(const char *name) {
+    size_t hash = 2166136261u;             // FNV offset basis
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;                 // FNV prime
+    }
+    return hash;
+}
+
+// Coarse monotonic clock in nanoseconds; served from the vDSO, no system call
+static long long coarse_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Forgets every cached command location and the PATH snapshot
+void path_cache_flush(void) {
+    for (size_t i = 0; i < path_cache.capacity; i++) { // Release names and paths
+        free(path_cache.slots[i].name);
+        free(path_cache.slots[i].path);
+    }
+    for (int i = 0; i < path_cache.num_dirs; i++) free(path_cache.dirs[i]);
+    free(path_cache.slots);
+    free(path_cache.dirs);
+    free(path_cache.mtimes);
+    free(path_cache.path_value);
+    memset(&path_cache, 0, sizeof(path_cache)); // Back to the empty state
+}
+
+// Snapshots PATH and the mtime of each of its directories
+static void path_cache_snapshot(const char *path_value) {
+    path_cache.path_value = strdup(path_value);
+    for (const char *p = path_value; ; p++) { // One directory per ':'-separated field
+        if (*p == ':' || *p == '\0') path_cache.num_dirs++;
+        if (*p == '\0') break;
+    }
+    path_cache.dirs = calloc(path_cache.num_dirs, sizeof(char *));
+    path_cache.mtimes = calloc(path_cache.num_dirs, sizeof(struct timespec));
+    const char *start = path_value;        // Beginning of the current field
+    for (int i = 0; i < path_cache.num_dirs; i++) {
+        size_t len = strcspn(start, ":");
+        path_cache.dirs[i] = len ? strndup(start, len) : strdup("."); // Empty field means cwd
+        struct stat st;
+        if (stat(path_cache.dirs[i], &st) == 0) path_cache.mtimes[i] = st.st_mtim;
+        start += len + 1;
+    }
+    path_cache.checked_ns = coarse_now_ns();
+}
+
+// Drops all entries if PATH changed or (at most once a second) any PATH directory changed
+static void path_cache_validate(void) {
+    const char *path_value = getenv("PATH");
+    if (!path_value) path_value = DEFAULT_PATH;
+    if (path_cache.path_value && strcmp(path_cache.path_value, path_value) != 0) path_cache_flush();
+    if (!path_cache.path_value) {          // Fresh cache: remember what it is valid for
+        path_cache_snapshot(path_value);
+        return;
+    }
+    long long now = coarse_now_ns();
+    if (now - path_cache.checked_ns < PATH_CACHE_RECHECK_NS) return; // Checked recently
+    path_cache.checked_ns = now;
+    for (int i = 0; i < path_cache.num_dirs; i++) {
+        struct stat st;                    // Zeroed mtime stands for "missing"
+        struct timespec mtime = {0, 0};
+        if (stat(path_cache.dirs[i], &st) == 0) mtime = st.st_mtim;
+        if (mtime.tv_sec != path_cache.mtimes[i].tv_sec || mtime.tv_nsec != path_cache.mtimes[i].tv_nsec) {
+            char *saved = strdup(path_value); // Entries added or removed: start over
+            path_cache_flush();
+            path_cache_snapshot(saved);
+            free(saved);
+            return;
+        }
+    }
+}
+
+// Finds name's slot, or the empty slot where it belongs
+static PathEntry *path_cache_slot(const char *name) {
+    size_t mask = path_cache.capacity - 1; // Capacity is a power of two
+    for (size_t i = path_hash(name) & mask; ; i = (i + 1) & mask) {
+        PathEntry *entry = &path_cache.slots[i];
+        if (!entry->name || strcmp(entry->name, name) == 0) return entry;
+    }
+}
+
+// Stores a lookup result, doubling the table when it passes half full
+static void path_cache_insert(const char *name, const char *path) {
+    if (path_cache.used * 2 >= path_cache.capacity) {
+        PathEntry *old = path_cache.slots;
+        size_t old_capacity = path_cache.capacity;
+        path_cache.capacity = old_capacity ? old_capacity * 2 : PATH_CACHE_INITIAL;
+        path_cache.slots = calloc(path_cache.capacity, sizeof(PathEntry));
+        for (size_t i = 0; i < old_capacity; i++) { // Rehash existing entries
+            if (old[i].name) *path_cache_slot(old[i].name) = old[i];
+        }
+        free(old);
+    }
+    PathEntry *entry = path_cache_slot(name);
+    entry->name = strdup(name);
+    entry->path = path ? strdup(path) : NULL; // NULL remembers the miss
+    entry->hits = 0;
+    path_cache.used++;
+}
+
+// Walks PATH for name; writes the first executable regular file into out
+static int path_search(const char *name, char *out, size_t size, int *relative) {
+    *relative = 0;                         // Set if any consulted directory is relative
+    for (int i = 0; i < path_cache.num_dirs; i++) {
+        const char *dir = path_cache.dirs[i];
+        if (dir[0] != '/') *relative = 1;  // Result would change with the cwd
+        if ((size_t)snprintf(out, size, "%s/%s", dir, name) >= size) continue;
+        struct stat st;
+        if (stat(out, &st) == 0 && S_ISREG(st.st_mode) && access(out, X_OK) == 0) return 0;
+    }
+    return -1;                             // Not found anywhere
+}
+
+// Returns the executable for name (names containing '/' are used as-is), or NULL if it
+// is not on PATH. *cached tells the caller the answer came from the table.
+const char *resolve_command(const char *name, int *cached) {
+    *cached = 0;
+    if (strchr(name, '/')) return name;    // Explicit path: exec it directly
+    if (*name == '\0') return NULL;        // Empty command never resolves
+    path_cache_validate();                 // Flush stale entries first
+    
+    if (path_cache.capacity) {
+        PathEntry *entry = path_cache_slot(name);
+        if (entry->name) {                 // Hit, positive or negative
+            entry->hits++;
+            *cached = 1;
+            return entry->path;
+        }
+    }
+    
+    static char found[PATH_MAX];           // Result of the PATH walk
+    int relative;                          // Relative PATH entries make results cwd-dependent
+    int rc = path_search(name, found, sizeof(found), &relative);
+    if (relative) return rc == 0 ? found : NULL; // Depends on the cwd: answer without caching
+    path_cache_insert(name, rc == 0 ? found : NULL);
+    PathEntry *entry = path_cache_slot(name);
+    entry->hits++;                         // This lookup counts as the first use
+    return entry->path;
+}
+
+// hash: list cached commands; hash -r: forget them; hash name...: look names up now
+int builtin_hash(Command *cmd) {
+    int status = 0;                        // 1 if any named command was not found
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->args[i], "-r") == 0) { // Reset the table
+            path_cache_flush();
+            continue;
+        }
+        int cached;
+        if (!resolve_command(cmd->args[i], &cached)) {
+            printf("hash: %s: not found\n", cmd->args[i]);
+            status = 1;
+        }
+    }
+    if (cmd->argc > 1) return status;
+    
+    if (path_cache.used == 0) {            // Nothing remembered yet
+        printf("hash: hash table empty\n");
+        return 0;
+    }
+    printf("hits\tcommand\n");             // Same layout as bash
+    for (size_t i = 0; i < path_cache.capacity; i++) {
+        PathEntry *entry = &path_cache.slots[i];
+        if (entry->name && entry->path) printf("%4u\t%s\n", entry->hits, entry->path);
+        else if (entry->name) printf("%4u\t%s (not found)\n", entry->hits, entry->name);
+    }
+    return 0;
+}
+
+// cd [dir | -]: changes the shell's own directory; defaults to $HOME
+static int builtin_cd(Command *cmd) {
+    const char *target = cmd->argc > 1 ? cmd->args[1] : getenv("HOME");
+    if (target && strcmp(target, "-") == 0) { // Back to the previous directory
+        target = getenv("OLDPWD");
+        if (target) printf("%s\n", target);
+    }
+    if (!target) {
+        printf("cd: no target directory\n");
+        return 1;
+    }
+    char old[PATH_MAX];                    // Directory being left
+    int have_old = getcwd(old, sizeof(old)) != NULL;
+    if (chdir(target) < 0) {
+        printf("cd: %s: %s\n", target, strerror(errno));
+        return 1;
+    }
+    char now[PATH_MAX];                    // Directory entered
+    if (have_old) setenv("OLDPWD", old, 1);
+    if (getcwd(now, sizeof(now))) setenv("PWD", now, 1);
+    return 0;
+}
+
+// pwd: prints the shell's working directory
+static int builtin_pwd(Command *cmd) {
+    (void)cmd;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        printf("pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+// echo [-n] args...: prints its arguments separated by spaces
+static int builtin_echo(Command *cmd) {
+    int first = 1;                         // Index of the first word to print
+    int newline = 1;                       // -n suppresses the trailing newline
+    if (cmd->argc > 1 && strcmp(cmd->args[1], "-n") == 0) {
+        newline = 0;
+        first = 2;
+    }
+    for (int i = first; i < cmd->argc; i++) {
+        fputs(cmd->args[i], stdout);
+        if (i < cmd->argc - 1) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return ferror(stdout) ? 1 : 0;
+}
+
+// true: succeeds without doing anything
+static int builtin_true(Command *cmd) {
+    (void)cmd;
+    return 0;
+}
+
+// false: fails without doing anything
+static int builtin_false(Command *cmd) {
+    (void)cmd;
+    return 1;
+}
+
+// export [NAME=value | NAME]...: sets environment variables for later commands;
+// with no operands, lists the environment
+static int builtin_export(Command *cmd) {
+    extern char **environ;                 // Process environment
+    if (cmd->argc == 1) {
+        for (char **env = environ; *env; env++) printf("export %s\n", *env);
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        char *eq = strchr(cmd->args[i], '='); // NAME=value or just NAME
+        size_t name_len = eq ? (size_t)(eq - cmd->args[i]) : strlen(cmd->args[i]);
+        if (name_len == 0) {
+            printf("export: '%s': not a valid identifier\n", cmd->args[i]);
+            status = 1;
+            continue;
+        }
+        char *name = strndup(cmd->args[i], name_len);
+        if (eq) setenv(name, eq + 1, 1);   // PATH changes are noticed by the hash cache
+        else if (!getenv(name)) setenv(name, "", 1); // Bare NAME: export as empty if unset
+        free(name);
+    }
+    return status;
+}
+
+// exit [n]: leaves the shell with n, or the status of the last command
+static int builtin_exit(Command *cmd) {
+    int status = cmd->argc > 1 ? atoi(cmd->args[1]) : last_status;
+    fflush(stdout);
+    exit(status & 0xff);
+}
+
+// The job fg and bg act on by default: the newest stopped job, else the newest job
+static Job *job_current(void) {
+    Job *newest = NULL;                    // Highest-numbered job
+    for (int id = jobs.max_id; id > 0; id--) {
+        Job *job = jobs.slots[id - 1];
+        if (!job || job->state == JOB_DONE) continue;
+        if (job->state == JOB_STOPPED) return job;
+        if (!newest) newest = job;
+    }
+    return newest;
+}
+
+// Prints one line of jobs output; with show_pgid, the process group follows the marker
+static void job_print(Job *job, Job *current, int show_pgid) {
+    char state[32];                        // Running, Stopped, Done or Exit n
+    if (job->state == JOB_RUNNING) strcpy(state, "Running");
+    else if (job->state == JOB_STOPPED) strcpy(state, "Stopped");
+    else if (job->procs[job->status_index].status == 0) strcpy(state, "Done");
+    else snprintf(state, sizeof(state), "Exit %d", job->procs[job->status_index].status);
+    printf("[%d]%c ", job->id, job == current ? '+' : ' ');
+    if (show_pgid) printf("%d ", (int)job->pgid);
+    printf(" %-24s%s\n", state, job->text);
+}
+
+// Announces background jobs that finished since the last prompt, oldest first, and forgets them
+void jobs_report(void) {
+    Job *list = NULL;                      // jobs.done reversed into completion order
+    while (jobs.done) {
+        Job *job = jobs.done;
+        jobs.done = job->next_done;
+        job->next_done = list;
+        list = job;
+    }
+    while (list) {
+        Job *next = list->next_done;
+        if (jobs.interactive) job_print(list, NULL, 0); // Scripts just forget them
+        job_free(list);
+        list = next;
+    }
+}
+
+// Resolves a job operand: %n, %% / %+ (current job) or, when numeric and pids_ok, a PID.
+// Prints an error naming who and returns NULL when nothing matches.
+static Job *job_lookup(const char *who, const char *spec, int pids_ok) {
+    Job *job = NULL;                       // Match, if any
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        job = job_current();
+        if (!job) printf("%s: no current job\n", who);
+        return job;
+    }
+    char *end;                             // Validates the number
+    long n = strtol(spec + (spec[0] == '%'), &end, 10);
+    if (*end == '\0' && n > 0) {
+        if (spec[0] == '%' || !pids_ok) {  // Job number
+            if (n <= jobs.max_id) job = jobs.slots[n - 1];
+        } else {                           // Process ID
+            JobProc *proc = job_find_pid((pid_t)n);
+            if (proc) job = proc->job;
+        }
+    }
+    if (!job) printf("%s: %s: no such job\n", who, spec);
+    return job;
+}
+
+// Sends SIGCONT to a stopped job and marks it running
+static void job_continue(Job *job) {
+    for (int i = 0; i < job->num_procs; i++) job->procs[i].stopped = 0;
+    job->stopped = 0;
+    job->state = JOB_RUNNING;
+    if (job->pgid > 0) kill(-job->pgid, SIGCONT);
+    else for (int i = 0; i < job->num_procs; i++) {
+        if (!job->procs[i].done) kill(job->procs[i].pid, SIGCONT);
+    }
+}
+
+// jobs [-l]: lists jobs; finished ones are reported once and forgotten
+static int builtin_jobs(Command *cmd) {
+    int show_pgid = cmd->argc > 1 && strcmp(cmd->args[1], "-l") == 0;
+    jobs_poll(NULL);                       // Pick up anything that changed meanwhile
+    Job *current = job_current();
+    for (int id = 1; id <= jobs.max_id; id++) {
+        Job *job = jobs.slots[id - 1];
+        if (!job) continue;
+        job_print(job, current, show_pgid);
+        if (job->state == JOB_DONE) job_free(job); // Shrinks max_id only from the top
+    }
+    return 0;
+}
+
+// Signal names accepted by kill, without the SIG prefix
+static const struct { const char *name; int sig; } kill_signals[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD},
+    {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+};
+
+// kill [-SIG | -s SIG] (%job | pid)...: signals processes; a job's whole process group is signalled
+static int builtin_kill(Command *cmd) {
+    int sig = SIGTERM;                     // Default, as kill(1)
+    int i = 1;                             // First operand
+    if (i < cmd->argc && cmd->args[i][0] == '-' && cmd->args[i][1]) {
+        const char *name = cmd->args[i] + 1;
+        if (strcmp(name, "s") == 0 && i + 1 < cmd->argc) name = cmd->args[++i];
+        if (strncmp(name, "SIG", 3) == 0) name += 3;
+        char *end;                         // Numeric signals are taken as-is
+        sig = (int)strtol(name, &end, 10);
+        if (*end || end == name) {
+            sig = -1;
+            for (size_t k = 0; k < sizeof(kill_signals) / sizeof(kill_signals[0]); k++) {
+                if (strcmp(name, kill_signals[k].name) == 0) sig = kill_signals[k].sig;
+            }
+        }
+        if (sig < 0) {
+            printf("kill: %s: invalid signal specification\n", cmd->args[i]);
+            return 1;
+        }
+        i++;
+    }
+    if (i == cmd->argc) {
+        printf("kill: usage: kill [-SIG | -s SIG] %%job | pid...\n");
+        return 1;
+    }
+    int status = 0;
+    for (; i < cmd->argc; i++) {
+        pid_t target;                      // Negative for a process group
+        if (cmd->args[i][0] == '%') {
+            Job *job = job_lookup("kill", cmd->args[i], 0);
+            if (!job) { status = 1; continue; }
+            if (job->pgid == 0) {          // No process group of its own: signal each process
+                for (int k = 0; k < job->num_procs; k++) {
+                    if (!job->procs[k].done) kill(job->procs[k].pid, sig);
+                }
+                continue;
+            }
+            target = -job->pgid;
+        } else {
+            target = (pid_t)atoi(cmd->args[i]);
+        }
+        if (target == 0 || kill(target, sig) < 0) {
+            printf("kill: %s: %s\n", cmd->args[i], target ? strerror(errno) : "arguments must be process or job IDs");
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// fg [job]: continues a job in the foreground and waits for it
+static int builtin_fg(Command *cmd) {
+    if (!jobs.enabled) {
+        printf("fg: no job control\n");
+        return 1;
+    }
+    Job *job = job_lookup("fg", cmd->argc > 1 ? cmd->args[1] : NULL, 0);
+    if (!job) return 1;
+    printf("%s\n", job->text);
+    if (job->state == JOB_DONE) {          // Finished before it could be resumed
+        int status = job->procs[job->status_index].status;
+        job_free(job);
+        return status;
+    }
+    job_continue(job);
+    return job_wait_foreground(job);
+}
+
+// bg [job...]: continues stopped jobs in the background
+static int builtin_bg(Command *cmd) {
+    if (!jobs.enabled) {
+        printf("bg: no job control\n");
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < (cmd->argc > 1 ? cmd->argc : 2); i++) {
+        Job *job = job_lookup("bg", cmd->argc > 1 ? cmd->args[i] : NULL, 0);
+        if (!job) { status = 1; continue; }
+        if (job->state != JOB_STOPPED) {
+            printf("bg: job %d already in background\n", job->id);
+            continue;
+        }
+        job_continue(job);
+        printf("[%d]+ %s &\n", job->id, job->text);
+    }
+    return status;
+}
+
+// wait [job | pid]...: waits for the given jobs, or for every running job; the status
+// is that of the last operand (0 with no operands, 127 for an unknown one)
+static int builtin_wait(Command *cmd) {
+    if (cmd->argc == 1) {
+        for (int id = 1; id <= jobs.max_id; id++) {
+            Job *job = jobs.slots[id - 1];
+            if (job && job->state == JOB_RUNNING) jobs_poll(job); // Finished jobs are still reported
+        }
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        Job *job = job_lookup("wait", cmd->args[i], 1);
+        if (!job) { status = 127; continue; }
+        jobs_poll(job);
+        JobProc *proc = cmd->args[i][0] == '%' ? NULL : job_find_pid(atoi(cmd->args[i]));
+        if (job->state == JOB_STOPPED) status = 128 + job->stop_signal;
+        else status = proc ? proc->status : job->procs[job->status_index].status;
+    }
+    return status;
+}
+
+// Starts the command for one input line, with stdout and stderr captured in memfds.
+// Placeholders {} are replaced by the line; without any, the line's words are appended.
+static void parallel_start(Parallel *par, char **words, int num_words, char *line, int devnull) {
+    if (par->len == par->cap) {            // Grow the window of unprinted tasks
+        size_t grown = par->cap ? par->cap * 2 : 64;
+        ParallelTask *tasks = realloc(par->tasks, grown * sizeof(ParallelTask));
+        if (!tasks) {
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+        par->tasks = tasks;
+        par->cap = grown;
+    }
+    size_t seq = par->first_seq + par->len; // Input position of this line
+    ParallelTask *task = &par->tasks[par->len++];
+    memset(task, 0, sizeof(*task));
+    task->line = line;
+    task->pid = -1;
+    task->pidfd = -1;
+    task->out_fd = memfd_create("parallel-out", MFD_CLOEXEC);
+    task->err_fd = memfd_create("parallel-err", MFD_CLOEXEC);
+    par->total++;
+    
+    // argv: the command words with {} filled in, plus the line's words if nothing was
+    int placeholders = 0;                  // Words containing {}
+    for (int i = 0; i < num_words; i++) placeholders += strstr(words[i], "{}") != NULL;
+    size_t line_len = strlen(line);
+    int extra = 0;                         // Words split from the line
+    for (char *c = line; *c; c++) extra += (c == line || c[-1] == ' ' || c[-1] == '\t') && *c != ' ' && *c != '\t';
+    char **argv = calloc(num_words + (placeholders ? 0 : extra) + 1, sizeof(char *));
+    char *split = placeholders ? NULL : strdup(line); // Owns the appended words
+    int argc = 0;
+    for (int i = 0; i < num_words; i++) {
+        if (!strstr(words[i], "{}")) { argv[argc++] = words[i]; continue; }
+        size_t size = strlen(words[i]) + 1; // Room for every {} becoming the line
+        for (char *at = strstr(words[i], "{}"); at; at = strstr(at + 2, "{}")) size += line_len;
+        char *out = malloc(size), *dst = out;
+        for (const char *src = words[i]; *src; ) {
+            if (src[0] == '{' && src[1] == '}') { memcpy(dst, line, line_len); dst += line_len; src += 2; }
+            else *dst++ = *src++;
+        }
+        *dst = '\0';
+        argv[argc++] = out;
+    }
+    if (split) {
+        for (char *word = strtok(split, " \t"); word; word = strtok(NULL, " \t")) argv[argc++] = word;
+    }
+    argv[argc] = NULL;
+    
+    SpawnRequest req = {0};                // Child reads /dev/null, writes to its memfds
+    req.argv = argv;
+    req.in_fd = devnull;
+    req.out_fd = task->out_fd;
+    req.err_fd = task->err_fd;
+    req.pgid = -1;                         // Stays in the caller's group, so Ctrl-C reaches it
+    if (argc > 0 && task->out_fd >= 0 && task->err_fd >= 0) task->pid = spawn_process(&req);
+    for (int i = 0; i < num_words; i++) {  // Free the substituted words; argv[i] came from words[i]
+        if (strstr(words[i], "{}")) free(argv[i]);
+    }
+    free(argv);
+    free(split);
+    
+    if (task->pid <= 0) {                  // Error already printed by the spawn layer
+        task->done = 1;
+        task->status = argc > 0 ? 127 : 1;
+        return;
+    }
+    par->running++;
+    task->pidfd = par->epoll_fd >= 0 ? syscall(SYS_pidfd_open, task->pid, 0) : -1;
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;                   // Readable once the child exits
+    ev.data.u64 = seq;                     // Leads straight back to the task
+    if (task->pidfd >= 0 && epoll_ctl(par->epoll_fd, EPOLL_CTL_ADD, task->pidfd, &ev) < 0) {
+        close(task->pidfd);
+        task->pidfd = -1;
+    }
+    if (task->pidfd < 0) par->unwatched++;
+}
+
+// Copies a task's captured output to the shell's stdout and stderr and releases it
+static void parallel_emit(Parallel *par, ParallelTask *task) {
+    fflush(stdout);                        // Earlier printf output goes first
+    struct stat out_st;                    // stream_file picks its fast path from the target
+    if (task->out_fd >= 0 && fstat(STDOUT_FILENO, &out_st) == 0 && lseek(task->out_fd, 0, SEEK_SET) == 0)
+        stream_file(task->out_fd, STDOUT_FILENO, &out_st);
+    if (task->err_fd >= 0 && fstat(STDERR_FILENO, &out_st) == 0 && lseek(task->err_fd, 0, SEEK_SET) == 0)
+        stream_file(task->err_fd, STDERR_FILENO, &out_st);
+    if (task->out_fd >= 0) close(task->out_fd);
+    if (task->err_fd >= 0) close(task->err_fd);
+    task->out_fd = task->err_fd = -1;
+    if (task->status != 0) {               // Remember the first few failures for the summary
+        if (par->failed < PARALLEL_MAX_FAILURES) par->failures[par->failed] = task->line;
+        else free(task->line);
+        par->failed++;
+    } else {
+        free(task->line);
+    }
+    task->line = NULL;
+    task->emitted = 1;
+}
+
+// Prints whatever may be printed: finished tasks in input order with -k, or every
+// finished task otherwise; then drops the printed prefix of the window
+static void parallel_flush(Parallel *par) {
+    for (size_t i = par->start; i < par->len; i++) {
+        ParallelTask *task = &par->tasks[i];
+        if (!task->done) {
+            if (par->keep_order) break;    // Later output waits for this one
+            continue;
+        }
+        if (!task->emitted) parallel_emit(par, task);
+    }
+    while (par->start < par->len && par->tasks[par->start].emitted) par->start++;
+    if (par->start > par->len / 2) {       // Compact so the window stays proportional to what is pending
+        memmove(par->tasks, par->tasks + par->start, (par->len - par->start) * sizeof(ParallelTask));
+        par->first_seq += par->start;
+        par->len -= par->start;
+        par->start = 0;
+    }
+}
+
+// Records a child's exit
+static void parallel_finished(Parallel *par, ParallelTask *task, int status) {
+    if (task->pidfd >= 0) {
+        epoll_ctl(par->epoll_fd, EPOLL_CTL_DEL, task->pidfd, NULL);
+        close(task->pidfd);
+        task->pidfd = -1;
+    } else {
+        par->unwatched--;
+    }
+    task->done = 1;
+    task->status = status;
+    par->running--;
+    if (status == 128 + SIGINT) par->interrupted = 1; // Ctrl-C: start nothing new
+}
+
+// Blocks until at least one running child exits
+static void parallel_wait(Parallel *par) {
+    if (par->unwatched > 0) {              // Some child has no pidfd: collect exits with waitpid
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == ECHILD) par->running = 0; // Nothing left to wait for
+            return;
+        }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        for (size_t i = par->start; i < par->len; i++) {
+            ParallelTask *task = &par->tasks[i];
+            if (task->pid == pid && !task->done) {
+                parallel_finished(par, task, code);
+                return;
+            }
+        }
+        job_reaped(pid, code);             // A background job's process: hand it over
+        return;
+    }
+    struct epoll_event events[JOB_EVENTS]; // Ready pidfds
+    int n = epoll_wait(par->epoll_fd, events, JOB_EVENTS, -1);
+    for (int i = 0; i < n; i++) {
+        ParallelTask *task = &par->tasks[events[i].data.u64 - par->first_seq];
+        siginfo_t info;                    // Exit details
+        memset(&info, 0, sizeof(info));
+        if (syscall(SYS_waitid, JOB_P_PIDFD, task->pidfd, &info, WEXITED, NULL) < 0) {
+            int status;                    // Kernel without waitid on pidfds
+            if (waitpid(task->pid, &status, 0) < 0) status = 1 << 8;
+            parallel_finished(par, task, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        } else {
+            parallel_finished(par, task, info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status);
+        }
+    }
+}
+
+// parallel [-j N] [-k] [-a file] command [args...]: runs command once per input line
+// (from file, or stdin), with at most N running at a time (default: online CPUs).
+// Each run's output is buffered and printed whole, in completion order or, with -k,
+// input order; a summary of failures and wall time goes to stderr. Status is the
+// number of failed runs, capped at 101, as in GNU parallel.
+static int builtin_parallel(Command *cmd) {
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN); // Saturate the machine by default
+    int keep_order = 0;                    // -k: print in input order
+    const char *input = NULL;              // -a file, else stdin
+    int i = 1;                             // First word after the options
+    for (; i < cmd->argc && cmd->args[i][0] == '-'; i++) {
+        const char *opt = cmd->args[i];
+        if (strcmp(opt, "-k") == 0) keep_order = 1;
+        else if (strncmp(opt, "-j", 2) == 0 && (opt[2] || i + 1 < cmd->argc)) {
+            max_jobs = atol(opt[2] ? opt + 2 : cmd->args[++i]);
+        } else if (strcmp(opt, "-a") == 0 && i + 1 < cmd->argc) input = cmd->args[++i];
+        else if (strcmp(opt, "--") == 0) { i++; break; }
+        else break;
+    }
+    if (i == cmd->argc || max_jobs < 1) {
+        printf("parallel: usage: parallel [-j N] [-k] [-a file] command [args...]\n");
+        return 1;
+    }
+    
+    FILE *in = input ? fopen(input, "re") : fdopen(fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0), "r"); // Not the shell's stdin stream
+    if (!in) {
+        printf("parallel: %s: %s\n", input ? input : "stdin", strerror(errno));
+        return 1;
+    }
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC); // Children must not eat the input
+    Parallel par = {0};
+    par.keep_order = keep_order;
+    par.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct timespec begin, end;            // Wall time for the summary
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    
+    char *line = NULL;                     // Current input line
+    size_t line_cap = 0;
+    int eof = 0;                           // Input exhausted (or interrupted)
+    while (1) {
+        while (!eof && !par.interrupted && par.running < max_jobs) { // Fill free slots
+            ssize_t len = getline(&line, &line_cap, in);
+            if (len < 0) { eof = 1; break; }
+            if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+            if (len == 0) continue;        // Blank lines carry no arguments
+            parallel_start(&par, cmd->args + i, cmd->argc - i, strdup(line), devnull);
+        }
+        parallel_flush(&par);
+        if (par.running == 0) break;       // Done, or nothing could be started
+        parallel_wait(&par);
+    }
+    parallel_flush(&par);                  // Anything still held for ordering
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    fflush(stdout);
+    double wall = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    fprintf(stderr, "parallel: %zu jobs, %zu failed, %.3f s wall, %ld slots\n", par.total, par.failed, wall, max_jobs);
+    for (size_t f = 0; f < par.failed && f < PARALLEL_MAX_FAILURES; f++) {
+        fprintf(stderr, "parallel: failed: %s\n", par.failures[f]);
+        free(par.failures[f]);
+    }
+    if (par.failed > PARALLEL_MAX_FAILURES) fprintf(stderr, "parallel: ... and %zu more\n", par.failed - PARALLEL_MAX_FAILURES);
+    if (par.interrupted) fprintf(stderr, "parallel: interrupted; remaining input skipped\n");
+    free(line);
+    free(par.tasks);
+    fclose(in);
+    if (devnull >= 0) close(devnull);
+    if (par.epoll_fd >= 0) close(par.epoll_fd);
+    return par.failed > 101 ? 101 : (int)par.failed;
+}
+
+// Options understood by set -o / set +o
+static const ShellOption shell_options[] = {
+    {"autopar", 0, &opt_autopar},
+    {"errexit", 'e', &opt_errexit},
+};
+
+// set [-o | +o] [option]... and set -e / +e: turns options on (-) or off (+);
+// set -o alone lists them
+static int builtin_set(Command *cmd) {
+    size_t num_options = sizeof(shell_options) / sizeof(shell_options[0]);
+    if (cmd->argc == 1 || (cmd->argc == 2 && strcmp(cmd->args[1], "-o") == 0)) {
+        for (size_t k = 0; k < num_options; k++) {
+            printf("%-15s %s\n", shell_options[k].name, *shell_options[k].flag ? "on" : "off");
+        }
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        const char *arg = cmd->args[i];
+        if ((arg[0] == '-' || arg[0] == '+') && arg[1] && arg[1] != 'o') { // Short forms: -e, +e
+            for (const char *c = arg + 1; *c; c++) {
+                size_t k = 0;
+                while (k < num_options && shell_options[k].letter != *c) k++;
+                if (k == num_options) {
+                    printf("set: -%c: invalid option\n", *c);
+                    status = 1;
+                    continue;
+                }
+                *shell_options[k].flag = arg[0] == '-';
+            }
+            continue;
+        }
+        if ((strcmp(arg, "-o") != 0 && strcmp(arg, "+o") != 0) || i + 1 == cmd->argc) {
+            printf("set: %s: invalid option\n", arg);
+            status = 1;
+            continue;
+        }
+        const char *name = cmd->args[++i];
+        size_t k = 0;
+        while (k < num_options && strcmp(name, shell_options[k].name) != 0) k++;
+        if (k == num_options) {
+            printf("set: %s: invalid option name\n", name);
+            status = 1;
+            continue;
+        }
+        *shell_options[k].flag = arg[0] == '-';
+    }
+    return status;
+}
+
+// killterm: terminates this shell instance
+static int builtin_killterm(Command *cmd) {
+    (void)cmd;
+    exit(0);                               // Exit this shell instance cleanly
+}
+
+// killallterms: terminates every instance of this shell, this one last
+static int builtin_killallterms(Command *cmd) {
+    (void)cmd;
+    kill_all_shells(self_name);            // Attempt to kill all running instances of this shell
+    exit(0);                               // Terminate this instance after kill operation
+}
+
+// Builtin dispatch table, consulted before anything is forked
+static const Builtin builtins[] = {
+    {"cd", builtin_cd},
+    {"pwd", builtin_pwd},
+    {"echo", builtin_echo},
+    {"true", builtin_true},
+    {"false", builtin_false},
+    {"export", builtin_export},
+    {"exit", builtin_exit},
+    {"hash", builtin_hash},
+    {"jobs", builtin_jobs},
+    {"fg", builtin_fg},
+    {"bg", builtin_bg},
+    {"wait", builtin_wait},
+    {"kill", builtin_kill},
+    {"parallel", builtin_parallel},
+    {"set", builtin_set},
+    {"cache", builtin_cache},
+    {"history", builtin_history},
+    {"killterm", builtin_killterm},
+    {"killallterms", builtin_killallterms},
+};
+
+// Returns the builtin named by cmd's first word, or NULL for external commands
+const Builtin *find_builtin(Command *cmd) {
+    if (cmd->file_op || cmd->argc == 0) return NULL; // File operators carry file names, not a command
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(cmd->args[0], builtins[i].name) == 0) return &builtins[i];
+    }
+    return NULL;
+}
+
+// Executes a ; sequence: left side first, then right side; status is the right side's.
+// Under set -o autopar the whole chain is handed to autopar_run instead, unless set -e
+// needs the commands after a failure left unstarted.
+int execute_sequential_commands(Node *node) {
+    if (opt_autopar && !opt_errexit && jobs.enabled) return autopar_run(node); // Subshells and set -e stay serial
+    last_status = execute_node(node->left); // Earlier commands run to completion first; $? sees the status
+    return execute_node(node->right);
+}
+
+// Commands known only to read the files named in their arguments. Any other command
+// may write to them (./gen out, sort -o out, dd of=out), so its arguments count as writes.
+static const char *autopar_readers[] = {
+    "cat", "tac", "grep", "egrep", "fgrep", "zgrep", "zcat", "wc", "head", "tail", "less",
+    "more", "cut", "paste", "join", "comm", "diff", "cmp", "nl", "od", "hexdump", "strings",
+    "rev", "fold", "fmt", "column", "md5sum", "sha1sum", "sha256sum", "sha512sum", "b2sum",
+    "cksum", "sum", "file", "stat", "ls", "du", "df", "readlink", "realpath", "basename",
+    "dirname", "test", "[", "sleep", "seq", "printf", "date", "expr", "which", "uname",
+};
+
+// Canonical name for a path that may not exist yet: realpath() of its longest existing
+// prefix plus the rest as written, so ./a, a, d/../a, links to a and a file inside a
+// directory made by an earlier segment all compare correctly
+static void autopar_canonical(const char *path, char *out, size_t size) {
+    char head[PATH_MAX];                   // Prefix being tried
+    char real[PATH_MAX];                   // Its resolved form
+    snprintf(head, sizeof(head), "%s", path);
+    size_t cut = strlen(head);             // Length of the prefix
+    while (1) {
+        head[cut] = '\0';
+        if (realpath(cut ? head : ".", real)) break;
+        if (cut == 0) {                    // Not even the working directory resolves
+            snprintf(out, size, "%s", path);
+            return;
+        }
+        char *slash = strrchr(head, '/');  // Drop the last component
+        cut = slash ? (slash == head ? 1 : (size_t)(slash - head)) : 0;
+    }
+    const char *tail = path + cut;         // Components that do not exist yet
+    while (*tail == '/') tail++;
+    snprintf(out, size, "%s%s%s", real, *tail && strcmp(real, "/") != 0 ? "/" : "", tail);
+}
+
+// Adds a file to a segment's resource set under its canonical name
+static void autopar_add(Segment *seg, const char *path, int write) {
+    char key[2 * PATH_MAX];                // Canonical form: resolved prefix plus the rest
+    if (strcmp(path, AUTOPAR_STDOUT) == 0) snprintf(key, sizeof(key), "%s", path);
+    else autopar_canonical(path, key, sizeof(key));
+    if (seg->num_res == seg->cap_res) {    // Grow into fresh arena space
+        int grown = seg->cap_res ? seg->cap_res * 2 : 8;
+        Resource *res = arena_alloc(&line_arena, grown * sizeof(Resource));
+        if (seg->num_res) memcpy(res, seg->res, seg->num_res * sizeof(Resource));
+        seg->res = res;
+        seg->cap_res = grown;
+    }
+    seg->res[seg->num_res].key = arena_strdup(&line_arena, key);
+    seg->res[seg->num_res].write = write;
+    seg->num_res++;
+}
+
+// Records what one command reads and writes; to_stdout is set for the stage whose
+// output reaches the shell's stdout, which counts as a shared file so output order holds
+static void autopar_collect_command(Segment *seg, Command *cmd, int to_stdout) {
+    if (cmd->expand) {                     // Words not expanded yet may name any file
+        seg->barrier = 1;
+        return;
+    }
+    if (cmd->input_file) autopar_add(seg, cmd->input_file, 0);
+    if (cmd->output_file) autopar_add(seg, cmd->output_file, 1);
+    else if (to_stdout) autopar_add(seg, AUTOPAR_STDOUT, 1);
+    if (cmd->file_op) {                    // ~ rewrites both files; # and + only read
+        for (int i = 0; i < cmd->argc; i++) autopar_add(seg, cmd->args[i], cmd->file_op == '~');
+        return;
+    }
+    const Builtin *builtin = find_builtin(cmd);
+    if (builtin && builtin->run != builtin_echo && builtin->run != builtin_pwd &&
+        builtin->run != builtin_true && builtin->run != builtin_false) {
+        seg->barrier = 1;                  // cd, export, set, exit, jobs...: shell state
+    }
+    int writes = !builtin;                 // Arguments may be outputs, not just inputs
+    for (size_t i = 0; writes && i < sizeof(autopar_readers) / sizeof(autopar_readers[0]); i++) {
+        if (strcmp(cmd->args[0], autopar_readers[i]) == 0) writes = 0;
+    }
+    if (strchr(cmd->args[0], '/')) autopar_add(seg, cmd->args[0], 0); // ./prog built by an earlier segment
+    for (int i = 1; i < cmd->argc; i++) {  // Any argument may name a file
+        const char *arg = cmd->args[i];
+        if (arg[0] == '-') {               // Options: only --name=value carries a file name
+            const char *eq = strchr(arg, '=');
+            if (!eq) continue;
+            arg = eq + 1;
+        }
+        if (*arg) autopar_add(seg, arg, writes);
+        const char *eq = arg[0] == '-' ? NULL : strchr(arg, '='); // dd-style of=file
+        if (eq && eq[1]) autopar_add(seg, eq + 1, writes);
+    }
+}
+
+// Collects the resources of everything a segment runs
+static void autopar_collect(Segment *seg, Node *node) {
+    switch (node->type) {
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_SEQUENCE:
+        autopar_collect(seg, node->left);
+        autopar_collect(seg, node->right);
+        return;
+    case NODE_BACKGROUND:
+        autopar_collect(seg, node->left);
+        return;
+    case NODE_COMMAND:
+    case NODE_PIPELINE:
+        for (int i = 0; i < node->num_commands; i++) {
+            autopar_collect_command(seg, &node->commands[i], i == (node->reverse ? 0 : node->num_commands - 1));
+        }
+        return;
+    case NODE_FANOUT:                      // The producer's output only reaches the branches
+        for (int i = 0; i < node->left->num_commands; i++) autopar_collect_command(seg, &node->left->commands[i], 0);
+        for (int b = 0; b < node->num_branches; b++) autopar_collect(seg, node->branches[b]);
+        return;
+    }
+}
+
+// Two resources overlap when they name the same file, or one lies inside the other
+static int autopar_overlap(const char *a, const char *b) {
+    size_t la = strlen(a), lb = strlen(b);
+    if (la > lb) { const char *t = a; a = b; b = t; size_t tl = la; la = lb; lb = tl; }
+    return strncmp(a, b, la) == 0 && (la == lb || b[la] == '/' || (la == 1 && a[0] == '/'));
+}
+
+// Segments conflict when one writes something the other reads or writes
+static int autopar_conflict(Segment *a, Segment *b) {
+    for (int i = 0; i < a->num_res; i++) {
+        for (int j = 0; j < b->num_res; j++) {
+            if ((a->res[i].write || b->res[j].write) && autopar_overlap(a->res[i].key, b->res[j].key)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Starts a segment whose predecessors have finished. Barriers, lone builtins and &
+// lists run to completion in the shell; pipelines become jobs in the shell's process
+// group; && / || lists run in a forked subshell.
+static void autopar_start(Segment *seg) {
+    Node *node = seg->node;
+    seg->state = AUTOPAR_DONE;             // Unless a job is left running below
+    if (seg->barrier || node->type == NODE_BACKGROUND ||
+        (node->type == NODE_COMMAND && find_builtin(&node->commands[0]))) {
+        seg->status = execute_node(node);
+        return;
+    }
+    if (node->type == NODE_COMMAND || node->type == NODE_PIPELINE || node->type == NODE_FANOUT) {
+        seg->job = job_start(node, -1);    // Shell's group: Ctrl-C reaches every segment
+        if (!seg->job) { seg->status = 1; return; }
+    } else {
+        seg->job = job_create(node, 1);
+        fflush(stdout);                    // Child must not replay buffered output
+        pid_t pid = fork();                // Needs the shell's code to walk the list
+        if (pid == 0) {
+            job_child_reset();
+            int status = execute_node(node);
+            fflush(stdout);                // Flush before _exit skips stdio teardown
+            _exit(status);
+        }
+        if (pid < 0) printf("Error: Cannot start subshell\n");
+        job_add_proc(seg->job, 0, pid);
+    }
+    seg->job->waited = 1;                  // Collected here, never announced at the prompt
+    seg->state = AUTOPAR_RUNNING;
+}
+
+// Runs a ; chain as a dependency graph: each segment waits only for earlier segments
+// it conflicts with, and otherwise runs concurrently. Files end up as after serial
+// execution, and the status is the last segment's.
+int autopar_run(Node *node) {
+    int count = 1;                         // Segments in the left-leaning ; chain
+    for (Node *n = node; n->type == NODE_SEQUENCE; n = n->left) count++;
+    Segment *segs = arena_alloc(&line_arena, count * sizeof(Segment));
+    memset(segs, 0, count * sizeof(Segment));
+    Node *n = node;
+    for (int k = count - 1; k > 0; k--, n = n->left) segs[k].node = n->right;
+    segs[0].node = n;
+    for (int k = 0; k < count; k++) autopar_collect(&segs[k], segs[k].node);
+    
+    // Edges i -> j for conflicting pairs; & lists are not waited for even when serial
+    for (int pass = 0; pass < 2; pass++) { // Count, then fill
+        for (int j = 1; j < count; j++) {
+            for (int i = 0; i < j; i++) {
+                if (segs[i].node->type == NODE_BACKGROUND) continue;
+                if (!segs[i].barrier && !segs[j].barrier && !autopar_conflict(&segs[i], &segs[j])) continue;
+                if (pass == 0) { segs[i].num_succ++; continue; }
+                segs[i].succ[segs[i].num_succ++] = j;
+                segs[j].waiting++;
+            }
+        }
+        for (int k = 0; pass == 0 && k < count; k++) {
+            segs[k].succ = arena_alloc(&line_arena, (segs[k].num_succ + 1) * sizeof(int));
+            segs[k].num_succ = 0;
+        }
+    }
+    
+    int *ready = arena_alloc(&line_arena, count * sizeof(int));   // FIFO of startable segments
+    int *running = arena_alloc(&line_arena, count * sizeof(int)); // Segments with a live job
+    int head = 0, tail = 0, num_running = 0, finished = 0;
+    for (int k = 0; k < count; k++) {
+        if (!segs[k].waiting) ready[tail++] = k;
+    }
+    while (finished < count) {
+        while (head < tail) {              // Start everything that is free to run
+            Segment *seg = &segs[ready[head++]];
+            autopar_start(seg);
+            if (seg->state == AUTOPAR_RUNNING) running[num_running++] = seg - segs;
+        }
+        for (int r = 0; r < num_running; r++) { // Collect finished segments
+            Segment *seg = &segs[running[r]];
+            if (seg->job->state != JOB_DONE) continue;
+            seg->status = seg->job->procs[seg->job->status_index].status;
+            job_free(seg->job);
+            seg->job = NULL;
+            seg->state = AUTOPAR_DONE;
+            running[r--] = running[--num_running];
+        }
+        for (int k = 0; k < count; k++) {  // Release successors of newly finished segments
+            Segment *seg = &segs[k];
+            if (seg->state != AUTOPAR_DONE) continue;
+            seg->state = AUTOPAR_RELEASED;
+            finished++;
+            for (int s = 0; s < seg->num_succ; s++) {
+                if (--segs[seg->succ[s]].waiting == 0) ready[tail++] = seg->succ[s];
+            }
+        }
+        if (head == tail && finished < count && jobs_dispatch(-1) < 0) break; // Wait for an exit
+    }
+    return segs[count - 1].status;
+}
+
+// Parses a byte count such as 1048576, 256k, 1m or 2g; 0 if malformed
+static long long parse_size(const char *text) {
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (*end == 'k' || *end == 'K') { size <<= 10; end++; }
+    else if (*end == 'm' || *end == 'M') { size <<= 20; end++; }
+    else if (*end == 'g' || *end == 'G') { size <<= 30; end++; }
+    return *end || size <= 0 ? 0 : size;
+}
+
+// Creates a close-on-exec pipe for a pipeline link. With $VORTEX_PIPESZ set it is
+// enlarged with F_SETPIPE_SZ, capped at pipe-max-size when the request is over it, so
+// high-throughput stages move more per wakeup.
+int pipe_open(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
+    const char *want = getenv(PIPESZ_ENV);
+    long size = want ? (long)parse_size(want) : 0; // Requested capacity; 0 keeps the kernel default
+    if (size > 0 && fcntl(fds[1], F_SETPIPE_SZ, size) < 0 && errno == EPERM) {
+        int fd = open(PIPE_MAX_SIZE_PATH, O_RDONLY | O_CLOEXEC); // Unprivileged ceiling
+        char buf[32];
+        ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+        if (fd >= 0) close(fd);
+        if (n > 0) {
+            buf[n] = '\0';
+            long max = atol(buf);
+            if (max > 0 && max < size) fcntl(fds[1], F_SETPIPE_SZ, max);
+        }
+    }
+    return 0;
+}
+
+// Parses a duration such as 30, 30s, 500ms, 2m or 1h (seconds by default); 0 if malformed
+static uint64_t parse_duration(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    double scale = 1e9;                    // Nanoseconds per unit
+    if (strcmp(end, "ms") == 0) scale = 1e6;
+    else if (strcmp(end, "m") == 0) scale = 60e9;
+    else if (strcmp(end, "h") == 0) scale = 3600e9;
+    else if (*end && strcmp(end, "s") != 0) return 0;
+    return end == text || !(value > 0) ? 0 : (uint64_t)(value * scale);
+}
+
+// Applies one limit option (--mem SIZE, --cpu N, --timeout DURATION) to limits;
+// returns -1 for an unknown option or a malformed value
+int limit_option(Limits *limits, const char *name, const char *value) {
+    if (strcmp(name, "--mem") == 0) return (limits->mem = parse_size(value)) > 0 ? 0 : -1;
+    if (strcmp(name, "--timeout") == 0) return (limits->timeout_ns = parse_duration(value)) > 0 ? 0 : -1;
+    if (strcmp(name, "--cpu") != 0) return -1;
+    char *end;
+    limits->cpu = strtod(value, &end);
+    return *end || end == value || !(limits->cpu > 0) ? -1 : 0;
+}
+
+// Writes text to a file in dir; 0 on success
+static int limit_write(const char *dir, const char *file, const char *text) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = write(fd, text, strlen(text));
+    close(fd);
+    return n == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+// Reads a small file from dir into buf, NUL-terminated; 0 on success
+static int limit_read(const char *dir, const char *file, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    return n < 0 ? -1 : 0;
+}
+
+// Finds where job cgroups can go, once per shell: the shell's own cgroup v2 directory,
+// with the cpu and memory controllers handed down to its children. The kernel refuses
+// that while the directory itself holds processes, so the shell first moves itself into
+// a leaf beside the job cgroups, as systemd does with delegated subtrees. If any step is
+// refused (no cgroup v2, not delegated to this user, other processes in the way), limiter
+// stays without a base and limits fall back to rlimits.
+static void limit_probe(void) {
+    limiter.probed = 1;
+    char mount[PATH_MAX] = "", own[PATH_MAX] = "", line[PATH_MAX * 2];
+    FILE *f = fopen("/proc/self/mountinfo", "re"); // "... mountpoint opts - cgroup2 ..."
+    while (f && fgets(line, sizeof(line), f)) {
+        char *dash = strstr(line, " - cgroup2 ");
+        char point[PATH_MAX];
+        if (dash && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            snprintf(mount, sizeof(mount), "%s", point);
+            break;
+        }
+    }
+    if (f) fclose(f);
+    f = fopen("/proc/self/cgroup", "re");  // "0::/path" is the v2 membership
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, sizeof(own), "%.4000s", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+        }
+    }
+    if (f) fclose(f);
+    if (!*mount) return;
+    char base[2 * PATH_MAX], available[256], enable[64] = "";
+    snprintf(base, sizeof(base), "%s%s", mount, own);
+    if (limit_read(base, "cgroup.controllers", available, sizeof(available)) < 0) return;
+    for (const char *c = available; (c = strstr(c, "cpu")) != NULL; c += 3) { // Not cpuset
+        if ((c == available || c[-1] == ' ') && (c[3] == ' ' || c[3] == '\n' || !c[3])) strcat(enable, "+cpu ");
+    }
+    if (strstr(available, "memory")) strcat(enable, "+memory");
+    if (!*enable) return;
+    if (limit_write(base, "cgroup.subtree_control", enable) < 0) {
+        char leaf[2 * PATH_MAX + 32];      // Holds the shell; job cgroups sit beside it
+        snprintf(leaf, sizeof(leaf), "%s/" LIMIT_CGROUP_PREFIX "%d", base, (int)getpid());
+        if (mkdir(leaf, 0755) < 0) return;
+        if (limit_write(leaf, "cgroup.procs", "0") < 0 || limit_write(base, "cgroup.subtree_control", enable) < 0) {
+            limit_write(base, "cgroup.procs", "0"); // Back where it was
+            rmdir(leaf);
+            return;
+        }
+    }
+    limit_read(base, "cgroup.subtree_control", limiter.controllers, sizeof(limiter.controllers));
+    limiter.base = strdup(base);
+}
+
+// Removes a job cgroup; one that still holds exiting processes is retried later
+static void limit_remove_cgroup(char *dir) {
+    if (rmdir(dir) == 0 || errno != EBUSY) {
+        free(dir);
+        return;
+    }
+    limiter.stale = realloc(limiter.stale, (limiter.num_stale + 1) * sizeof(char *));
+    limiter.stale[limiter.num_stale++] = dir;
+}
+
+// Creates a transient cgroup for a job with the requested memory and CPU caps; returns
+// 0, or -1 if cgroups cannot provide every limit asked for
+static int limit_cgroup(JobLimit *limit) {
+    if (!limiter.probed) limit_probe();
+    if (!limiter.base) return -1;
+    if (limit->want.mem && !strstr(limiter.controllers, "memory")) return -1;
+    if (limit->want.cpu && !strstr(limiter.controllers, "cpu")) return -1;
+    int stale = limiter.num_stale;         // Earlier cgroups whose last processes have exited by now
+    limiter.num_stale = 0;
+    for (int i = 0; i < stale; i++) limit_remove_cgroup(limiter.stale[i]);
+    
+    char dir[PATH_MAX], value[64];
+    snprintf(dir, sizeof(dir), "%s/" LIMIT_CGROUP_PREFIX "%d-%u", limiter.base, (int)getpid(), ++limiter.serial);
+    if (mkdir(dir, 0755) < 0) return -1;
+    int ok = 1;
+    if (limit->want.mem) {
+        snprintf(value, sizeof(value), "%lld", limit->want.mem);
+        ok = limit_write(dir, "memory.max", value) == 0;
+        limit_write(dir, "memory.swap.max", "0"); // Otherwise the job can page out past the limit
+        limit_write(dir, "memory.oom.group", "1"); // An OOM kill takes the whole job, not one stage
+    }
+    if (ok && limit->want.cpu) {
+        snprintf(value, sizeof(value), "%lld %d", (long long)(limit->want.cpu * LIMIT_CPU_PERIOD + 0.5), LIMIT_CPU_PERIOD);
+        ok = limit_write(dir, "cpu.max", value) == 0;
+    }
+    char procs[PATH_MAX + 16];
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", dir);
+    limit->procs_fd = ok ? open(procs, O_WRONLY | O_CLOEXEC) : -1;
+    if (limit->procs_fd < 0) {
+        rmdir(dir);
+        return -1;
+    }
+    limit->cgroup = strdup(dir);
+    return 0;
+}
+
+// Prepares a job's limits before its children start: a transient cgroup when --mem or
+// --cpu is given and cgroups allow it, otherwise RLIMIT_AS for --mem and a CPU affinity
+// mask of --cpu CPUs (rounded up). The --timeout clock is started by limit_arm.
+JobLimit *limit_create(Job *job, const Limits *want) {
+    JobLimit *limit = calloc(1, sizeof(JobLimit));
+    limit->job = job;
+    limit->want = *want;
+    limit->procs_fd = limit->timer_fd = -1;
+    if ((want->mem || want->cpu) && limit_cgroup(limit) < 0 && want->cpu) {
+        cpu_set_t allowed;                 // CPUs this shell may use
+        int need = (int)want->cpu + (want->cpu > (int)want->cpu); // Whole CPUs covering the request
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && need < CPU_COUNT(&allowed)) {
+            for (int cpu = 0; cpu < CPU_SETSIZE && CPU_COUNT(&limit->cpus) < need; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) CPU_SET(cpu, &limit->cpus);
+            }
+        }
+    }
+    return limit;
+}
+
+// Runs in a starting child, before exec: joins the job's cgroup, or applies the rlimit
+// and affinity that stand in for it. Only makes system calls, as spawn_child_setup needs.
+int limit_enter(const JobLimit *limit) {
+    if (limit->procs_fd >= 0) return write(limit->procs_fd, "0", 1) == 1 ? 0 : -1; // "0" moves the writer
+    if (limit->want.mem) {
+        struct rlimit rl = { limit->want.mem, limit->want.mem };
+        if (setrlimit(RLIMIT_AS, &rl) < 0) return -1;
+    }
+    if (CPU_COUNT(&limit->cpus) && sched_setaffinity(0, sizeof(limit->cpus), &limit->cpus) < 0) return -1;
+    return 0;
+}
+
+// Sets the --timeout timer to go off after ns
+static void limit_timer_set(JobLimit *limit, uint64_t ns) {
+    struct itimerspec when = {0};
+    when.it_value.tv_sec = ns / 1000000000ULL;
+    when.it_value.tv_nsec = ns % 1000000000ULL;
+    timerfd_settime(limit->timer_fd, 0, &when, NULL);
+}
+
+// Starts a limited job's --timeout clock, watched by the job event loop. Its epoll entry
+// carries the JobLimit pointer with the low bit set, which tells it apart from a pidfd's.
+void limit_arm(JobLimit *limit) {
+    if (!limit->want.timeout_ns || limit->job->state == JOB_DONE) return;
+    limit->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (limit->timer_fd < 0) return;
+    limit_timer_set(limit, limit->want.timeout_ns);
+    if (!jobs.enabled) return;             // Subshell: limit_wait_direct polls it
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void *)((uintptr_t)limit | 1);
+    epoll_ctl(jobs.epoll_fd, EPOLL_CTL_ADD, limit->timer_fd, &ev);
+}
+
+// Stops and closes a limited job's timer
+static void limit_disarm(JobLimit *limit) {
+    if (limit->timer_fd < 0) return;
+    if (jobs.enabled) epoll_ctl(jobs.epoll_fd, EPOLL_CTL_DEL, limit->timer_fd, NULL);
+    close(limit->timer_fd);
+    limit->timer_fd = -1;
+}
+
+// Sends sig to every process of a limited job: its process group, and for SIGKILL also
+// anything left in its cgroup, such as a daemon that started a group of its own
+static void limit_signal(JobLimit *limit, int sig) {
+    Job *job = limit->job;
+    if (sig == SIGKILL && limit->cgroup) limit_write(limit->cgroup, "cgroup.kill", "1");
+    if (job->pgid > 0) {
+        kill(-job->pgid, sig);
+        return;
+    }
+    for (int i = 0; i < job->num_procs; i++) {
+        if (!job->procs[i].done && job->procs[i].pid > 0) kill(job->procs[i].pid, sig);
+    }
+}
+
+// --timeout ran out: the job gets SIGTERM (and SIGCONT, in case it is stopped), then
+// SIGKILL if it is still there after LIMIT_GRACE_NS
+void limit_timer_fired(JobLimit *limit) {
+    uint64_t expirations;
+    if (read(limit->timer_fd, &expirations, sizeof(expirations)) < 0) {}
+    if (limit->job->state == JOB_DONE) return;
+    if (limit->signals++ == 0) {
+        limit->reason = LIMIT_TIMEOUT;
+        printf("Error: limit: '%s' timed out after %gs\n", limit->job->text, limit->want.timeout_ns / 1e9);
+        fflush(stdout);
+        limit_signal(limit, SIGTERM);
+        limit_signal(limit, SIGCONT);
+        limit_timer_set(limit, LIMIT_GRACE_NS);
+    } else {
+        limit_signal(limit, SIGKILL);
+    }
+}
+
+// Called once every process of a limited job has been reaped: stops the timer, checks
+// the cgroup for an OOM kill, and makes the reason the job's status (124 for a timeout,
+// 137 for memory) so that && and || can act on it
+void limit_job_done(Job *job) {
+    JobLimit *limit = job->limit;
+    limit_disarm(limit);
+    char events[512];                      // memory.events: "oom_kill N" among other counters
+    const char *oom;
+    if (limit->reason == LIMIT_NONE && limit->cgroup && limit_read(limit->cgroup, "memory.events", events, sizeof(events)) == 0 &&
+        (oom = strstr(events, "oom_kill ")) != NULL && atoll(oom + 9) > 0) {
+        limit->reason = LIMIT_MEMORY;
+        printf("Error: limit: '%s' was killed for exceeding --mem %lld bytes\n", job->text, limit->want.mem);
+    }
+    if (limit->reason == LIMIT_TIMEOUT) job->procs[job->status_index].status = LIMIT_STATUS_TIMEOUT;
+    if (limit->reason == LIMIT_MEMORY) job->procs[job->status_index].status = LIMIT_STATUS_MEMORY;
+}
+
+// Waits for a limited job in a subshell, which has no event loop: the children's pidfds
+// and the timer are polled together. Without pidfds the caller's blocking waits remain,
+// and the timeout is not enforced.
+void limit_wait_direct(Job *job) {
+    int n = job->num_procs;
+    struct pollfd *fds = calloc(n + 1, sizeof(struct pollfd));
+    for (int i = 0; i < n; i++) {
+        fds[i].fd = job->procs[i].done ? -1 : syscall(SYS_pidfd_open, job->procs[i].pid, 0);
+        fds[i].events = POLLIN;
+        if (fds[i].fd < 0 && !job->procs[i].done) n = -1; // No pidfds
+    }
+    if (n < 0) n = job->num_procs;
+    else {
+        fds[n].fd = job->limit->timer_fd;
+        fds[n].events = POLLIN;
+        while (job->live > 0) {
+            if (poll(fds, n + 1, -1) < 0 && errno != EINTR) break;
+            if (fds[n].revents) limit_timer_fired(job->limit);
+            for (int i = 0; i < n; i++) {
+                if (fds[i].fd < 0 || !fds[i].revents) continue;
+                int status;                // Raw wait status
+                struct rusage usage;
+                while (wait4(job->procs[i].pid, &status, 0, &usage) < 0 && errno == EINTR) {}
+                job_proc_exited(&job->procs[i], WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), &usage);
+                close(fds[i].fd);
+                fds[i].fd = -1;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (fds[i].fd >= 0) close(fds[i].fd);
+    }
+    free(fds);
+}
+
+// Releases a job's limits: the timer, and the cgroup after killing anything still in it
+void limit_free(JobLimit *limit) {
+    limit_disarm(limit);
+    if (limit->procs_fd >= 0) close(limit->procs_fd);
+    if (limit->cgroup) {
+        char populated[256];               // cgroup.events: "populated 0|1"
+        if (limit_read(limit->cgroup, "cgroup.events", populated, sizeof(populated)) == 0 && strstr(populated, "populated 1")) {
+            limit_write(limit->cgroup, "cgroup.kill", "1"); // Stragglers would hold the cgroup forever
+        }
+        limit_remove_cgroup(limit->cgroup);
+    }
+    if (limiter.starting == limit) limiter.starting = NULL;
+    free(limit);
+}
+
+// Moves a stage into the job's process group: pgid 0 makes pid the leader, -1 leaves it
+static void job_join_group(pid_t pid, pid_t *pgid) {
+    if (pid <= 0 || *pgid < 0) return;
+    if (*pgid == 0) *pgid = pid;           // First stage started leads the group
+    setpgid(pid, *pgid);                   // Also from the parent, so tcsetpgrp cannot race the child
+}
+
+// Starts the stages of a | or = chain as job->procs[base...]. in_fd feeds the stage that
+// reads first and out_fd takes the terminal-facing stage's output (-1 inherits either).
+// If the chain's pipes cannot be created its stages are recorded as failed and -1 returned.
+static int start_chain(Job *job, int base, Node *node, int in_fd, int out_fd, pid_t *pgid) {
+    Command *commands = node->commands;    // Stages in source order
+    int num_commands = node->num_commands;
+    int reverse = node->reverse;           // = wiring instead of |
+    int (*pipes)[2] = arena_alloc(&line_arena, sizeof(int[2]) * num_commands); // One per link
+    
+    // Create pipes for all links; close-on-exec keeps them out of children
+    for (int i = 0; i < num_commands - 1; i++) {
+        if (pipe_open(pipes[i]) < 0) {     // Attempt to create a pipe
+            printf("Error: Pipe creation failed\n"); // Report failure
+            for (int j = 0; j < i; j++) { close(pipes[j][0]); close(pipes[j][1]); }
+            for (int j = 0; j < num_commands; j++) job_add_proc(job, base + j, -1);
+            return -1;                     // Abort function
+        }
+    }
+    
+    // | : stage i reads pipe i-1 and writes pipe i.  = : stage i reads pipe i and writes pipe i-1,
+    // launched last to first so data flows back toward the first command.
+    for (int n = 0; n < num_commands; n++) {
+        int i = reverse ? num_commands - 1 - n : n;
+        int stage_in, stage_out;           // Pipe ends for this stage
+        if (!reverse) {
+            stage_in = i > 0 ? pipes[i-1][0] : in_fd;
+            stage_out = i < num_commands - 1 ? pipes[i][1] : out_fd;
+        } else {
+            stage_in = i < num_commands - 1 ? pipes[i][0] : in_fd;
+            stage_out = i > 0 ? pipes[i-1][1] : out_fd;
+        }
+        uint64_t t0 = job->traced ? trace_now_ns() : 0; // Launch latency, for time and VORTEX_TRACE
+        pid_t pid = commands[i].expand && expand_command(&commands[i]) < 0 ? -1
+                  : spawn_command(&commands[i], stage_in, stage_out, *pgid);
+        if (job->traced) job_trace_start(&job->procs[base + i], commands[i].args[0], t0);
+        job_join_group(pid, pgid);
+        job_add_proc(job, base + i, pid);
+    }
+    
+    // Parent closes all pipe ends to avoid interference
+    for (int i = 0; i < num_commands - 1; i++) {
+        close(pipes[i][0]);                // Close read end
+        close(pipes[i][1]);                // Close write end
+    }
+    return 0;
+}
+
+// Body of the fan-out pump: copies everything readable on in to each out[i] without
+// it entering user space. Each round tees the producer's pending data into every
+// consumer's private lag pipe (the last one takes it with splice, which consumes it),
+// then drains the lag pipes into the consumers. A round starts only once every lag
+// pipe is empty, so a slow consumer holds the producer back instead of buffering
+// without bound; a consumer that exits is dropped and the others continue.
+static void fanout_pump(int in, int *out, int (*lag)[2], int count) {
+    size_t *pending = calloc(count, sizeof(size_t)); // Bytes in lag[i] not yet passed on
+    struct pollfd *waits = calloc(count, sizeof(struct pollfd)); // Consumers with a full pipe
+    int live = count, eof = 0;             // Consumers still reading; producer finished
+    while (live > 0) {
+        while (1) {                        // Drain every lag pipe
+            int num_waits = 0;
+            for (int i = 0; i < count; i++) {
+                while (out[i] >= 0 && pending[i] > 0) {
+                    ssize_t n = splice(lag[i][0], NULL, out[i], NULL, pending[i], SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                    if (n > 0) pending[i] -= n;
+                    else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                        waits[num_waits].fd = out[i];
+                        waits[num_waits++].events = POLLOUT;
+                        break;
+                    } else {               // Consumer closed its end: stop feeding it
+                        close(out[i]);
+                        out[i] = -1;
+                        live--;
+                    }
+                }
+            }
+            if (num_waits == 0) break;
+            poll(waits, num_waits, -1);    // Backpressure: wait for the slowest full consumer
+        }
+        if (eof || live == 0) break;
+        
+        int first = -1, last = -1;         // Consumers that get tee'd and spliced copies
+        for (int i = 0; i < count; i++) {
+            if (out[i] < 0) continue;
+            if (first < 0) first = i;
+            last = i;
+        }
+        ssize_t len;                       // Bytes taken from the producer this round
+        if (first == last) len = splice(in, NULL, lag[last][1], NULL, INT_MAX, SPLICE_F_MOVE);
+        else len = tee(in, lag[first][1], INT_MAX, 0); // Blocks until data or end of input
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) {                    // End of input (or an error): drain and finish
+            eof = 1;
+            continue;
+        }
+        pending[first] = len;
+        for (int i = first + 1; i < last; i++) {
+            if (out[i] < 0) continue;
+            ssize_t n = tee(in, lag[i][1], len, 0); // Lag pipes are as large as the input pipe
+            pending[i] = n > 0 ? n : 0;
+        }
+        if (first != last) {               // The final copy consumes the data from the input pipe
+            size_t left = len;
+            while (left > 0) {
+                ssize_t n = splice(in, NULL, lag[last][1], NULL, left, SPLICE_F_MOVE);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                left -= n;
+            }
+            pending[last] = len - left;
+        }
+    }
+    free(pending);
+    free(waits);
+}
+
+// Starts producer |& { branches }: the producer's stages, then a pump process, then
+// every branch. The job's stages are laid out in that order, and its status is that
+// of the last branch's terminal-facing stage.
+static Job *fanout_start(Node *node, pid_t pgid) {
+    Node *producer = node->left;
+    int count = node->num_branches;
+    int num_procs = producer->num_commands + 1; // Producer stages plus the pump
+    for (int b = 0; b < count; b++) num_procs += node->branches[b]->num_commands;
+    
+    // Pipe 0 runs producer -> pump; for branch b, pipe 1+b runs pump -> branch and
+    // pipe 1+count+b is the pump's private lag pipe for that branch.
+    int num_pipes = 1 + 2 * count;
+    int (*pipes)[2] = arena_alloc(&line_arena, sizeof(int[2]) * num_pipes);
+    for (int i = 0; i < num_pipes; i++) {
+        if (pipe_open(pipes[i]) < 0) {
+            printf("Error: Pipe creation failed\n");
+            for (int j = 0; j < i; j++) { close(pipes[j][0]); close(pipes[j][1]); }
+            return NULL;
+        }
+    }
+    // tee copies at most what fits, so every lag pipe must hold a full input pipe
+    int capacity = fcntl(pipes[0][1], F_GETPIPE_SZ);
+    for (int b = 0; b < count; b++) {
+        int *lag = pipes[1 + count + b];
+        if (fcntl(lag[1], F_SETPIPE_SZ, capacity) < 0) { // Over this user's pipe quota
+            int got = fcntl(lag[1], F_GETPIPE_SZ);
+            if (got < capacity) capacity = got;
+        }
+    }
+    if (fcntl(pipes[0][1], F_GETPIPE_SZ) > capacity) fcntl(pipes[0][1], F_SETPIPE_SZ, capacity); // Still empty
+    
+    Job *job = job_create(node, num_procs); // Tracks every stage until it is reaped
+    if (!jobs.interactive && !node->limits) pgid = -1; // Without job control children stay in the shell's group
+    int base = 0;                          // Next stage index
+    start_chain(job, base, producer, -1, pipes[0][1], &pgid);
+    base += producer->num_commands;
+    
+    uint64_t t0 = job->traced ? trace_now_ns() : 0;
+    fflush(stdout);                        // Child must not replay buffered output
+    pid_t pid = fork();                    // Only the shell's code can run the pump
+    if (pid == 0) {
+        int *outs = malloc(count * sizeof(int)); // Consumer pipe write ends
+        int (*lags)[2] = malloc(count * sizeof(int[2]));
+        fcntl(pipes[0][0], F_SETFD, 0);    // Kept across job_child_reset's close-on-exec sweep
+        for (int b = 0; b < count; b++) {
+            outs[b] = pipes[1 + b][1];
+            lags[b][0] = pipes[1 + count + b][0];
+            lags[b][1] = pipes[1 + count + b][1];
+            fcntl(outs[b], F_SETFD, 0);
+            fcntl(lags[b][0], F_SETFD, 0);
+            fcntl(lags[b][1], F_SETFD, 0);
+        }
+        if (limiter.starting && limit_enter(limiter.starting) < 0) _exit(1);
+        job_child_reset();
+        if (pgid >= 0) setpgid(0, pgid);   // Leads the group if the producer failed to start
+        signal(SIGPIPE, SIG_IGN);          // A consumer exiting is an EPIPE to handle, not a kill
+        fanout_pump(pipes[0][0], outs, lags, count);
+        _exit(0);
+    }
+    if (pid < 0) printf("Error: Cannot start fan-out\n");
+    if (job->traced) job_trace_start(&job->procs[base], "(fan-out)", t0);
+    job_join_group(pid, &pgid);
+    job_add_proc(job, base, pid);
+    base++;
+    
+    for (int b = 0; b < count; b++) {
+        start_chain(job, base, node->branches[b], pipes[1 + b][0], -1, &pgid);
+        if (b == count - 1) job->status_index = base + (node->branches[b]->reverse ? 0 : node->branches[b]->num_commands - 1);
+        base += node->branches[b]->num_commands;
+    }
+    job->pgid = pgid > 0 ? pgid : 0;
+    for (int i = 0; i < num_pipes; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    return job;
+}
+
+// Starts the stages of a | or = pipeline as a new job; NULL if its pipes could not be created
+static Job *chain_start(Node *node, pid_t pgid) {
+    Job *job = job_create(node, node->num_commands); // Tracks every stage until it is reaped
+    if (!jobs.interactive && !node->limits) pgid = -1; // Without job control children stay in the shell's group
+    if (start_chain(job, 0, node, -1, -1, &pgid) < 0) {
+        job_free(job);                     // Nothing was started
+        return NULL;
+    }
+    job->pgid = pgid > 0 ? pgid : 0;
+    job->status_index = node->reverse ? 0 : node->num_commands - 1;
+    return job;
+}
+
+// Starts every stage of a pipeline and returns the job tracking them, or NULL if the
+// pipes could not be created. pgid 0 gives the job its own process group, led by the
+// first stage started; -1 keeps the stages in the shell's group.
+// A limited job always gets its own process group, which a timeout kills as a whole.
+Job *job_start(Node *node, pid_t pgid) {
+    if (node->limits) pgid = 0;
+    Job *job = node->type == NODE_FANOUT ? fanout_start(node, pgid) : chain_start(node, pgid);
+    limiter.starting = NULL;               // Later children are not part of this job
+    if (job && job->limit) limit_arm(job->limit); // The clock starts once every stage runs
+    return job;
+}
+
+// Runs a pipeline as one job in its own process group. Foreground jobs are waited for
+// and return the status of the stage whose output reaches the terminal (last for |,
+// first for =); background jobs return 0.
+int run_job(Node *node, int background) {
+    Job *job = job_start(node, 0);
+    if (!job) return 1;                    // Error already printed
+    if (!background) return job_wait_foreground(job); // Reaped through the event loop, not blocking waits
+    pid_t last_pid = -1;                   // Announced like bash's [1] pid
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].pid > 0) last_pid = job->procs[i].pid;
+    }
+    return job_launched(job, last_pid);
+}
+
+// Manages execution of commands connected by standard pipes (|)
+int handle_pipes(Node *node) {
+    return run_job(node, 0);
+}
+
+// Executes commands with reverse pipe logic using '=' operator
+int handle_reverse_pipes(Node *node) {
+    return run_job(node, 0);
+}
+
+// Handles file append operation (~) by cross-appending file contents.
+// Both original lengths are snapshotted first, so each append copies a fixed range
+// at a fixed offset; a journal records progress so a crash can be rolled forward.
+int handle_file_append(char *file1, char *file2) {
+    int fd1 = open(file1, O_RDWR | O_CREAT | O_CLOEXEC, 0666); // Open or create file1
+    if (fd1 < 0) {                         // Check if file1 opened successfully
+        printf("Error: Cannot open or create file %s\n", file1);
+        return 1;                          // Exit function
+    }
+    int fd2 = open(file2, O_RDWR | O_CREAT | O_CLOEXEC, 0666); // Open or create file2
+    if (fd2 < 0) {                         // Check if file2 opened successfully
+        printf("Error: Cannot open or create file %s\n", file2);
+        close(fd1);                        // Close file1
+        return 1;                          // Exit function
+    }
+    
+    struct stat st1, st2;                  // Snapshot of both files before any write
+    if (fstat(fd1, &st1) < 0 || fstat(fd2, &st2) < 0) {
+        printf("Error: Cannot read file sizes\n");
+        close(fd1);
+        close(fd2);
+        return 1;
+    }
+    int same = st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino; // a ~ a appends twice
+    
+    // Journal the plan before touching either file
+    char journal[PATH_MAX];                // Journal path for this shell
+    char name[64];                         // Per-process journal name
+    char real1[PATH_MAX], real2[PATH_MAX]; // Absolute paths for recovery from any cwd
+    snprintf(name, sizeof(name), SWAP_JOURNAL_PREFIX "%d.journal", (int)getpid());
+    int journaled = state_path(name, journal, sizeof(journal)) == 0 &&
+                    realpath(file1, real1) && realpath(file2, real2);
+    if (journaled && access(journal, F_OK) == 0) { // An earlier ~ in this shell could not be settled
+        recover_file_append();
+        if (access(journal, F_OK) == 0) {  // Still pending: keep its journal rather than overwrite it
+            printf("Error: An earlier ~ is still unfinished; not starting another\n");
+            close(fd1);
+            close(fd2);
+            return 1;
+        }
+    }
+    if (journaled) {
+        FILE *j = fopen(journal, "w");     // Small text record, rewritten per phase
+        journaled = j != NULL;
+        if (j) {
+            fprintf(j, "0\n%lld %lld %d\n%llu %llu %llu %llu\n%s\n%s\n",
+                    (long long)st1.st_size, (long long)st2.st_size, same,
+                    (unsigned long long)st1.st_dev, (unsigned long long)st1.st_ino,
+                    (unsigned long long)st2.st_dev, (unsigned long long)st2.st_ino, real1, real2);
+            fflush(j);
+            fdatasync(fileno(j));          // Plan must be durable before data moves
+            fclose(j);
+        }
+    }
+    
+    int status = 0;                        // Exit status of the operation
+    int settled = 1;                       // Both files are whole: the journal can go
+    if (run_swap_append(fd1, fd2, st1.st_size, st2.st_size, same, 0, journaled ? journal : NULL) < 0) {
+        // Undo any partial append so neither file keeps half of the operation
+        settled = ftruncate(fd1, st1.st_size) == 0 && ftruncate(fd2, st2.st_size) == 0 &&
+                  fdatasync(fd1) == 0 && fdatasync(fd2) == 0;
+        printf("Error: Failed to append between %s and %s%s\n", file1, file2, // Report write failure
+               settled ? "; both files left unchanged" : journaled ? "; will retry at next start" : "");
+        status = 1;
+    }
+    if (journaled && settled) unlink(journal); // Otherwise the next start rolls it forward
+    close(fd1);                            // Close file1 after appending
+    close(fd2);                            // Close file2 after appending
+    return status;
+}
+
+// Runs the appends from the given phase: 0 = file2 -> end of file1, 1 = file1 -> end of file2.
+// Offsets come from the snapshot, so repeating a phase after a crash rewrites the same bytes.
+int run_swap_append(int fd1, int fd2, off_t len1, off_t len2, int same, int phase, const char *journal) {
+    if (phase == 0) {
+        if (copy_range(fd2, 0, fd1, len1, len2) < 0) return -1; // Append original file2 to file1
+        if (fdatasync(fd1) < 0) return -1; // First half durable before recording it
+        if (journal) {                     // Record progress: only phase 1 remains
+            int j = open(journal, O_WRONLY | O_CLOEXEC);
+            if (j >= 0) {
+                if (pwrite(j, "1", 1, 0) == 1) fdatasync(j); // Phase digit is the journal's first byte
+                close(j);
+            }
+        }
+    }
+    off_t dest = same ? len1 + len2 : len2; // Same file: second copy lands after the first
+    if (copy_range(fd1, 0, fd2, dest, len1) < 0) return -1; // Append original file1 to file2
+    return fdatasync(fd2);                 // Both halves durable before the journal goes
+}
+
+// Copies len bytes from in_fd at in_off to out_fd at out_off in O(1) memory:
+// reflink when the filesystem allows it, then copy_file_range, then a fixed buffer
+int copy_range(int in_fd, off_t in_off, int out_fd, off_t out_off, off_t len) {
+    if (len == 0) return 0;                // Nothing to move
+    struct file_clone_range clone = {      // Share extents instead of copying data
+        .src_fd = in_fd, .src_offset = in_off, .src_length = len, .dest_offset = out_off,
+    };
+    if (ioctl(out_fd, FICLONERANGE, &clone) == 0) return 0; // Needs block-aligned offsets
+    
+    off_t in_pos = in_off, out_pos = out_off; // Explicit offsets leave file positions untouched
+    off_t left = len;                      // Bytes still to copy
+    while (left > 0) {
+        ssize_t n = copy_file_range(in_fd, &in_pos, out_fd, &out_pos, left > COPY_CHUNK ? COPY_CHUNK : left, 0);
+        if (n > 0) { left -= n; continue; } // Kernel advanced in_pos and out_pos
+        if (n == 0) return -1;             // Source shrank under us
+        if (errno == EINTR) continue;      // Interrupted, retry
+        if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) return -1;
+        break;                             // Unsupported here: use the buffer loop
+    }
+    
+    static char buffer[COPY_BUF_SIZE];     // Fixed buffer shared with stream_file's fallback size
+    while (left > 0) {
+        ssize_t n = pread(in_fd, buffer, left > (off_t)sizeof(buffer) ? (off_t)sizeof(buffer) : left, in_pos);
+        if (n < 0 && errno == EINTR) continue; // Interrupted, retry
+        if (n <= 0) return -1;             // Error or source shrank
+        for (ssize_t off = 0; off < n; ) { // Handle short writes
+            ssize_t w = pwrite(out_fd, buffer + off, n - off, out_pos + off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0) return -1;
+            off += w;
+        }
+        in_pos += n;                       // Advance both offsets
+        out_pos += n;
+        left -= n;
+    }
+    return 0;
+}
+
+// Rolls forward ~ operations whose shell died mid-way, using their journals
+void recover_file_append(void) {
+    char dir[PATH_MAX];                    // State directory holding journals
+    if (state_path("", dir, sizeof(dir)) < 0) return; // No state directory: nothing to recover
+    DIR *d = opendir(dir);
+    if (!d) return;
+    
+    struct dirent *ent;                    // Directory entry being inspected
+    while ((ent = readdir(d)) != NULL) {
+        int pid;                           // Shell that wrote the journal
+        if (sscanf(ent->d_name, SWAP_JOURNAL_PREFIX "%d.journal", &pid) != 1) continue;
+        if (pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM)) continue; // Owner still running
+        
+        char path[PATH_MAX * 2];           // Full journal path
+        snprintf(path, sizeof(path), "%s%s", dir, ent->d_name);
+        FILE *j = fopen(path, "r");
+        if (!j) continue;
+        int phase;                         // 1 once file1 has received its append
+        long long len1, len2;              // Snapshotted original lengths
+        int same;                          // Both names referred to one file
+        unsigned long long dev1, ino1, dev2, ino2; // Identity of the files at snapshot time
+        char file1[PATH_MAX], file2[PATH_MAX]; // Absolute paths
+        int ok = fscanf(j, "%d\n%lld %lld %d\n%llu %llu %llu %llu\n", &phase, &len1, &len2, &same,
+                        &dev1, &ino1, &dev2, &ino2) == 8 &&
+                 fgets(file1, sizeof(file1), j) && fgets(file2, sizeof(file2), j);
+        fclose(j);
+        if (!ok) { unlink(path); continue; } // Unreadable journal: drop it
+        file1[strcspn(file1, "\n")] = '\0';
+        file2[strcspn(file2, "\n")] = '\0';
+        
+        int fd1 = open(file1, O_RDWR | O_CLOEXEC), fd2 = open(file2, O_RDWR | O_CLOEXEC);
+        struct stat st1, st2;              // Files must still be the ones journaled
+        int keep = 0;                      // Recovery failed: try again at the next start
+        if (fd1 >= 0 && fd2 >= 0 && fstat(fd1, &st1) == 0 && fstat(fd2, &st2) == 0 &&
+            st1.st_dev == dev1 && st1.st_ino == ino1 && st2.st_dev == dev2 && st2.st_ino == ino2) {
+            // Sizes this ~ alone can have left: the file of the current phase anywhere between
+            // its snapshot length and its full length, as a copy cut short leaves it, and the
+            // other one untouched or done. Anything else means another writer appended since,
+            // and replaying at the snapshot offsets would overwrite its data.
+            long long mid1 = len1 + len2;  // file1 once phase 0 is done
+            long long end2 = same ? mid1 + len1 : len2 + len1; // file2 once phase 1 is done
+            int sized;                     // Sizes fit the journaled phase
+            if (same) sized = phase == 0 ? st1.st_size >= len1 && st1.st_size <= mid1
+                                         : st1.st_size >= mid1 && st1.st_size <= end2;
+            else if (phase == 0) sized = st1.st_size >= len1 && st1.st_size <= mid1 && st2.st_size == len2;
+            else sized = st1.st_size == mid1 && st2.st_size >= len2 && st2.st_size <= end2;
+            if (!sized) {
+                fprintf(stderr, "Skipping recovery of ~ between %s and %s: files changed since\n", file1, file2);
+            } else {
+                fprintf(stderr, "Recovering interrupted ~ between %s and %s\n", file1, file2);
+                if (run_swap_append(fd1, fd2, len1, len2, same, phase, NULL) < 0) {
+                    fprintf(stderr, "Error: Recovery of ~ between %s and %s failed\n", file1, file2);
+                    keep = 1;
+                }
+            }
+        }
+        if (fd1 >= 0) close(fd1);
+        if (fd2 >= 0) close(fd2);
+        if (!keep) unlink(path);           // Recovered or no longer applicable
+    }
+    closedir(d);
+}
+
+// decode_stream sink for #: counts each decoded buffer into the WordCount in ctx
+static int wc_decoded(const unsigned char *buf, size_t len, void *ctx) {
+    wc_feed(ctx, buf, len);
+    return 0;
+}
+
+// Counts lines, words and bytes in a specified file, like wc in the C locale
+int count_words(char *filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC); // Open file for reading
+    struct stat st;                        // File metadata picks the counting strategy
+    if (fd < 0 || fstat(fd, &st) < 0) {    // Check if file opened successfully
+        printf("Error: Cannot open file %s\n", filename);
+        if (fd >= 0) close(fd);            // Release descriptor on fstat failure
+        return 1;                          // Exit function on failure
+    }
+    
+    WordCount wc = {0};                    // Accumulators for the whole file
+    int status = 0;                        // Exit status of the operation
+    int format = decode_detect(fd, &st);   // gzip and zstd files count as their decompressed text
+    if (format != DECODE_NONE) {           // Not checkpointed: resuming would need the decoder's state
+        if (decode_stream(fd, format, wc_decoded, &wc) < 0) {
+            printf("Error: Failed to decompress file %s\n", filename);
+            status = 1;
+        } else {
+            printf("%llu %llu %llu %s\n", wc.lines, wc.words, wc.bytes, filename); // wc order, decompressed bytes
+        }
+        close(fd);
+        return status;
+    }
+    off_t start = wc_cache_lookup(&st, fd, &wc); // Resume after bytes counted on an earlier run
+    if (count_fd(fd, &st, start, &wc) < 0) { // Single pass over the unseen bytes
+        printf("Error: Failed to read file %s\n", filename);
+        status = 1;
+    } else {
+        printf("%llu %llu %llu %s\n", wc.lines, wc.words, wc.bytes, filename); // wc order
+        wc_cache_store(&st, fd, &wc);      // Let the next run start from here
+    }
+    close(fd);                             // Close the file
+    return status;
+}
+
+// Byte classes for wc -w semantics: spaces end words, printable ASCII starts them,
+// everything else (controls, bytes >= 0x80) is transparent and leaves the state alone
+enum { WC_OTHER = 0, WC_PRINT = 1, WC_SPACE = 2 };
+
+// Classifies one byte into WC_OTHER, WC_PRINT or WC_SPACE
+static inline int wc_class(unsigned char c) {
+    if (c == ' ' || (c >= '\t' && c <= '\r')) return WC_SPACE; // Space, \t \n \v \f \r
+    if (c > ' ' && c < 0x7f) return WC_PRINT; // Printable, non-space ASCII
+    return WC_OTHER;                       // Transparent byte
+}
+
+// Folds one 64-byte block, given as bitmasks, into the running counts.
+// Words start at the first printable byte of each run of non-space bytes; the
+// carry of q + starts clears the transparent prefix of each run so that runs
+// without any printable byte (or before their first one) do not count.
+static inline void wc_block(WordCount *wc, uint64_t print, uint64_t space, uint64_t nl) {
+    uint64_t carry = (uint64_t)wc->in_word;          // State entering bit 0
+    uint64_t g = ~space;                             // Non-space runs
+    uint64_t q = g & ~print;                         // Transparent bytes
+    uint64_t starts = g & ~(g << 1) & ~carry;        // Runs beginning in this block
+    uint64_t inside = g & ~(q & ~(q + (starts & q))); // In-word state after each byte
+    wc->words += __builtin_popcountll(print & ~((inside << 1) | carry));
+    wc->lines += __builtin_popcountll(nl);
+    wc->in_word = (int)(inside >> 63);               // State leaving the block
+}
+
+// Scalar kernel: builds the block masks one byte at a time
+static size_t wc_kernel_scalar(WordCount *wc, const unsigned char *buf, size_t len) {
+    size_t done = 0;                       // Bytes folded so far
+    for (; done + 64 <= len; done += 64) { // Whole blocks only; caller handles the tail
+        uint64_t print = 0, space = 0, nl = 0; // Per-block class masks
+        for (int i = 0; i < 64; i++) {
+            unsigned char c = buf[done + i];
+            int cls = wc_class(c);
+            print |= (uint64_t)(cls == WC_PRINT) << i;
+            space |= (uint64_t)(cls == WC_SPACE) << i;
+            nl |= (uint64_t)(c == '\n') << i;
+        }
+        wc_block(wc, print, space, nl);
+    }
+    return done;                           // Number of bytes consumed
+}
+
+#ifdef WC_HAVE_X86
+// SSE2 kernel: classifies 16 bytes per compare using signed byte arithmetic
+__attribute__((target("sse2")))
+static size_t wc_kernel_sse2(WordCount *wc, const unsigned char *buf, size_t len) {
+    const __m128i lo_print = _mm_set1_epi8(0x20), hi_print = _mm_set1_epi8(0x7f);
+    const __m128i lo_ctl = _mm_set1_epi8(0x08), hi_ctl = _mm_set1_epi8(0x0e);
+    const __m128i sp = _mm_set1_epi8(' '), lf = _mm_set1_epi8('\n');
+    size_t done = 0;                       // Bytes folded so far
+    for (; done + 64 <= len; done += 64) {
+        uint64_t print = 0, space = 0, nl = 0; // Per-block class masks
+        for (int i = 0; i < 4; i++) {      // Four 16-byte lanes per block
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + done + i * 16));
+            __m128i p = _mm_and_si128(_mm_cmpgt_epi8(v, lo_print), _mm_cmplt_epi8(v, hi_print));
+            __m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                        _mm_and_si128(_mm_cmpgt_epi8(v, lo_ctl), _mm_cmplt_epi8(v, hi_ctl)));
+            print |= (uint64_t)(uint16_t)_mm_movemask_epi8(p) << (i * 16);
+            space |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (i * 16);
+            nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)) << (i * 16);
+        }
+        wc_block(wc, print, space, nl);
+    }
+    return done;                           // Number of bytes consumed
+}
+
+// AVX2 kernel: same classification, 32 bytes per compare
+__attribute__((target("avx2")))
+static size_t wc_kernel_avx2(WordCount *wc, const unsigned char *buf, size_t len) {
+    const __m256i lo_print = _mm256_set1_epi8(0x20), hi_print = _mm256_set1_epi8(0x7f);
+    const __m256i lo_ctl = _mm256_set1_epi8(0x08), hi_ctl = _mm256_set1_epi8(0x0e);
+    const __m256i sp = _mm256_set1_epi8(' '), lf = _mm256_set1_epi8('\n');
+    size_t done = 0;                       // Bytes folded so far
+    for (; done + 64 <= len; done += 64) {
+        uint64_t print = 0, space = 0, nl = 0; // Per-block class masks
+        for (int i = 0; i < 2; i++) {      // Two 32-byte lanes per block
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + done + i * 32));
+            __m256i p = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo_print), _mm256_cmpgt_epi8(hi_print, v));
+            __m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                        _mm256_and_si256(_mm256_cmpgt_epi8(v, lo_ctl), _mm256_cmpgt_epi8(hi_ctl, v)));
+            print |= (uint64_t)(uint32_t)_mm256_movemask_epi8(p) << (i * 32);
+            space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (i * 32);
+            nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf)) << (i * 32);
+        }
+        wc_block(wc, print, space, nl);
+    }
+    return done;                           // Number of bytes consumed
+}
+#endif
+
+static size_t (*wc_kernel)(WordCount *, const unsigned char *, size_t); // Chosen by wc_init
+static pthread_once_t wc_once = PTHREAD_ONCE_INIT; // Guards wc_init across worker threads
+static __thread sigjmp_buf *wc_fault;      // Set while this thread reads a mapped file
+
+// SIGBUS from a mapped page past the end of a file that shrank while # counted it:
+// abandon that count. Any other SIGBUS gets the default action when the access repeats.
+static void wc_sigbus(int sig) {
+    if (wc_fault) siglongjmp(*wc_fault, 1);
+    signal(sig, SIG_DFL);
+}
+
+// Picks the widest kernel the CPU supports and installs the SIGBUS guard
+static void wc_init(void) {
+    wc_kernel = wc_kernel_scalar;          // Portable default
+#ifdef WC_HAVE_X86
+    __builtin_cpu_init();                  // Populate CPU feature bits
+    if (__builtin_cpu_supports("avx2")) wc_kernel = wc_kernel_avx2;
+    else if (__builtin_cpu_supports("sse2")) wc_kernel = wc_kernel_sse2;
+#endif
+    const char *force = getenv("VORTEX_WC_KERNEL"); // Lets benchmarks pin a kernel
+    if (force && strcmp(force, "scalar") == 0) wc_kernel = wc_kernel_scalar;
+    
+    struct sigaction sa = {0};
+    sa.sa_handler = wc_sigbus;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+// Advances counts over an arbitrary buffer; state carries over to the next call
+void wc_feed(WordCount *wc, const unsigned char *buf, size_t len) {
+    pthread_once(&wc_once, wc_init);       // Kernel chosen once, before any thread uses it
+    size_t done = wc_kernel(wc, buf, len); // Vectorized bulk
+    for (; done < len; done++) {           // Scalar tail of fewer than 64 bytes
+        int cls = wc_class(buf[done]);
+        if (cls == WC_SPACE) wc->in_word = 0; // Whitespace ends any word
+        else if (cls == WC_PRINT && !wc->in_word) { // Printable byte opens a word
+            wc->words++;
+            wc->in_word = 1;
+        }
+        if (buf[done] == '\n') wc->lines++; // Track lines in the same pass
+    }
+    wc->bytes += len;                      // Every byte counts toward the total
+}
+
+// One worker's slice of a mapped file; counted as if it began outside a word
+typedef struct {
+    const unsigned char *data;             // Start of the slice
+    size_t len;                            // Slice length
+    WordCount wc;                          // Counts assuming in_word = 0 at entry
+    int first_class;                       // Class of the first non-transparent byte
+    int truncated;                         // Set if the file shrank under the slice
+} WcSlice;
+
+// Thread entry point: counts one slice independently
+static void *wc_slice_worker(void *arg) {
+    WcSlice *slice = arg;                  // Slice assigned to this thread
+    sigjmp_buf fault;                      // Landing point if the slice's pages vanish
+    if (sigsetjmp(fault, 1)) {
+        wc_fault = NULL;
+        slice->truncated = 1;
+        return NULL;
+    }
+    wc_fault = &fault;
+    slice->first_class = WC_OTHER;         // Assume the slice has no events
+    for (size_t i = 0; i < slice->len; i++) { // Find the first byte that changes state
+        int cls = wc_class(slice->data[i]);
+        if (cls != WC_OTHER) { slice->first_class = cls; break; }
+    }
+    wc_feed(&slice->wc, slice->data, slice->len); // Count the slice
+    wc_fault = NULL;
+    return NULL;
+}
+
+// Counts a mapped region, splitting large inputs across worker threads.
+// Returns -1 if the file shrank under the mapping; wc is then incomplete.
+static int wc_count_mapped(WordCount *wc, const unsigned char *data, size_t len) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN); // Online CPUs bound the useful parallelism
+    size_t nthreads = len / WC_MIN_PER_THREAD; // Keep each slice large enough to amortize startup
+    if (nthreads > (size_t)cpus) nthreads = cpus > 0 ? (size_t)cpus : 1;
+    if (nthreads > WC_MAX_THREADS) nthreads = WC_MAX_THREADS;
+    if (nthreads < 1) nthreads = 1;        // Small input: one slice, counted inline
+    pthread_once(&wc_once, wc_init);       // Guard installed before any page is touched
+    
+    WcSlice slices[WC_MAX_THREADS] = {{0}}; // Per-thread slices and results
+    pthread_t threads[WC_MAX_THREADS];     // Worker handles
+    int started[WC_MAX_THREADS] = {0};     // Tracks which workers actually launched
+    size_t step = len / nthreads;          // Even split; boundaries are stitched below
+    for (size_t i = 0; i < nthreads; i++) {
+        slices[i].data = data + i * step;
+        slices[i].len = (i == nthreads - 1) ? len - i * step : step;
+        started[i] = nthreads > 1 && pthread_create(&threads[i], NULL, wc_slice_worker, &slices[i]) == 0;
+        if (!started[i]) wc_slice_worker(&slices[i]); // Count inline
+    }
+    
+    // Stitch: a slice whose first event is printable continues the previous word
+    int status = 0;                        // -1 once any slice was cut short
+    for (size_t i = 0; i < nthreads; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        WcSlice *sl = &slices[i];
+        if (sl->truncated) status = -1;
+        unsigned long long words = sl->wc.words;
+        if (wc->in_word && sl->first_class == WC_PRINT) words--; // Word spans the boundary
+        wc->words += words;
+        wc->lines += sl->wc.lines;
+        wc->bytes += sl->len;
+        if (sl->first_class != WC_OTHER) wc->in_word = sl->wc.in_word; // Slice had events
+    }
+    return status;
+}
+
+// Counts an open file from offset start: mmap for regular files, large reads otherwise
+int count_fd(int fd, struct stat *st, off_t start, WordCount *wc) {
+    if (S_ISREG(st->st_mode) && st->st_size > start) { // Mappable input
+        off_t aligned = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1); // mmap needs page alignment
+        size_t map_len = st->st_size - aligned; // Map through the end of the file
+        void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, aligned);
+        if (map != MAP_FAILED) {
+            madvise(map, map_len, MADV_SEQUENTIAL); // Aggressive readahead
+            int status = wc_count_mapped(wc, (unsigned char *)map + (start - aligned), st->st_size - start);
+            munmap(map, map_len);          // Release the mapping
+            return status;                 // -1: the file shrank while being counted
+        }
+    }
+    if (S_ISREG(st->st_mode) && start > 0 && lseek(fd, start, SEEK_SET) < 0) return -1;
+    
+    static unsigned char buffer[WC_BUF_SIZE]; // Streaming buffer for pipes and special files
+    ssize_t n;                             // Bytes returned by each read
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {                       // Read failed
+            if (errno == EINTR) continue;  // Interrupted, retry
+            return -1;                     // Report failure to caller
+        }
+        wc_feed(wc, buffer, n);            // Counts carry across reads
+    }
+    return 0;
+}
+
+// Builds $XDG_CACHE_HOME/vortexshell/<name> (or ~/.cache/...), creating directories as needed
+int state_path(const char *name, char *path, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME"); // Preferred cache root
+    const char *home = getenv("HOME");     // Fallback root
+    int n;                                 // Length of the formatted path
+    if (base && *base) n = snprintf(path, size, "%s", base);
+    else if (home && *home) n = snprintf(path, size, "%s/.cache", home);
+    else return -1;                        // Nowhere sensible to keep state
+    if (n < 0 || (size_t)n >= size) return -1; // Path would not fit
+    mkdir(path, 0700);                     // Cache root may not exist yet
+    
+    n += snprintf(path + n, size - n, "/vortexshell");
+    if ((size_t)n >= size) return -1;      // Path would not fit
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) return -1; // Shell's own directory
+    n = snprintf(path + n, size - n, "/%s", name); // Append the file name
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// FNV-1a over the first and last WC_FINGERPRINT_LEN bytes before offset; 0 means unreadable
+uint64_t wc_fingerprint(int fd, uint64_t offset) {
+    unsigned char buf[WC_FINGERPRINT_LEN]; // One window at a time
+    uint64_t windows[2] = {0, offset > sizeof(buf) ? offset - sizeof(buf) : 0}; // Head, tail
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV offset basis
+    for (int w = 0; w < 2; w++) {
+        uint64_t len = offset - windows[w] < sizeof(buf) ? offset - windows[w] : sizeof(buf);
+        ssize_t n = pread(fd, buf, len, windows[w]);
+        if (n < 0 || (uint64_t)n != len) return 0; // Short read: treat as changed
+        for (ssize_t i = 0; i < n; i++) {
+            hash ^= buf[i];
+            hash *= 0x100000001b3ULL;      // FNV prime
+        }
+    }
+    return hash ? hash : 1;                // Reserve 0 for "unreadable"
+}
+
+// Loads the checkpoint table; returns the number of entries read
+static int wc_cache_load(WcCheckpoint *table, char *path, size_t path_size) {
+    if (getenv("VORTEX_WC_CACHE") && strcmp(getenv("VORTEX_WC_CACHE"), "0") == 0) return -1;
+    if (state_path(WC_CACHE_FILE, path, path_size) < 0) return -1; // No state directory
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;                  // First use: empty table
+    ssize_t n = read(fd, table, sizeof(WcCheckpoint) * WC_CACHE_ENTRIES);
+    close(fd);
+    return n > 0 ? (int)(n / sizeof(WcCheckpoint)) : 0;
+}
+
+// Modification time in nanoseconds, as stored in a checkpoint
+static int64_t wc_mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Restores counts for the already-seen prefix of an append-only file.
+// Returns the offset to resume from, or 0 for a full recount.
+off_t wc_cache_lookup(struct stat *st, int fd, WordCount *wc) {
+    if (!S_ISREG(st->st_mode) || st->st_size < WC_CACHE_MIN) return 0; // Not worth tracking
+    WcCheckpoint table[WC_CACHE_ENTRIES];  // Whole table fits comfortably on the stack
+    char path[MAX_LINE * 4];               // Location of the checkpoint file
+    int count = wc_cache_load(table, path, sizeof(path));
+    for (int i = 0; i < count; i++) {
+        WcCheckpoint *cp = &table[i];
+        if (cp->dev != (uint64_t)st->st_dev || cp->ino != (uint64_t)st->st_ino) continue;
+        // Truncated, or rewritten in place (rotation via copytruncate): recount from scratch
+        if (cp->offset > (uint64_t)st->st_size || cp->fingerprint != wc_fingerprint(fd, cp->offset)) return 0;
+        // Modified without growing: nothing was appended, so the write landed inside the prefix
+        if (cp->offset == (uint64_t)st->st_size && cp->mtime_ns != wc_mtime_ns(st)) return 0;
+        wc->lines = cp->lines;             // Resume with the stored prefix totals
+        wc->words = cp->words;
+        wc->bytes = cp->offset;
+        wc->in_word = cp->in_word;
+        return (off_t)cp->offset;          // Only the appended bytes remain to be counted
+    }
+    return 0;                              // Unknown file (new, replaced or rotated inode)
+}
+
+// Saves the counts at the current end of file, evicting the least recently used entry if full
+void wc_cache_store(struct stat *st, int fd, WordCount *wc) {
+    if (!S_ISREG(st->st_mode) || wc->bytes < WC_CACHE_MIN) return; // Not worth tracking
+    WcCheckpoint table[WC_CACHE_ENTRIES];  // Current table contents
+    char path[MAX_LINE * 4];               // Location of the checkpoint file
+    int count = wc_cache_load(table, path, sizeof(path));
+    if (count < 0) return;                 // Cache disabled or unavailable
+    
+    int slot = -1;                         // Entry to overwrite
+    for (int i = 0; i < count && slot < 0; i++) { // Same file already tracked?
+        if (table[i].dev == (uint64_t)st->st_dev && table[i].ino == (uint64_t)st->st_ino) slot = i;
+    }
+    if (slot < 0 && count < WC_CACHE_ENTRIES) slot = count++; // Free space at the end
+    if (slot < 0) {                        // Table full: replace the stalest entry
+        slot = 0;
+        for (int i = 1; i < count; i++) {
+            if (table[i].last_used < table[slot].last_used) slot = i;
+        }
+    }
+    
+    WcCheckpoint *cp = &table[slot];       // Fill in the new checkpoint
+    memset(cp, 0, sizeof(*cp));
+    cp->dev = st->st_dev;
+    cp->ino = st->st_ino;
+    cp->offset = wc->bytes;
+    cp->lines = wc->lines;
+    cp->words = wc->words;
+    cp->in_word = wc->in_word;
+    cp->fingerprint = wc_fingerprint(fd, wc->bytes);
+    cp->mtime_ns = wc_mtime_ns(st);
+    cp->last_used = time(NULL);
+    
+    // Write a private copy and rename it over the table so readers never see a torn file
+    char tmp[MAX_LINE * 4 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) return;                   // Cache is best effort
+    ssize_t len = (ssize_t)(sizeof(WcCheckpoint) * count);
+    int ok = write(out, table, len) == len; // Whole table must land
+    if (close(out) != 0) ok = 0;           // Deferred write errors surface here
+    if (ok) rename(tmp, path);             // Atomically publish the new table
+    else unlink(tmp);                      // Partial write: discard
+}
+
+// Finds the history log ($VORTEX_HISTFILE, else history in the state directory) and its index
+static int history_paths(char *log, char *idx, size_t size) {
+    const char *env = getenv(HISTORY_ENV);
+    if (env && *env) {
+        if (snprintf(log, size, "%s", env) >= (int)size) return -1;
+    } else if (state_path(HISTORY_FILE, log, size) < 0) {
+        return -1;
+    }
+    return snprintf(idx, size, "%s%s", log, HISTORY_INDEX_SUFFIX) >= (int)size ? -1 : 0;
+}
+
+// Appends an interactive line to the shared log with one O_APPEND write, so lines from
+// concurrent shells never interleave. Blank lines, lines starting with a space and
+// immediate repeats are not recorded.
+void history_add(const char *line) {
+    if (!*line || line[0] == ' ' || line[0] == '\t') return;
+    if (history.last && strcmp(history.last, line) == 0) return;
+    if (history.log_fd < 0) {              // First line of the session: open lazily
+        char log[PATH_MAX], idx[PATH_MAX];
+        if (history_paths(log, idx, sizeof(log)) < 0) return;
+        history.log_fd = open(log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (history.log_fd < 0) return;    // History is best effort
+    }
+    size_t len = strlen(line);
+    char *record = malloc(len + 1);
+    if (!record) return;
+    memcpy(record, line, len);
+    record[len] = '\n';
+    if (write(history.log_fd, record, len + 1) < 0) { /* Disk full: the command still runs */ }
+    record[len] = '\0';
+    free(history.last);
+    history.last = record;                 // Kept for the repeat check
+}
+
+// Maps a whole file read-only; NULL (and *len 0) if it is missing or empty. Stores the
+// file's inode in *ino unless ino is NULL.
+static char *history_map(const char *path, size_t *len, ino_t *ino) {
+    *len = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+        else *len = st.st_size;
+        if (ino) *ino = st.st_ino;
+    }
+    close(fd);                             // The mapping stays valid
+    return data;
+}
+
+// Identifies a log file: FNV-1a over its first line, seeded with its inode. A log that was
+// replaced or truncated and rewritten gets a different id, so its old index is not used.
+static uint64_t history_log_id(const char *log, size_t len, ino_t ino) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ ino; // FNV offset basis
+    for (size_t i = 0; i < len && log[i] != '\n'; i++) {
+        hash ^= (unsigned char)log[i];
+        hash *= 0x100000001b3ULL;          // FNV prime
+    }
+    return hash;
+}
+
+// Returns the next complete segment at offset, or NULL at the end of the index, at a
+// segment still being written, or at one that does not fit the log: another log's, or
+// past log_len after the log shrank. covered is where the previous segment ended.
+static const HistorySegment *history_segment(const char *idx, size_t idx_len, size_t offset, uint64_t covered,
+                                             uint64_t log_len, uint64_t log_id) {
+    if (offset + sizeof(HistorySegment) > idx_len) return NULL;
+    const HistorySegment *seg = (const HistorySegment *)(idx + offset);
+    if (seg->magic != HISTORY_SEG_MAGIC || seg->size > idx_len - offset || seg->log_start != covered ||
+        seg->log_end > log_len || seg->log_id != log_id ||
+        seg->size != sizeof(HistorySegment) + (2 * (uint64_t)seg->num_trigrams + 1 + seg->num_postings) * sizeof(uint32_t))
+        return NULL;
+    return seg;
+}
+
+// Indexes log bytes [start, end), which end just past a newline, as one segment appended
+// to the index: every trigram of every line, with the offsets of the lines containing it
+static int history_write_segment(int idx_fd, const char *log, uint64_t start, uint64_t end, uint64_t log_id) {
+    size_t len = end - start;
+    uint64_t *pairs = malloc(len * sizeof(uint64_t)); // trigram << 32 | line offset; under one per byte
+    uint64_t *spare = malloc(len * sizeof(uint64_t)); // Radix sort scratch
+    if (!pairs || !spare) {
+        free(pairs);
+        free(spare);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t line = 0; line < len; ) {
+        const unsigned char *p = (const unsigned char *)log + start + line;
+        size_t line_len = (const unsigned char *)memchr(p, '\n', len - line) - p;
+        for (size_t i = 0; i + 3 <= line_len; i++) {
+            uint64_t tri = (uint64_t)p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+            pairs[n++] = tri << 32 | line;
+        }
+        line += line_len + 1;
+    }
+    for (int shift = 32; shift < 56; shift += 8) { // LSD radix sort on the trigram; stable, so
+        size_t count[257] = {0};           // each posting list stays in log order
+        for (size_t i = 0; i < n; i++) count[((pairs[i] >> shift) & 0xff) + 1]++;
+        for (int b = 0; b < 256; b++) count[b + 1] += count[b];
+        for (size_t i = 0; i < n; i++) spare[count[(pairs[i] >> shift) & 0xff]++] = pairs[i];
+        uint64_t *swap = pairs;
+        pairs = spare;
+        spare = swap;
+    }
+    
+    size_t num_trigrams = 0, num_postings = 0; // After dropping repeats within a line
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && pairs[i] == pairs[i - 1]) continue;
+        if (i == 0 || pairs[i] >> 32 != pairs[i - 1] >> 32) num_trigrams++;
+        num_postings++;
+    }
+    size_t size = sizeof(HistorySegment) + (2 * num_trigrams + 1 + num_postings) * sizeof(uint32_t);
+    char *out = malloc(size);
+    int rc = -1;
+    if (out) {
+        HistorySegment *seg = (HistorySegment *)out;
+        seg->magic = HISTORY_SEG_MAGIC;
+        seg->log_start = start;
+        seg->log_end = end;
+        seg->size = size;
+        seg->log_id = log_id;
+        seg->num_trigrams = num_trigrams;
+        seg->num_postings = num_postings;
+        uint32_t *trigrams = (uint32_t *)(seg + 1); // Sorted trigrams
+        uint32_t *starts = trigrams + num_trigrams; // Posting range of trigram t: starts[t]..starts[t+1]
+        uint32_t *postings = starts + num_trigrams + 1;
+        size_t t = 0, p = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (i > 0 && pairs[i] == pairs[i - 1]) continue;
+            if (i == 0 || pairs[i] >> 32 != pairs[i - 1] >> 32) {
+                trigrams[t] = pairs[i] >> 32;
+                starts[t++] = p;
+            }
+            postings[p++] = (uint32_t)pairs[i];
+        }
+        starts[t] = p;
+        rc = write(idx_fd, out, size) == (ssize_t)size ? 0 : -1; // One append: readers see all or nothing
+        free(out);
+    }
+    free(pairs);
+    free(spare);
+    return rc;
+}
+
+// Brings the index up to date when enough of the log is unindexed, so searches scan at
+// most HISTORY_SEGMENT_MIN bytes directly. Shells serialize on a lock on the index.
+// log is the first log_len bytes of log_path as mapped with inode log_ino.
+static void history_update_index(const char *log, size_t log_len, ino_t log_ino, const char *log_path,
+                                 const char *idx_path) {
+    int fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    struct stat st;                        // The log now; another shell may have grown it past log_len
+    if (flock(fd, LOCK_EX) < 0 || stat(log_path, &st) < 0 || st.st_ino != log_ino) {
+        close(fd);                         // Replaced since it was mapped: the next search sees the new one
+        return;
+    }
+    uint64_t log_id = history_log_id(log, log_len, log_ino);
+    size_t idx_len;                        // Mapped after locking: another shell may have just extended it
+    char *idx = history_map(idx_path, &idx_len, NULL);
+    uint64_t covered = 0;
+    size_t offset = 0;
+    const HistorySegment *seg;
+    while ((seg = history_segment(idx, idx_len, offset, covered, st.st_size, log_id))) {
+        covered = seg->log_end;
+        offset += seg->size;
+    }
+    if (offset < idx_len && ftruncate(fd, offset) < 0) covered = log_len; // Torn or stale tail: drop it, or give up
+    if (idx) munmap(idx, idx_len);
+    
+    while (covered <= log_len && log_len - covered >= HISTORY_SEGMENT_MIN) {
+        uint64_t end = covered + HISTORY_SEGMENT_MAX < log_len ? covered + HISTORY_SEGMENT_MAX : log_len;
+        const char *nl = memrchr(log + covered, '\n', end - covered); // Segments end on a line boundary
+        if (!nl) nl = memchr(log + end, '\n', log_len - end); // One very long line
+        if (!nl || history_write_segment(fd, log, covered, nl - log + 1, log_id) < 0) break;
+        covered = nl - log + 1;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Emits every line in log[start, end) that contains pattern, in order
+static void history_scan(const char *log, size_t start, size_t end, const char *pattern, size_t plen,
+                         void (*emit)(const char *, size_t, void *), void *ctx) {
+    const char *p = log + start, *stop = log + end;
+    while (p < stop) {
+        const char *hit = plen ? memmem(p, stop - p, pattern, plen) : p;
+        if (!hit) return;
+        const char *line = hit;            // Back up to the start of the line
+        while (line > p && line[-1] != '\n') line--;
+        const char *nl = memchr(hit, '\n', stop - hit);
+        if (!nl) nl = stop;
+        emit(line, nl - line, ctx);
+        p = nl + 1;
+    }
+}
+
+// Posting list of trigram tri in seg; NULL if no line in the segment contains it
+static const uint32_t *history_postings(const HistorySegment *seg, uint32_t tri, uint32_t *count) {
+    const uint32_t *trigrams = (const uint32_t *)(seg + 1);
+    const uint32_t *starts = trigrams + seg->num_trigrams;
+    size_t lo = 0, hi = seg->num_trigrams; // Binary search over the sorted trigrams
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (trigrams[mid] < tri) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == seg->num_trigrams || trigrams[lo] != tri) return NULL;
+    *count = starts[lo + 1] - starts[lo];
+    return starts + seg->num_trigrams + 1 + starts[lo];
+}
+
+// Calls emit for every history line containing pattern (every line when it is empty),
+// oldest first. The log and index are mapped for this call only, so nothing is read at
+// startup and lines from other shells show up immediately. Indexed segments answer from
+// the posting list of the pattern's rarest trigram; the unindexed tail is scanned.
+int history_search(const char *pattern, void (*emit)(const char *line, size_t len, void *ctx), void *ctx) {
+    char log_path[PATH_MAX], idx_path[PATH_MAX];
+    if (history_paths(log_path, idx_path, sizeof(log_path)) < 0) return -1;
+    size_t log_len, idx_len = 0;
+    ino_t log_ino;
+    char *log = history_map(log_path, &log_len, &log_ino);
+    if (!log) return 0;                    // No history yet
+    const char *last_nl = memrchr(log, '\n', log_len);
+    size_t end = last_nl ? (size_t)(last_nl - log + 1) : 0; // Complete lines only
+    size_t plen = strlen(pattern);
+    
+    uint64_t covered = 0;                  // Log bytes answered through the index
+    if (plen >= 3) {
+        history_update_index(log, end, log_ino, log_path, idx_path);
+        char *idx = history_map(idx_path, &idx_len, NULL);
+        uint64_t log_id = history_log_id(log, end, log_ino);
+        size_t offset = 0;
+        const HistorySegment *seg;
+        while ((seg = history_segment(idx, idx_len, offset, covered, end, log_id))) {
+            const uint32_t *best = NULL;   // Shortest posting list among the pattern's trigrams
+            uint32_t best_count = 0;
+            for (size_t i = 0; i + 3 <= plen; i++) {
+                const unsigned char *t = (const unsigned char *)pattern + i;
+                uint32_t count;
+                const uint32_t *list = history_postings(seg, (uint32_t)t[0] << 16 | t[1] << 8 | t[2], &count);
+                if (!list) { best = NULL; best_count = 0; break; } // Some trigram never occurs: no match here
+                if (!best || count < best_count) { best = list; best_count = count; }
+            }
+            for (uint32_t i = 0; i < best_count; i++) { // Confirm each candidate line
+                const char *line = log + seg->log_start + best[i];
+                const char *nl = memchr(line, '\n', log + seg->log_end - line);
+                if (memmem(line, nl - line, pattern, plen)) emit(line, nl - line, ctx);
+            }
+            covered = seg->log_end;
+            offset += seg->size;
+        }
+        if (idx) munmap(idx, idx_len);
+    }
+    history_scan(log, covered, end, pattern, plen, emit, ctx);
+    munmap(log, log_len);
+    return 0;
+}
+
+// Prints one history line
+static void history_print(const char *line, size_t len, void *ctx) {
+    (void)ctx;
+    fwrite(line, 1, len, stdout);
+    putchar('\n');
+}
+
+// history: every line; history N: the last N; history /pattern: lines containing pattern
+// (the rest of the arguments, joined by spaces)
+int builtin_history(Command *cmd) {
+    if (cmd->argc > 1 && cmd->args[1][0] == '/') {
+        size_t size = 1;                   // Pattern length plus NUL
+        for (int i = 1; i < cmd->argc; i++) size += strlen(cmd->args[i]) + 1;
+        char *pattern = arena_alloc(&line_arena, size);
+        char *p = pattern;
+        for (int i = 1; i < cmd->argc; i++) p += sprintf(p, "%s%s", i > 1 ? " " : "", cmd->args[i] + (i == 1));
+        return history_search(pattern, history_print, NULL) < 0;
+    }
+    if (cmd->argc > 2 || (cmd->argc == 2 && atol(cmd->args[1]) <= 0)) {
+        printf("Usage: history [N | /pattern]\n");
+        return 2;
+    }
+    if (cmd->argc == 1) return history_search("", history_print, NULL) < 0;
+    
+    char log_path[PATH_MAX], idx_path[PATH_MAX];
+    size_t log_len;
+    char *log = history_paths(log_path, idx_path, sizeof(log_path)) == 0 ? history_map(log_path, &log_len, NULL) : NULL;
+    if (!log) return 0;
+    long want = atol(cmd->args[1]);
+    const char *start = log + log_len;     // Walk back over want newlines
+    if (start > log && start[-1] == '\n') start--; // The log's final newline ends the last line
+    const char *from = log;                // Output starts here
+    for (long i = 0; i < want; i++) {
+        const char *nl = memrchr(log, '\n', start - log);
+        if (!nl) { from = log; break; }    // Fewer lines than asked for
+        start = nl;
+        from = nl + 1;
+    }
+    fwrite(from, 1, log + log_len - from, stdout);
+    munmap(log, log_len);
+    return 0;
+}
+
+// Orders listing names for binary search
+static int dir_name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Releases a listing and marks its slot unused
+static void dir_listing_free(DirListing *dl) {
+    free(dl->path);
+    free(dl->pool);
+    free(dl->names);
+    memset(dl, 0, sizeof(*dl));
+}
+
+// Whether name is in a sorted listing
+static int dir_listing_has(const DirListing *dl, const char *name) {
+    int lo = 0, hi = dl->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(dl->names[mid], name);
+        if (cmp == 0) return 1;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+// Reads the directory at path into dl, replacing what it held. With executables set, only
+// regular files with an execute bit are kept, as a PATH lookup would accept them; names the
+// previous listing already held are kept without another stat, so rereading a directory
+// after an install costs one stat per new name. Otherwise every entry but . and .. is kept
+// and directories get a trailing '/'. A missing directory gives an empty listing with a
+// zero mtime, so its creation is noticed later.
+static void dir_listing_read(DirListing *dl, const char *path, int executables) {
+    DirListing old = *dl;                  // Consulted while reading, released at the end
+    memset(dl, 0, sizeof(*dl));
+    dl->path = strdup(path);               // path may be old.path itself
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    dl->read_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    int fd = open(dl->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    DIR *dir = fd >= 0 && fstat(fd, &st) == 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        dir_listing_free(&old);
+        return;
+    }
+    dl->mtime = st.st_mtim;
+    size_t used = 0, size = 0;             // Bytes of pool filled and allocated
+    size_t *offsets = NULL;                // Where each name starts; pool moves as it grows
+    int capacity = 0;                      // Allocated entries in offsets
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        int is_dir = entry->d_type == DT_DIR;
+        if (executables && is_dir) continue;
+        if ((executables && !dir_listing_has(&old, name)) || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            if (fstatat(dirfd(dir), name, &st, 0) < 0) continue; // Dangling link
+            is_dir = S_ISDIR(st.st_mode);
+            if (executables && !(S_ISREG(st.st_mode) && (st.st_mode & 0111))) continue;
+        }
+        size_t name_len = strlen(name);
+        size_t len = name_len + (is_dir ? 2 : 1); // Name, '/' for directories, NUL
+        if (used + len > size) {
+            size = size ? size * 2 : 4096;
+            while (used + len > size) size *= 2;
+            dl->pool = realloc(dl->pool, size);
+        }
+        if (dl->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            offsets = realloc(offsets, sizeof(size_t) * capacity);
+        }
+        offsets[dl->count++] = used;
+        memcpy(dl->pool + used, name, name_len);
+        if (is_dir) dl->pool[used + name_len] = '/';
+        dl->pool[used + len - 1] = '\0';
+        used += len;
+    }
+    closedir(dir);
+    dl->names = malloc(sizeof(char *) * (dl->count ? dl->count : 1));
+    for (int i = 0; i < dl->count; i++) dl->names[i] = dl->pool + offsets[i];
+    free(offsets);
+    qsort(dl->names, dl->count, sizeof(char *), dir_name_cmp);
+    dir_listing_free(&old);
+}
+
+// Whether dl no longer matches its directory: the mtime moved, or the listing was read so
+// soon after a change that a further change could carry the same timestamp
+static int dir_listing_stale(DirListing *dl) {
+    struct stat st;
+    struct timespec mtime = {0, 0};        // Zero stands for "missing"
+    if (stat(dl->path, &st) == 0) mtime = st.st_mtim;
+    if (mtime.tv_sec != dl->mtime.tv_sec || mtime.tv_nsec != dl->mtime.tv_nsec) return 1;
+    return mtime.tv_sec && dl->read_ns - (mtime.tv_sec * 1000000000LL + mtime.tv_nsec) < COMPLETE_RACY_NS;
+}
+
+// Merges the sorted runs of names in from, bounded by ends[0..num_runs), into to; pairs of
+// neighbouring runs are merged until one is left, which may end up in either array.
+// Returns the array holding the result.
+static char **completer_merge_runs(char **from, char **to, size_t *ends, int num_runs) {
+    while (num_runs > 1) {
+        int merged = 0;                    // Runs after this pass
+        size_t start = 0;
+        for (int r = 0; r < num_runs; r += 2) {
+            size_t mid = ends[r], end = r + 1 < num_runs ? ends[r + 1] : mid;
+            size_t a = start, b = mid, out = start;
+            while (a < mid && b < end) to[out++] = strcmp(from[a], from[b]) <= 0 ? from[a++] : from[b++];
+            while (a < mid) to[out++] = from[a++];
+            while (b < end) to[out++] = from[b++];
+            ends[merged++] = end;
+            start = end;
+        }
+        num_runs = merged;
+        char **swap = from;
+        from = to;
+        to = swap;
+    }
+    return from;
+}
+
+// Rebuilds the sorted command table from the PATH listings and the builtins. The listings
+// are already sorted, so they are merged rather than sorted again.
+static void completer_merge(void) {
+    size_t num_builtins = sizeof(builtins) / sizeof(builtins[0]);
+    size_t total = num_builtins;           // Names before duplicates are dropped
+    for (int i = 0; i < completer.num_path_dirs; i++) total += completer.path_dirs[i].count;
+    char **names = malloc(sizeof(char *) * total);
+    char **spare = malloc(sizeof(char *) * total);
+    size_t *ends = malloc(sizeof(size_t) * (completer.num_path_dirs + 1)); // End of each sorted run
+    size_t n = 0;
+    for (size_t i = 0; i < num_builtins; i++) names[n++] = (char *)builtins[i].name;
+    qsort(names, n, sizeof(char *), dir_name_cmp);
+    ends[0] = n;
+    for (int i = 0; i < completer.num_path_dirs; i++) {
+        memcpy(names + n, completer.path_dirs[i].names, sizeof(char *) * completer.path_dirs[i].count);
+        n += completer.path_dirs[i].count;
+        ends[i + 1] = n;
+    }
+    char **sorted = completer_merge_runs(names, spare, ends, completer.num_path_dirs + 1);
+    free(sorted == names ? spare : names);
+    free(ends);
+    int unique = 0;                        // A name on several PATH directories is offered once
+    for (size_t i = 0; i < n; i++) {
+        if (unique == 0 || strcmp(sorted[unique - 1], sorted[i]) != 0) sorted[unique++] = sorted[i];
+    }
+    free(completer.commands);
+    completer.commands = sorted;
+    completer.num_commands = unique;
+}
+
+// Lists every directory of completer.path_value and merges them. Runs on the builder
+// thread after startup, or inline when PATH changes; until the thread is joined, nothing
+// else touches the completer, so no lock is needed.
+static void *completer_build(void *arg) {
+    (void)arg;
+    for (int i = 0; i < completer.num_path_dirs; i++) dir_listing_free(&completer.path_dirs[i]);
+    free(completer.path_dirs);
+    completer.num_path_dirs = 1;
+    for (const char *p = completer.path_value; *p; p++) completer.num_path_dirs += *p == ':';
+    completer.path_dirs = calloc(completer.num_path_dirs, sizeof(DirListing));
+    const char *start = completer.path_value; // Beginning of the current field
+    for (int i = 0; i < completer.num_path_dirs; i++) {
+        size_t len = strcspn(start, ":");
+        char *dir = len ? strndup(start, len) : strdup("."); // Empty field means cwd
+        dir_listing_read(&completer.path_dirs[i], dir, 1);
+        free(dir);
+        start += len + 1;
+    }
+    completer_merge();
+    return NULL;
+}
+
+// Starts listing PATH on a background thread so the first prompt is not delayed. The
+// thread blocks every signal; the shell's signal handling stays on the main thread.
+void completer_start(void) {
+    const char *path_value = getenv("PATH");
+    completer.path_value = strdup(path_value ? path_value : DEFAULT_PATH);
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    completer.building = pthread_create(&completer.builder, NULL, completer_build, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+// Brings the command table up to date: waits for the builder if it is still running,
+// rebuilds everything if PATH changed, and otherwise rereads only the directories whose
+// mtime moved
+static void completer_refresh(void) {
+    if (completer.building) {
+        pthread_join(completer.builder, NULL);
+        completer.building = 0;
+    }
+    const char *path_value = getenv("PATH");
+    if (!path_value) path_value = DEFAULT_PATH;
+    if (!completer.commands || strcmp(completer.path_value, path_value) != 0) {
+        free(completer.path_value);
+        completer.path_value = strdup(path_value);
+        completer_build(NULL);
+        return;
+    }
+    int changed = 0;                       // Some directory was reread
+    for (int i = 0; i < completer.num_path_dirs; i++) {
+        DirListing *dl = &completer.path_dirs[i];
+        if (dir_listing_stale(dl)) {
+            dir_listing_read(dl, dl->path, 1);
+            changed = 1;
+        }
+    }
+    if (changed) completer_merge();
+}
+
+// Finds the run of names in sorted[0..count) that start with prefix; returns its first
+// index and sets *num to its length
+static int completer_range(char **sorted, int count, const char *prefix, size_t len, int *num) {
+    int lo = 0, hi = count;                // First name not below the prefix
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(sorted[mid], prefix, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    int first = lo;
+    hi = count;                            // First name past the prefix
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(sorted[mid], prefix, len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *num = lo - first;
+    return first;
+}
+
+// Returns the cached listing of dir (relative to the cwd), reading it if it is new or changed
+static DirListing *completer_dir(const char *dir) {
+    char path[PATH_MAX], cwd[PATH_MAX];    // Cache key: the absolute directory
+    int n = dir[0] == '/' ? snprintf(path, sizeof(path), "%s", dir)
+          : getcwd(cwd, sizeof(cwd)) ? snprintf(path, sizeof(path), "%s/%s", cwd, dir) : -1;
+    if (n < 0 || n >= (int)sizeof(path)) return NULL;
+    DirListing *slot = NULL;               // The directory's slot, or the one to reuse
+    for (int i = 0; i < COMPLETE_DIR_CACHE && !slot; i++) {
+        if (completer.files[i].path && strcmp(completer.files[i].path, path) == 0) slot = &completer.files[i];
+    }
+    if (slot && dir_listing_stale(slot)) dir_listing_read(slot, path, 0);
+    if (!slot) {                           // An unused slot, else the least recently used
+        slot = &completer.files[0];
+        for (int i = 1; i < COMPLETE_DIR_CACHE && slot->path; i++) {
+            if (!completer.files[i].path || completer.files[i].used_ns < slot->used_ns) slot = &completer.files[i];
+        }
+        dir_listing_read(slot, path, 0);
+    }
+    slot->used_ns = coarse_now_ns();
+    return slot;
+}
+
+// Collects the completions of word (already unquoted) into completer.matches, sorted. In
+// command position a word without '/' is completed against PATH executables and builtins;
+// anything else against the entries of the directory it names. Names starting with '.' are
+// offered only when the typed name starts with '.'.
+int complete_word(const char *word, int command) {
+    completer.num_matches = 0;
+    char **sorted;                         // Listing to search
+    int count;
+    const char *base = word;               // Part of word the names are matched against
+    if (command && !strchr(word, '/')) {
+        completer_refresh();
+        sorted = completer.commands;
+        count = completer.num_commands;
+    } else {
+        char dir[PATH_MAX] = ".";          // Directory part, through the last '/'
+        const char *slash = strrchr(word, '/');
+        if (slash) {
+            base = slash + 1;
+            if ((size_t)(base - word) >= sizeof(dir)) return 0;
+            memcpy(dir, word, base - word);
+            dir[base - word] = '\0';
+        }
+        DirListing *dl = completer_dir(dir);
+        if (!dl) return 0;
+        sorted = dl->names;
+        count = dl->count;
+    }
+    int num, first = completer_range(sorted, count, base, strlen(base), &num);
+    if (num > completer.matches_size) {
+        completer.matches_size = num;
+        completer.matches = realloc(completer.matches, sizeof(char *) * num);
+    }
+    for (int i = first; i < first + num; i++) {
+        if (sorted[i][0] == '.' && base[0] != '.') continue;
+        completer.matches[completer.num_matches++] = sorted[i];
+    }
+    return completer.num_matches;
+}
+
+// Appends word to an argument vector growing in the line arena, keeping it NULL-terminated
+static void expand_push(char ***args, int *argc, int *cap, char *word) {
+    if (*argc + 1 >= *cap) {
+        int grown = *cap ? *cap * 2 : 8;
+        char **bigger = arena_alloc(&line_arena, grown * sizeof(char *));
+        if (*argc) memcpy(bigger, *args, *argc * sizeof(char *)); // Old array stays in the arena
+        *args = bigger;
+        *cap = grown;
+    }
+    (*args)[(*argc)++] = word;
+    (*args)[*argc] = NULL;
+}
+
+// Starts expanding a command: the first command of a line, or one run from another
+// directory, starts with an empty glob cache
+static void glob_cache_begin(void) {
+    char cwd[PATH_MAX];                    // Relative listings belong to this directory
+    const char *here = getcwd(cwd, sizeof(cwd)) ? cwd : "";
+    if (glob_cache.generation != line_arena.resets || !glob_cache.cwd || strcmp(glob_cache.cwd, here) != 0) {
+        for (size_t i = 0; i < glob_cache.capacity; i++) dir_listing_free(&glob_cache.slots[i]);
+        glob_cache.used = 0;
+        glob_cache.generation = line_arena.resets;
+        free(glob_cache.cwd);
+        glob_cache.cwd = strdup(here);
+    }
+    glob_cache.command++;
+}
+
+// Finds dir's slot in the glob cache, or the empty slot where it belongs
+static DirListing *glob_cache_slot(const char *dir) {
+    size_t mask = glob_cache.capacity - 1; // Capacity is a power of two
+    for (size_t i = path_hash(dir) & mask; ; i = (i + 1) & mask) {
+        DirListing *slot = &glob_cache.slots[i];
+        if (!slot->path || strcmp(slot->path, dir) == 0) return slot;
+    }
+}
+
+// Returns the listing of dir for glob matching. Each directory is read once per line; a
+// later command of the line checks its mtime first, as an earlier one may have changed it.
+// The pointer is valid until the next call.
+static DirListing *glob_dir(const char *dir) {
+    if (glob_cache.used * 2 >= glob_cache.capacity) { // Keep the table under half full
+        DirListing *old = glob_cache.slots;
+        size_t old_capacity = glob_cache.capacity;
+        glob_cache.capacity = old_capacity ? old_capacity * 2 : 64;
+        glob_cache.slots = calloc(glob_cache.capacity, sizeof(DirListing));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].path) *glob_cache_slot(old[i].path) = old[i];
+        }
+        free(old);
+    }
+    DirListing *slot = glob_cache_slot(dir);
+    if (!slot->path) {
+        dir_listing_read(slot, dir, 0);
+        glob_cache.used++;
+    } else if (slot->used_ns != glob_cache.command && dir_listing_stale(slot)) {
+        dir_listing_read(slot, dir, 0);
+    }
+    slot->used_ns = glob_cache.command;
+    return slot;
+}
+
+// Tests c against the [...] class whose body starts at pat[i], just past the '['. Returns
+// 1 or 0 and sets *end past the closing ']'; returns -1 for an unterminated class, which
+// makes the '[' an ordinary character.
+static int glob_class(const char *pat, size_t plen, size_t i, unsigned char c, size_t *end) {
+    int negate = i < plen && (pat[i] == '!' || pat[i] == '^');
+    if (negate) i++;
+    int found = 0;
+    for (int first = 1; i < plen && (pat[i] != ']' || first); first = 0) {
+        unsigned char lo = pat[i] == EXPAND_ESC && i + 1 < plen ? pat[++i] : pat[i];
+        i++;
+        unsigned char hi = lo;             // Single character, or the top of a range
+        if (i + 1 < plen && pat[i] == '-' && pat[i + 1] != ']') {
+            hi = pat[i + 1] == EXPAND_ESC && i + 2 < plen ? pat[i + 2] : pat[i + 1];
+            i += pat[i + 1] == EXPAND_ESC ? 3 : 2;
+        }
+        if (c >= lo && c <= hi) found = 1;
+    }
+    if (i >= plen) return -1;
+    *end = i + 1;
+    return found != negate;
+}
+
+// Matches name against one path component of a glob (EXPAND_ESC marks literal bytes).
+// Only the most recent * is remembered as a restart point: when the rest fails to match,
+// that * takes one more character and matching resumes, so the cost is bounded by
+// name length times pattern length rather than growing exponentially with the stars.
+static int glob_match(const char *pat, size_t plen, const char *name, size_t nlen) {
+    size_t px = 0, nx = 0;                 // Positions in pattern and name
+    size_t star_px = 0, star_nx = 0;       // Restart point after the last *
+    int star = 0;                          // A * has been seen
+    while (px < plen || nx < nlen) {
+        if (px < plen) {
+            char c = pat[px];
+            if (c == '*') {                // Match nothing for now; remember how to take more
+                star = 1;
+                star_px = px;
+                star_nx = nx + 1;
+                px++;
+                continue;
+            }
+            if (nx < nlen) {
+                size_t end;
+                int in_class = c == '[' ? glob_class(pat, plen, px + 1, name[nx], &end) : -1;
+                if (c == '?' || in_class == 1) {
+                    px = in_class == 1 ? end : px + 1;
+                    nx++;
+                    continue;
+                }
+                if (in_class < 0 && c != '?') { // Literal byte
+                    size_t width = c == EXPAND_ESC && px + 1 < plen ? 2 : 1;
+                    if (pat[px + width - 1] == name[nx]) {
+                        px += width;
+                        nx++;
+                        continue;
+                    }
+                }
+            }
+        }
+        if (star && star_nx <= nlen) {     // Let the last * absorb one more character
+            px = star_px;
+            nx = star_nx;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// Copies n bytes of an escaped word into the line arena without its EXPAND_ESC bytes
+static char *glob_unescape(const char *src, size_t n) {
+    char *out = arena_alloc(&line_arena, n + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (src[i] == EXPAND_ESC && i + 1 < n) i++;
+        out[len++] = src[i];
+    }
+    out[len] = '\0';
+    return out;
+}
+
+// Whether n bytes of an escaped word contain a live *, ? or [
+static int glob_has_magic(const char *pat, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (pat[i] == EXPAND_ESC) i++;
+        else if (pat[i] == '*' || pat[i] == '?' || pat[i] == '[') return 1;
+    }
+    return 0;
+}
+
+// Expands a glob one path component at a time: literal components are appended without
+// touching the disk, and each component with *, ? or [ is matched against the listing of
+// every directory reached so far. Names starting with '.' match only a component that
+// starts with '.'. Appends the matches, in sorted order, to args; returns how many.
+static int glob_expand(const char *pat, char ***args, int *argc, int *cap) {
+    size_t plen = strlen(pat);
+    char **bases = arena_alloc(&line_arena, 2 * sizeof(char *)); // Paths reached so far
+    bases[0] = pat[0] == '/' ? "/" : "";
+    int num_bases = 1, cap_bases = 2;
+    size_t i = 0;                          // Start of the current component
+    while (i < plen && pat[i] == '/') i++;
+    int last = 0, literal_tail = 0;        // Final component reached; it had no glob characters
+    while (!last && num_bases > 0 && i < plen) {
+        size_t end = i;
+        while (end < plen && pat[end] != '/') end += pat[end] == EXPAND_ESC && end + 1 < plen ? 2 : 1;
+        last = end >= plen;
+        const char *comp = pat + i;
+        size_t clen = end - i;
+        char **next = NULL;
+        int num_next = 0, cap_next = 0;
+        literal_tail = !glob_has_magic(comp, clen);
+        if (literal_tail) {                // No need to list anything
+            char *lit = glob_unescape(comp, clen);
+            for (int b = 0; b < num_bases; b++) {
+                char *path = arena_alloc(&line_arena, strlen(bases[b]) + clen + 2);
+                sprintf(path, "%s%s%s", bases[b], lit, last ? "" : "/");
+                expand_push(&next, &num_next, &cap_next, path);
+            }
+        } else {
+            int hidden = comp[0] == '.' || (comp[0] == EXPAND_ESC && comp[1] == '.'); // Pattern asks for dot files
+            for (int b = 0; b < num_bases; b++) {
+                size_t base_len = strlen(bases[b]);
+                DirListing *dl = glob_dir(base_len ? bases[b] : ".");
+                for (int n = 0; n < dl->count; n++) {
+                    const char *name = dl->names[n];
+                    size_t nlen = strlen(name);
+                    int is_dir = name[nlen - 1] == '/';
+                    if (is_dir) nlen--;
+                    if ((!last && !is_dir) || (name[0] == '.' && !hidden)) continue;
+                    if (!glob_match(comp, clen, name, nlen)) continue;
+                    char *path = arena_alloc(&line_arena, base_len + nlen + 2);
+                    memcpy(path, bases[b], base_len);
+                    memcpy(path + base_len, name, nlen + !last); // Keeps the '/' of a directory in the middle
+                    path[base_len + nlen + !last] = '\0';
+                    expand_push(&next, &num_next, &cap_next, path);
+                }
+            }
+        }
+        bases = next;
+        num_bases = num_next;
+        cap_bases = cap_next;
+        i = end;
+        while (i < plen && pat[i] == '/') i++; // A trailing / keeps only directories, already '/'-terminated
+    }
+    (void)cap_bases;
+    int added = 0;
+    for (int b = 0; b < num_bases; b++) {
+        struct stat st;                    // A literal last component must exist
+        if (literal_tail && lstat(bases[b], &st) < 0) continue;
+        expand_push(args, argc, cap, bases[b]);
+        added++;
+    }
+    return added;
+}
+
+// Appends n bytes to a growing heap buffer; with escape set, glob characters and marker
+// bytes are escaped so they stay literal
+static void expand_put(char **buf, size_t *len, size_t *size, const char *s, size_t n, int escape) {
+    if (*len + 2 * n + 1 > *size) {
+        while (*len + 2 * n + 1 > *size) *size = *size ? *size * 2 : 256;
+        *buf = realloc(*buf, *size);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (escape && is_expand_char(s[i])) (*buf)[(*len)++] = EXPAND_ESC;
+        (*buf)[(*len)++] = s[i];
+    }
+    (*buf)[*len] = '\0';
+}
+
+// Expands one word: $NAME, ${NAME}, $? and $$ are replaced first. As in zsh, a value is
+// never split into several words or treated as a pattern. If live glob characters remain,
+// the word becomes its matches; a pattern that matches nothing is kept as typed. A word
+// left empty is dropped unless it was quoted. Returns the number of words appended.
+static int expand_word(const char *word, char ***args, int *argc, int *cap) {
+    int quoted = word[0] == EXPAND_QUOTED;
+    if (quoted) word++;
+    char *buf = NULL;                      // Word with variables replaced, still escaped
+    size_t len = 0, size = 0;
+    expand_put(&buf, &len, &size, "", 0, 0);
+    for (size_t i = 0; word[i]; ) {
+        if (word[i] == EXPAND_ESC && word[i + 1]) {
+            expand_put(&buf, &len, &size, word + i, 2, 0);
+            i += 2;
+            continue;
+        }
+        if (word[i] != '$') {
+            expand_put(&buf, &len, &size, word + i, 1, 0);
+            i++;
+            continue;
+        }
+        const char *name = word + i + 1;   // Name after $ or ${
+        size_t name_len = 0, skip;         // skip: bytes of the reference
+        if (*name == '{') {
+            name++;
+            while (isalnum((unsigned char)name[name_len]) || name[name_len] == '_') name_len++;
+            skip = name[name_len] == '}' && name_len ? name_len + 3 : 0;
+        } else if (*name == '?' || *name == '$') {
+            name_len = 1;
+            skip = 2;
+        } else if (*name == EXPAND_ESC && (name[1] == '?' || name[1] == '$')) { // Quoted "$?" escapes the ?
+            name++;
+            name_len = 1;
+            skip = 3;
+        } else {
+            while (isalnum((unsigned char)name[name_len]) || name[name_len] == '_') name_len++;
+            skip = name_len && !isdigit((unsigned char)name[0]) ? name_len + 1 : 0;
+        }
+        if (!skip) {                       // Not a reference: a plain $
+            expand_put(&buf, &len, &size, "$", 1, 0);
+            i++;
+            continue;
+        }
+        char number[24];                   // $? and $$
+        const char *value = number;
+        if (*name == '?') snprintf(number, sizeof(number), "%d", last_status);
+        else if (*name == '$') snprintf(number, sizeof(number), "%d", (int)getpid());
+        else {
+            char key[256];
+            snprintf(key, sizeof(key), "%.*s", (int)name_len, name);
+            value = getenv(key);
+            if (!value) value = "";        // Unset expands to nothing
+        }
+        expand_put(&buf, &len, &size, value, strlen(value), 1);
+        i += skip;
+    }
+    int added = glob_has_magic(buf, len) ? glob_expand(buf, args, argc, cap) : 0;
+    if (!added && (len || quoted || !*word)) { // An empty word came from quotes
+        expand_push(args, argc, cap, glob_unescape(buf, len));
+        added = 1;
+    }
+    free(buf);
+    return added;
+}
+
+// Expands $VAR, ${VAR}, $?, $$ and *, ? and [...] in a command's words just before it runs,
+// replacing its argument vector (which has no size limit). A redirection must expand to
+// exactly one word. Returns -1, after reporting any error, when the command cannot run.
+int expand_command(Command *cmd) {
+    glob_cache_begin();
+    char **args = NULL;
+    int argc = 0, cap = 0;
+    for (int i = 0; i < cmd->argc; i++) expand_word(cmd->args[i], &args, &argc, &cap);
+    char **targets[] = { &cmd->input_file, &cmd->output_file };
+    for (int t = 0; t < 2; t++) {
+        if (!*targets[t]) continue;
+        char **one = NULL;
+        int n = 0, one_cap = 0;
+        const char *word = *targets[t] + (**targets[t] == EXPAND_QUOTED);
+        if (expand_word(*targets[t], &one, &n, &one_cap) != 1) {
+            printf("Error: %s: ambiguous redirect\n", glob_unescape(word, strlen(word)));
+            return -1;
+        }
+        *targets[t] = one[0];
+    }
+    cmd->expand = 0;
+    cmd->args = args;
+    cmd->argc = argc;
+    if (cmd->file_op == '#' && argc != 1) {
+        printf("Error: # requires exactly one file name\n");
+        return -1;
+    }
+    if (cmd->file_op == '~' && argc != 2) {
+        printf("Error: Two text files required for ~ operation\n");
+        return -1;
+    }
+    return argc ? 0 : -1;                  // Nothing left to run
+}
 
-int main() {
-    char input[MAX_CMD_LEN];       // Buffer to capture user input from stdin
-    char self_name[MAX_LINE];      // Stores this process's name for identification
-    
-    shell_pgid = getpid();         // Set this process's PID as the group leader
-    setpgid(0, 0);                 // Assign this process to its own process group for signal control
-    
-    // Fetch the executable name to use in kill_all_shells
-    get_process_name(self_name, sizeof(self_name)); // Populates self_name with process basename
-    
-    // Main shell loop to continuously accept and process commands
-    while (1) {
-        printf("w25shell$ ");      // Display a unique, hardcoded shell prompt
-        fflush(stdout);            // Force the prompt to appear immediately on the terminal
-        
-        // Capture user input; skip to next iteration if fgets fails (e.g., EOF)
-        if (!fgets(input, MAX_CMD_LEN, stdin)) {
-            continue;              // Avoid processing invalid or empty input
+// Returns the next key byte, taking whatever the terminal has queued in one read() (a
+// paste arrives in one piece); -1 at end of input
+static int editor_key(LineReader *in) {
+    while (in->start == in->end) {
+        if (!in->buf) {
+            in->buf = malloc(READER_BUF_SIZE);
+            in->size = READER_BUF_SIZE;
         }
-        
-        input[strcspn(input, "\n")] = 0;  // Strip the newline character from input
-        
-        // Check for built-in termination commands before parsing
-        if (strcmp(input, "killterm") == 0) {
-            exit(0);               // Exit this shell instance cleanly
+        in->start = in->end = 0;
+        ssize_t n = read(in->fd, in->buf, in->size - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            in->eof = 1;
+            return -1;
         }
-        if (strcmp(input, "killallterms") == 0) {
-            kill_all_shells(self_name); // Attempt to kill all running instances of this shell
-            exit(0);               // Terminate this instance after kill operation
+        in->end = n;
+    }
+    return (unsigned char)in->buf[in->start++];
+}
+
+// Redraws the prompt and line on the terminal row, scrolled sideways so the cursor stays
+// visible. Every byte is taken to be one column.
+static void editor_refresh(Editor *ed) {
+    struct winsize ws;
+    size_t cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
+    size_t plen = strlen(ed->prompt);
+    size_t start = 0;                      // First byte of buf on screen
+    if (plen + ed->pos >= cols) start = plen + ed->pos - cols + 1;
+    if (start > ed->pos) start = ed->pos;  // Prompt wider than the terminal
+    size_t shown = ed->len - start;
+    if (plen + shown > cols) shown = plen < cols ? cols - plen : 0;
+    printf("\r%s%.*s\x1b[K\r", ed->prompt, (int)shown, ed->buf + start);
+    if (plen + ed->pos - start) printf("\x1b[%zuC", plen + ed->pos - start);
+    fflush(stdout);
+}
+
+// Inserts n bytes at the cursor and moves past them
+static void editor_insert(Editor *ed, const char *text, size_t n) {
+    if (ed->len + n + 1 > ed->size) {
+        while (ed->len + n + 1 > ed->size) ed->size *= 2;
+        ed->buf = realloc(ed->buf, ed->size);
+    }
+    memmove(ed->buf + ed->pos + n, ed->buf + ed->pos, ed->len - ed->pos + 1); // NUL included
+    memcpy(ed->buf + ed->pos, text, n);
+    ed->pos += n;
+    ed->len += n;
+}
+
+// Removes n bytes starting at from
+static void editor_delete(Editor *ed, size_t from, size_t n) {
+    memmove(ed->buf + from, ed->buf + from + n, ed->len - from - n + 1);
+    ed->len -= n;
+    if (ed->pos >= from + n) ed->pos -= n;
+    else if (ed->pos > from) ed->pos = from;
+}
+
+// Replaces the whole line, leaving the cursor at its end
+static void editor_set(Editor *ed, const char *text, size_t n) {
+    ed->len = ed->pos = 0;
+    ed->buf[0] = '\0';
+    editor_insert(ed, text, n);
+}
+
+// Up (dir < 0) and Down (dir > 0) through the history log, which the first Up of a line
+// maps. Going down past the newest entry brings back what was being typed.
+static void editor_history(Editor *ed, int dir) {
+    if (!ed->log) {
+        char log_path[PATH_MAX], idx_path[PATH_MAX];
+        if (dir > 0 || history_paths(log_path, idx_path, sizeof(log_path)) < 0) return;
+        if (!(ed->log = history_map(log_path, &ed->map_len, NULL))) return;
+        const char *last_nl = memrchr(ed->log, '\n', ed->map_len);
+        ed->log_len = last_nl ? (size_t)(last_nl - ed->log + 1) : 0; // Complete lines only
+        ed->hist_at = ed->log_len;
+        ed->draft = strdup(ed->buf);
+    }
+    if (dir < 0) {
+        if (ed->hist_at == 0) return;      // Already at the oldest entry
+        const char *end = ed->log + ed->hist_at - 1; // Newline ending the previous entry
+        const char *nl = memrchr(ed->log, '\n', end - ed->log);
+        ed->hist_at = nl ? (size_t)(nl - ed->log + 1) : 0;
+        editor_set(ed, ed->log + ed->hist_at, end - (ed->log + ed->hist_at));
+    } else if (ed->hist_at < ed->log_len) {
+        const char *nl = memchr(ed->log + ed->hist_at, '\n', ed->log_len - ed->hist_at);
+        ed->hist_at = nl - ed->log + 1;
+        if (ed->hist_at == ed->log_len) {
+            editor_set(ed, ed->draft, strlen(ed->draft));
+        } else {
+            const char *line = ed->log + ed->hist_at;
+            editor_set(ed, line, (const char *)memchr(line, '\n', ed->log_len - ed->hist_at) - line);
         }
+    }
+}
 
-        int num_commands = 0;      // Counter for the number of commands parsed from input
-        
-        // Detect and handle pipe operator (|) for sequential command execution
-        if (strchr(input, '|') && !strstr(input, "||")) {
-            char *commands_str[MAX_PIPES + 1]; // Array to hold command strings split by '|'
-            char *token = strtok(input, "|");  // Begin tokenizing input at pipe symbols
-            while (token && num_commands <= MAX_PIPES) {
-                commands_str[num_commands++] = token; // Store each command segment
-                token = strtok(NULL, "|"); // Move to next token
-            }
-            Command commands[MAX_PIPES + 1];   // Array to store parsed Command structs
-            for (int i = 0; i < num_commands; i++) {
-                parse_command(commands_str[i], &commands[i]); // Parse each command string
-            }
-            handle_pipes(commands, num_commands); // Execute commands with pipe logic
-        }
-        // Handle reverse pipe operator (=) for reverse-order execution
-        else if (strchr(input, '=')) {
-            char *commands_str[MAX_PIPES + 1]; // Temporary storage for command segments
-            char *token = strtok(input, "=");  // Split input by '='
-            while (token && num_commands <= MAX_PIPES) {
-                commands_str[num_commands++] = token; // Collect each command
-                token = strtok(NULL, "=");
-            }
-            Command commands[MAX_PIPES + 1];   // Array for parsed commands
-            for (int i = 0; i < num_commands; i++) {
-                parse_command(commands_str[i], &commands[i]); // Parse into Command structs
-            }
-            handle_reverse_pipes(commands, num_commands); // Execute in reverse order
-        }
-        // Process file append operator (~) to swap and append file contents
-        else if (strchr(input, '~')) {
-            char *file1 = strtok(input, "~");  // Extract first file name
-            char *file2 = strtok(NULL, "~");   // Extract second file name
-            if (file1 && file2) {              // Ensure both files are provided
-                // Remove leading whitespace from file1
-                while (*file1 == ' ') file1++;
-                // Trim trailing whitespace from file1
-                char *end1 = file1 + strlen(file1) - 1;
-                while (end1 > file1 && *end1 == ' ') *end1-- = '\0';
-                
-                // Remove leading whitespace from file2
-                while (*file2 == ' ') file2++;
-                // Trim trailing whitespace from file2
-                char *end2 = file2 + strlen(file2) - 1;
-                while (end2 > file2 && *end2 == ' ') *end2-- = '\0';
-                
-                handle_file_append(file1, file2); // Perform the append operation
-            } else {
-                printf("Error: Two text files required for ~ operation\n"); // Error if missing files
-            }
-        }
-        // Handle word count operator (#) for counting words in a file
-        else if (input[0] == '#') {
-            char *filename = input + 1;    // Skip '#' to access filename
-            while (*filename == ' ') filename++; // Skip any leading spaces
-            count_words(filename);         // Compute and display word count
-        }
-        // Process file concatenation operator (+) to merge files to stdout
-        else if (strchr(input, '+')) {
-            char *files[MAX_PIPES + 1];    // Array to store file names
-            int num_files = 0;             // Counter for number of files
-            char *token = strtok(input, "+"); // Split input by '+'
-            while (token && num_files <= MAX_PIPES) {
-                while (*token == ' ') token++; // Trim leading spaces
-                char *end = token + strlen(token) - 1; // Point to end of token
-                while (end > token && *end == ' ') *end-- = '\0'; // Trim trailing spaces
-                files[num_files++] = token; // Add file to array
-                token = strtok(NULL, "+");  // Next token
-            }
-            concatenate_files(files, num_files); // Concatenate and output files
-        }
-        // Handle sequential command execution with semicolon (;)
-        else if (strchr(input, ';')) {
-            char *commands_str[MAX_SEQUENTIAL]; // Array for sequential commands
-            char input_copy[MAX_CMD_LEN];       // Copy of input to avoid modifying original
-            strncpy(input_copy, input, MAX_CMD_LEN - 1); // Safe copy
-            input_copy[MAX_CMD_LEN - 1] = '\0'; // Ensure null termination
-            
-            char *token = strtok(input_copy, ";"); // Split by semicolon
-            num_commands = 0;
-            while (token && num_commands < MAX_SEQUENTIAL) {
-                while (*token == ' ') token++; // Remove leading spaces
-                char *end = token + strlen(token) - 1; // End of current token
-                while (end > token && *end == ' ') *end-- = '\0'; // Remove trailing spaces
-                if (strlen(token) > 0) {   // Ignore empty commands
-                    commands_str[num_commands++] = token; // Store command
-                }
-                token = strtok(NULL, ";"); // Move to next command
-            }
-            if (num_commands > 0) {        // Execute if there are valid commands
-                execute_sequential_commands(commands_str, num_commands);
-            }
+// Keeps the most recent distinct lines seen, like an LRU list: a repeat moves to the newest end
+static void editor_search_collect(const char *line, size_t len, void *ctx) {
+    EditorSearch *search = ctx;
+    for (int i = 0; i < search->count; i++) {
+        if (strlen(search->lines[i]) == len && memcmp(search->lines[i], line, len) == 0) {
+            char *same = search->lines[i];
+            memmove(search->lines + i, search->lines + i + 1, sizeof(char *) * (search->count - i - 1));
+            search->lines[search->count - 1] = same;
+            return;
         }
-        // Process conditional execution with && (AND) or || (OR)
-        else if (strstr(input, "&&") || strstr(input, "||")) {
-            char input_copy[MAX_CMD_LEN];  // Working copy of input
-            strncpy(input_copy, input, MAX_CMD_LEN - 1); // Safe copy
-            input_copy[MAX_CMD_LEN - 1] = '\0'; // Null terminate
-            
-            Command commands[MAX_PIPES + 1]; // Array for parsed commands
-            char operators[MAX_PIPES];       // Array to store operator types (& or |)
-            char *token = input_copy;        // Start tokenizing from input copy
-            int op_idx = 0;                  // Index for operators array
-            num_commands = 0;                // Command counter
-            while (token && num_commands <= MAX_PIPES) {
-                char *and_pos = strstr(token, "&&"); // Find AND operator
-                char *or_pos = strstr(token, "||");  // Find OR operator
-                if (and_pos && (!or_pos || and_pos < or_pos)) { // AND takes precedence
-                    *and_pos = '\0';         // Split at &&
-                    parse_command(token, &commands[num_commands++]); // Parse command
-                    operators[op_idx++] = '&'; // Record AND operator
-                    token = and_pos + 2;     // Move past &&
-                    while (*token == ' ') token++; // Skip spaces
-                }
-                else if (or_pos) {           // OR operator found
-                    *or_pos = '\0';          // Split at ||
-                    parse_command(token, &commands[num_commands++]); // Parse command
-                    operators[op_idx++] = '|'; // Record OR operator
-                    token = or_pos + 2;      // Move past ||
-                    while (*token == ' ') token++; // Skip spaces
-                }
-                else {                       // No more operators
-                    parse_command(token, &commands[num_commands++]); // Parse final command
-                    break;                   // Exit loop
-                }
-            }
-            if (num_commands > 0) {         // Execute if commands exist
-                execute_conditional(commands, num_commands, operators);
-            }
+    }
+    if (search->count == search->want) {   // Drop the oldest
+        free(search->lines[0]);
+        memmove(search->lines, search->lines + 1, sizeof(char *) * --search->count);
+    }
+    search->lines[search->count++] = strndup(line, len);
+}
+
+// Ctrl-R: incremental reverse search through history_search. Each key refines the query and
+// each further Ctrl-R steps to an older distinct match. Ctrl-G or Ctrl-C restores the line;
+// any other key leaves the match in place and is returned for the caller to handle (Enter
+// runs it). Returns 0 when the key was consumed.
+static int editor_search(Editor *ed, LineReader *in) {
+    char *saved = strdup(ed->buf);         // Line before the search, for Ctrl-G
+    size_t saved_pos = ed->pos;
+    const char *saved_prompt = ed->prompt;
+    char query[MAX_LINE] = "";
+    size_t qlen = 0;
+    char prompt[MAX_LINE + 32];            // "(reverse-i-search)`query': "
+    int skip = 0;                          // Matches stepped over with Ctrl-R
+    int key;
+    while (1) {
+        EditorSearch search = { calloc(skip + 1, sizeof(char *)), 0, skip + 1 };
+        if (qlen) history_search(query, editor_search_collect, &search);
+        if (search.count) {
+            if (skip >= search.count) skip = search.count - 1; // No older match: stay on the oldest
+            const char *match = search.lines[search.count - 1 - skip];
+            editor_set(ed, match, strlen(match));
+            ed->pos = strstr(match, query) - match; // Cursor on the matched text
         }
-        // Default case: execute a single command
-        else {
-            Command cmd = {0};             // Initialize empty Command struct
-            parse_command(input, &cmd);    // Parse the input into cmd
-            if (cmd.argc > 0) {            // Only execute if arguments were parsed
-                execute_single_command(&cmd); // Run the command
-            }
-            free_command(&cmd);            // Clean up allocated memory
+        for (int i = 0; i < search.count; i++) free(search.lines[i]);
+        free(search.lines);
+        snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%s': ", qlen && !search.count ? "failed " : "", query);
+        ed->prompt = prompt;
+        editor_refresh(ed);
+        key = editor_key(in);
+        if (key == 18) {                   // Ctrl-R: next older match
+            skip++;
+        } else if (key == 127 || key == 8) {
+            if (qlen) query[--qlen] = '\0';
+            skip = 0;
+        } else if (key >= 32 && qlen + 1 < sizeof(query)) {
+            query[qlen++] = key;
+            query[qlen] = '\0';
+            skip = 0;
+        } else {
+            break;
         }
     }
-    return 0;                             // Exit main (unreachable due to infinite loop)
+    ed->prompt = saved_prompt;
+    if (key == 7 || key == 3) {            // Ctrl-G / Ctrl-C: back to the line as it was
+        editor_set(ed, saved, strlen(saved));
+        ed->pos = saved_pos;
+        key = 0;
+    }
+    free(saved);
+    return key;
 }
 
-// Parses raw input into a structured Command object for execution
-void parse_command(char *input, Command *cmd) {
-    cmd->argc = 0;            // Reset argument count to zero
-    cmd->input_file = NULL;   // No input file by default
-    cmd->output_file = NULL;  // No output file by default
-    cmd->append_output = 0;   // Default to overwrite mode for output
-    
-    char input_copy[MAX_CMD_LEN]; // Local copy to avoid modifying original input
-    strncpy(input_copy, input, MAX_CMD_LEN - 1); // Copy input safely
-    input_copy[MAX_CMD_LEN - 1] = '\0'; // Ensure null termination
-    
-    char *token = strtok(input_copy, " "); // Start tokenizing by spaces
-    while (token && cmd->argc < MAX_ARGS) { // Continue until no tokens or limit reached
-        if (strcmp(token, "<") == 0) {     // Check for input redirection
-            cmd->input_file = strtok(NULL, " "); // Set input file from next token
-            token = strtok(NULL, " ");     // Skip to next token
-            continue;                      // Move to next iteration
+// Prints the candidates in columns below the line, asking first when there are many
+static void editor_list(LineReader *in, char **names, int count) {
+    printf("\n");
+    if (count > COMPLETE_LIST_ASK) {
+        printf("Display all %d possibilities? (y or n)", count);
+        fflush(stdout);
+        int key = editor_key(in);
+        printf("\n");
+        if (key != 'y' && key != 'Y') return;
+    }
+    struct winsize ws;
+    size_t cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
+    size_t width = 0;                      // Widest name plus a gap
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(names[i]);
+        if (len > width) width = len;
+    }
+    width += 2;
+    int per_row = cols / width ? cols / width : 1;
+    int rows = (count + per_row - 1) / per_row;
+    for (int r = 0; r < rows; r++) {       // Sorted down the columns, as ls does
+        for (int c = 0; c < per_row && c * rows + r < count; c++) printf("%-*s", (int)width, names[c * rows + r]);
+        printf("\n");
+    }
+}
+
+// Inserts n bytes of a completion, escaped so the lexer reads them back unchanged: with a
+// backslash outside quotes, and only where needed inside double quotes
+static void editor_insert_escaped(Editor *ed, const char *text, size_t n, char quote) {
+    for (size_t i = 0; i < n; i++) {
+        if ((!quote && strchr(COMPLETE_ESCAPE, text[i])) || (quote == '"' && strchr("\"\\$`", text[i]))) {
+            editor_insert(ed, "\\", 1);
         }
-        if (strcmp(token, ">") == 0) {     // Check for output redirection (overwrite)
-            cmd->output_file = strtok(NULL, " "); // Set output file
-            cmd->append_output = 0;        // Set overwrite mode
-            token = strtok(NULL, " ");     // Skip to next token
+        editor_insert(ed, text + i, 1);
+    }
+}
+
+// Tab: completes the word before the cursor. A single candidate is inserted whole; several
+// extend the word to their longest common prefix, and a second Tab lists them.
+static void editor_complete(Editor *ed, LineReader *in) {
+    // Split the line up to the cursor as next_token would, noting whether the last word is
+    // in command position: the first word, or after an operator, =, {, ',', time or memo
+    const char *buf = ed->buf;
+    size_t i = 0, start;                   // Scan position; start of the current word
+    int command = 1, redirect = 0;         // What the next word is
+    while (1) {
+        while (i < ed->pos && (buf[i] == ' ' || buf[i] == '\t')) i++;
+        start = i;
+        if (i == ed->pos) break;           // Empty word at the cursor
+        if (buf[i] == '|' || buf[i] == '&' || buf[i] == ';') {
+            while (i < ed->pos && (buf[i] == '|' || buf[i] == '&' || buf[i] == ';')) i++;
+            command = 1;
+            redirect = 0;
             continue;
         }
-        if (strcmp(token, ">>") == 0) {    // Check for output redirection (append)
-            cmd->output_file = strtok(NULL, " "); // Set output file
-            cmd->append_output = 1;        // Set append mode
-            token = strtok(NULL, " ");     // Skip to next token
+        if (buf[i] == '<' || buf[i] == '>') {
+            while (i < ed->pos && (buf[i] == '<' || buf[i] == '>')) i++;
+            redirect = 1;
             continue;
         }
-        cmd->args[cmd->argc] = strdup(token); // Duplicate token into args array
-        cmd->argc++;                       // Increment argument count
-        token = strtok(NULL, " ");         // Move to next token
+        char quote = 0;
+        while (i < ed->pos && (quote || !is_word_break(buf[i]))) {
+            if (quote) {
+                if (buf[i] == quote) quote = 0;
+                else if (quote == '"' && buf[i] == '\\') i++;
+            } else if (buf[i] == '\'' || buf[i] == '"') {
+                quote = buf[i];
+            } else if (buf[i] == '\\') {
+                i++;
+            }
+            i++;
+        }
+        if (i >= ed->pos) break;           // The cursor is in this word
+        size_t len = i - start;
+        if (redirect) redirect = 0;        // A redirection target leaves the position as it was
+        else command = (len == 1 && strchr("={,", buf[start])) ||
+                       (len == 4 && (strncmp(buf + start, "time", 4) == 0 || strncmp(buf + start, "memo", 4) == 0));
     }
-    cmd->args[cmd->argc] = NULL;           // Null-terminate the args array for execvp
     
-    // Enforce argument count limits (1-5 args + command)
-    if (cmd->argc < 1 || cmd->argc > 5) {
-        printf("Error: Command '%s' must have 1-5 arguments\n", cmd->args[0] ? cmd->args[0] : input);
-        free_command(cmd);                 // Clean up on error
-        cmd->argc = 0;                     // Reset argc to indicate failure
+    char *word = malloc(ed->pos - start + 1); // The word as the lexer would read it
+    size_t len = 0;
+    char quote = 0;                        // Quote still open at the cursor
+    for (size_t j = start; j < ed->pos; j++) {
+        char c = buf[j];
+        if (quote && c == quote) quote = 0;
+        else if (!quote && (c == '\'' || c == '"')) quote = c;
+        else if (c == '\\' && j + 1 < ed->pos && (!quote || (quote == '"' && strchr("\"\\$`", buf[j + 1])))) word[len++] = buf[++j];
+        else word[len++] = c;
     }
-}
-
-// Frees dynamically allocated memory within a Command structure
-void free_command(Command *cmd) {
-    for (int i = 0; i < cmd->argc; i++) {  // Iterate through all arguments
-        if (cmd->args[i]) {                // Check if pointer is non-null
-            free(cmd->args[i]);            // Release allocated memory
-            cmd->args[i] = NULL;           // Prevent double-free
+    word[len] = '\0';
+    const char *slash = strrchr(word, '/');
+    size_t typed = slash ? strlen(slash + 1) : len; // Bytes of each candidate already on the line
+    int count = complete_word(word, command && !redirect);
+    free(word);
+    if (count == 0) {
+        printf("\a");
+        return;
+    }
+    const char *first = completer.matches[0], *last = completer.matches[count - 1];
+    size_t common = 0;                     // Sorted, so the first and last bound the common prefix
+    while (first[common] && first[common] == last[common]) common++;
+    if (common > typed) {
+        editor_insert_escaped(ed, first + typed, common - typed, quote);
+        if (count == 1 && first[common - 1] != '/') { // Complete word: close it
+            if (quote) editor_insert(ed, &quote, 1);
+            editor_insert(ed, " ", 1);
         }
+    } else if (ed->tabs >= 2) {
+        editor_list(in, completer.matches, count);
+    } else {
+        printf("\a");
     }
-    cmd->argc = 0;                         // Reset argument count to zero
 }
 
-// Executes a single command with possible I/O redirection
-void execute_single_command(Command *cmd) {
-    if (cmd->argc == 0) return;            // Exit if no valid command to execute
+// Reads one line at the terminal in raw mode, with editing: arrows, Home/End, Delete, the
+// usual Emacs keys, Up/Down through the history log, Ctrl-R to search it and Tab to
+// complete. The line stays valid until the next call; NULL at end of input (Ctrl-D on an
+// empty line). Falls back to reader_line if the terminal cannot be switched to raw mode.
+char *editor_line(LineReader *in, const char *prompt) {
+    Editor *ed = &editor;
+    struct termios cooked, raw;            // Modes to restore; modes while editing
+    if (tcgetattr(in->fd, &cooked) < 0) {
+        in->edit = 0;
+        printf("%s", prompt);
+        fflush(stdout);
+        return reader_line(in);
+    }
+    raw = cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG); // Ctrl-C and Ctrl-Z arrive as keys
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(in->fd, TCSADRAIN, &raw);
+    if (!ed->buf) {
+        ed->size = MAX_LINE;
+        ed->buf = malloc(ed->size);
+    }
+    ed->len = ed->pos = 0;
+    ed->buf[0] = '\0';
+    ed->prompt = prompt;
+    ed->tabs = 0;
+    editor_refresh(ed);
     
-    pid_t pid = fork();                    // Fork to create a child process
-    if (pid == 0) {                        // Child process block
-        setpgid(0, shell_pgid);            // Assign child to shell's process group
-        
-        if (cmd->input_file) {             // Handle input redirection if specified
-            int fd = open(cmd->input_file, O_RDONLY); // Open file for reading
-            if (fd < 0) {                  // Check for file open failure
-                printf("Error: Cannot open input file %s\n", cmd->input_file);
-                exit(1);                   // Exit child with error
-            }
-            dup2(fd, STDIN_FILENO);        // Redirect stdin to file
-            close(fd);                     // Close file descriptor
-        }
-        if (cmd->output_file) {            // Handle output redirection if specified
-            int fd = open(cmd->output_file, 
-                         O_WRONLY | O_CREAT | (cmd->append_output ? O_APPEND : O_TRUNC), 
-                         0666);            // Open file with write/create, mode based on append
-            if (fd < 0) {                  // Check for file open failure
-                printf("Error: Cannot open output file %s\n", cmd->output_file);
-                exit(1);                   // Exit child with error
-            }
-            dup2(fd, STDOUT_FILENO);       // Redirect stdout to file
-            close(fd);                     // Close file descriptor
-        }
-        execvp(cmd->args[0], cmd->args);   // Execute the command with arguments
-        // If execvp returns, it failed
-        printf("Error: Command '%s' not found\n", cmd->args[0]);
-        exit(1);                       // Exit child with error status
-    }
-    wait(NULL);                            // Parent waits for child to finish
-    free_command(cmd);                     // Clean up command memory in parent
-}
-
-// Executes multiple commands sequentially as separated by semicolons
-void execute_sequential_commands(char *commands[], int num_commands) {
-    for (int i = 0; i < num_commands; i++) { // Loop through each command
-        Command cmd = {0};                   // Initialize a new Command struct
-        char command_copy[MAX_CMD_LEN];      // Local copy of command string
-        strncpy(command_copy, commands[i], MAX_CMD_LEN - 1); // Safe copy
-        command_copy[MAX_CMD_LEN - 1] = '\0'; // Null terminate
-        
-        char *args[MAX_ARGS + 1];            // Temporary array for arguments
-        int arg_count = 0;                   // Counter for arguments
-        char *token = strtok(command_copy, " "); // Tokenize command by spaces
-        while (token && arg_count < MAX_ARGS) { // Parse tokens
-            args[arg_count++] = token;       // Store token
-            token = strtok(NULL, " ");       // Next token
+    int done = 0;                          // 1: line ready; -1: end of input
+    int next = 0;                          // Key handed back by the search, handled next
+    while (!done) {
+        int key = next ? next : editor_key(in);
+        next = 0;
+        ed->tabs = key == '\t' ? ed->tabs + 1 : 0;
+        switch (key) {
+        case -1:                           // Input closed: run what was typed, then stop
+            if (ed->len) printf("\n");
+            done = ed->len ? 1 : -1;
+            break;
+        case '\r': case '\n':
+            ed->pos = ed->len;
+            editor_refresh(ed);
+            printf("\n");
+            done = 1;
+            break;
+        case 3:                            // Ctrl-C: abandon the line
+            printf("^C\n");
+            ed->len = ed->pos = 0;
+            ed->buf[0] = '\0';
+            done = 1;
+            break;
+        case 4:                            // Ctrl-D: end of input on an empty line, else delete
+            if (ed->len == 0) done = -1;
+            else if (ed->pos < ed->len) editor_delete(ed, ed->pos, 1);
+            break;
+        case 127: case 8:                  // Backspace
+            if (ed->pos > 0) editor_delete(ed, ed->pos - 1, 1);
+            break;
+        case '\t':
+            editor_complete(ed, in);
+            break;
+        case 1: ed->pos = 0; break;        // Ctrl-A
+        case 5: ed->pos = ed->len; break;  // Ctrl-E
+        case 2: if (ed->pos > 0) ed->pos--; break; // Ctrl-B
+        case 6: if (ed->pos < ed->len) ed->pos++; break; // Ctrl-F
+        case 11: editor_delete(ed, ed->pos, ed->len - ed->pos); break; // Ctrl-K
+        case 21: editor_delete(ed, 0, ed->pos); break; // Ctrl-U
+        case 23: {                         // Ctrl-W: the word before the cursor
+            size_t from = ed->pos;
+            while (from > 0 && ed->buf[from - 1] == ' ') from--;
+            while (from > 0 && ed->buf[from - 1] != ' ') from--;
+            editor_delete(ed, from, ed->pos - from);
+            break;
         }
-        args[arg_count] = NULL;              // Null terminate args array
-
-        if (arg_count > 0) {                 // Proceed if arguments exist
-            cmd.argc = arg_count;            // Set argument count
-            for (int j = 0; j < arg_count; j++) { // Copy arguments into cmd
-                cmd.args[j] = strdup(args[j]); // Duplicate string for safety
+        case 12: printf("\x1b[H\x1b[2J"); break; // Ctrl-L
+        case 16: editor_history(ed, -1); break; // Ctrl-P
+        case 14: editor_history(ed, 1); break; // Ctrl-N
+        case 18: next = editor_search(ed, in); break; // Ctrl-R
+        case 27: {                         // Escape sequence: arrows, Home, End, Delete
+            int kind = editor_key(in);
+            int code = kind == '[' || kind == 'O' ? editor_key(in) : 0;
+            if (code >= '0' && code <= '9') { // ESC [ n ~
+                if (editor_key(in) != '~') break;
+                if (code == '3' && ed->pos < ed->len) editor_delete(ed, ed->pos, 1);
+                if (code == '1' || code == '7') ed->pos = 0;
+                if (code == '4' || code == '8') ed->pos = ed->len;
             }
-            cmd.args[arg_count] = NULL;      // Null terminate cmd args
-
-            if (cmd.argc < 1 || cmd.argc > 5) { // Validate argument count
-                printf("Error: Command '%s' must have 1-5 arguments\n", cmd.args[0]);
-                free_command(&cmd);          // Clean up on error
-            } else {
-                execute_single_command(&cmd); // Execute valid command
+            if (code == 'A') editor_history(ed, -1);
+            if (code == 'B') editor_history(ed, 1);
+            if (code == 'C' && ed->pos < ed->len) ed->pos++;
+            if (code == 'D' && ed->pos > 0) ed->pos--;
+            if (code == 'H') ed->pos = 0;
+            if (code == 'F') ed->pos = ed->len;
+            break;
+        }
+        default:
+            if (key >= 32) {
+                char c = key;
+                editor_insert(ed, &c, 1);
             }
+            break;
         }
+        if (!done && !next && in->start == in->end) editor_refresh(ed); // Not mid-paste
+    }
+    
+    tcsetattr(in->fd, TCSADRAIN, &cooked);
+    if (ed->log) {
+        munmap(ed->log, ed->map_len);
+        ed->log = NULL;
     }
+    free(ed->draft);
+    ed->draft = NULL;
+    return done < 0 ? NULL : ed->buf;
 }
 
-// Manages execution of commands connected by standard pipes (|)
-void handle_pipes(Command *commands, int num_commands) {
-    int pipes[MAX_PIPES][2];               // Array of pipe file descriptors
-    pid_t pids[MAX_PIPES + 1];             // Array to store child PIDs
+// Starts a memo hash
+static void memo_hash_init(MemoHash *m) {
+    m->h[0] = 0x9e3779b97f4a7c15ULL;       // Distinct seeds for the two lanes
+    m->h[1] = 0xc2b2ae3d27d4eb4fULL;
+    m->len = 0;
+}
+
+// Folds one 64-bit word into a lane (murmur3-style multiply and rotate)
+static uint64_t memo_mix(uint64_t h, uint64_t w) {
+    w *= 0x87c37b91114253d5ULL;
+    h ^= (w << 31) | (w >> 33);
+    h = (h << 27) | (h >> 37);
+    return h * 5 + 0x52dce729;
+}
+
+// Adds bytes to the hash, 16 at a time; a short tail is zero-padded
+static void memo_hash_update(MemoHash *m, const void *data, size_t len) {
+    const unsigned char *p = data;
+    m->len += len;
+    for (; len >= 16; p += 16, len -= 16) {
+        uint64_t a, b;
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 8, 8);
+        m->h[0] = memo_mix(m->h[0], a);
+        m->h[1] = memo_mix(m->h[1], b);
+    }
+    if (len) {
+        unsigned char tail[16] = {0};
+        memcpy(tail, p, len);
+        memo_hash_update(m, tail, 16);
+        m->len -= 16;                      // Padding is not part of the length
+    }
+}
+
+// Adds a string with its length, so "ab","c" and "a","bc" hash differently
+static void memo_hash_string(MemoHash *m, const char *s) {
+    uint64_t len = s ? strlen(s) : UINT64_MAX; // NULL hashes apart from ""
+    memo_hash_update(m, &len, sizeof(len));
+    if (s) memo_hash_update(m, s, len);
+}
+
+// Finishes the hash into out[2]
+static void memo_hash_final(MemoHash *m, uint64_t out[2]) {
+    uint64_t h0 = m->h[0] ^ m->len, h1 = m->h[1] ^ m->len;
+    h0 += h1;
+    h1 += h0;
+    for (int i = 0; i < 2; i++) {          // murmur3 fmix64 on each lane
+        uint64_t h = i ? h1 : h0;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        out[i] = h;
+    }
+    out[0] += out[1];
+    out[1] += out[0];
+}
+
+// Adds what identifies a file's contents: device, inode, size and mtime in ns. A missing
+// path hashes as absent, so creating it changes the key. Returns 0 if it exists.
+static int memo_hash_file(MemoHash *m, const char *path, struct stat *st) {
+    if (stat(path, st) < 0) {
+        memo_hash_string(m, "-");
+        return -1;
+    }
+    uint64_t id[6] = {st->st_dev, st->st_ino, st->st_mode, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec};
+    memo_hash_update(m, id, sizeof(id));
+    return 0;
+}
+
+// Builds the key of a memo command: argv, working directory, the key variables, the
+// executable, < input and every argument that names a file (whole, or after an =).
+// Returns -1 when the command must run uncached: < input missing, or output written
+// over one of its own inputs.
+static int memo_key(Command *cmd, uint64_t key[2]) {
+    MemoHash m;
+    memo_hash_init(&m);
+    struct stat st, out_st;                // An input's identity; the > target's
+    int have_out = cmd->output_file && stat(cmd->output_file, &out_st) == 0;
+    int clash = 0;                         // Some input is the output file
     
-    // Create pipes for all commands except the last
-    for (int i = 0; i < num_commands - 1; i++) {
-        if (pipe(pipes[i]) < 0) {          // Attempt to create a pipe
-            printf("Error: Pipe creation failed\n"); // Report failure
-            return;                        // Abort function
+    uint64_t header[2] = {cmd->argc, (uint64_t)(unsigned char)cmd->file_op};
+    memo_hash_update(&m, header, sizeof(header));
+    for (int i = 0; i < cmd->argc; i++) memo_hash_string(&m, cmd->args[i]);
+    char cwd[PATH_MAX];
+    memo_hash_string(&m, getcwd(cwd, sizeof(cwd)));
+    
+    const char *vars = getenv(MEMO_VARS_ENV);
+    if (!vars) vars = MEMO_DEFAULT_VARS;
+    while (*vars) {                        // NAME=value (or NAME alone when unset) per variable
+        size_t len = strcspn(vars, ":");
+        char name[MAX_LINE];
+        if (len > 0 && len < sizeof(name)) {
+            memcpy(name, vars, len);
+            name[len] = '\0';
+            memo_hash_string(&m, name);
+            memo_hash_string(&m, getenv(name));
         }
+        vars += len + (vars[len] == ':');
     }
     
-    // Fork and execute each command in the pipeline
-    for (int i = 0; i < num_commands; i++) {
-        pids[i] = fork();                  // Create a child process
-        if (pids[i] == 0) {                // Child process
-            if (i > 0) {                   // Not the first command
-                dup2(pipes[i-1][0], STDIN_FILENO); // Redirect stdin from previous pipe
-                close(pipes[i-1][1]);      // Close write end of previous pipe
-            }
-            if (i < num_commands - 1) {    // Not the last command
-                dup2(pipes[i][1], STDOUT_FILENO); // Redirect stdout to next pipe
-                close(pipes[i][0]);        // Close read end of current pipe
-            }
-            // Close all pipe ends to prevent leaks in child
-            for (int j = 0; j < num_commands - 1; j++) {
-                close(pipes[j][0]);        // Close read end
-                close(pipes[j][1]);        // Close write end
-            }
-            execvp(commands[i].args[0], commands[i].args); // Execute command
-            printf("Error: Command not found\n"); // Exec failed if this runs
-            exit(1);                       // Exit child with error
+    if (!cmd->file_op) {                   // A rebuilt binary may print something else
+        int cached;
+        const char *exe = resolve_command(cmd->args[0], &cached);
+        if (!exe) return -1;               // Let the run report it
+        memo_hash_string(&m, exe);
+        memo_hash_file(&m, exe, &st);
+    }
+    if (cmd->input_file) {
+        memo_hash_string(&m, "<");
+        if (memo_hash_file(&m, cmd->input_file, &st) < 0) return -1; // Let the run report it
+        if (have_out && st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino) clash = 1;
+    }
+    for (int i = cmd->file_op ? 0 : 1; i < cmd->argc; i++) {
+        const char *eq = strchr(cmd->args[i], '='); // --in=file, if=file
+        for (int part = 0; part < 2; part++) {
+            const char *path = part ? (eq ? eq + 1 : NULL) : cmd->args[i];
+            if (!path || !*path) continue;
+            if (memo_hash_file(&m, path, &st) == 0 && have_out &&
+                st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino) clash = 1;
         }
     }
-    
-    // Parent closes all pipe ends to avoid interference
-    for (int i = 0; i < num_commands - 1; i++) {
-        close(pipes[i][0]);                // Close read end
-        close(pipes[i][1]);                // Close write end
+    memo_hash_final(&m, key);
+    return clash ? -1 : 0;
+}
+
+// Builds the path of name inside the memo directory, creating the directory
+static int memo_path(const char *name, char *path, size_t size) {
+    if (state_path(MEMO_DIR, path, size) < 0) return -1;
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) return -1;
+    size_t n = strlen(path);
+    return snprintf(path + n, size - n, "/%s", name) >= (int)(size - n) ? -1 : 0;
+}
+
+// Path of the file holding the output with content hash blob
+static int memo_blob_path(const uint64_t blob[2], char *path, size_t size) {
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)blob[0], (unsigned long long)blob[1]);
+    return memo_path(name, path, size);
+}
+
+// Reads the index; an absent or foreign file loads as an empty cache
+static void memo_load(MemoIndex *index) {
+    char path[PATH_MAX];
+    memset(index, 0, offsetof(MemoIndex, entries));
+    index->magic = MEMO_MAGIC;
+    if (memo_path(MEMO_INDEX, path, sizeof(path)) < 0) return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, index, sizeof(MemoIndex));
+    close(fd);
+    size_t head = offsetof(MemoIndex, entries);
+    if (n < (ssize_t)head || index->magic != MEMO_MAGIC || index->count > MEMO_MAX_ENTRIES ||
+        (size_t)n < head + index->count * sizeof(MemoEntry)) {
+        memset(index, 0, head);            // Torn or from another version: start over
+        index->magic = MEMO_MAGIC;
     }
-    // Wait for all child processes to complete
-    for (int i = 0; i < num_commands; i++) {
-        waitpid(pids[i], NULL, 0);         // Wait for specific child
-        free_command(&commands[i]);        // Free command memory
+}
+
+// Writes the index to a private file and renames it into place, as wc_cache_store does
+static void memo_save(MemoIndex *index) {
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    if (memo_path(MEMO_INDEX, path, sizeof(path)) < 0) return;
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) return;                   // Cache is best effort
+    ssize_t len = offsetof(MemoIndex, entries) + index->count * sizeof(MemoEntry);
+    int ok = write(out, index, len) == len;
+    if (close(out) != 0) ok = 0;
+    if (ok) rename(tmp, path);
+    else unlink(tmp);
+}
+
+// Nonzero if an entry other than skip still uses blob
+static int memo_blob_used(MemoIndex *index, const uint64_t blob[2], int skip) {
+    for (uint32_t i = 0; i < index->count; i++) {
+        if ((int)i != skip && index->entries[i].blob[0] == blob[0] && index->entries[i].blob[1] == blob[1]) return 1;
     }
+    return 0;
 }
 
-// Executes commands with reverse pipe logic using '=' operator
-void handle_reverse_pipes(Command *commands, int num_commands) {
-    int pipes[MAX_PIPES][2];               // Pipe file descriptors for reverse piping
-    pid_t pids[MAX_PIPES + 1];             // PIDs for child processes
+// Bytes on disk: each output file counts once however many entries share it
+static uint64_t memo_disk_bytes(MemoIndex *index) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < index->count; i++) {
+        int first = 1;                     // First entry naming this blob
+        for (uint32_t j = 0; j < i && first; j++) {
+            first = index->entries[j].blob[0] != index->entries[i].blob[0] ||
+                    index->entries[j].blob[1] != index->entries[i].blob[1];
+        }
+        if (first) total += index->entries[i].size;
+    }
+    return total;
+}
+
+// Drops entry i, deleting its output file unless another entry shares it; returns bytes freed
+static uint64_t memo_drop(MemoIndex *index, uint32_t i) {
+    MemoEntry *entry = &index->entries[i];
+    uint64_t freed = 0;
+    if (!memo_blob_used(index, entry->blob, i)) {
+        char path[PATH_MAX];
+        if (memo_blob_path(entry->blob, path, sizeof(path)) == 0) unlink(path);
+        freed = entry->size;
+    }
+    *entry = index->entries[--index->count]; // Order does not matter
+    return freed;
+}
+
+// Evicts least recently used entries until the output fits budget and one slot is free
+static void memo_evict(MemoIndex *index, uint64_t budget) {
+    uint64_t total = memo_disk_bytes(index);
+    while (index->count > 0 && (total > budget || index->count == MEMO_MAX_ENTRIES)) {
+        uint32_t oldest = 0;
+        for (uint32_t i = 1; i < index->count; i++) {
+            if (index->entries[i].last_used < index->entries[oldest].last_used) oldest = i;
+        }
+        total -= memo_drop(index, oldest);
+    }
+}
+
+// Realtime clock in ns; orders uses across shells and reboots
+static int64_t memo_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Copies a cached or just-captured output to where the command's stdout would have gone
+static int memo_replay(int fd, Command *cmd) {
+    int out = STDOUT_FILENO;
+    if (cmd->output_file) {
+        out = open(cmd->output_file, O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append_output ? O_APPEND : O_TRUNC), 0666);
+        if (out < 0) {
+            printf("Error: Cannot open output file %s\n", cmd->output_file);
+            return -1;
+        }
+    }
+    fflush(stdout);                        // Raw writes follow anything already printed
+    struct stat out_st;
+    int rc = fstat(out, &out_st) == 0 && lseek(fd, 0, SEEK_SET) == 0 ? stream_file(fd, out, &out_st) : -1;
+    if (out != STDOUT_FILENO) close(out);
+    return rc;
+}
+
+// Content hash of an open file's bytes
+static int memo_hash_fd(int fd, uint64_t size, uint64_t blob[2]) {
+    MemoHash m;
+    memo_hash_init(&m);
+    if (size > 0) {
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return -1;
+        madvise(data, size, MADV_SEQUENTIAL);
+        memo_hash_update(&m, data, size);
+        munmap(data, size);
+    }
+    memo_hash_final(&m, blob);
+    return 0;
+}
+
+// Runs a memo command. A hit copies the stored output to the command's stdout (or
+// its > file) and returns the stored status without running anything. A miss runs
+// the command with stdout captured to a file in the cache, replays that file, and
+// files it under the hash of its content so identical outputs are stored once.
+// stderr is never cached, and runs ended by a signal are not recorded.
+int memo_run(Node *node) {
+    Command *cmd = &node->commands[0];
+    Command run = *cmd;                    // The command as it actually runs
+    run.memo = 0;
+    Node single = *node;
+    single.commands = &run;
+    uint64_t key[2];
+    if (memo_key(cmd, key) < 0) return execute_single_command(&single);
     
-    // Set up pipes for reverse execution
-    for (int i = 0; i < num_commands - 1; i++) {
-        if (pipe(pipes[i]) < 0) {          // Create pipe
-            printf("Error: Pipe creation failed\n"); // Report error
-            return;                        // Exit on failure
+    static MemoIndex index;                // 80 KB: too big for the stack
+    memo_load(&index);
+    for (uint32_t i = 0; i < index.count; i++) {
+        MemoEntry *entry = &index.entries[i];
+        if (entry->key[0] != key[0] || entry->key[1] != key[1]) continue;
+        char path[PATH_MAX];
+        int fd = memo_blob_path(entry->blob, path, sizeof(path)) == 0 ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+        if (fd < 0) {                      // Output file removed behind our back: forget the entry
+            memo_drop(&index, i);
+            break;
         }
+        int rc = memo_replay(fd, cmd);
+        close(fd);
+        if (rc < 0) return 1;
+        entry->last_used = memo_now();
+        index.hits++;
+        index.bytes_saved += entry->size;
+        index.ns_saved += entry->run_ns;
+        int status = entry->status;
+        memo_save(&index);
+        return status;
     }
     
-    // Fork and execute commands in reverse order
-    for (int i = num_commands - 1; i >= 0; i--) {
-        pids[i] = fork();                  // Create child process
-        if (pids[i] == 0) {                // Child process
-            if (i < num_commands - 1) {    // Not the last command in reverse
-                dup2(pipes[i][0], STDIN_FILENO); // Read from next pipe
-                close(pipes[i][1]);        // Close write end
-            }
-            if (i > 0) {                   // Not the first command in reverse
-                dup2(pipes[i-1][1], STDOUT_FILENO); // Write to previous pipe
-                close(pipes[i-1][0]);      // Close read end
+    char tmp[PATH_MAX];                    // Captured stdout, renamed to its hash afterwards
+    char name[64];
+    static unsigned serial;                // Unique within this shell
+    snprintf(name, sizeof(name), "run.%d.%u", (int)getpid(), serial++);
+    if (memo_path(name, tmp, sizeof(tmp)) < 0) return execute_single_command(&single); // No cache directory
+    run.output_file = tmp;
+    run.append_output = 0;
+    uint64_t t0 = trace_now_ns();
+    int status = execute_single_command(&single);
+    uint64_t run_ns = trace_now_ns() - t0;
+    
+    int fd = open(tmp, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return status;             // Redirection failed: nothing was produced
+    unlink(tmp);                           // Kept open; linked again under its hash if stored
+    struct stat st;
+    if (memo_replay(fd, cmd) < 0) status = 1;
+    
+    long long budget = getenv(MEMO_BUDGET_ENV) ? parse_size(getenv(MEMO_BUDGET_ENV)) : MEMO_DEFAULT_BUDGET;
+    MemoEntry entry = {0};
+    entry.key[0] = key[0];
+    entry.key[1] = key[1];
+    if (status < 128 && fstat(fd, &st) == 0 && st.st_size <= budget &&
+        memo_hash_fd(fd, st.st_size, entry.blob) == 0) {
+        char path[PATH_MAX];
+        memo_load(&index);                 // Another shell may have written it meanwhile
+        index.misses++;
+        if (memo_blob_path(entry.blob, path, sizeof(path)) == 0) {
+            int stored = access(path, F_OK) == 0; // Same output already on disk
+            if (!stored) {                 // Copy into place, then publish atomically
+                char part[PATH_MAX + 8];
+                snprintf(part, sizeof(part), "%s.part", tmp);
+                int out = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                struct stat part_st;
+                if (out >= 0) {
+                    stored = fstat(out, &part_st) == 0 && lseek(fd, 0, SEEK_SET) == 0 &&
+                             stream_file(fd, out, &part_st) == 0;
+                    if (close(out) != 0) stored = 0;
+                    if (stored) stored = rename(part, path) == 0;
+                    if (!stored) unlink(part);
+                }
             }
-            // Close all pipe ends in child
-            for (int j = 0; j < num_commands - 1; j++) {
-                close(pipes[j][0]);        // Close read end
-                close(pipes[j][1]);        // Close write end
+            if (stored) {
+                entry.size = st.st_size;
+                entry.run_ns = run_ns;
+                entry.status = status;
+                entry.last_used = memo_now();
+                if (index.count == MEMO_MAX_ENTRIES) memo_evict(&index, UINT64_MAX); // Frees one slot
+                index.entries[index.count++] = entry;
+                // Drop a stale entry for the key. The new entry is already in, so an output
+                // file both share stays; one only the stale entry used is deleted.
+                for (uint32_t i = 0; i + 1 < index.count; i++) {
+                    if (index.entries[i].key[0] == key[0] && index.entries[i].key[1] == key[1]) {
+                        memo_drop(&index, i);
+                        break;
+                    }
+                }
+                memo_evict(&index, budget > 0 ? (uint64_t)budget : 0);
             }
-            execvp(commands[i].args[0], commands[i].args); // Execute command
-            printf("Error: Command not found\n"); // Exec failed
-            exit(1);                       // Exit child with error
         }
+        memo_save(&index);
     }
-    
-    // Parent closes all pipe ends
-    for (int i = 0; i < num_commands - 1; i++) {
-        close(pipes[i][0]);                // Close read end
-        close(pipes[i][1]);                // Close write end
+    close(fd);
+    return status;
+}
+
+// Formats a byte count for cache stats
+static void memo_format_bytes(uint64_t bytes, char *out, size_t size) {
+    if (bytes >= (1ULL << 30)) snprintf(out, size, "%.1f GB", bytes / 1073741824.0);
+    else if (bytes >= (1ULL << 20)) snprintf(out, size, "%.1f MB", bytes / 1048576.0);
+    else if (bytes >= 1024) snprintf(out, size, "%.1f KB", bytes / 1024.0);
+    else snprintf(out, size, "%llu B", (unsigned long long)bytes);
+}
+
+// cache stats: entries, size, hit rate and what replays saved; cache clear: empties the memo cache
+int builtin_cache(Command *cmd) {
+    static MemoIndex index;
+    memo_load(&index);
+    if (cmd->argc == 2 && strcmp(cmd->args[1], "clear") == 0) {
+        while (index.count > 0) memo_drop(&index, 0);
+        memset(&index, 0, offsetof(MemoIndex, entries));
+        index.magic = MEMO_MAGIC;
+        memo_save(&index);
+        return 0;
     }
-    // Wait for all children and clean up
-    for (int i = 0; i < num_commands; i++) {
-        waitpid(pids[i], NULL, 0);         // Wait for child to finish
-        free_command(&commands[i]);        // Free command memory
+    if (cmd->argc > 2 || (cmd->argc == 2 && strcmp(cmd->args[1], "stats") != 0)) {
+        printf("Usage: cache [stats | clear]\n");
+        return 2;
     }
+    long long budget = getenv(MEMO_BUDGET_ENV) ? parse_size(getenv(MEMO_BUDGET_ENV)) : MEMO_DEFAULT_BUDGET;
+    uint64_t lookups = index.hits + index.misses;
+    char size[32], limit[32], saved[32];
+    memo_format_bytes(memo_disk_bytes(&index), size, sizeof(size));
+    memo_format_bytes(budget, limit, sizeof(limit));
+    memo_format_bytes(index.bytes_saved, saved, sizeof(saved));
+    printf("entries\t%u\n", index.count);
+    printf("size\t%s of %s\n", size, limit);
+    printf("hits\t%llu\n", (unsigned long long)index.hits);
+    printf("misses\t%llu\n", (unsigned long long)index.misses);
+    printf("hit rate\t%.1f%%\n", lookups ? 100.0 * index.hits / lookups : 0.0);
+    printf("bytes saved\t%s\n", saved);
+    printf("time saved\t%.3fs\n", index.ns_saved / 1e9);
+    return 0;
 }
 
-// Handles file append operation (~) by cross-appending file contents
-void handle_file_append(char *file1, char *file2) {
-    FILE *f1_read = fopen(file1, "a+");   // Open file1 for reading and appending
-    FILE *f2_read = fopen(file2, "a+");   // Open file2 for reading and appending
+// Sets up the shell's io_uring on first use: maps the rings, checks that openat, read
+// and close are supported, and registers one buffer per slot. Returns -1 (and the
+// caller uses the synchronous path) if io_uring is missing, disabled or too old.
+static int uring_setup(void) {
+    const char *env = getenv(URING_ENV);
+    if (env && strcmp(env, "0") == 0) return -1; // Turned off, e.g. to compare paths
+    if (uring.fd >= 0) return 0;
+    if (uring.failed) return -1;           // Tried once already
+    uring.failed = 1;                      // Until everything below succeeds
     
-    if (!f1_read) {                        // Check if file1 opened successfully
-        printf("Error: Cannot open or create file %s\n", file1);
-        if (f2_read) fclose(f2_read);      // Close file2 if opened
-        return;                            // Exit function
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(SYS_io_uring_setup, URING_DEPTH * 2, &params); // Opens, reads and closes in flight
+    if (fd < 0) return -1;                 // ENOSYS, or EPERM under kernel.io_uring_disabled
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP; // Both rings in one mapping
+    if (single) sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+    char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);                         // The mappings go with the process; nothing to reuse
+        return -1;
     }
-    if (!f2_read) {                        // Check if file2 opened successfully
-        printf("Error: Cannot open or create file %s\n", file2);
-        fclose(f1_read);                   // Close file1
-        return;                            // Exit function
+    
+    size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_len);
+    int usable = probe && syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    static const int needed[] = {IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_READ, IORING_OP_CLOSE};
+    for (size_t i = 0; usable && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        usable = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!usable) {                         // Pre-5.6 kernel: no openat/close opcodes
+        close(fd);
+        return -1;
+    }
+    
+    uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring.sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring.cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring.sqes = sqes;
+    uring.sq_entries = params.sq_entries;
+    uring.sq_local = *uring.sq_tail;       // A subshell may carry counts from the parent's ring
+    uring.inflight = 0;
+    
+    // Registered buffers skip pinning pages on every read; without them plain reads still work
+    uring.buffers = mmap(NULL, (size_t)URING_DEPTH * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring.buffers == MAP_FAILED) {
+        close(fd);
+        return -1;
     }
+    struct iovec iov[URING_DEPTH];
+    for (int i = 0; i < URING_DEPTH; i++) {
+        iov[i].iov_base = uring.buffers + (size_t)i * URING_BUF_SIZE;
+        iov[i].iov_len = URING_BUF_SIZE;
+    }
+    uring.fixed = syscall(SYS_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0; // RLIMIT_MEMLOCK may refuse
+    uring.fd = fd;
+    uring.failed = 0;
+    return 0;
+}
 
-    // Get sizes of both files
-    fseek(f1_read, 0, SEEK_END);           // Move to end of file1
-    long f1_size = ftell(f1_read);         // Get file1 size
-    fseek(f2_read, 0, SEEK_END);           // Move to end of file2
-    long f2_size = ftell(f2_read);         // Get file2 size
+// Next free submission entry, zeroed; NULL if the queue is full
+static struct io_uring_sqe *uring_get_sqe(void) {
+    unsigned head = __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+    if (uring.sq_local - head >= uring.sq_entries) return NULL;
+    unsigned index = uring.sq_local++ & uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring.sq_array[index] = index;
+    return sqe;
+}
 
-    char *buf1 = malloc(f1_size + 1);      // Allocate buffer for file1 content
-    char *buf2 = malloc(f2_size + 1);      // Allocate buffer for file2 content
-    
-    if (!buf1 || !buf2) {                  // Check for memory allocation failure
-        printf("Error: Memory allocation failed\n");
-        if (buf1) free(buf1);              // Free buf1 if allocated
-        if (buf2) free(buf2);              // Free buf2 if allocated
-        fclose(f1_read);                   // Close file1
-        fclose(f2_read);                   // Close file2
-        return;                            // Exit function
+// Submits queued entries and waits until at least min_complete completions are ready
+static int uring_enter(unsigned min_complete) {
+    unsigned to_submit = uring.sq_local - *uring.sq_tail;
+    __atomic_store_n(uring.sq_tail, uring.sq_local, __ATOMIC_RELEASE); // Publish the new entries
+    while (syscall(SYS_io_uring_enter, uring.fd, to_submit, min_complete,
+                   min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+        if (errno != EINTR) return -1;
+        to_submit = 0;                     // The kernel consumed them before the signal
+    }
+    return 0;
+}
+
+// Queues an open, a read into the slot's buffer, or a close; user_data names the slot and step
+static void uring_queue(int op, int fd, const char *path, int slot, int step) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    if (!sqe) {                            // Queue full: hand what is queued to the kernel first
+        uring_enter(0);
+        sqe = uring_get_sqe();
     }
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)slot << 8 | step;
+    if (op == IORING_OP_OPENAT) {
+        sqe->addr = (uintptr_t)path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    } else if (op != IORING_OP_CLOSE) {    // Read the first buffer's worth at offset 0
+        sqe->addr = (uintptr_t)(uring.buffers + (size_t)slot * URING_BUF_SIZE);
+        sqe->len = URING_BUF_SIZE;
+        sqe->buf_index = slot;
+    }
+    uring.inflight++;
+}
 
-    // Read file contents into buffers
-    fseek(f1_read, 0, SEEK_SET);           // Rewind file1 to start
-    fseek(f2_read, 0, SEEK_SET);           // Rewind file2 to start
-    size_t read1 = fread(buf1, 1, f1_size, f1_read); // Read file1 content
-    size_t read2 = fread(buf2, 1, f2_size, f2_read); // Read file2 content
-    buf1[read1] = '\0';                    // Null terminate buffer1
-    buf2[read2] = '\0';                    // Null terminate buffer2
+// Writes the gathered buffers in order, retrying short writes; 0 on success
+static int uring_flush(int out_fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(out_fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) { // Skip fully written entries
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {                   // Partially written entry
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
 
-    fclose(f1_read);                       // Close file1 after reading
-    fclose(f2_read);                       // Close file2 after reading
+// Identifies a compressed stream by its first bytes: 1f 8b for gzip, 28 b5 2f fd for zstd.
+// Formats the shell was built without, or all of them under VORTEX_DECOMPRESS=0, are
+// reported as DECODE_NONE so the bytes pass through unchanged.
+static int decode_magic(const unsigned char *buf, size_t len) {
+    const char *env = getenv(DECODE_ENV);
+    if (env && strcmp(env, "0") == 0) return DECODE_NONE;
+#ifdef DECODE_HAVE_GZIP
+    if (len >= 2 && buf[0] == 0x1f && buf[1] == 0x8b) return DECODE_GZIP;
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f && buf[3] == 0xfd) return DECODE_ZSTD;
+#endif
+    (void)buf;
+    (void)len;
+    return DECODE_NONE;
+}
 
-    // Reopen files for appending
-    FILE *f1_append = fopen(file1, "a");   // Open file1 for appending
-    FILE *f2_append = fopen(file2, "a");   // Open file2 for appending
-    
-    if (!f1_append || !f2_append) {        // Check if reopening failed
-        printf("Error: Cannot open files for appending\n");
-        if (f1_append) fclose(f1_append);  // Close file1 if opened
-        if (f2_append) fclose(f2_append);  // Close file2 if opened
-        free(buf1);                        // Free buffer1
-        free(buf2);                        // Free buffer2
-        return;                            // Exit function
+// Looks at the first bytes of a regular file without moving its offset. Pipes and
+// terminals are never decoded: their first bytes cannot be read back.
+int decode_detect(int fd, struct stat *st) {
+    unsigned char magic[4];                // Enough for every supported format
+    if (!S_ISREG(st->st_mode)) return DECODE_NONE;
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+    return n > 0 ? decode_magic(magic, n) : DECODE_NONE;
+}
+
+// Refills the compressed buffer; returns the bytes read, 0 at end of file, -1 on error
+static ssize_t decode_read(Decoder *dec) {
+    while (1) {
+        ssize_t n = read(dec->fd, dec->in, DECODE_IN_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) dec->in_eof = 1;
+        return n;
     }
+}
 
-    // Append file2 content to file1
-    if (fwrite(buf2, 1, f2_size, f1_append) != f2_size) {
-        printf("Error: Failed to append to %s\n", file1); // Report write failure
+// Decodes up to size bytes into out; returns how many, 0 at the end of the input, or -1
+// on a read error or corrupt or truncated data. Concatenated members (gzip) and frames
+// (zstd) decode as one stream, as zcat and zstdcat do.
+static ssize_t decode_fill(Decoder *dec, unsigned char *out, size_t size) {
+    size_t produced = 0;                   // Bytes written to out
+#ifdef DECODE_HAVE_GZIP
+    if (dec->format == DECODE_GZIP) {
+        z_stream *z = &dec->z;
+        z->next_out = out;
+        z->avail_out = size;
+        while (z->avail_out > 0) {
+            if (z->avail_in == 0) {
+                if (dec->in_eof) break;
+                ssize_t n = decode_read(dec);
+                if (n < 0) return -1;
+                if (n == 0) break;
+                z->next_in = dec->in;
+                z->avail_in = n;
+            }
+            int rc = inflate(z, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) {      // Member done; another may follow
+                dec->clean = 1;
+                inflateReset(z);
+            } else if (rc == Z_DATA_ERROR && dec->clean) {
+                z->avail_in = 0;           // Trailing garbage after the last member, which gzip ignores too
+                dec->in_eof = 1;
+            } else if (rc == Z_OK) {
+                if (z->total_in > 0) dec->clean = 0; // Into the next member
+            } else if (rc != Z_BUF_ERROR) { // Z_BUF_ERROR: needs more input, read above
+                return -1;
+            }
+        }
+        produced = size - z->avail_out;
     }
-    // Append file1 content to file2
-    if (fwrite(buf1, 1, f1_size, f2_append) != f1_size) {
-        printf("Error: Failed to append to %s\n", file2); // Report write failure
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    if (dec->format == DECODE_ZSTD) {
+        ZSTD_outBuffer zout = { out, size, 0 };
+        while (zout.pos < zout.size) {
+            if (dec->zin.pos == dec->zin.size) {
+                if (dec->in_eof) break;
+                ssize_t n = decode_read(dec);
+                if (n < 0) return -1;
+                if (n == 0) break;
+                dec->zin = (ZSTD_inBuffer){ dec->in, (size_t)n, 0 };
+            }
+            size_t rc = ZSTD_decompressStream(dec->zstd, &zout, &dec->zin);
+            if (ZSTD_isError(rc)) return -1;
+            dec->clean = rc == 0;          // 0: a frame ended and is fully flushed
+        }
+        produced = zout.pos;
     }
+#endif
+    if (produced == 0 && dec->in_eof && !dec->clean) return -1; // Cut off mid-stream
+    return produced;
+}
 
-    fclose(f1_append);                     // Close file1 after appending
-    fclose(f2_append);                     // Close file2 after appending
-    free(buf1);                            // Free buffer1 memory
-    free(buf2);                            // Free buffer2 memory
+// Reader thread: fills the two output buffers alternately, waiting while the next one
+// is still with the caller, so decoding overlaps with counting or writing
+static void *decode_thread(void *arg) {
+    Decoder *dec = arg;
+    int turn = 0;                          // Buffer filled next
+    while (1) {
+        pthread_mutex_lock(&dec->lock);
+        while (dec->full[turn] && !dec->stop) pthread_cond_wait(&dec->cond, &dec->lock);
+        int stop = dec->stop;
+        pthread_mutex_unlock(&dec->lock);
+        if (stop) break;
+        ssize_t n = decode_fill(dec, dec->out[turn], DECODE_OUT_SIZE);
+        pthread_mutex_lock(&dec->lock);
+        if (n > 0) {
+            dec->len[turn] = n;
+            dec->full[turn] = 1;
+        } else {
+            dec->done = 1;
+            dec->error = n < 0;
+        }
+        pthread_cond_signal(&dec->cond);
+        pthread_mutex_unlock(&dec->lock);
+        if (n <= 0) break;
+        turn ^= 1;
+    }
+    return NULL;
 }
 
-// Counts the number of words in a specified file
-void count_words(char *filename) {
-    FILE *f = fopen(filename, "r");        // Open file for reading
-    if (!f) {                              // Check if file opened successfully
-        printf("Error: Cannot open file %s\n", filename);
-        return;                            // Exit function on failure
+// Decompresses fd, which decode_detect found to hold format, from its start. Each decoded
+// buffer is passed to sink in order; memory stays at two output buffers and one input
+// buffer whatever the decoded size. Returns 0, or -1 on a read error, corrupt input, or
+// when sink returns -1.
+int decode_stream(int fd, int format, int (*sink)(const unsigned char *buf, size_t len, void *ctx), void *ctx) {
+    Decoder dec;
+    memset(&dec, 0, sizeof(dec));
+    dec.fd = fd;
+    dec.format = format;
+    if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    dec.in = malloc(DECODE_IN_SIZE);
+    dec.out[0] = malloc(DECODE_OUT_SIZE);
+    dec.out[1] = malloc(DECODE_OUT_SIZE);
+    int ready = dec.in && dec.out[0] && dec.out[1];
+#ifdef DECODE_HAVE_GZIP
+    int inflating = 0;                     // inflateInit2 succeeded; inflateEnd is owed
+    if (ready && format == DECODE_GZIP) ready = inflating = inflateInit2(&dec.z, 15 + 16) == Z_OK; // gzip wrapper only
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    if (ready && format == DECODE_ZSTD) ready = (dec.zstd = ZSTD_createDCtx()) != NULL;
+#endif
+    int status = ready ? 0 : -1;
+    pthread_t thread;
+    int threaded = ready && pthread_mutex_init(&dec.lock, NULL) == 0 && pthread_cond_init(&dec.cond, NULL) == 0 &&
+                   pthread_create(&thread, NULL, decode_thread, &dec) == 0;
+    if (ready && threaded) {
+        int turn = 0;                      // Buffer consumed next
+        while (1) {
+            pthread_mutex_lock(&dec.lock);
+            while (!dec.full[turn] && !dec.done) pthread_cond_wait(&dec.cond, &dec.lock);
+            int full = dec.full[turn];
+            if (!full && dec.error) status = -1;
+            pthread_mutex_unlock(&dec.lock);
+            if (!full) break;              // Everything consumed
+            if (sink(dec.out[turn], dec.len[turn], ctx) < 0) {
+                status = -1;
+                break;
+            }
+            pthread_mutex_lock(&dec.lock);
+            dec.full[turn] = 0;
+            pthread_cond_signal(&dec.cond);
+            pthread_mutex_unlock(&dec.lock);
+            turn ^= 1;
+        }
+        pthread_mutex_lock(&dec.lock);
+        dec.stop = 1;                      // Needed only if sink failed; harmless otherwise
+        pthread_cond_signal(&dec.cond);
+        pthread_mutex_unlock(&dec.lock);
+        pthread_join(thread, NULL);
+    } else if (ready) {                    // No thread: decode and consume in turn
+        ssize_t n;
+        while ((n = decode_fill(&dec, dec.out[0], DECODE_OUT_SIZE)) > 0) {
+            if (sink(dec.out[0], n, ctx) < 0) break;
+        }
+        if (n != 0) status = -1;
     }
+#ifdef DECODE_HAVE_GZIP
+    if (inflating) inflateEnd(&dec.z);
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    if (dec.zstd) ZSTD_freeDCtx(dec.zstd);
+#endif
+    free(dec.in);
+    free(dec.out[0]);
+    free(dec.out[1]);
+    return status;
+}
+
+// decode_stream sink for +: writes each decoded buffer to the descriptor in ctx
+static int decode_write(const unsigned char *buf, size_t len, void *ctx) {
+    struct iovec iov = { (void *)buf, len };
+    return uring_flush(*(int *)ctx, &iov, 1);
+}
+
+// + over many files through io_uring: up to URING_DEPTH files are opened and read at
+// once, each into its own registered buffer, while output is written strictly in file
+// order with one writev per run of finished files. A file larger than its buffer has
+// the rest streamed by stream_file when its turn comes. Returns -1 without writing
+// anything if io_uring is unavailable; otherwise the operator's status.
+static int uring_concatenate(char **files, int num_files, struct stat *out_st) {
+    if (uring_setup() < 0) return -1;
+    struct {
+        int fd;                            // Opened descriptor, or -1
+        int state;                         // URING_FREE, URING_OPENING, URING_READING or URING_READY
+        int result;                        // Bytes read, or -errno of the failed step
+    } slots[URING_DEPTH];
+    struct iovec iov[URING_DEPTH];         // Finished files waiting to be written
+    int read_op = uring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    int status = 0;
+    int head = 0, next = 0;                // Next file to write; next file to open
+    memset(slots, 0, sizeof(slots));
     
-    int words = 0;                         // Accumulator for word count
-    char c;                                // Character buffer for reading
-    int in_word = 0;                       // Flag to track if currently in a word
-    
-    while ((c = fgetc(f)) != EOF) {        // Read file character by character
-        if (c == ' ' || c == '\n' || c == '\t') { // Check for whitespace
-            in_word = 0;                   // End of a word
+    while (head < num_files) {
+        for (; next < num_files && next - head < URING_DEPTH; next++) { // Keep the window full
+            int slot = next % URING_DEPTH;
+            slots[slot].fd = -1;
+            slots[slot].state = URING_OPENING;
+            uring_queue(IORING_OP_OPENAT, AT_FDCWD, files[next], slot, URING_OPENING);
+        }
+        
+        // Write out every finished file at the head of the window
+        int batch = 0, first = head, before = head; // Gathered buffers, the file they start at
+        while (head < num_files && slots[head % URING_DEPTH].state == URING_READY) {
+            int slot = head % URING_DEPTH;
+            int fd = slots[slot].fd, result = slots[slot].result;
+            char *buffer = uring.buffers + (size_t)slot * URING_BUF_SIZE;
+            struct stat in_st;
+            int opened = fd >= 0 && fstat(fd, &in_st) == 0;
+            int self = opened && S_ISREG(out_st->st_mode) && in_st.st_dev == out_st->st_dev &&
+                       in_st.st_ino == out_st->st_ino;
+            int format = opened && S_ISREG(in_st.st_mode) && result > 0 ? decode_magic((unsigned char *)buffer, result) : DECODE_NONE;
+            if (opened && !self && S_ISREG(in_st.st_mode) && result >= 0 && result < URING_BUF_SIZE && !format) {
+                if (batch == 0) first = head; // Whole file is in its buffer: gather it
+                iov[batch].iov_base = buffer;
+                iov[batch++].iov_len = result;
+                uring_queue(IORING_OP_CLOSE, fd, NULL, slot, URING_CLOSING);
+            } else {                       // Error, or more to copy than the buffer holds
+                if (batch && uring_flush(STDOUT_FILENO, iov, batch) < 0) {
+                    printf("Error: Failed to copy %s to output\n", files[first]);
+                    status = 1;
+                }
+                batch = 0;
+                if (!opened) printf("Error: Cannot open file %s\n", files[head]);
+                else if (self) printf("Error: Input file %s is the output file\n", files[head]); // Would grow forever
+                else if (format) {         // Compressed: decoded from the start instead
+                    int out_fd = STDOUT_FILENO;
+                    if (decode_stream(fd, format, decode_write, &out_fd) < 0) {
+                        printf("Error: Failed to decompress %s to output\n", files[head]);
+                        status = 1;
+                    }
+                } else {                   // Its first buffer, then the rest through stream_file
+                    iov[0].iov_base = buffer;
+                    iov[0].iov_len = result > 0 ? result : 0;
+                    if (result < 0 || uring_flush(STDOUT_FILENO, iov, 1) < 0 ||
+                        (S_ISREG(in_st.st_mode) && lseek(fd, result, SEEK_SET) < 0) ||
+                        stream_file(fd, STDOUT_FILENO, out_st) < 0) {
+                        printf("Error: Failed to copy %s to output\n", files[head]);
+                        status = 1;
+                    }
+                }
+                if (!opened || self) status = 1;
+                fflush(stdout);            // Keep the message ahead of later raw output
+                if (fd >= 0) close(fd);
+            }
+            slots[slot].state = URING_FREE; // Reused by the file URING_DEPTH places later
+            head++;
+        }
+        if (batch && uring_flush(STDOUT_FILENO, iov, batch) < 0) {
+            printf("Error: Failed to copy %s to output\n", files[first]);
+            fflush(stdout);
+            status = 1;
         }
-        else if (!in_word) {               // Start of a new word
-            words++;                       // Increment word count
-            in_word = 1;                   // Mark as inside a word
+        if (head != before) continue;      // Slots were freed: refill before waiting
+        
+        if (uring_enter(1) < 0) {          // Wait for the next open or read to finish
+            printf("Error: io_uring failed: %s\n", strerror(errno));
+            close(uring.fd);               // Abandon the ring; the next + sets up a fresh one
+            uring.fd = -1;
+            uring.inflight = 0;
+            return 1;
+        }
+        unsigned cq_head = *uring.cq_head;
+        unsigned cq_tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; cq_head != cq_tail; cq_head++) {
+            struct io_uring_cqe *cqe = &uring.cqes[cq_head & uring.cq_mask];
+            int slot = cqe->user_data >> 8, step = cqe->user_data & 0xff;
+            uring.inflight--;
+            if (step == URING_CLOSING) continue; // Nothing waits on a close
+            if (step == URING_OPENING && cqe->res >= 0) { // Opened: read its first buffer
+                slots[slot].fd = cqe->res;
+                slots[slot].state = URING_READING;
+                uring_queue(read_op, cqe->res, NULL, slot, URING_READING);
+                continue;
+            }
+            slots[slot].result = cqe->res; // Read finished, or the open failed (fd stays -1)
+            slots[slot].state = URING_READY;
         }
+        __atomic_store_n(uring.cq_head, cq_head, __ATOMIC_RELEASE);
     }
     
-    printf("%d\n", words);                 // Print total word count
-    fclose(f);                             // Close the file
+    while (uring.inflight > 0) {           // Collect the last closes so the ring starts empty next time
+        if (uring_enter(uring.inflight) < 0) break;
+        unsigned cq_tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+        uring.inflight -= cq_tail - *uring.cq_head;
+        __atomic_store_n(uring.cq_head, cq_tail, __ATOMIC_RELEASE);
+    }
+    return status;
 }
 
 // Concatenates multiple files and outputs to stdout
-void concatenate_files(char **files, int num_files) {
+int concatenate_files(char **files, int num_files) {
+    struct stat out_st;                    // Describes where stdout currently points
+    fflush(stdout);                        // Drain stdio so raw fd writes stay in order
+    if (fstat(STDOUT_FILENO, &out_st) < 0) { // Inspect stdout once for the whole batch
+        printf("Error: Cannot inspect standard output\n");
+        return 1;                          // Nothing sensible to write to
+    }
+    
+    if (num_files >= URING_MIN_FILES) {    // Many files: overlap their opens and reads
+        int status = uring_concatenate(files, num_files, &out_st);
+        if (status >= 0) return status;
+    }
+    
+    int status = 0;                        // Nonzero if any file could not be copied
     for (int i = 0; i < num_files; i++) {  // Iterate through each file
-        FILE *f = fopen(files[i], "r");    // Open current file for reading
-        if (!f) {                          // Check for open failure
+        int fd = open(files[i], O_RDONLY | O_CLOEXEC); // Open current file for reading
+        if (fd < 0) {                      // Check for open failure
             printf("Error: Cannot open file %s\n", files[i]);
+            fflush(stdout);                // Keep the message ahead of later raw output
+            status = 1;
             continue;                      // Skip to next file
         }
         
-        fseek(f, 0, SEEK_END);             // Move to end of file
-        long size = ftell(f);              // Get file size
-        fseek(f, 0, SEEK_SET);             // Rewind to start
-        
-        char *buffer = malloc(size + 1);   // Allocate buffer for file content
-        if (!buffer) {                     // Check for allocation failure
-            printf("Error: Memory allocation failed for %s\n", files[i]);
-            fclose(f);                     // Close file
+        struct stat in_st;                 // Metadata of the input file
+        if (fstat(fd, &in_st) == 0 && S_ISREG(out_st.st_mode) &&
+            in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+            printf("Error: Input file %s is the output file\n", files[i]); // Would grow forever
+            fflush(stdout);
+            status = 1;
+            close(fd);                     // Close file
             continue;                      // Skip to next file
         }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // Hint the kernel to read ahead aggressively
         
-        size_t read_size = fread(buffer, 1, size, f); // Read file into buffer
-        if (read_size > 0) {               // If content was read
-            fwrite(buffer, 1, read_size, stdout); // Write to stdout
+        int format = decode_detect(fd, &in_st); // gzip and zstd files are written decompressed
+        int out_fd = STDOUT_FILENO;
+        if (format != DECODE_NONE) {
+            if (decode_stream(fd, format, decode_write, &out_fd) < 0) {
+                printf("Error: Failed to decompress %s to output\n", files[i]);
+                fflush(stdout);
+                status = 1;
+            }
+        } else if (stream_file(fd, STDOUT_FILENO, &out_st) < 0) { // Stream file to stdout without buffering it
+            printf("Error: Failed to copy %s to output\n", files[i]);
+            fflush(stdout);
+            status = 1;
         }
-        
-        free(buffer);                      // Free allocated buffer
-        fclose(f);                         // Close file
+        close(fd);                         // Close file
     }
-    fflush(stdout);                        // Flush stdout to ensure output displays
+    return status;
 }
 
-// Executes commands conditionally based on && and || operators
-void execute_conditional(Command *commands, int num_commands, char *operators) {
-    int last_status = 0;                   // Tracks exit status of previous command
-    for (int i = 0; i < num_commands; i++) { // Iterate through commands
-        // Execute if first command, or AND succeeds, or OR fails
-        if (i == 0 || 
-            (operators[i-1] == '&' && last_status == 0) || 
-            (operators[i-1] == '|' && last_status != 0)) {
-            pid_t pid = fork();            // Fork a child process
-            if (pid == 0) {                // Child process
-                setpgid(0, shell_pgid);    // Join shell's process group
-                execvp(commands[i].args[0], commands[i].args); // Execute command
-                printf("Error: Command '%s' not found\n", commands[i].args[0]);
-                exit(1);                   // Exit child on failure
-            }
-            int status;                    // Status variable for waitpid
-            waitpid(pid, &status, 0);      // Wait for child to finish
-            // Set last_status based on child's exit code
-            last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
-            free_command(&commands[i]);    // Free command memory
-        } else {
-            free_command(&commands[i]);    // Skip and clean up if condition fails
+// Streams in_fd to out_fd, preferring in-kernel copies; returns 0 on success, -1 on error
+int stream_file(int in_fd, int out_fd, struct stat *out_st) {
+    struct stat in_st;                     // Input metadata decides which fast paths apply
+    if (fstat(in_fd, &in_st) < 0) return -1; // Unreadable descriptor
+    int in_regular = S_ISREG(in_st.st_mode); // Zero-copy calls need a page-cache backed source
+    ssize_t n;                             // Bytes moved by the latest call
+    
+    // Regular file output: copy_file_range lets the filesystem copy (or reflink) extents
+    if (in_regular && S_ISREG(out_st->st_mode)) {
+        while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0)) > 0)
+            ;                              // Kernel advances both file offsets
+        if (n == 0) return 0;              // Reached end of input
+        if (errno != EXDEV && errno != EINVAL && errno != ENOSYS &&
+            errno != EBADF && errno != EOPNOTSUPP) return -1; // Real I/O error
+        // Unsupported pairing (e.g. O_APPEND or cross-fs on old kernels): try the next path
+    }
+    // Pipe output: splice moves page references straight into the pipe
+    if (in_regular && S_ISFIFO(out_st->st_mode)) {
+        while ((n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+            ;                              // Input offset advances with each splice
+        if (n == 0) return 0;              // Reached end of input
+        if (errno != EINVAL && errno != ENOSYS) return -1; // Real I/O error
+    }
+    // Sockets and anything else the kernel accepts: sendfile from the page cache
+    if (in_regular) {
+        while ((n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK)) > 0)
+            ;                              // Input offset advances with each call
+        if (n == 0) return 0;              // Reached end of input
+        if (errno != EINVAL && errno != ENOSYS) return -1; // Real I/O error
+    }
+    
+    // Fallback: fixed-size buffer so memory stays flat regardless of input size
+    static char buffer[COPY_BUF_SIZE];     // Reused across files and calls
+    while ((n = read(in_fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {                       // Read failed
+            if (errno == EINTR) continue;  // Interrupted, retry
+            return -1;                     // Report failure to caller
+        }
+        for (ssize_t off = 0; off < n; ) { // Handle short writes
+            ssize_t w = write(out_fd, buffer + off, n - off);
+            if (w < 0) {                   // Write failed
+                if (errno == EINTR) continue; // Interrupted, retry
+                return -1;                 // Report failure to caller
+            }
+            off += w;                      // Advance past written bytes
         }
     }
+    return 0;                              // Whole input copied
+}
+
+// Executes commands conditionally based on && and || operators
+int execute_conditional(Node *node) {
+    errexit_suppressed++;                  // A tested command may fail without tripping set -e
+    int status = execute_node(node->left); // Tracks exit status of previous command
+    errexit_suppressed--;
+    last_status = status;                  // For $? on the right side
+    // Run the right side if AND succeeded, or OR failed; otherwise keep the left status
+    if ((node->type == NODE_AND && status == 0) ||
+        (node->type == NODE_OR && status != 0)) {
+        status = execute_node(node->right);
+    }
+    return status;
 }
 
 // Retrieves the current process's name from /proc/self/cmdline
 void get_process_name(char *name, size_t size) {
     FILE *fp = fopen(CMDLINE_PATH, "r");   // Open proc file for reading
     if (fp) {                              // Check if file opened
-        fread(name, 1, size - 1, fp);      // Read command line into name
+        size_t n = fread(name, 1, size - 1, fp); // Read command line into name
+        name[n] = 0;                       // argv[0] ends at its own NUL; this covers a short read
         fclose(fp);                        // Close file
         // Extract basename from full path
         char *basename = strrchr(name, '/'); // Find last slash
         if (basename) {                    // If path exists
-            strcpy(name, basename + 1);    // Copy basename to name
+            memmove(name, basename + 1, strlen(basename + 1) + 1); // Copy basename to name
         }
     } else {                               // Handle failure to open file
         perror("Failed to get process name"); // Print error
@@ -611,44 +7464,70 @@ void get_process_name(char *name, size_t size) {
     }
 }
 
-// Kills all instances of this shell, self last
+// Raw getdents64 record; glibc only gained a wrapper in 2.30
+struct proc_dirent {
+    uint64_t d_ino;            // Inode number
+    int64_t d_off;             // Offset of the next record
+    unsigned short d_reclen;   // Size of this record
+    unsigned char d_type;      // File type
+    char d_name[];             // NUL-terminated name
+};
+
+// Reads /proc/<pid>/comm relative to the open /proc directory; returns 0 on success
+static int read_proc_comm(int proc_fd, const char *pid, char *comm) {
+    char path[32];                         // "<pid>/comm"
+    snprintf(path, sizeof(path), "%s/comm", pid);
+    int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;                 // Exited since the scan saw it
+    ssize_t n = read(fd, comm, PROC_COMM_LEN);
+    close(fd);
+    if (n <= 0) return -1;
+    comm[n - 1] = 0;                       // Drop the trailing newline (n <= 16 includes it)
+    return 0;
+}
+
+// Kills all instances of this shell owned by the same user, self last. /proc is scanned
+// with getdents64 directly, skipping non-numeric entries and other users' processes before
+// anything is opened. Each match is signaled through a pidfd opened before its name is
+// read, so a PID recycled between the scan and the kill is never hit.
 void kill_all_shells(char *self_name) {
-    FILE *fp;                              // File pointer for popen
-    char line[MAX_LINE];                   // Buffer for ps output lines
-    pid_t pid = getpid();                  // Get current process ID
-    
-    // Open pipe to ps command to list user processes
-    fp = popen("ps -u $(whoami) -o pid,comm", "r");
-    if (!fp) {                             // Check if popen failed
-        perror("Failed to run ps command"); // Report error
-        return;                            // Exit function
-    }
-
-    int self_killed = 0;                   // Flag to defer killing self
-
-    // Read ps output line by line
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        int proc_id;                       // Process ID from ps
-        char command[MAX_LINE];            // Command name from ps
-
-        // Parse PID and command name from line
-        if (sscanf(line, "%d %s", &proc_id, command) == 2) {
-            if (strcmp(command, self_name) == 0) { // Match process name
-                if (proc_id != pid) {      // Not the current process
-                    printf("Killing process: %d (%s)\n", proc_id, command);
-                    kill(proc_id, SIGKILL); // Send SIGKILL to terminate
-                } else {                   // Current process
-                    self_killed = 1;       // Mark for later kill
-                }
+    pid_t self = getpid();                 // Killed last
+    uid_t uid = getuid();                  // Only our own processes
+    char want[PROC_COMM_LEN];              // self_name as the kernel truncates it in comm
+    snprintf(want, sizeof(want), "%s", self_name);
+    
+    int proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        perror("Failed to open /proc");
+        return;
+    }
+    char buf[PROC_DENTS_SIZE] __attribute__((aligned(8))); // Batch of directory records
+    long n;                                // Bytes returned by one getdents64
+    while ((n = syscall(SYS_getdents64, proc_fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n; ) {
+            struct proc_dirent *d = (struct proc_dirent *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] < '1' || d->d_name[0] > '9') continue; // Not a process
+            char *end;
+            long pid = strtol(d->d_name, &end, 10);
+            if (*end || pid == self) continue;
+            struct stat st;                // Owner of /proc/<pid> is the process's user
+            if (fstatat(proc_fd, d->d_name, &st, 0) < 0 || st.st_uid != uid) continue;
+            
+            int pidfd = syscall(SYS_pidfd_open, (pid_t)pid, 0); // Pins this exact process
+            if (pidfd < 0 && errno != ENOSYS) continue; // Already gone
+            char comm[PROC_COMM_LEN];      // Name of the process the pidfd refers to
+            if (read_proc_comm(proc_fd, d->d_name, comm) == 0 && strcmp(comm, want) == 0) {
+                printf("Killing process: %ld (%s)\n", pid, comm);
+                if (pidfd >= 0) syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+                else kill((pid_t)pid, SIGKILL); // Kernels before 5.3: plain kill
             }
+            if (pidfd >= 0) close(pidfd);
         }
     }
-
-    pclose(fp);                            // Close pipe to ps command
-
-    // Kill self last if marked
-    if (self_killed) {
-        printf("Killing self: %d (%s)\n", pid, self_name);
-        kill(pid, SIGKILL);                // Terminate this process
-    }
-}
\ No newline at end of file
+    close(proc_fd);
+    
+    printf("Killing self: %d (%s)\n", (int)self, self_name);
+    fflush(stdout);
+    kill(self, SIGKILL);                   // Terminate this process
+}
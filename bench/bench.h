@@ -0,0 +1,55 @@
+// Shared helpers for the VortexShell benchmarks: a monotonic clock, running one shell
+// line, percentiles over latency samples, and one JSON object per result line on stdout.
+// Include it after ../VortexShell.c.
+#ifndef VORTEX_BENCH_H
+#define VORTEX_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;                    // Clock reading
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Runs one line through the parser and executor and sets last_status, as the shell
+// does; returns elapsed nanoseconds
+static inline uint64_t bench_run_line(const char *line) {
+    uint64_t t0 = bench_now_ns();
+    Node *tree = parse_line(line, &line_arena);
+    if (tree) last_status = execute_node(tree);
+    arena_reset(&line_arena);
+    return bench_now_ns() - t0;
+}
+
+// qsort comparator for latency samples
+static inline int bench_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts samples in place and returns the requested percentile (0-100)
+static inline uint64_t bench_percentile(uint64_t *samples, size_t n, double pct) {
+    if (n == 0) return 0;                  // No data
+    qsort(samples, n, sizeof(*samples), bench_cmp_u64);
+    size_t idx = (size_t)(pct / 100.0 * (n - 1) + 0.5); // Nearest-rank on the sorted samples
+    return samples[idx < n ? idx : n - 1];
+}
+
+// Emits one result as a JSON line: {"bench":..,"case":..,"metric":..,"value":..,"unit":..}.
+// When $VORTEX_BENCH_COMMIT is set (make bench sets it), a "commit" field is added so
+// results from different revisions can be kept in one file and compared.
+static inline void bench_emit(const char *bench, const char *case_name, const char *metric, double value, const char *unit) {
+    const char *commit = getenv("VORTEX_BENCH_COMMIT");
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"metric\":\"%s\",\"value\":%.6g,\"unit\":\"%s\"",
+           bench, case_name, metric, value, unit);
+    if (commit && *commit) printf(",\"commit\":\"%s\"", commit);
+    printf("}\n");
+    fflush(stdout);                        // Keep results ordered with any child output
+}
+
+#endif
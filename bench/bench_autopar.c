@@ -0,0 +1,57 @@
+// Wall time of one ; sequence of N independent I/O-bound commands, each writing its
+// own file, run serially and under set -o autopar. Commands that mostly wait (on a
+// timer, or on synchronous writes) should overlap, so autopar approaches N times faster.
+//
+//   gcc -O2 -pthread -o bench_autopar bench/bench_autopar.c && ./bench_autopar [commands]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Builds "cmd > dir/out_0 ; cmd > dir/out_1 ; ..." with %s in cmd replaced by the output file
+static char *build_line(const char *cmd, const char *dir, int count) {
+    size_t size = (strlen(cmd) + 2 * strlen(dir) + 64) * count;
+    char *line = malloc(size), *end = line;
+    for (int i = 0; i < count; i++) {
+        char out[PATH_MAX];                // This command's own file
+        snprintf(out, sizeof(out), "%s/out_%d", dir, i);
+        if (i) end += sprintf(end, " ; ");
+        end += sprintf(end, cmd, out);
+        if (!strstr(cmd, "of=")) end += sprintf(end, " > %s", out);
+    }
+    return line;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 16; // Independent commands in the sequence
+    static const struct { const char *name; const char *cmd; } cases[] = {
+        {"sleep 50ms", "sleep 0.05"},      // Latency-bound: waits on a timer
+        {"dsync 1MB", "dd if=/dev/zero of=%s bs=64k count=16 oflag=dsync status=none"}, // Waits on the disk
+    };
+    char dir[] = "bench_autopar.XXXXXX";   // Scratch directory for the outputs
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // autopar needs the job event loop
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        char *line = build_line(cases[c].cmd, dir, count);
+        opt_autopar = 0;
+        uint64_t serial = bench_run_line(line);
+        opt_autopar = 1;
+        uint64_t parallel = bench_run_line(line);
+        free(line);
+        bench_emit("autopar", cases[c].name, "serial", serial / 1e6, "ms");
+        bench_emit("autopar", cases[c].name, "autopar", parallel / 1e6, "ms");
+        bench_emit("autopar", cases[c].name, "speedup", (double)serial / parallel, "x");
+    }
+
+    for (int i = 0; i < count; i++) {      // Clean up the scratch files
+        char out[PATH_MAX];
+        snprintf(out, sizeof(out), "%s/out_%d", dir, i);
+        unlink(out);
+    }
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Tab completion against 50k candidates: PATH directories holding N executables in all
+// (default 50000), and one directory of N files. It times how long completer_start keeps the
+// first prompt waiting, the background build, and per-Tab latency for command and filename
+// prefixes. It also times the Tab after an install, which rereads one directory, and a
+// naive rescan of every PATH directory for comparison.
+//
+//   gcc -O2 -pthread -o bench_complete bench/bench_complete.c && ./bench_complete [candidates]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+#define BENCH_PATH_DIRS 10             // Candidates are spread over this many PATH directories
+
+// Writes a random lowercase name of 3 to 10 letters, unique through the numeric suffix
+static void random_name(char *out, size_t size, unsigned *seed, int i) {
+    int len = 3 + rand_r(seed) % 8;
+    for (int c = 0; c < len; c++) out[c] = 'a' + rand_r(seed) % 26;
+    snprintf(out + len, size - len, "-%d", i);
+}
+
+// Times one Tab: complete_word on a random prefix of a random name from names
+static uint64_t time_prefix(char (*names)[32], int count, unsigned *seed, int command) {
+    char prefix[32];
+    const char *name = names[rand_r(seed) % count];
+    size_t len = 1 + rand_r(seed) % 4;
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)len, name);
+    uint64_t t0 = bench_now_ns();
+    complete_word(prefix, command);
+    return bench_now_ns() - t0;
+}
+
+int main(int argc, char **argv) {
+    int total = argc > 1 ? atoi(argv[1]) : 50000;
+    char dir[] = "bench_complete.XXXXXX";  // Scratch directory
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char (*names)[32] = malloc(sizeof(*names) * total); // Every name created, for prefixes
+    char *root = realpath(dir, NULL);      // PATH entries must be absolute
+    char *path_value = malloc(BENCH_PATH_DIRS * (strlen(root) + 16));
+    char path[PATH_MAX];
+    unsigned seed = 11;                    // Fixed seed: same names on every run
+    path_value[0] = '\0';
+    for (int d = 0; d < BENCH_PATH_DIRS; d++) {
+        snprintf(path, sizeof(path), "%s/bin%d", dir, d);
+        mkdir(path, 0755);
+        sprintf(path_value + strlen(path_value), "%s%s/bin%d", d ? ":" : "", root, d);
+    }
+    for (int i = 0; i < total; i++) {
+        random_name(names[i], sizeof(names[i]), &seed, i);
+        snprintf(path, sizeof(path), "%s/bin%d/%s", dir, i % BENCH_PATH_DIRS, names[i]);
+        close(open(path, O_WRONLY | O_CREAT, 0755));
+    }
+    snprintf(path, sizeof(path), "%s/files", dir);
+    mkdir(path, 0755);
+    for (int i = 0; i < total; i++) {
+        snprintf(path, sizeof(path), "%s/files/%s", dir, names[i]);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    setenv("PATH", path_value, 1);
+    usleep(2 * COMPLETE_RACY_NS / 1000);   // Let the fresh directories' mtimes settle
+    
+    uint64_t t0 = bench_now_ns();
+    completer_start();
+    bench_emit("complete", "startup", "prompt_delay", (bench_now_ns() - t0) / 1e3, "us");
+    complete_word("", 1);                  // Joins the builder
+    bench_emit("complete", "startup", "build", (bench_now_ns() - t0) / 1e6, "ms");
+    bench_emit("complete", "startup", "commands", completer.num_commands, "names");
+    
+    int runs = 20000;
+    uint64_t *samples = malloc(sizeof(uint64_t) * runs);
+    for (int r = 0; r < runs; r++) samples[r] = time_prefix(names, total, &seed, 1);
+    bench_emit("complete", "command", "p50", bench_percentile(samples, runs, 50) / 1e3, "us");
+    bench_emit("complete", "command", "p99", bench_percentile(samples, runs, 99) / 1e3, "us");
+    
+    snprintf(path, sizeof(path), "%s/bin0/zz-installed", dir); // A new command in one directory
+    close(open(path, O_WRONLY | O_CREAT, 0755));
+    t0 = bench_now_ns();
+    int found = complete_word("zz-inst", 1);
+    bench_emit("complete", "after install", "latency", (bench_now_ns() - t0) / 1e3, "us");
+    bench_emit("complete", "after install", "found", found, "names");
+    
+    int rescans = 20;                      // Baseline: read every PATH directory on each Tab
+    for (int r = 0; r < rescans; r++) {
+        t0 = bench_now_ns();
+        int matches = 0;
+        for (int d = 0; d < BENCH_PATH_DIRS; d++) {
+            snprintf(path, sizeof(path), "%s/bin%d", dir, d);
+            DIR *listing = opendir(path);
+            struct dirent *entry;
+            while ((entry = readdir(listing)) != NULL) matches += strncmp(entry->d_name, names[r], 2) == 0;
+            closedir(listing);
+        }
+        samples[r] = bench_now_ns() - t0;
+    }
+    bench_emit("complete", "rescan PATH", "p50", bench_percentile(samples, rescans, 50) / 1e3, "us");
+    
+    char prefix[PATH_MAX + 64];
+    snprintf(prefix, sizeof(prefix), "%s/files/%.2s", dir, names[0]);
+    t0 = bench_now_ns();
+    complete_word(prefix, 0);              // Reads the directory
+    bench_emit("complete", "file cold", "latency", (bench_now_ns() - t0) / 1e3, "us");
+    for (int r = 0; r < runs; r++) {
+        snprintf(prefix, sizeof(prefix), "%s/files/%.*s", dir, 1 + r % 4, names[(r * 7919) % total]);
+        t0 = bench_now_ns();
+        complete_word(prefix, 0);
+        samples[r] = bench_now_ns() - t0;
+    }
+    bench_emit("complete", "file cached", "p50", bench_percentile(samples, runs, 50) / 1e3, "us");
+    bench_emit("complete", "file cached", "p99", bench_percentile(samples, runs, 99) / 1e3, "us");
+    
+    for (int i = 0; i < total; i++) {      // Remove the scratch tree
+        snprintf(path, sizeof(path), "%s/bin%d/%s", dir, i % BENCH_PATH_DIRS, names[i]);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/files/%s", dir, names[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/bin0/zz-installed", dir);
+    unlink(path);
+    for (int d = 0; d < BENCH_PATH_DIRS; d++) {
+        snprintf(path, sizeof(path), "%s/bin%d", dir, d);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/files", dir);
+    rmdir(path);
+    rmdir(dir);
+    free(path_value);
+    free(root);
+    free(samples);
+    free(names);
+    return 0;
+}
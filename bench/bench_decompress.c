@@ -0,0 +1,104 @@
+// Compressed inputs to # and +, decoded in-process, against the pipelines they replace:
+// zcat file | wc -w and zcat file > /dev/null (zstdcat for .zst, when the shell has
+// zstd and the zstd tool is installed). Throughput counts decompressed bytes. The
+// shell's peak RSS is reported at the end, to show that decoding memory stays fixed.
+//
+//   gcc -O2 -pthread -o bench_decompress bench/bench_decompress.c -lz && ./bench_decompress [MB]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Best of three runs of line
+static uint64_t best_of_3(const char *line) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < 3; r++) {
+        uint64_t elapsed = bench_run_line(line);
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Writes mb MB of words and lines of varying length to path
+static int make_text(const char *path, int mb) {
+    static const char *words[] = {"vortex", "shell", "a", "pipeline", "of", "words", "\t", "zero-copy"};
+    char *chunk = malloc(1 << 20);         // One MB of text, written mb times with a varying tail
+    size_t len = 0;
+    unsigned seed = 7;                     // Fixed seed: same file on every run
+    while (len < (1 << 20) - 64) {
+        len += sprintf(chunk + len, "%s", words[rand_r(&seed) % 8]);
+        chunk[len++] = rand_r(&seed) % 9 ? ' ' : '\n';
+    }
+    while (len < (1 << 20)) chunk[len++] = '\n';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    for (int i = 0; i < mb; i++) {
+        snprintf(chunk, 16, "%015d", i);   // Keeps the compressor from seeing one repeated MB
+        chunk[15] = ' ';
+        if (write(fd, chunk, len) != (ssize_t)len) { close(fd); return -1; }
+    }
+    free(chunk);
+    return close(fd);
+}
+
+// Times # and + on a compressed file against the equivalent pipelines through cat_tool
+static void compare(const char *name, const char *file, const char *cat_tool, double gb) {
+    char line[4 * PATH_MAX], case_name[64]; // Command being measured, result name
+    snprintf(line, sizeof(line), "#%s > /dev/null", file);
+    uint64_t ours = best_of_3(line);
+    snprintf(line, sizeof(line), "%s %s | wc -w > /dev/null", cat_tool, file);
+    uint64_t theirs = best_of_3(line);
+    snprintf(case_name, sizeof(case_name), "# %s", name);
+    bench_emit("decompress", case_name, "throughput", gb / (ours / 1e9), "GB/s");
+    snprintf(case_name, sizeof(case_name), "%s | wc -w", cat_tool);
+    bench_emit("decompress", case_name, "throughput", gb / (theirs / 1e9), "GB/s");
+    snprintf(case_name, sizeof(case_name), "# %s", name);
+    bench_emit("decompress", case_name, "speedup_vs_pipeline", (double)theirs / ours, "x");
+
+    snprintf(line, sizeof(line), "%s + %s > /dev/null", file, file);
+    ours = best_of_3(line);
+    snprintf(line, sizeof(line), "%s %s %s > /dev/null", cat_tool, file, file);
+    theirs = best_of_3(line);
+    snprintf(case_name, sizeof(case_name), "+ %s", name);
+    bench_emit("decompress", case_name, "throughput", 2 * gb / (ours / 1e9), "GB/s");
+    snprintf(case_name, sizeof(case_name), "%s (2 files)", cat_tool);
+    bench_emit("decompress", case_name, "throughput", 2 * gb / (theirs / 1e9), "GB/s");
+}
+
+int main(int argc, char **argv) {
+    int mb = argc > 1 ? atoi(argv[1]) : 256; // Decompressed size of the input
+    double gb = mb / 1024.0;
+    char dir[] = "bench_decompress.XXXXXX"; // Scratch directory
+    char text[PATH_MAX], gz[PATH_MAX], zst[PATH_MAX], cmd[4 * PATH_MAX];
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(text, sizeof(text), "%s/text", dir);
+    snprintf(gz, sizeof(gz), "%s/text.gz", dir);
+    snprintf(zst, sizeof(zst), "%s/text.zst", dir);
+    if (make_text(text, mb) < 0) {
+        perror("make_text");
+        return 1;
+    }
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // The pipelines run as jobs
+
+#ifdef DECODE_HAVE_GZIP
+    snprintf(cmd, sizeof(cmd), "gzip -c %s > %s", text, gz);
+    if (system(cmd) == 0) compare("gzip", gz, "zcat", gb);
+#endif
+#ifdef DECODE_HAVE_ZSTD
+    snprintf(cmd, sizeof(cmd), "zstd -q -f %s -o %s 2>/dev/null", text, zst);
+    if (system(cmd) == 0) compare("zstd", zst, "zstdcat", gb);
+#endif
+    (void)cmd;
+    struct rusage usage;                   // Peak memory of the shell across every run
+    getrusage(RUSAGE_SELF, &usage);
+    bench_emit("decompress", "shell", "max_rss", usage.ru_maxrss / 1024.0, "MB");
+
+    unlink(text);
+    unlink(gz);
+    unlink(zst);
+    rmdir(dir);
+    return 0;
+}
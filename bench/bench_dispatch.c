@@ -0,0 +1,77 @@
+// Commands per second through the non-interactive dispatcher: a generated script of
+// builtin-only lines (so no fork hides the cost) is run by shell_loop, once from a
+// file and once from a pipe fed by a child process, as vortexshell script.vsh and
+// generator | vortexshell would read it.
+//
+//   gcc -O2 -pthread -o bench_dispatch bench/bench_dispatch.c && ./bench_dispatch [lines]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Writes the script: a rotating mix of simple commands, conditionals, sequences and redirections
+static size_t gen_script(int fd, int num_lines) {
+    static const char *lines[] = {
+        "true", "echo line %d > /dev/null", "false || true", "true && true ; true",
+        "export VORTEX_BENCH=%d", "cd .", "echo \"quoted %d\" >> /dev/null", "pwd > /dev/null",
+    };
+    FILE *out = fdopen(dup(fd), "w");
+    size_t bytes = 0;                      // Script size
+    for (int i = 0; i < num_lines; i++) {
+        int n = fprintf(out, lines[i % 8], i);
+        fputc('\n', out);
+        bytes += n + 1;
+    }
+    fclose(out);
+    return bytes;
+}
+
+// Runs every line from fd through shell_loop; returns elapsed nanoseconds
+static uint64_t run_script(int fd) {
+    LineReader in = { .fd = fd };
+    uint64_t t0 = bench_now_ns();
+    shell_loop(&in, 0);
+    uint64_t elapsed = bench_now_ns() - t0;
+    free(in.buf);
+    return elapsed;
+}
+
+static void report(const char *name, int num_lines, size_t bytes, uint64_t ns) {
+    bench_emit("dispatch", name, "commands_per_sec", num_lines / (ns / 1e9), "cmd/s");
+    bench_emit("dispatch", name, "per_command", (double)ns / num_lines, "ns");
+    bench_emit("dispatch", name, "input_rate", bytes / (ns / 1e9) / 1e6, "MB/s");
+}
+
+int main(int argc, char **argv) {
+    int num_lines = argc > 1 ? atoi(argv[1]) : 100000; // Script length
+    char path[] = "bench_dispatch.XXXXXX"; // Script file
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // As a script shell: no terminal, no prompt
+
+    size_t bytes = gen_script(fd, num_lines);
+    lseek(fd, 0, SEEK_SET);
+    report("file", num_lines, bytes, run_script(fd));
+
+    int pfd[2];                            // Generator -> shell
+    if (pipe(pfd) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t writer = fork();
+    if (writer == 0) {                     // Feeds the script as fast as the pipe takes it
+        close(pfd[0]);
+        gen_script(pfd[1], num_lines);
+        _exit(0);
+    }
+    close(pfd[1]);
+    report("pipe", num_lines, bytes, run_script(pfd[0]));
+    close(pfd[0]);
+    waitpid(writer, NULL, 0);
+    close(fd);
+    return 0;
+}
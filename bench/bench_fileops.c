@@ -0,0 +1,102 @@
+// Throughput of the file operators on large text files, run through execute_node:
+// + into a regular file and into a pipe, # against an external wc -w over the same
+// (cached) file, and ~ cross-appending two files of N MB each.
+//
+//   gcc -O2 -pthread -o bench_fileops bench/bench_fileops.c && ./bench_fileops [MB]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Best of three runs of line; prepare, if given, runs untimed before each
+static uint64_t best_of_3(const char *line, void (*prepare)(void)) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < 3; r++) {
+        if (prepare) prepare();
+        uint64_t elapsed = bench_run_line(line);
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Writes mb MB of words and lines of varying length to path
+static int make_text(const char *path, int mb) {
+    static const char *words[] = {"vortex", "shell", "a", "pipeline", "of", "words", "\t", "zero-copy"};
+    char *chunk = malloc(1 << 20);         // One MB of text, written mb times
+    size_t len = 0;
+    unsigned seed = 7;                     // Fixed seed: same file on every run
+    while (len < (1 << 20) - 64) {
+        len += sprintf(chunk + len, "%s", words[rand_r(&seed) % 8]);
+        chunk[len++] = rand_r(&seed) % 9 ? ' ' : '\n';
+    }
+    while (len < (1 << 20)) chunk[len++] = '\n';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    for (int i = 0; i < mb; i++) {
+        if (write(fd, chunk, len) != (ssize_t)len) { close(fd); return -1; }
+    }
+    free(chunk);
+    return close(fd);
+}
+
+static char dir[] = "bench_fileops.XXXXXX"; // Scratch directory
+static char text[PATH_MAX], left[PATH_MAX], right[PATH_MAX], out[PATH_MAX];
+
+// Replaces path with a fresh copy of the text file
+static void copy_text(const char *path) {
+    int in = open(text, O_RDONLY);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    struct stat st;
+    fstat(in, &st);
+    copy_range(in, 0, fd, 0, st.st_size);
+    close(in);
+    close(fd);
+}
+
+static void reset_swap_pair(void) { copy_text(left); copy_text(right); }
+static void remove_out(void) { unlink(out); }
+
+int main(int argc, char **argv) {
+    int mb = argc > 1 ? atoi(argv[1]) : 256; // Size of each input file
+    double gb = mb / 1024.0;
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(text, sizeof(text), "%s/text", dir);
+    snprintf(left, sizeof(left), "%s/left", dir);
+    snprintf(right, sizeof(right), "%s/right", dir);
+    snprintf(out, sizeof(out), "%s/out", dir);
+    if (make_text(text, mb) < 0) {
+        perror("make_text");
+        return 1;
+    }
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // wc and the + pipe run as jobs
+    setenv("VORTEX_WC_CACHE", "0", 1);     // Count every byte on every run
+    char line[4 * PATH_MAX];               // Command being measured
+
+    snprintf(line, sizeof(line), "%s + %s > %s", text, text, out);
+    bench_emit("fileops", "+ to file", "throughput", 2 * gb / (best_of_3(line, remove_out) / 1e9), "GB/s");
+    snprintf(line, sizeof(line), "%s + %s | cat > /dev/null", text, text);
+    bench_emit("fileops", "+ to pipe", "throughput", 2 * gb / (best_of_3(line, NULL) / 1e9), "GB/s");
+    remove_out();
+
+    snprintf(line, sizeof(line), "#%s > /dev/null", text);
+    uint64_t ours = best_of_3(line, NULL);
+    snprintf(line, sizeof(line), "wc -w %s > /dev/null", text);
+    uint64_t theirs = best_of_3(line, NULL);
+    bench_emit("fileops", "# words", "throughput", gb / (ours / 1e9), "GB/s");
+    bench_emit("fileops", "wc -w", "throughput", gb / (theirs / 1e9), "GB/s");
+    bench_emit("fileops", "# words", "speedup_vs_wc", (double)theirs / ours, "x");
+
+    snprintf(line, sizeof(line), "%s ~ %s", left, right);
+    uint64_t swap = best_of_3(line, reset_swap_pair);
+    bench_emit("fileops", "~ swap-append", "throughput", 2 * gb / (swap / 1e9), "GB/s");
+    bench_emit("fileops", "~ swap-append", "wall", swap / 1e6, "ms");
+
+    unlink(text);
+    unlink(left);
+    unlink(right);
+    rmdir(dir);
+    return 0;
+}
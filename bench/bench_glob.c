@@ -0,0 +1,108 @@
+// Glob expansion over large directories: * in a flat directory of N files and
+// */logs/*.gz across a tree holding N files, each expanded from scratch (a new line)
+// and again by a later command of the same line, which reuses the listings after an
+// mtime check. glob(3) over the same patterns is the baseline; a pattern full of
+// stars shows the matcher stays linear.
+//
+//   gcc -O2 -pthread -o bench_glob bench/bench_glob.c && ./bench_glob [files]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+#include <glob.h>
+
+// Parses "x <pattern>" and expands it; returns elapsed nanoseconds and the word count
+static uint64_t expand_once(const char *pattern, int *words) {
+    char line[256];                        // Command whose argument is the pattern
+    snprintf(line, sizeof(line), "x %s", pattern);
+    uint64_t t0 = bench_now_ns();
+    Node *tree = parse_line(line, &line_arena);
+    expand_command(&tree->commands[0]);
+    *words = tree->commands[0].argc - 1;
+    return bench_now_ns() - t0;
+}
+
+// Creates path as an empty file
+static void touch(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0) close(fd);
+}
+
+static char dir[] = "bench_glob.XXXXXX"; // Scratch directory
+
+int main(int argc, char **argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 100000; // Files in the flat directory, and in the tree
+    int subdirs = 200;                     // Tree: subdirs/logs/ each holding files / subdirs
+    if (!mkdtemp(dir) || chdir(dir) < 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];                   // File being created or removed
+    mkdir("flat", 0755);
+    mkdir("tree", 0755);
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "flat/file%06d.%s", i, i % 4 ? "txt" : "log");
+        touch(path);
+    }
+    for (int d = 0; d < subdirs; d++) {
+        snprintf(path, sizeof(path), "tree/d%03d", d);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "tree/d%03d/logs", d);
+        mkdir(path, 0755);
+        for (int i = 0; i < files / subdirs; i++) {
+            snprintf(path, sizeof(path), "tree/d%03d/logs/%05d.%s", d, i, i % 2 ? "gz" : "txt");
+            touch(path);
+        }
+    }
+
+    static const struct { const char *name; const char *where; const char *pattern; } cases[] = {
+        {"* flat", "flat", "*"},
+        {"*.log flat", "flat", "*.log"},
+        {"*/logs/*.gz tree", "tree", "*/logs/*.gz"},
+        {"*a*a*a*b flat", "flat", "*e*0*0*0*.log"},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        if (chdir(cases[c].where) < 0) return 1;
+        uint64_t cold = UINT64_MAX, warm = UINT64_MAX, libc = UINT64_MAX; // Best of five each
+        int words = 0, theirs = 0;
+        for (int r = 0; r < 5; r++) {
+            uint64_t elapsed = expand_once(cases[c].pattern, &words); // First command of a line
+            if (elapsed < cold) cold = elapsed;
+            elapsed = expand_once(cases[c].pattern, &words); // Later command, same line
+            if (elapsed < warm) warm = elapsed;
+            arena_reset(&line_arena);
+
+            glob_t g;
+            uint64_t t0 = bench_now_ns();
+            glob(cases[c].pattern, 0, NULL, &g);
+            elapsed = bench_now_ns() - t0;
+            theirs = g.gl_pathc;
+            globfree(&g);
+            if (elapsed < libc) libc = elapsed;
+        }
+        if (words != theirs) fprintf(stderr, "%s: %d matches, glob(3) found %d\n", cases[c].name, words, theirs);
+        bench_emit("glob", cases[c].name, "matches", words, "words");
+        bench_emit("glob", cases[c].name, "new_line", cold / 1e6, "ms");
+        bench_emit("glob", cases[c].name, "same_line", warm / 1e6, "ms");
+        bench_emit("glob", cases[c].name, "glob(3)", libc / 1e6, "ms");
+        if (chdir("..") < 0) return 1;
+    }
+
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "flat/file%06d.%s", i, i % 4 ? "txt" : "log");
+        unlink(path);
+    }
+    for (int d = 0; d < subdirs; d++) {
+        for (int i = 0; i < files / subdirs; i++) {
+            snprintf(path, sizeof(path), "tree/d%03d/logs/%05d.%s", d, i, i % 2 ? "gz" : "txt");
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "tree/d%03d/logs", d);
+        rmdir(path);
+        snprintf(path, sizeof(path), "tree/d%03d", d);
+        rmdir(path);
+    }
+    rmdir("flat");
+    rmdir("tree");
+    if (chdir("..") == 0) rmdir(dir);
+    return 0;
+}
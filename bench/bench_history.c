@@ -0,0 +1,98 @@
+// History at scale: a log of N entries (default one million) is written, then
+// history_search is timed: the first search (which indexes the log), later indexed
+// searches for rare, common and absent patterns, and a plain scan of the whole log for
+// comparison. Also the rate at which history_add appends lines.
+//
+//   gcc -O2 -pthread -o bench_history bench/bench_history.c && ./bench_history [entries]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+static void count_line(const char *line, size_t len, void *ctx) {
+    (void)line;
+    (void)len;
+    (*(long *)ctx)++;
+}
+
+int main(int argc, char **argv) {
+    int entries = argc > 1 ? atoi(argv[1]) : 1000000;
+    char dir[] = "bench_history.XXXXXX";   // Scratch directory
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char log[PATH_MAX], idx[PATH_MAX];
+    snprintf(log, sizeof(log), "%s/history", dir);
+    snprintf(idx, sizeof(idx), "%s/history.idx", dir);
+    setenv(HISTORY_ENV, log, 1);
+
+    static const char *words[] = {
+        "git", "commit", "-m", "push", "make", "ls", "-la", "cd", "grep", "-r", "vim", "ssh",
+        "docker", "build", "run", "kubectl", "apply", "-f", "deploy.yaml", "tail", "/var/log/syslog",
+    };
+    FILE *out = fopen(log, "w");
+    unsigned seed = 5;                     // Fixed seed: same log on every run
+    for (int i = 0; i < entries; i++) {
+        int num_words = 1 + rand_r(&seed) % 6;
+        for (int w = 0; w < num_words; w++) fprintf(out, "%s%s", w ? " " : "", words[rand_r(&seed) % 21]);
+        if (i % 1000 == 0) fprintf(out, " # ticket-%d", i); // Rare tokens: one entry in a thousand
+        fputc('\n', out);
+    }
+    fclose(out);
+    struct stat st;
+    stat(log, &st);
+    bench_emit("history", "log", "size", st.st_size / 1048576.0, "MB");
+
+    long hits = 0;
+    uint64_t t0 = bench_now_ns();
+    history_search("ticket-42000", count_line, &hits); // Indexes the whole log first
+    bench_emit("history", "first search", "latency", (bench_now_ns() - t0) / 1e6, "ms");
+    stat(idx, &st);
+    bench_emit("history", "index", "size", st.st_size / 1048576.0, "MB");
+
+    static const struct { const char *name; const char *pattern; } cases[] = {
+        {"rare", "ticket-42000"}, {"common", "kubectl apply"}, {"absent", "rsync -av"},
+    };
+    int runs = 50;
+    uint64_t *samples = malloc(sizeof(uint64_t) * runs);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        for (int r = 0; r < runs; r++) {
+            hits = 0;
+            t0 = bench_now_ns();
+            history_search(cases[c].pattern, count_line, &hits);
+            samples[r] = bench_now_ns() - t0;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "search %s", cases[c].name);
+        bench_emit("history", name, "p50", bench_percentile(samples, runs, 50) / 1e3, "us");
+        bench_emit("history", name, "p99", bench_percentile(samples, runs, 99) / 1e3, "us");
+        bench_emit("history", name, "matches", hits, "lines");
+    }
+
+    size_t log_len;                        // Baseline: memmem over the mapped log, no index
+    char *data = history_map(log, &log_len, NULL);
+    for (int r = 0; r < runs; r++) {
+        hits = 0;
+        t0 = bench_now_ns();
+        history_scan(data, 0, log_len, "ticket-42000", 12, count_line, &hits);
+        samples[r] = bench_now_ns() - t0;
+    }
+    munmap(data, log_len);
+    bench_emit("history", "full scan rare", "p50", bench_percentile(samples, runs, 50) / 1e3, "us");
+
+    unlink(log);                           // Appends go to a fresh log
+    unlink(idx);
+    int appends = entries / 10;
+    char line[64];
+    t0 = bench_now_ns();
+    for (int i = 0; i < appends; i++) {
+        snprintf(line, sizeof(line), "make -j8 target-%d", i);
+        history_add(line);
+    }
+    bench_emit("history", "append", "rate", appends / ((bench_now_ns() - t0) / 1e9), "lines/s");
+
+    unlink(log);
+    rmdir(dir);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,45 @@
+// Cost of the limit prefix: latency of an external no-op command run bare and under each kind
+// of limit (a --timeout timer, rlimits or a transient cgroup for --mem and --cpu), and
+// how quickly a timeout ends a job that ignores SIGTERM.
+//
+//   gcc -O2 -pthread -o bench_limit bench/bench_limit.c && ./bench_limit [iterations]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000; // Commands per case
+    static const struct { const char *name; const char *line; } cases[] = {
+        {"bare", "/bin/true"},
+        {"--timeout", "limit --timeout 60s /bin/true"},
+        {"--mem", "limit --mem 256m /bin/true"},
+        {"--cpu", "limit --cpu 1 /bin/true"},
+        {"all three", "limit --mem 256m --cpu 1 --timeout 60s /bin/true"},
+    };
+    uint64_t *samples = malloc(sizeof(uint64_t) * iterations);
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // Commands are jobs reaped by the event loop
+    limit_probe();
+    bench_emit("limit", "backend", "cgroup", limiter.base != NULL, "bool");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        for (int i = 0; i < iterations; i++) samples[i] = bench_run_line(cases[c].line);
+        bench_emit("limit", cases[c].name, "p50", bench_percentile(samples, iterations, 50) / 1e3, "us");
+        bench_emit("limit", cases[c].name, "p99", bench_percentile(samples, iterations, 99) / 1e3, "us");
+    }
+
+    int saved = dup(STDOUT_FILENO);        // Keep the timeout messages out of the results
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    uint64_t term = bench_run_line("limit --timeout 100ms sleep 10");
+    int term_status = last_status;
+    uint64_t kill = bench_run_line("limit --timeout 100ms sh -c 'trap \"\" TERM; sleep 10'");
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    bench_emit("limit", "timeout, exits on SIGTERM", "wall", term / 1e6, "ms");
+    bench_emit("limit", "timeout, exits on SIGTERM", "status", term_status, "");
+    bench_emit("limit", "timeout, ignores SIGTERM", "wall", kill / 1e6, "ms");
+    bench_emit("limit", "timeout, ignores SIGTERM", "status", last_status, "");
+    free(samples);
+    return 0;
+}
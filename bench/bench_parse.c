@@ -0,0 +1,58 @@
+// Parse throughput of the single-pass lexer/parser over a corpus of large generated
+// command lines (long pipelines, many arguments, quotes, redirections, && || ;).
+// Each line is parsed into the arena and released with one arena_reset.
+//
+//   gcc -O2 -pthread -o bench_parse bench/bench_parse.c && ./bench_parse [lines]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Appends one generated command to buf at *len
+static void gen_command(char *buf, size_t *len, unsigned *seed) {
+    static const char *words[] = {"grep", "-v", "--color=auto", "/var/log/syslog", "\"quoted arg\"",
+                                  "'single $quoted'", "esc\\ aped", "file.txt", "x", "a+b"};
+    int argc = 1 + rand_r(seed) % 40;      // Far beyond the old five-argument cap
+    *len += sprintf(buf + *len, "cmd%u", rand_r(seed) % 100);
+    for (int i = 0; i < argc; i++) {
+        *len += sprintf(buf + *len, " %s", words[rand_r(seed) % 10]);
+    }
+    if (rand_r(seed) % 4 == 0) *len += sprintf(buf + *len, " < in%u.txt", rand_r(seed) % 10);
+    if (rand_r(seed) % 4 == 0) *len += sprintf(buf + *len, " >> out%u.txt", rand_r(seed) % 10);
+}
+
+int main(int argc, char **argv) {
+    int num_lines = argc > 1 ? atoi(argv[1]) : 20000; // Corpus size
+    static const char *joiners[] = {" | ", " && ", " || ", " ; "};
+    char **corpus = malloc(sizeof(char *) * num_lines);
+    size_t total_bytes = 0;                // Corpus size in bytes
+    unsigned seed = 42;                    // Fixed seed: same corpus on every run
+    
+    for (int i = 0; i < num_lines; i++) {  // Build the corpus up front
+        char *line = malloc(64 * 1024);
+        size_t len = 0;
+        int stages = 1 + rand_r(&seed) % 24; // Far beyond the old five-pipe cap
+        for (int j = 0; j < stages; j++) {
+            if (j) len += sprintf(line + len, "%s", joiners[rand_r(&seed) % 4]);
+            gen_command(line, &len, &seed);
+        }
+        corpus[i] = line;
+        total_bytes += len;
+    }
+    
+    int rounds = 5;                        // Repeat to smooth out noise
+    uint64_t best = UINT64_MAX;            // Fastest full pass over the corpus
+    for (int r = 0; r < rounds; r++) {
+        uint64_t t0 = bench_now_ns();
+        for (int i = 0; i < num_lines; i++) {
+            if (!parse_line(corpus[i], &line_arena)) return 1; // Every line must parse
+            arena_reset(&line_arena);
+        }
+        uint64_t elapsed = bench_now_ns() - t0;
+        if (elapsed < best) best = elapsed;
+    }
+    
+    bench_emit("parse", "generated corpus", "throughput", total_bytes / (best / 1e9) / (1 << 20), "MB/s");
+    bench_emit("parse", "generated corpus", "lines", num_lines / (best / 1e9), "lines/s");
+    bench_emit("parse", "generated corpus", "avg_line", (double)total_bytes / num_lines, "bytes");
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Pipeline throughput: N MB of /dev/zero pushed through | and = pipelines run by
+// execute_node, so the numbers include job setup and reaping as the shell does them.
+// = runs data from the last stage back to the first, so its source is written last.
+// |& copies the producer's stream to every consumer; throughput counts the input once.
+//
+//   gcc -O2 -pthread -o bench_pipe bench/bench_pipe.c && ./bench_pipe [MB]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+int main(int argc, char **argv) {
+    int mb = argc > 1 ? atoi(argv[1]) : 1024; // Bytes pushed per run, in MB
+    static const struct { const char *name; const char *fmt; } cases[] = {
+        {"| 2 stages", "dd if=/dev/zero bs=1M count=%d status=none | cat > /dev/null"},
+        {"| 4 stages", "dd if=/dev/zero bs=1M count=%d status=none | cat | cat | cat > /dev/null"},
+        {"= 2 stages", "cat > /dev/null = dd if=/dev/zero bs=1M count=%d status=none"},
+        {"= 4 stages", "cat > /dev/null = cat = cat = dd if=/dev/zero bs=1M count=%d status=none"},
+        {"|& 2 consumers", "dd if=/dev/zero bs=1M count=%d status=none |& { cat > /dev/null , cat > /dev/null }"},
+        {"|& 4 consumers", "dd if=/dev/zero bs=1M count=%d status=none |& { cat > /dev/null , cat > /dev/null , "
+                           "cat > /dev/null , cat > /dev/null }"},
+    };
+    shell_pgid = getpgrp();
+    jobs_init(0);                          // Pipelines are jobs reaped by the event loop
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        char line[256];                    // The pipeline for this size
+        snprintf(line, sizeof(line), cases[c].fmt, mb);
+        uint64_t best = UINT64_MAX;        // Fastest of three runs
+        for (int r = 0; r < 3; r++) {
+            uint64_t elapsed = bench_run_line(line);
+            if (elapsed < best) best = elapsed;
+        }
+        bench_emit("pipe", cases[c].name, "throughput", mb / 1024.0 / (best / 1e9), "GB/s");
+        bench_emit("pipe", cases[c].name, "wall", best / 1e6, "ms");
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Requests per second and latency through vortexshell --serve: a server is forked
+// running serve(), and 1, 4 and 16 client threads each keep one connection busy with
+// back-to-back requests. For comparison, the same commands are run the way a tool would
+// without the daemon, by starting ./vortexshell -c for each one (skipped if the binary
+// has not been built).
+//
+//   gcc -O2 -pthread -o bench_serve bench/bench_serve.c && ./bench_serve [requests]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+static char sock_path[64];                 // Server's socket
+static const char *command;                // Command line every request runs
+static int per_client;                     // Requests sent by each client thread
+
+// One client thread's connection and latency samples
+typedef struct {
+    int fd;                                // Connected socket
+    uint64_t *samples;                     // Latency of each request
+    int failed;                            // Requests that did not end with status 0
+} Client;
+
+// Reads exactly len bytes; returns 0 on success
+static int read_full(int fd, void *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Sends one request and reads frames until its status; returns the status, or -1
+static int request(int fd, const char *cmd) {
+    char frame[sizeof(ServeFrame) + 512];  // Header, command, empty directory, one variable
+    const char *var = "BENCH_SERVE=1";
+    size_t cmd_len = strlen(cmd) + 1, var_len = strlen(var) + 1;
+    ServeFrame header = { SERVE_REQUEST, cmd_len + 1 + var_len };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), cmd, cmd_len);
+    frame[sizeof(header) + cmd_len] = 0;   // "": the server's directory
+    memcpy(frame + sizeof(header) + cmd_len + 1, var, var_len);
+    if (write(fd, frame, sizeof(header) + header.length) != (ssize_t)(sizeof(header) + header.length)) return -1;
+    char payload[SERVE_READ_SIZE];
+    while (read_full(fd, &header, sizeof(header)) == 0) {
+        if (header.length > sizeof(payload) || read_full(fd, payload, header.length) < 0) return -1;
+        if (header.type == SERVE_STATUS) return *(int32_t *)payload;
+    }
+    return -1;
+}
+
+static void *client_main(void *arg) {
+    Client *client = arg;
+    for (int i = 0; i < per_client; i++) {
+        uint64_t t0 = bench_now_ns();
+        if (request(client->fd, command) != 0) client->failed++;
+        client->samples[i] = bench_now_ns() - t0;
+    }
+    return NULL;
+}
+
+// Runs num_clients concurrent clients against the server and reports the results
+static void run_clients(const char *case_name, int num_clients) {
+    Client *clients = calloc(num_clients, sizeof(Client));
+    pthread_t *threads = calloc(num_clients, sizeof(pthread_t));
+    uint64_t *samples = malloc(sizeof(uint64_t) * num_clients * per_client);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    for (int c = 0; c < num_clients; c++) {
+        clients[c].fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(clients[c].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            exit(1);
+        }
+        clients[c].samples = samples + c * per_client;
+    }
+    uint64_t start = bench_now_ns();
+    for (int c = 0; c < num_clients; c++) pthread_create(&threads[c], NULL, client_main, &clients[c]);
+    int failed = 0;                        // Should stay 0
+    for (int c = 0; c < num_clients; c++) {
+        pthread_join(threads[c], NULL);
+        failed += clients[c].failed;
+        close(clients[c].fd);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    int total = num_clients * per_client;
+    bench_emit("serve", case_name, "rate", total / (elapsed / 1e9), "req/s");
+    bench_emit("serve", case_name, "p50", bench_percentile(samples, total, 50) / 1e3, "us");
+    bench_emit("serve", case_name, "p99", bench_percentile(samples, total, 99) / 1e3, "us");
+    if (failed) bench_emit("serve", case_name, "failed", failed, "req");
+    free(samples);
+    free(threads);
+    free(clients);
+}
+
+// The same requests without the daemon: a fresh ./vortexshell -c per command
+static void run_fresh(const char *case_name, int total) {
+    if (access("./vortexshell", X_OK) < 0) return;
+    char *argv[] = {"vortexshell", "-c", (char *)command, NULL};
+    uint64_t *samples = malloc(sizeof(uint64_t) * total);
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < total; i++) {
+        uint64_t t0 = bench_now_ns();
+        pid_t pid;
+        int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, devnull, STDOUT_FILENO);
+        if (posix_spawn(&pid, "./vortexshell", &actions, NULL, argv, environ) == 0) wait_for_child(pid);
+        posix_spawn_file_actions_destroy(&actions);
+        close(devnull);
+        samples[i] = bench_now_ns() - t0;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    bench_emit("serve", case_name, "rate", total / (elapsed / 1e9), "req/s");
+    bench_emit("serve", case_name, "p50", bench_percentile(samples, total, 50) / 1e3, "us");
+    bench_emit("serve", case_name, "p99", bench_percentile(samples, total, 99) / 1e3, "us");
+    free(samples);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 2000; // Requests per case, split among the clients
+    static const struct { const char *name; const char *line; } commands[] = {
+        {"builtin", "true"},
+        {"pipeline", "echo hello | cat"},
+    };
+    static const int client_counts[] = {1, 4, 16};
+    snprintf(sock_path, sizeof(sock_path), "/tmp/bench_serve.%d.sock", (int)getpid());
+    pid_t server_pid = fork();
+    if (server_pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);      // The server's own messages stay out of the results
+        exit(serve(sock_path));
+    }
+    for (int tries = 0; access(sock_path, F_OK) < 0 && tries < 1000; tries++) usleep(1000);
+
+    for (size_t k = 0; k < sizeof(commands) / sizeof(commands[0]); k++) {
+        command = commands[k].line;
+        char case_name[64];                // e.g. "pipeline clients=16"
+        for (size_t c = 0; c < sizeof(client_counts) / sizeof(client_counts[0]); c++) {
+            per_client = requests / client_counts[c];
+            snprintf(case_name, sizeof(case_name), "%s clients=%d", commands[k].name, client_counts[c]);
+            run_clients(case_name, client_counts[c]);
+        }
+        snprintf(case_name, sizeof(case_name), "%s fresh -c", commands[k].name);
+        run_fresh(case_name, requests / 4); // Slow enough that a quarter gives stable numbers
+    }
+    kill(server_pid, SIGTERM);
+    wait_for_child(server_pid);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Spawn latency against shell RSS for each spawn backend.
+// fork is the pre-spawn-layer behavior; posix and vfork avoid copying page tables,
+// so their latency should stay flat as the shell's resident set grows. The "dispatch"
+// case goes through execute_single_command, adding the job table and pidfd reaping.
+//
+//   gcc -O2 -pthread -o bench_spawn bench/bench_spawn.c && ./bench_spawn [iterations]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+// Resident set size of this process in MB, from /proc/self/statm
+static double rss_mb(void) {
+    long pages_total = 0, pages_resident = 0; // statm reports pages
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2) pages_resident = 0;
+        fclose(f);
+    }
+    return pages_resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000; // Spawns per backend and RSS level
+    size_t levels_mb[] = {0, 256, 1024};   // Extra memory the "shell" holds while spawning
+    const char *names[] = {"posix", "vfork", "fork"}; // Indexed by SPAWN_* backend
+    char *child_argv[] = {"/bin/true", NULL}; // Cheapest possible child
+    uint64_t *samples = malloc(sizeof(uint64_t) * iterations);
+    shell_pgid = getpgrp();                // Children join the benchmark's own group
+    jobs_init(0);                          // execute_single_command reaps through the job loop
+    Node *dispatch = parse_line("/bin/true", &line_arena); // Parsed once, run every iteration
+    
+    for (size_t l = 0; l < sizeof(levels_mb) / sizeof(levels_mb[0]); l++) {
+        char *ballast = NULL;              // Touched memory that inflates page tables
+        if (levels_mb[l]) {
+            ballast = malloc(levels_mb[l] << 20);
+            if (!ballast) continue;        // Not enough memory on this box
+            memset(ballast, 1, levels_mb[l] << 20); // Fault every page in
+        }
+        for (int b = SPAWN_POSIX; b <= SPAWN_FORK; b++) {
+            spawn_backend = b;
+            for (int i = 0; i < iterations; i++) {
+                SpawnRequest req = {0};    // Plain child, inherited stdio
+                req.argv = child_argv;
+                req.in_fd = req.out_fd = req.err_fd = -1;
+                req.pgid = shell_pgid;
+                uint64_t t0 = bench_now_ns();
+                pid_t pid = spawn_process(&req);
+                if (pid > 0) wait_for_child(pid);
+                samples[i] = bench_now_ns() - t0;
+            }
+            char case_name[64];            // e.g. "posix rss=1024MB"
+            snprintf(case_name, sizeof(case_name), "%s rss=%zuMB", names[b], levels_mb[l]);
+            bench_emit("spawn", case_name, "rss", rss_mb(), "MB");
+            bench_emit("spawn", case_name, "p50", bench_percentile(samples, iterations, 50) / 1e3, "us");
+            bench_emit("spawn", case_name, "p99", bench_percentile(samples, iterations, 99) / 1e3, "us");
+        }
+        spawn_backend = SPAWN_POSIX;       // The shell's default path, end to end
+        for (int i = 0; i < iterations; i++) {
+            uint64_t t0 = bench_now_ns();
+            execute_single_command(dispatch);
+            samples[i] = bench_now_ns() - t0;
+        }
+        char case_name[64];
+        snprintf(case_name, sizeof(case_name), "dispatch rss=%zuMB", levels_mb[l]);
+        bench_emit("spawn", case_name, "p50", bench_percentile(samples, iterations, 50) / 1e3, "us");
+        bench_emit("spawn", case_name, "p99", bench_percentile(samples, iterations, 99) / 1e3, "us");
+        free(ballast);
+    }
+    free(samples);
+    return 0;
+}
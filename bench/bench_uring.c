@@ -0,0 +1,97 @@
+// + over thousands of small files: the io_uring batch path against the synchronous
+// one-file-at-a-time path (VORTEX_URING=0), with the files in the page cache and with
+// them evicted first (posix_fadvise DONTNEED), which is where overlapping opens and
+// reads should pay off.
+//
+//   gcc -O2 -pthread -o bench_uring bench/bench_uring.c && ./bench_uring [files]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+static char dir[] = "bench_uring.XXXXXX"; // Scratch directory
+static int num_files;
+
+// Drops every input file from the page cache
+static void evict(void) {
+    char path[PATH_MAX];
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Best of three runs of line with output removed before each; evicts inputs first if cold
+static uint64_t best_of_3(const char *line, const char *out, int cold) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < 3; r++) {
+        unlink(out);
+        if (cold) evict();
+        uint64_t t0 = bench_now_ns();
+        Node *tree = parse_line(line, &line_arena);
+        if (tree) execute_node(tree);
+        arena_reset(&line_arena);
+        uint64_t elapsed = bench_now_ns() - t0;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    num_files = argc > 1 ? atoi(argv[1]) : 4000;
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    size_t cap = (size_t)num_files * 64 + PATH_MAX; // "dir/fN + " per file
+    char *line = malloc(cap);
+    size_t len = 0;
+    unsigned seed = 11;                    // Fixed seed: same files on every run
+    char buf[16384];
+    for (int i = 0; i < num_files; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        int size = 512 + rand_r(&seed) % (sizeof(buf) - 512); // 0.5 to 16 KB
+        memset(buf, 'a' + i % 26, size);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, buf, size) != size) {
+            perror(path);
+            return 1;
+        }
+        fsync(fd);                         // Clean pages can be evicted
+        close(fd);
+        len += snprintf(line + len, cap - len, "%s%s", i ? " + " : "", path);
+    }
+    char out[PATH_MAX];
+    snprintf(out, sizeof(out), "%s/out", dir);
+    snprintf(line + len, cap - len, " > %s", out);
+    shell_pgid = getpgrp();
+    jobs_init(0);
+    
+    for (int cold = 0; cold < 2; cold++) {
+        setenv(URING_ENV, "0", 1);
+        uint64_t sync_ns = best_of_3(line, out, cold);
+        unsetenv(URING_ENV);
+        uint64_t uring_ns = best_of_3(line, out, cold);
+        const char *cache = cold ? "cold" : "warm";
+        char name[64];
+        snprintf(name, sizeof(name), "+ sync %s", cache);
+        bench_emit("uring", name, "files_per_sec", num_files / (sync_ns / 1e9), "files/s");
+        bench_emit("uring", name, "wall", sync_ns / 1e6, "ms");
+        snprintf(name, sizeof(name), "+ io_uring %s", cache);
+        bench_emit("uring", name, "files_per_sec", num_files / (uring_ns / 1e9), "files/s");
+        bench_emit("uring", name, "wall", uring_ns / 1e6, "ms");
+        bench_emit("uring", name, "speedup_vs_sync", (double)sync_ns / uring_ns, "x");
+    }
+    char path[PATH_MAX];
+    for (int i = 0; i < num_files; i++) {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        unlink(path);
+    }
+    unlink(out);
+    rmdir(dir);
+    free(line);
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Short-lived commands at a high rate through the zygote and through direct spawning,
+// as the shell's resident set grows. The zygote is forked first, while the process is
+// small, so its per-command cost should not move when the ballast is added.
+//
+//   gcc -O2 -pthread -o bench_zygote bench/bench_zygote.c && ./bench_zygote [iterations]
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include "bench.h"
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000; // Commands per backend and RSS level
+    size_t levels_mb[] = {0, 256, 1024};   // Extra memory the "shell" holds while spawning
+    static const struct { const char *name; int backend; } backends[] = {
+        {"fork", SPAWN_FORK}, {"posix", SPAWN_POSIX}, {"zygote", SPAWN_ZYGOTE},
+    };
+    char *child_argv[] = {"true", NULL};   // Cheapest possible command, resolved through the cache
+    uint64_t *samples = malloc(sizeof(uint64_t) * iterations);
+    shell_pgid = getpgrp();
+    if (zygote_start(0) < 0) {             // Before any ballast, as main() does
+        perror("zygote_start");
+        return 1;
+    }
+
+    for (size_t l = 0; l < sizeof(levels_mb) / sizeof(levels_mb[0]); l++) {
+        char *ballast = NULL;              // Touched memory that inflates page tables
+        if (levels_mb[l]) {
+            ballast = malloc(levels_mb[l] << 20);
+            if (!ballast) continue;        // Not enough memory on this box
+            memset(ballast, 1, levels_mb[l] << 20); // Fault every page in
+        }
+        for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+            spawn_backend = backends[b].backend;
+            uint64_t start = bench_now_ns();
+            for (int i = 0; i < iterations; i++) {
+                SpawnRequest req = {0};    // Plain child, inherited stdio
+                req.argv = child_argv;
+                req.in_fd = req.out_fd = req.err_fd = -1;
+                req.pgid = -1;
+                uint64_t t0 = bench_now_ns();
+                pid_t pid = spawn_process(&req);
+                if (pid > 0) wait_for_child(pid);
+                samples[i] = bench_now_ns() - t0;
+            }
+            double rate = iterations / ((bench_now_ns() - start) / 1e9);
+            char case_name[64];            // e.g. "zygote rss=1024MB"
+            snprintf(case_name, sizeof(case_name), "%s rss=%zuMB", backends[b].name, levels_mb[l]);
+            bench_emit("zygote", case_name, "rate", rate, "cmd/s");
+            bench_emit("zygote", case_name, "p50", bench_percentile(samples, iterations, 50) / 1e3, "us");
+            bench_emit("zygote", case_name, "p99", bench_percentile(samples, iterations, 99) / 1e3, "us");
+        }
+        free(ballast);
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,122 @@
+// Crash recovery of ~: leaves a journal and files as a shell killed partway through a
+// copy would, runs recover_file_append, and checks the operation was rolled forward.
+// Also checks that files another writer appended to since are left alone.
+//
+//   gcc -O2 -pthread -o test_swap_recovery tests/test_swap_recovery.c && ./test_swap_recovery
+#define VORTEX_NO_MAIN
+#include "../VortexShell.c"
+#include <stdarg.h>
+
+static char dir[] = "/tmp/vortex-swap-XXXXXX"; // Scratch files and state directory
+static int failures;
+
+// Writes len bytes of c to path, or appends them when offset is nonzero
+static void fill(const char *path, char c, off_t offset, size_t len) {
+    char *buf = malloc(len);
+    memset(buf, c, len);
+    int fd = open(path, O_WRONLY | O_CREAT | (offset ? 0 : O_TRUNC), 0644);
+    if (fd < 0 || pwrite(fd, buf, len, offset) != (ssize_t)len) {
+        perror(path);
+        exit(2);
+    }
+    close(fd);
+    free(buf);
+}
+
+// Whether path holds exactly the runs given as (char, length) pairs, ending with 0
+static int holds(const char *path, ...) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    va_list ap;
+    va_start(ap, path);
+    int ok = 1;
+    char buf[4096];
+    for (int c; ok && (c = va_arg(ap, int)) != 0; ) {
+        for (long left = va_arg(ap, long); ok && left > 0; ) {
+            ssize_t n = read(fd, buf, left < (long)sizeof(buf) ? left : (long)sizeof(buf));
+            if (n <= 0) ok = 0;
+            for (ssize_t i = 0; ok && i < n; i++) ok = buf[i] == c;
+            left -= n;
+        }
+    }
+    va_end(ap);
+    if (ok && read(fd, buf, 1) != 0) ok = 0; // Nothing after the last run
+    close(fd);
+    return ok;
+}
+
+// Leaves the journal a dead shell would have written for file1 ~ file2 at phase
+static void journal(const char *file1, const char *file2, int phase, long len1, long len2) {
+    pid_t pid = fork();                    // A pid that is certainly not running
+    if (pid == 0) _exit(0);
+    waitpid(pid, NULL, 0);
+    struct stat st1, st2;
+    stat(file1, &st1);
+    stat(file2, &st2);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/vortexshell/" SWAP_JOURNAL_PREFIX "%d.journal", dir, (int)pid);
+    FILE *j = fopen(path, "w");
+    fprintf(j, "%d\n%ld %ld %d\n%llu %llu %llu %llu\n%s\n%s\n", phase, len1, len2, strcmp(file1, file2) == 0,
+            (unsigned long long)st1.st_dev, (unsigned long long)st1.st_ino,
+            (unsigned long long)st2.st_dev, (unsigned long long)st2.st_ino, file1, file2);
+    fclose(j);
+}
+
+static void check(const char *name, int ok) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    if (!ok) failures++;
+}
+
+int main(void) {
+    if (!mkdtemp(dir)) return 2;
+    setenv("XDG_CACHE_HOME", dir, 1);
+    char a[PATH_MAX], b[PATH_MAX], state[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    if (state_path("", state, sizeof(state)) < 0) return 2; // Creates the state directory
+
+    // Phase 0 cut short: a has 20000 of b's 50000 bytes
+    fill(a, 'a', 0, 100000);
+    fill(b, 'b', 0, 50000);
+    journal(a, b, 0, 100000, 50000);
+    fill(a, 'b', 100000, 20000);
+    recover_file_append();
+    check("phase 0 partial copy rolled forward",
+          holds(a, 'a', 100000L, 'b', 50000L, 0) && holds(b, 'b', 50000L, 'a', 100000L, 0));
+
+    // Phase 1 cut short: a is done, b has 30000 of a's 100000 bytes
+    fill(a, 'a', 0, 100000);
+    fill(a, 'b', 100000, 50000);
+    fill(b, 'b', 0, 50000);
+    journal(a, b, 1, 100000, 50000);
+    fill(b, 'a', 50000, 30000);
+    recover_file_append();
+    check("phase 1 partial copy rolled forward",
+          holds(a, 'a', 100000L, 'b', 50000L, 0) && holds(b, 'b', 50000L, 'a', 100000L, 0));
+
+    // a ~ a cut short in its second copy
+    fill(a, 'a', 0, 40000);
+    journal(a, a, 1, 40000, 40000);
+    fill(a, 'a', 40000, 40000 + 10000);
+    recover_file_append();
+    check("same file partial copy rolled forward", holds(a, 'a', 120000L, 0));
+
+    // Another writer appended past what the ~ could have written: leave both files alone
+    fill(a, 'a', 0, 100000);
+    fill(b, 'b', 0, 50000);
+    journal(a, b, 0, 100000, 50000);
+    fill(a, 'x', 100000, 60000);
+    recover_file_append();
+    check("foreign append left alone", holds(a, 'a', 100000L, 'x', 60000L, 0) && holds(b, 'b', 50000L, 0));
+
+    DIR *d = opendir(state);               // Every journal was consumed
+    int left = 0;
+    for (struct dirent *ent; d && (ent = readdir(d)); ) left += strstr(ent->d_name, ".journal") != NULL;
+    if (d) closedir(d);
+    check("journals removed", left == 0);
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) return 2;
+    return failures ? 1 : 0;
+}